@@ -10,14 +10,18 @@ CONFIG += c++11
 
 SOURCES += \
     ioServiceThread.cpp \
+    log_tail.cpp \
     main.cpp \
     server.cpp \
+    server_stats.cpp \
     servercontroller.cpp
 
 HEADERS += \
     connection.h \
     ioServiceThread.h \
+    log_tail.h \
     server.h \
+    server_stats.h \
     servercontroller.h
 
 FORMS += \
@@ -13,18 +13,26 @@
 #ifndef CONNECTION_H
 #define CONNECTION_H
 
+#include <chrono>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 
 using std::string;
 
 // Connection structure that tracks the socket, streambuf, and request in string form
+// open_ marks a connection counted as active in the server stats and responding_ one whose response is still being
+// written; request_start_ and response_size_ feed the latency and byte counters once the response has been written
 struct Connection {
-    Connection(boost::asio::io_service& io_service) : socket_(io_service), read_buffer_() { }
-    Connection(boost::asio::io_service& io_service, size_t max_buffer_size) : socket_(io_service), read_buffer_(max_buffer_size) { }
+    Connection(boost::asio::io_service& io_service) : socket_(io_service), read_buffer_(), open_(false), responding_(false), response_size_(0) { }
+    Connection(boost::asio::io_service& io_service, size_t max_buffer_size) : socket_(io_service), read_buffer_(max_buffer_size), open_(false), responding_(false), response_size_(0) { }
     boost::asio::ip::tcp::socket socket_;
     boost::asio::streambuf read_buffer_;
     string request_;
+
+    bool open_;
+    bool responding_;
+    std::chrono::steady_clock::time_point request_start_;
+    size_t response_size_;
 };
 
 #endif // CONNECTION_H
@@ -0,0 +1,28 @@
+/*
+
+    Function definitions for LogTail
+
+    Author: Jarod Graygo
+
+*/
+
+#include "log_tail.h"
+
+void LogTail::push(std::string text) {
+    Entry entry{ std::time(nullptr), std::move(text) };
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (entries_.size() >= capacity_) {
+        entries_.pop_front();
+        ++dropped_;
+    }
+    entries_.push_back(std::move(entry));
+}
+
+size_t LogTail::drain(std::deque<Entry>& out) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    out.swap(entries_);
+    entries_.clear();
+    size_t dropped = dropped_;
+    dropped_ = 0;
+    return dropped;
+}
@@ -0,0 +1,43 @@
+/*
+
+    Bounded buffer of console messages between the io_service thread and the GUI.
+
+    The server appends a message in constant time and never waits on the GUI; the GUI
+    takes everything that has accumulated in one batch when it refreshes. If the GUI
+    falls behind the oldest messages are dropped and counted instead of letting the
+    buffer grow (every message still reaches log.txt).
+
+    Author: Jarod Graygo
+
+*/
+
+#ifndef LOG_TAIL_H
+#define LOG_TAIL_H
+
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <string>
+
+class LogTail {
+public:
+    struct Entry {
+        std::time_t time_;
+        std::string text_;
+    };
+
+    explicit LogTail(size_t capacity = 1000) : capacity_(capacity), dropped_(0) { }
+
+    void push(std::string text);
+
+    // Hand over all pending entries in out (replacing its contents), returning how many were dropped since the last call
+    size_t drain(std::deque<Entry>& out);
+
+private:
+    std::mutex mutex_;
+    std::deque<Entry> entries_;
+    size_t capacity_;
+    size_t dropped_;
+};
+
+#endif // LOG_TAIL_H
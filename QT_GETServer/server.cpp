@@ -11,20 +11,27 @@
 
 #include "server.h"
 
+// How long stop() lets the requests in flight finish before closing their connections
+static const std::chrono::seconds drain_timeout(30);
 
-// Writes string to log file
+// Writes string to log file and queues it for the console, which picks it up on its next refresh
 void Server::write_to_outputs(string str) {
     writer_mutex_.lock();
     if (logging_)
         if (str.find("DEBUGGING::") == string::npos)
             log_writer_ << str;
-    emit ready_write_console(QString::fromStdString("<span><span style=\"color:grey\">[" + get_current_date_and_time() + "]</span> ~ <span style=\"color:green\">SERVER</span>:: " + str + "</span"));
     writer_mutex_.unlock();
+    log_tail_.push(std::move(str));
 }
 
 void Server::close_connection(con_handle_t con_handle) {
+    if (con_handle->open_) {
+        con_handle->open_ = false;
+        stats_.connection_closed();
+    }
+    boost::system::error_code ignored;
     con_handle->read_buffer_.consume(con_handle->read_buffer_.size());
-    con_handle->socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both);
+    con_handle->socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
 }
 
 // Handle what happens after asynchronous read
@@ -35,9 +42,11 @@ void Server::handle_read(con_handle_t con_handle, boost::system::error_code cons
         std::istreambuf_iterator<char> eos;
         string tempreq(std::istreambuf_iterator<char>(is), eos);
         con_handle->request_ = tempreq;
+        con_handle->request_start_ = std::chrono::steady_clock::now();
     }
 
     if (!err) {
+        con_handle->responding_ = true;
         do_async_read(con_handle);
         write_response(con_handle);
     }
@@ -62,6 +71,8 @@ void Server::do_async_read(con_handle_t con_handle) {
 // If there isn't close the connection and clear the streambuf
 void Server::handle_response(con_handle_t con_handle, std::shared_ptr<string> msg_buffer, bool isFinished, boost::system::error_code const& err) {
     if (!err && isFinished) {
+        con_handle->responding_ = false;
+        stats_.request_completed(con_handle->response_size_, std::chrono::steady_clock::now() - con_handle->request_start_);
         if (con_handle->socket_.is_open()) {
             close_connection(con_handle);
         }
@@ -86,6 +97,7 @@ void Server::write_response(con_handle_t con_handle) {
     vector<unsigned char> fileBuff = std::get<2>(resinfo);
     size_t binarySize = fileBuff.size();
     auto buff = std::make_shared<string>(std::get<0>(resinfo));
+    con_handle->response_size_ = binarySize + buff->size();
 
     string date = get_current_date_and_time();
     std::replace(date.begin(), date.end(), ' ', '_');
@@ -148,6 +160,8 @@ void Server::handle_acknowledge(con_handle_t con_handle, std::shared_ptr<string>
 // This function simply sends an empty acknowledgment message to the client
 void Server::handle_accept(con_handle_t& con_handle, boost::system::error_code const& err) {
     if (!err) {
+        con_handle->open_ = true;
+        stats_.connection_opened();
         if (debugging_)
             write_to_outputs("<span style=\"color:blue\">DEBUGGING:: </span>New connection from: " + con_handle->socket_.remote_endpoint().address().to_string());
 
@@ -158,13 +172,16 @@ void Server::handle_accept(con_handle_t& con_handle, boost::system::error_code c
 
     }
     else {
-        write_to_outputs("<span style=\"color:red\">!!ERROR!! </span>" + err.message() + '\n');
+        // Closing the listener to stop the server cancels the pending accept, which is expected
+        if (!(draining_ && err == boost::asio::error::operation_aborted))
+            write_to_outputs("<span style=\"color:red\">!!ERROR!! </span>" + err.message() + '\n');
         if (con_handle != m_connections_.end()) {
             close_connection(con_handle);
             m_connections_.erase(con_handle);
         }
     }
-    start_accept();
+    if (!draining_)
+        start_accept();
 }
 
 // Add the connection to the list and asynchronously accept it
@@ -189,21 +206,61 @@ void Server::start() {
     m_acceptor_.listen();
     start_accept();
     io_service_thread_ = new IOServiceThread(&m_ioservice_);
+    connect(io_service_thread_, SIGNAL(finished()), this, SLOT(finish_stop()));
     io_service_thread_->start();
 }
 
-// Stops the server and all its services
+// Stops the server gracefully without blocking the GUI: the drain runs on the io_service thread and
+// finish_stop() cleans up once that thread has exited
 void Server::stop() {
     write_to_outputs("Stopping sever...");
+    boost::asio::post(m_ioservice_, [this]() { begin_drain(); });
+}
+
+// Stop listening, close the connections still waiting for a request, then wait for the ones with a response in flight
+void Server::begin_drain() {
+    if (draining_) return;
+    draining_ = true;
+    drain_deadline_ = std::chrono::steady_clock::now() + drain_timeout;
+    boost::system::error_code ignored;
+    m_acceptor_.close(ignored);
+    for (auto con = m_connections_.begin(); con != m_connections_.end(); ++con)
+        if (con->open_ && !con->responding_) close_connection(con);
+    check_drained(boost::system::error_code());
+}
+
+// Poll until no connection is open or the deadline has passed, then let the io_service thread exit
+void Server::check_drained(boost::system::error_code const& err) {
+    if (err) return;
+    if (stats_.snapshot().active_connections_ > 0 && std::chrono::steady_clock::now() < drain_deadline_) {
+        m_drain_timer_.expires_after(std::chrono::milliseconds(50));
+        m_drain_timer_.async_wait(boost::bind(&Server::check_drained, this, boost::asio::placeholders::error));
+        return;
+    }
+    for (auto& con : m_connections_) {
+        boost::system::error_code ignored;
+        con.socket_.close(ignored);
+    }
     m_ioservice_.stop();
-    io_service_thread_->terminate();
+}
+
+// Runs on the GUI thread after the io_service thread has finished
+void Server::finish_stop() {
     io_service_thread_->wait();
     delete io_service_thread_;
-    if (m_acceptor_.is_open())
-        m_acceptor_.close();
+    io_service_thread_ = nullptr;
+    for (auto& con : m_connections_) {
+        if (con.open_) {
+            con.open_ = false;
+            stats_.connection_closed();
+        }
+    }
     m_connections_.clear();
+    writer_mutex_.lock();
     log_writer_.close();
+    writer_mutex_.unlock();
     write_to_outputs("<span style =\"color:red\"><i>Server stopped!</i></span><br>");
+    emit stopped();
 }
 
 // Extract the requested filename from the request and return it as a string
@@ -378,8 +435,11 @@ std::string replace_all(std::string str, const std::string& from, const std::str
 }
 
 std::string get_current_date_and_time() {
-    time_t now = time(0);
-    char* dt = new char[26];
+    return get_date_and_time(time(0));
+}
+
+std::string get_date_and_time(time_t now) {
+    char dt[26];
     ctime_s(dt, 26, &now);
     std::string date = dt;
     std::replace(date.begin(), date.end(), '\n', '\0');
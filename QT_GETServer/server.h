@@ -14,6 +14,7 @@
 #ifndef SERVER_H
 #define SERVER_H
 
+#include <chrono>
 #include <cstdint>
 #include <iostream>
 #include <list>
@@ -25,6 +26,8 @@
 #include "connection.h"
 #include "ui_servercontroller.h"
 #include "ioServiceThread.h"
+#include "log_tail.h"
+#include "server_stats.h"
 
 using std::vector;
 
@@ -38,10 +41,15 @@ private:
     QTextEdit *output_;
     IOServiceThread *io_service_thread_;
     QMutex writer_mutex_;
+    LogTail log_tail_;
+    ServerStats stats_;
 
     std::ofstream log_writer_;
     boost::asio::io_service m_ioservice_;
     boost::asio::ip::tcp::acceptor m_acceptor_;
+    boost::asio::steady_timer m_drain_timer_;
+    bool draining_;
+    std::chrono::steady_clock::time_point drain_deadline_;
     std::list<Connection> m_connections_;
     using con_handle_t = std::list<Connection>::iterator;
 
@@ -57,26 +65,38 @@ private:
     void handle_acknowledge(con_handle_t, std::shared_ptr<string>, boost::system::error_code const&);
     void handle_accept(con_handle_t&, boost::system::error_code const&);
     void start_accept();
+    void begin_drain();
+    void check_drained(boost::system::error_code const&);
+
+private slots:
+    void finish_stop();
+
+signals:
+    // Emitted on the GUI thread once stop() has finished draining and the io_service thread has exited
+    void stopped();
 
 public slots:
     void beenPinged() {
         qDebug() << "Pingged";
     }
 
-signals:
-    void ready_write_console(QString to_insert);
-
 public:
-    Server(QTextEdit *output_console = nullptr, uint16_t prt = 8080, bool log = true, bool debug = false) : QObject(), logging_(log), debugging_(debug), port_(prt), output_(output_console), log_writer_(), m_ioservice_(), m_acceptor_(m_ioservice_), m_connections_() { }
+    Server(QTextEdit *output_console = nullptr, uint16_t prt = 8080, bool log = true, bool debug = false) : QObject(), logging_(log), debugging_(debug), port_(prt), output_(output_console), log_writer_(), m_ioservice_(), m_acceptor_(m_ioservice_), m_drain_timer_(m_ioservice_), draining_(false), m_connections_() { }
 
+    // Returns straight away; the server stops accepting and finishes the requests in flight before stopped() is emitted
     void stop();
     void start();
 
     bool is_running();
+
+    // Polled by the GUI on a timer rather than pushed to it, so a busy server never waits on the GUI thread
+    LogTail& log_tail() { return log_tail_; }
+    ServerStats::Snapshot stats() const { return stats_.snapshot(); }
 };
 
 vector<string> split_string(string, char);
 std::string replace_all(std::string, const std::string&, const std::string&);
 std::string get_current_date_and_time();
+std::string get_date_and_time(time_t);
 
 #endif // SERVER_H
@@ -0,0 +1,46 @@
+/*
+
+    Function definitions for ServerStats
+
+    Author: Jarod Graygo
+
+*/
+
+#include "server_stats.h"
+
+void ServerStats::request_completed(uint64_t bytes, std::chrono::steady_clock::duration latency) {
+    uint64_t us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+    size_t bucket = 0;
+    while (bucket + 1 < latency_buckets && us >= (uint64_t(1) << bucket)) ++bucket;
+
+    requests_.fetch_add(1, std::memory_order_relaxed);
+    bytes_sent_.fetch_add(bytes, std::memory_order_relaxed);
+    latency_[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+// Each counter is read on its own, so a snapshot taken while requests complete may be off by the
+// requests in flight; that is fine for a display refreshed several times a second
+ServerStats::Snapshot ServerStats::snapshot() const {
+    Snapshot snap;
+    snap.requests_ = requests_.load(std::memory_order_relaxed);
+    snap.bytes_sent_ = bytes_sent_.load(std::memory_order_relaxed);
+    snap.active_connections_ = active_connections_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < latency_buckets; ++i)
+        snap.latency_[i] = latency_[i].load(std::memory_order_relaxed);
+    return snap;
+}
+
+uint64_t latency_percentile(const ServerStats::Snapshot& from, const ServerStats::Snapshot& to, double fraction) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < ServerStats::latency_buckets; ++i)
+        total += to.latency_[i] - from.latency_[i];
+    if (total == 0) return 0;
+
+    uint64_t target = (uint64_t)(fraction * total);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < ServerStats::latency_buckets; ++i) {
+        seen += to.latency_[i] - from.latency_[i];
+        if (seen > target) return uint64_t(1) << i;
+    }
+    return uint64_t(1) << (ServerStats::latency_buckets - 1);
+}
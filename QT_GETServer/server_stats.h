@@ -0,0 +1,53 @@
+/*
+
+    Request counters shared between the io_service thread and the GUI. The server only
+    ever bumps relaxed atomics, so recording a request never waits on the GUI; the GUI
+    takes a snapshot on its own schedule and works out rates and latency percentiles
+    from the difference between two snapshots.
+
+    Author: Jarod Graygo
+
+*/
+
+#ifndef SERVER_STATS_H
+#define SERVER_STATS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+class ServerStats {
+public:
+    // Bucket i counts requests that took less than 2^i microseconds (and at least 2^(i-1))
+    static const size_t latency_buckets = 32;
+
+    struct Snapshot {
+        uint64_t requests_ = 0;
+        uint64_t bytes_sent_ = 0;
+        int64_t active_connections_ = 0;
+        std::array<uint64_t, latency_buckets> latency_{};
+    };
+
+    ServerStats() : requests_(0), bytes_sent_(0), active_connections_(0) {
+        for (auto& bucket : latency_) bucket.store(0, std::memory_order_relaxed);
+    }
+
+    void connection_opened() { active_connections_.fetch_add(1, std::memory_order_relaxed); }
+    void connection_closed() { active_connections_.fetch_sub(1, std::memory_order_relaxed); }
+    void request_completed(uint64_t bytes, std::chrono::steady_clock::duration latency);
+
+    Snapshot snapshot() const;
+
+private:
+    std::atomic<uint64_t> requests_;
+    std::atomic<uint64_t> bytes_sent_;
+    std::atomic<int64_t> active_connections_;
+    std::array<std::atomic<uint64_t>, latency_buckets> latency_;
+};
+
+// Latency (upper bound of the bucket, in microseconds) below which the given fraction of the requests
+// completed between the two snapshots fall; 0 if no request completed in between
+uint64_t latency_percentile(const ServerStats::Snapshot& from, const ServerStats::Snapshot& to, double fraction);
+
+#endif // SERVER_STATS_H
@@ -1,16 +1,34 @@
 #include "servercontroller.h"
 #include "ui_servercontroller.h"
+#include <QScrollBar>
+#include <QTextCursor>
 
-ServerController::ServerController(QWidget *parent) : QMainWindow(parent), ui(new Ui::ServerController) {
+// The GUI refreshes at 10 Hz and renders at most this many new console lines per refresh; anything beyond
+// that is summarised in a single line (log.txt still gets every message)
+static const int refresh_interval_ms = 100;
+static const size_t max_lines_per_refresh = 200;
+static const int console_scrollback = 2000;
+// Rates and percentiles on the stats panel cover roughly the last second
+static const std::chrono::milliseconds stats_window(1000);
+
+ServerController::ServerController(QWidget *parent) : QMainWindow(parent), ui(new Ui::ServerController), srv_(nullptr) {
     ui->setupUi(this);
     output_console_ = findChild<QTextEdit*>("ConsoleOutputBroswer");
     output_console_->setReadOnly(true);
+    output_console_->document()->setMaximumBlockCount(console_scrollback);
     write_to_console(QString::fromStdString("<span style='color:grey'>[" + get_current_date_and_time() + "]</span> ~ <span style='color:blue;'> MAIN:: </span> Initializing control panel..."));
     server_control_ = findChild<QPushButton*>("ServerControl");
     open_readme_ = findChild<QPushButton*>("OpenReadme");
     debugging_input_ = findChild<QCheckBox*>("DebuggingInput");
     logging_input_ = findChild<QCheckBox*>("LoggingInput");
     port_num_input_ = findChild<QLineEdit*>("PortNumInput");
+    requests_per_sec_ = findChild<QLabel*>("RequestsPerSecValue");
+    bytes_per_sec_ = findChild<QLabel*>("BytesPerSecValue");
+    active_connections_ = findChild<QLabel*>("ActiveConnectionsValue");
+    latency_ = findChild<QLabel*>("LatencyValue");
+
+    connect(&refresh_timer_, SIGNAL(timeout()), this, SLOT(refresh()));
+    refresh_timer_.start(refresh_interval_ms);
 
     logging_input_->setCheckState(Qt::Checked);
     connect(server_control_, SIGNAL(clicked()), this, SLOT(start_server()));
@@ -25,6 +43,7 @@ ServerController::ServerController(QWidget *parent) : QMainWindow(parent), ui(ne
 }
 
 ServerController::~ServerController() {
+    delete srv_;
     delete ui;
 }
 
@@ -40,14 +59,24 @@ void ServerController::start_server() {
     debugging_input_->setEnabled(false);
     logging_input_->setEnabled(false);
     port_num_input_->setEnabled(false);
+    delete srv_;
+    stats_history_.clear();
     srv_ = new Server(output_console_, port_num, logging, debugging);
-    connect(srv_, SIGNAL(ready_write_console(QString)), this, SLOT(write_to_console(QString)));
+    connect(srv_, SIGNAL(stopped()), this, SLOT(server_stopped()));
     srv_->start();
 }
 
+// The server drains in the background; the controls come back once it reports that it has stopped
 void ServerController::stop_server() {
     qDebug() << "Stopping server\n";
+    server_control_->setEnabled(false);
+    server_control_->setText("Stopping...");
     srv_->stop();
+}
+
+void ServerController::server_stopped() {
+    refresh();
+    server_control_->setEnabled(true);
     server_control_->disconnect();
     connect(server_control_, SIGNAL(clicked()), this, SLOT(start_server()));
     server_control_->setText("Start Server");
@@ -68,3 +97,74 @@ void ServerController::write_to_console(QString to_insert) {
     output_console_->append(to_insert);
 }
 
+void ServerController::refresh() {
+    if (!srv_) return;
+    append_server_output();
+    update_stats_panel();
+}
+
+// Append everything the server logged since the last refresh as one edit, so the console is laid out once per refresh
+void ServerController::append_server_output() {
+    std::deque<LogTail::Entry> entries;
+    size_t skipped = srv_->log_tail().drain(entries);
+    if (entries.size() > max_lines_per_refresh) {
+        skipped += entries.size() - max_lines_per_refresh;
+        entries.erase(entries.begin(), entries.end() - max_lines_per_refresh);
+    }
+    if (entries.empty() && skipped == 0) return;
+
+    QScrollBar *scroll = output_console_->verticalScrollBar();
+    bool at_bottom = scroll->value() == scroll->maximum();
+
+    QTextCursor cursor(output_console_->document());
+    cursor.movePosition(QTextCursor::End);
+    cursor.beginEditBlock();
+    if (skipped) {
+        cursor.insertBlock();
+        cursor.insertHtml(QString::fromStdString("<span style=\"color:grey\"><i>... " + std::to_string(skipped) + " messages not shown, see log.txt</i></span>"));
+    }
+    for (const LogTail::Entry& entry : entries) {
+        cursor.insertBlock();
+        cursor.insertHtml(QString::fromStdString("<span><span style=\"color:grey\">[" + get_date_and_time(entry.time_) + "]</span> ~ <span style=\"color:green\">SERVER</span>:: " + entry.text_ + "</span>"));
+    }
+    cursor.endEditBlock();
+
+    if (at_bottom) scroll->setValue(scroll->maximum());
+}
+
+static QString format_rate(double bytes_per_sec) {
+    if (bytes_per_sec >= 1024.0 * 1024.0) return QString::number(bytes_per_sec / (1024.0 * 1024.0), 'f', 1) + " MB/s";
+    if (bytes_per_sec >= 1024.0) return QString::number(bytes_per_sec / 1024.0, 'f', 1) + " KB/s";
+    return QString::number(bytes_per_sec, 'f', 0) + " B/s";
+}
+
+static QString format_latency(uint64_t us) {
+    if (us >= 1000) return QString::number(us / 1000.0, 'f', 1) + " ms";
+    return QString::number(us) + " us";
+}
+
+// Rates and percentiles are taken between the newest snapshot and one about a second older
+void ServerController::update_stats_panel() {
+    auto now = std::chrono::steady_clock::now();
+    stats_history_.emplace_back(now, srv_->stats());
+    while (stats_history_.size() > 2 && now - stats_history_[1].first >= stats_window)
+        stats_history_.pop_front();
+
+    const ServerStats::Snapshot& oldest = stats_history_.front().second;
+    const ServerStats::Snapshot& newest = stats_history_.back().second;
+    double seconds = std::chrono::duration<double>(now - stats_history_.front().first).count();
+
+    active_connections_->setText(QString::number(newest.active_connections_));
+    if (seconds <= 0) return;
+    requests_per_sec_->setText(QString::number((newest.requests_ - oldest.requests_) / seconds, 'f', 0));
+    bytes_per_sec_->setText(format_rate((newest.bytes_sent_ - oldest.bytes_sent_) / seconds));
+
+    if (newest.requests_ == oldest.requests_) {
+        latency_->setText("-");
+        return;
+    }
+    latency_->setText("p50 < " + format_latency(latency_percentile(oldest, newest, 0.50)) +
+        "\np95 < " + format_latency(latency_percentile(oldest, newest, 0.95)) +
+        "\np99 < " + format_latency(latency_percentile(oldest, newest, 0.99)));
+}
+
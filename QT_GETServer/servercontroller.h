@@ -1,7 +1,10 @@
 #ifndef SERVERCONTROLLER_H
 #define SERVERCONTROLLER_H
 
+#include <deque>
+#include <utility>
 #include <QMainWindow>
+#include <QTimer>
 #include "ui_servercontroller.h"
 #include "server.h"
 
@@ -19,6 +22,8 @@ public:
 private:
 
     unsigned int get_port_num();
+    void append_server_output();
+    void update_stats_panel();
     bool get_debugging() { return debugging_input_->isChecked(); }
     bool get_logging() { return logging_input_->isChecked(); }
 
@@ -30,12 +35,19 @@ private:
     QCheckBox *debugging_input_, *logging_input_;
     QLineEdit *port_num_input_;
     QTextEdit *output_console_;
+    QLabel *requests_per_sec_, *bytes_per_sec_, *active_connections_, *latency_;
+
+    // The console and stats panel are refreshed from the server on a timer instead of on every request
+    QTimer refresh_timer_;
+    std::deque<std::pair<std::chrono::steady_clock::time_point, ServerStats::Snapshot>> stats_history_;
 
 private slots:
 
     void start_server();
     void stop_server();
+    void server_stopped();
     void open_readme();
     void write_to_console(QString to_insert);
+    void refresh();
 };
 #endif // SERVERCONTROLLER_H
@@ -0,0 +1,212 @@
+/*
+
+    Function definitions for AssetManifests class
+
+    Author: Jarod Graygo
+
+*/
+
+#include "asset_manifest.h"
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+namespace {
+
+// Just enough JSON for an asset manifest: objects, arrays and strings are understood, other values are skipped
+class ManifestParser {
+public:
+    explicit ManifestParser(const std::string& text) : text_(text), pos_(0) { }
+
+    bool parse(std::vector<std::string>& files, std::vector<std::string>& entrypoints) {
+        if (!consume('{')) return false;
+        if (consume('}')) return true;
+        do {
+            std::string key;
+            if (!parse_string(key) || !consume(':')) return false;
+            if (key == "files") {
+                if (!parse_object_values(files)) return false;
+            }
+            else if (key == "entrypoints") {
+                if (!parse_string_array(entrypoints)) return false;
+            }
+            else if (!skip_value()) {
+                return false;
+            }
+        } while (consume(','));
+        return consume('}');
+    }
+
+private:
+    void skip_whitespace() {
+        while (pos_ < text_.size() && std::isspace((unsigned char)text_[pos_])) ++pos_;
+    }
+
+    bool consume(char c) {
+        skip_whitespace();
+        if (pos_ < text_.size() && text_[pos_] == c) {
+            ++pos_;
+            return true;
+        }
+        return false;
+    }
+
+    bool peek(char c) {
+        skip_whitespace();
+        return pos_ < text_.size() && text_[pos_] == c;
+    }
+
+    // File names are plain ASCII; \u escapes are skipped rather than decoded
+    bool parse_string(std::string& out) {
+        if (!consume('"')) return false;
+        while (pos_ < text_.size()) {
+            char c = text_[pos_++];
+            if (c == '"') return true;
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (pos_ >= text_.size()) return false;
+            char escaped = text_[pos_++];
+            switch (escaped) {
+            case 'n': out += '\n'; break;
+            case 't': out += '\t'; break;
+            case 'r': out += '\r'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'u': pos_ += 4; break;
+            default: out += escaped; break;
+            }
+        }
+        return false;
+    }
+
+    // The values of an object whose values are all strings
+    bool parse_object_values(std::vector<std::string>& values) {
+        if (!consume('{')) return false;
+        if (consume('}')) return true;
+        do {
+            std::string key, value;
+            if (!parse_string(key) || !consume(':') || !parse_string(value)) return false;
+            values.push_back(value);
+        } while (consume(','));
+        return consume('}');
+    }
+
+    bool parse_string_array(std::vector<std::string>& values) {
+        if (!consume('[')) return false;
+        if (consume(']')) return true;
+        do {
+            std::string value;
+            if (!parse_string(value)) return false;
+            values.push_back(value);
+        } while (consume(','));
+        return consume(']');
+    }
+
+    bool skip_value() {
+        std::string ignored;
+        if (peek('"')) return parse_string(ignored);
+        if (consume('{')) {
+            if (consume('}')) return true;
+            do {
+                if (!parse_string(ignored) || !consume(':') || !skip_value()) return false;
+            } while (consume(','));
+            return consume('}');
+        }
+        if (consume('[')) {
+            if (consume(']')) return true;
+            do {
+                if (!skip_value()) return false;
+            } while (consume(','));
+            return consume(']');
+        }
+        // Numbers, true, false and null
+        size_t start = pos_;
+        while (pos_ < text_.size() && (std::isalnum((unsigned char)text_[pos_]) || text_[pos_] == '-' || text_[pos_] == '+' || text_[pos_] == '.')) ++pos_;
+        return pos_ > start;
+    }
+
+    const std::string& text_;
+    size_t pos_;
+};
+
+// A build names a file after its contents with a run of hex digits between dots, e.g. main.cf02be27.chunk.js
+bool is_content_hashed(const std::string& path) {
+    size_t start = path.find_last_of('/');
+    start = start == std::string::npos ? 0 : start + 1;
+    while (start < path.size()) {
+        size_t end = std::min(path.find('.', start), path.size());
+        if (end - start >= 8 && std::all_of(path.begin() + start, path.begin() + end, [](unsigned char c) { return std::isxdigit(c) != 0; }))
+            return true;
+        start = end + 1;
+    }
+    return false;
+}
+
+bool ends_with(const std::string& str, const std::string& suffix) {
+    return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+}
+
+size_t AssetManifests::load(const std::string& root) {
+    size_t loaded = 0;
+    std::error_code ec;
+    auto options = std::filesystem::directory_options::skip_permission_denied;
+    for (auto it = std::filesystem::recursive_directory_iterator(root, options, ec); !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+        if (it->path().filename() == "asset-manifest.json" && load_manifest(root, it->path().generic_string()))
+            ++loaded;
+    }
+    return loaded;
+}
+
+const AssetManifests::Asset* AssetManifests::find(const std::string& path) const {
+    if (assets_.empty()) return nullptr;
+    auto found = assets_.find(path);
+    return found == assets_.end() ? nullptr : &found->second;
+}
+
+// Paths in a manifest are relative to the directory it sits in; the table is keyed the way parse_get() resolves requests
+bool AssetManifests::load_manifest(const std::string& root, const std::string& manifest_path) {
+    std::ifstream in(manifest_path.c_str(), std::ios::binary | std::ios::in);
+    std::string json((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::vector<std::string> files, entrypoints;
+    if (!in || !parse_asset_manifest(json, files, entrypoints)) return false;
+
+    std::string dir = manifest_path.substr(0, manifest_path.find_last_of('/') + 1);
+    std::string url_dir = "/" + (dir.compare(0, root.size(), root) == 0 ? dir.substr(root.size()) : dir);
+
+    std::error_code ec;
+    for (const std::string& file : files) {
+        if (file.empty()) continue;
+        std::string relative = file[0] == '/' ? file.substr(1) : file;
+        std::string path = dir + relative;
+        if (!is_content_hashed(relative) || !std::filesystem::is_regular_file(path, ec)) continue;
+        Asset& asset = assets_[path];
+        if (!asset.immutable_) ++immutable_count_;
+        asset.immutable_ = true;
+    }
+
+    std::string preload;
+    for (const std::string& entry : entrypoints) {
+        const char* kind = ends_with(entry, ".js") ? "script" : ends_with(entry, ".css") ? "style" : nullptr;
+        if (!kind) continue;
+        if (!preload.empty()) preload += ", ";
+        preload += "<" + url_dir + entry + ">; rel=preload; as=" + kind;
+    }
+    if (preload.empty()) return true;
+
+    // The app's pages are the HTML files next to the manifest; the build's index.html is often renamed
+    for (auto it = std::filesystem::directory_iterator(dir, ec); !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+        if (it->path().extension() == ".html")
+            assets_[dir + it->path().filename().generic_string()].preload_ = preload;
+    }
+    return true;
+}
+
+bool parse_asset_manifest(const std::string& json, std::vector<std::string>& files, std::vector<std::string>& entrypoints) {
+    return ManifestParser(json).parse(files, entrypoints);
+}
@@ -0,0 +1,51 @@
+/*
+
+    What the build manifests of the bundled web apps say about their files.
+
+    A create-react-app build writes an asset-manifest.json listing every file it
+    produced, most of them named after a hash of their contents, and the entrypoint
+    chunks its page loads. Those names change whenever the contents do, so they can
+    be cached by the browser for good, and the page can ask for the entrypoints
+    before the browser has parsed it. The manifests under a document root are read
+    once at startup; afterwards the table is only read.
+
+    Author: Jarod Graygo
+
+*/
+
+#ifndef ASSET_MANIFEST_H
+#define ASSET_MANIFEST_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class AssetManifests {
+public:
+    struct Asset {
+        // Named after a hash of its contents, so a given name never changes
+        bool immutable_ = false;
+        // Link header value preloading the entrypoints, set on the pages of an app
+        std::string preload_;
+    };
+
+    // Read every asset-manifest.json under the document root, returns how many were read
+    size_t load(const std::string& root);
+
+    // Look up a file by the path the server resolved the request to (the document root followed by the request path)
+    const Asset* find(const std::string& path) const;
+
+    size_t immutable_count() const { return immutable_count_; }
+
+private:
+    bool load_manifest(const std::string& root, const std::string& manifest_path);
+
+    std::unordered_map<std::string, Asset> assets_;
+    size_t immutable_count_ = 0;
+};
+
+// Parse the parts of an asset-manifest.json that matter: the file paths listed under "files" and the "entrypoints"
+// Returns false if the text is not a JSON object
+bool parse_asset_manifest(const std::string& json, std::vector<std::string>& files, std::vector<std::string>& entrypoints);
+
+#endif // ASSET_MANIFEST_H
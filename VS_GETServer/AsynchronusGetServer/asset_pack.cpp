@@ -0,0 +1,156 @@
+/*
+
+    Function definitions for AssetPack class
+
+    Author: Jarod Graygo
+
+*/
+
+#include "asset_pack.h"
+#include <cstring>
+#include "content_store.h"
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+const char AssetPack::magic_[8] = { 'G', 'E', 'T', 'S', 'P', 'A', 'K', '1' };
+
+namespace {
+
+    // Whether [offset, offset + len) lies within a file of the given size
+    bool inside(uint64_t offset, uint64_t len, uint64_t file_bytes) {
+        return offset <= file_bytes && len <= file_bytes - offset;
+    }
+
+}
+
+std::unique_ptr<AssetPack> AssetPack::open(const std::string& file_name, std::string& error) {
+    std::unique_ptr<AssetPack> pack(new AssetPack());
+#ifdef _WIN32
+    HANDLE file = CreateFileA(file_name.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        error = "could not open " + file_name;
+        return nullptr;
+    }
+    pack->file_ = file;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart < (LONGLONG)sizeof(PackHeader)) {
+        error = file_name + " is too small to be a pack";
+        return nullptr;
+    }
+    pack->bytes_ = (size_t)size.QuadPart;
+    pack->mapping_ = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (pack->mapping_) pack->data_ = static_cast<const char*>(MapViewOfFile(pack->mapping_, FILE_MAP_READ, 0, 0, 0));
+    if (!pack->data_) {
+        error = "could not map " + file_name;
+        return nullptr;
+    }
+#else
+    int fd = ::open(file_name.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error = "could not open " + file_name;
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(PackHeader)) {
+        ::close(fd);
+        error = file_name + " is too small to be a pack";
+        return nullptr;
+    }
+    void* data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        error = "could not map " + file_name;
+        return nullptr;
+    }
+    pack->data_ = static_cast<const char*>(data);
+    pack->bytes_ = (size_t)st.st_size;
+#endif
+
+    pack->header_ = reinterpret_cast<const PackHeader*>(pack->data_);
+    if (!pack->validate(error)) {
+        error = file_name + " " + error;
+        return nullptr;
+    }
+    pack->buckets_ = reinterpret_cast<const uint32_t*>(pack->data_ + pack->header_->buckets_offset_);
+    pack->entries_ = reinterpret_cast<const PackEntry*>(pack->data_ + pack->header_->entries_offset_);
+    pack->strings_ = pack->data_ + pack->header_->strings_offset_;
+    return pack;
+}
+
+AssetPack::~AssetPack() {
+#ifdef _WIN32
+    if (data_) UnmapViewOfFile(data_);
+    if (mapping_) CloseHandle(mapping_);
+    if (file_) CloseHandle(file_);
+#else
+    if (data_) munmap(const_cast<char*>(data_), bytes_);
+#endif
+}
+
+// Everything an entry points at has to lie inside the file, so a damaged or truncated pack is refused at startup
+// rather than read past its end while serving
+bool AssetPack::validate(std::string& error) const {
+    const PackHeader& header = *header_;
+    if (std::memcmp(header.magic_, magic_, sizeof(magic_)) != 0) {
+        error = "is not an asset pack";
+        return false;
+    }
+    uint32_t buckets = header.bucket_count_;
+    if (header.file_bytes_ != bytes_ || buckets == 0 || (buckets & (buckets - 1)) != 0 || buckets <= header.entry_count_
+        || header.buckets_offset_ % alignof(uint32_t) != 0 || header.entries_offset_ % alignof(PackEntry) != 0
+        || !inside(header.buckets_offset_, (uint64_t)buckets * sizeof(uint32_t), bytes_)
+        || !inside(header.entries_offset_, (uint64_t)header.entry_count_ * sizeof(PackEntry), bytes_)
+        || !inside(header.strings_offset_, header.strings_bytes_, bytes_)) {
+        error = "is damaged or was cut short";
+        return false;
+    }
+
+    const uint32_t* bucket = reinterpret_cast<const uint32_t*>(data_ + header.buckets_offset_);
+    for (uint32_t i = 0; i < buckets; ++i) {
+        if (bucket[i] > header.entry_count_) {
+            error = "has a bucket pointing past its entries";
+            return false;
+        }
+    }
+    const PackEntry* entry = reinterpret_cast<const PackEntry*>(data_ + header.entries_offset_);
+    for (uint32_t i = 0; i < header.entry_count_; ++i) {
+        const PackEntry& e = entry[i];
+        if (!inside(e.path_offset_, e.path_bytes_, header.strings_bytes_) || !inside(e.header_offset_, e.header_bytes_, header.strings_bytes_)
+            || !inside(e.etag_offset_, e.etag_bytes_, header.strings_bytes_) || !inside(e.body_offset_, e.body_bytes_, bytes_)
+            || !inside(e.gzip_offset_, e.gzip_bytes_, bytes_)) {
+            error = "has an entry reaching past its end";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool AssetPack::find(const std::string& path, Asset& asset) const {
+    uint64_t hash = xxhash64(path.data(), path.size());
+    uint32_t mask = header_->bucket_count_ - 1;
+    // The table is never full, so the probe always reaches an empty bucket
+    for (uint32_t i = (uint32_t)hash & mask;; i = (i + 1) & mask) {
+        uint32_t slot = buckets_[i];
+        if (slot == 0) return false;
+        const PackEntry& entry = entries_[slot - 1];
+        if (entry.path_hash_ != hash || entry.path_bytes_ != path.size() || std::memcmp(strings_ + entry.path_offset_, path.data(), path.size()) != 0)
+            continue;
+
+        asset.body_ = data_ + entry.body_offset_;
+        asset.body_bytes_ = (size_t)entry.body_bytes_;
+        asset.gzip_ = entry.gzip_bytes_ ? data_ + entry.gzip_offset_ : nullptr;
+        asset.gzip_bytes_ = (size_t)entry.gzip_bytes_;
+        asset.header_ = std::string_view(strings_ + entry.header_offset_, entry.header_bytes_);
+        asset.etag_ = std::string_view(strings_ + entry.etag_offset_, entry.etag_bytes_);
+        asset.binary_ = entry.binary_ != 0;
+        return true;
+    }
+}
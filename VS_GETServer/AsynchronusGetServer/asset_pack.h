@@ -0,0 +1,111 @@
+/*
+
+    A site's files packed into one read only file that the server maps into memory, so
+    serving them takes no opens, stats or reads. Tools/asset_pack_build writes a pack from
+    a document root.
+
+    Layout, in the byte order of the machine that built it:
+        PackHeader
+        buckets      bucket_count_ u32s, each an entry number + 1 or 0 for an empty bucket
+        entries      entry_count_ PackEntries
+        strings      paths, ETags and header lines the entries point into
+        bodies       each starting on a page boundary, identical bodies stored once
+    A path is looked up by its xxHash64, probing the buckets linearly from hash & (bucket_count_ - 1).
+    Paths are relative to the document root, with / separators.
+
+    Author: Jarod Graygo
+
+*/
+
+#ifndef ASSET_PACK_H
+#define ASSET_PACK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+struct PackHeader {
+    char magic_[8];
+    uint32_t entry_count_;
+    // A power of two, larger than entry_count_
+    uint32_t bucket_count_;
+    uint64_t buckets_offset_;
+    uint64_t entries_offset_;
+    uint64_t strings_offset_;
+    uint64_t strings_bytes_;
+    uint64_t file_bytes_;
+    uint64_t reserved_;
+};
+
+struct PackEntry {
+    uint64_t path_hash_;
+    uint64_t body_offset_;
+    uint64_t body_bytes_;
+    // Gzip encoded copy of the body, 0 bytes when there is none
+    uint64_t gzip_offset_;
+    uint64_t gzip_bytes_;
+    // Offsets into the strings
+    uint32_t path_offset_;
+    uint32_t header_offset_;
+    uint32_t etag_offset_;
+    uint16_t path_bytes_;
+    // Header lines that never change for the file: Server, Content-Type, Connection, and Cache-Control, Link and Vary where they apply
+    uint16_t header_bytes_;
+    uint8_t etag_bytes_;
+    // The body goes out as binary (Accept-Ranges and Content-Transfer-Encoding are added)
+    uint8_t binary_;
+    uint16_t reserved_;
+    uint32_t reserved2_;
+};
+
+static_assert(sizeof(PackHeader) == 64, "pack headers are 64 bytes on disk");
+static_assert(sizeof(PackEntry) == 64, "pack entries are 64 bytes on disk");
+
+class AssetPack {
+public:
+    // A packed file; everything points into the mapping and stays valid as long as the pack
+    struct Asset {
+        const char* body_ = nullptr;
+        size_t body_bytes_ = 0;
+        const char* gzip_ = nullptr;
+        size_t gzip_bytes_ = 0;
+        std::string_view header_;
+        std::string_view etag_;
+        bool binary_ = false;
+    };
+
+    static const char magic_[8];
+    static const size_t page_bytes_ = 4096;
+
+    // Map the pack, checking that everything in it lies inside the file; on failure null is returned and error says why
+    static std::unique_ptr<AssetPack> open(const std::string& file_name, std::string& error);
+    ~AssetPack();
+
+    AssetPack(const AssetPack&) = delete;
+    AssetPack& operator=(const AssetPack&) = delete;
+
+    // Look a file up by its path relative to the document root
+    bool find(const std::string& path, Asset&) const;
+
+    size_t size() const { return header_->entry_count_; }
+    size_t bytes() const { return bytes_; }
+
+private:
+    AssetPack() = default;
+    bool validate(std::string& error) const;
+
+    const char* data_ = nullptr;
+    size_t bytes_ = 0;
+    const PackHeader* header_ = nullptr;
+    const uint32_t* buckets_ = nullptr;
+    const PackEntry* entries_ = nullptr;
+    const char* strings_ = nullptr;
+#ifdef _WIN32
+    void* file_ = nullptr;
+    void* mapping_ = nullptr;
+#endif
+};
+
+#endif // ASSET_PACK_H
@@ -0,0 +1,190 @@
+/*
+
+    Function definitions for BinaryLogWriter and BinaryLogReader classes
+
+    Author: Jarod Graygo
+
+*/
+
+#include "binary_log.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <boost/asio/ip/address.hpp>
+
+namespace {
+
+    struct BlockHeader {
+        uint32_t flags_;
+        uint32_t definitions_bytes_;
+        uint32_t record_count_;
+        uint32_t reserved_;
+        int64_t base_ms_;
+    };
+
+    static_assert(sizeof(BlockHeader) == 24, "binary log block headers are 24 bytes on disk");
+
+    const size_t definition_header_bytes = 8;
+
+}
+
+const char BinaryLogWriter::magic_[8] = { 'G', 'E', 'T', 'S', 'L', 'O', 'G', '1' };
+
+//////////////////////// WRITER ////////////////////////
+
+BinaryLogWriter::BinaryLogWriter(size_t block_bytes, size_t max_interned)
+    : block_bytes_(block_bytes), max_interned_(max_interned), base_ms_(0), reset_pending_(true) { }
+
+BinaryLogWriter::~BinaryLogWriter() {
+    flush();
+}
+
+bool BinaryLogWriter::open(const std::string& file_name) {
+    file_.open(file_name, std::ios::binary | std::ios::app | std::ios::ate);
+    if (!file_) return false;
+    if (file_.tellp() == 0) file_.write(magic_, sizeof(magic_));
+    return (bool)file_;
+}
+
+void BinaryLogWriter::record(int64_t unix_ms, const uint8_t address[16], const std::string& request_line, uint16_t status, uint64_t bytes, uint32_t latency_us) {
+    if (!file_.is_open()) return;
+    // A record's time is an offset from the block's, so a block covers a second at most and a clock set back starts a new one
+    if (!records_.empty() && (unix_ms < base_ms_ || unix_ms - base_ms_ > 1000)) flush();
+    // A full table starts the ids over in a new block rather than growing with every distinct path a client makes up
+    if (addresses_.size() >= max_interned_ || requests_.size() >= max_interned_) {
+        flush();
+        addresses_.clear();
+        requests_.clear();
+        reset_pending_ = true;
+    }
+    if (records_.empty()) base_ms_ = unix_ms;
+
+    BinaryLogRecord entry;
+    entry.time_ms_ = (uint32_t)(unix_ms - base_ms_);
+    entry.latency_us_ = latency_us;
+    entry.address_id_ = intern(addresses_, address_definition, std::string(reinterpret_cast<const char*>(address), 16));
+    entry.request_id_ = intern(requests_, request_definition, request_line.substr(0, std::numeric_limits<uint16_t>::max()));
+    entry.bytes_ = (uint32_t)std::min<uint64_t>(bytes, std::numeric_limits<uint32_t>::max());
+    entry.status_ = status;
+    entry.reserved_ = 0;
+    records_.push_back(entry);
+
+    if (definitions_.size() + records_.size() * sizeof(BinaryLogRecord) >= block_bytes_) flush();
+}
+
+uint32_t BinaryLogWriter::intern(std::unordered_map<std::string, uint32_t>& table, DefinitionKind kind, const std::string& value) {
+    auto found = table.find(value);
+    if (found != table.end()) return found->second;
+
+    uint32_t id = (uint32_t)table.size();
+    table.emplace(value, id);
+    char header[definition_header_bytes] = { (char)kind, 0 };
+    uint16_t length = (uint16_t)value.size();
+    std::memcpy(header + 2, &length, sizeof(length));
+    std::memcpy(header + 4, &id, sizeof(id));
+    definitions_.append(header, sizeof(header));
+    definitions_.append(value);
+    return id;
+}
+
+void BinaryLogWriter::flush() {
+    if (records_.empty() || !file_.is_open()) return;
+    BlockHeader header = { reset_pending_ ? (uint32_t)reset_dictionaries : 0u, (uint32_t)definitions_.size(), (uint32_t)records_.size(), 0, base_ms_ };
+
+    std::string block;
+    block.reserve(sizeof(header) + definitions_.size() + records_.size() * sizeof(BinaryLogRecord));
+    block.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    block.append(definitions_);
+    block.append(reinterpret_cast<const char*>(records_.data()), records_.size() * sizeof(BinaryLogRecord));
+    file_.write(block.data(), block.size());
+    file_.flush();
+
+    definitions_.clear();
+    records_.clear();
+    reset_pending_ = false;
+}
+
+//////////////////////// READER ////////////////////////
+
+bool BinaryLogReader::open(const std::string& file_name) {
+    file_.open(file_name, std::ios::binary);
+    char magic[sizeof(BinaryLogWriter::magic_)];
+    return file_.read(magic, sizeof(magic)) && std::memcmp(magic, BinaryLogWriter::magic_, sizeof(magic)) == 0;
+}
+
+bool BinaryLogReader::next(Entry& entry) {
+    while (next_record_ == records_.size()) {
+        if (!read_block()) return false;
+    }
+    const BinaryLogRecord& record = records_[next_record_++];
+    auto address = addresses_.find(record.address_id_);
+    auto request = requests_.find(record.request_id_);
+    if (address == addresses_.end() || request == requests_.end()) {
+        corrupt_ = true;
+        return false;
+    }
+    entry.unix_ms_ = base_ms_ + record.time_ms_;
+    entry.address_ = address->second;
+    entry.request_line_ = request->second;
+    entry.status_ = record.status_;
+    entry.bytes_ = record.bytes_;
+    entry.latency_us_ = record.latency_us_;
+    return true;
+}
+
+bool BinaryLogReader::read_block() {
+    BlockHeader header;
+    if (!file_.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+        corrupt_ = file_.gcount() != 0;
+        return false;
+    }
+    // Far larger than any writer makes them, so the file is damaged
+    if (header.record_count_ > (1u << 24) || header.definitions_bytes_ > (1u << 28)) {
+        corrupt_ = true;
+        return false;
+    }
+    std::string definitions(header.definitions_bytes_, '\0');
+    records_.resize(header.record_count_);
+    if (!file_.read(&definitions[0], definitions.size())
+        || !file_.read(reinterpret_cast<char*>(records_.data()), records_.size() * sizeof(BinaryLogRecord))) {
+        corrupt_ = true;
+        return false;
+    }
+    if (header.flags_ & BinaryLogWriter::reset_dictionaries) {
+        addresses_.clear();
+        requests_.clear();
+    }
+
+    // Addresses are kept in text form, the way the text log shows them, with - for a client whose address was unknown
+    for (size_t pos = 0; pos < definitions.size();) {
+        if (definitions.size() - pos < definition_header_bytes) {
+            corrupt_ = true;
+            return false;
+        }
+        uint8_t kind = (uint8_t)definitions[pos];
+        uint16_t length;
+        uint32_t id;
+        std::memcpy(&length, &definitions[pos + 2], sizeof(length));
+        std::memcpy(&id, &definitions[pos + 4], sizeof(id));
+        pos += definition_header_bytes;
+        if (definitions.size() - pos < length) {
+            corrupt_ = true;
+            return false;
+        }
+        std::string value = definitions.substr(pos, length);
+        pos += length;
+
+        if (kind == BinaryLogWriter::address_definition && value.size() == 16) {
+            boost::asio::ip::address_v6::bytes_type bytes;
+            std::memcpy(bytes.data(), value.data(), bytes.size());
+            boost::asio::ip::address_v6 address(bytes);
+            if (address.is_unspecified()) addresses_[id] = "-";
+            else addresses_[id] = address.is_v4_mapped() ? boost::asio::ip::make_address_v4(boost::asio::ip::v4_mapped, address).to_string() : address.to_string();
+        }
+        else if (kind == BinaryLogWriter::request_definition)
+            requests_[id] = value;
+    }
+    base_ms_ = header.base_ms_;
+    next_record_ = 0;
+    return true;
+}
@@ -0,0 +1,111 @@
+/*
+
+    Compact binary form of the access log, for servers logging too many requests to afford
+    the text lines.
+
+    The file starts with the 8 byte magic "GETSLOG1" and is followed by blocks, each one
+    written in a single call:
+        header       flags (u32), definitions_bytes (u32), record_count (u32), reserved (u32), base_ms (i64)
+        definitions  kind (u8), 0 (u8), length (u16), id (u32), then length bytes of value
+        records      record_count fixed width BinaryLogRecords
+    Client addresses (16 bytes, IPv4 as v4-mapped IPv6) and request lines are interned: each
+    is defined once, in the block of the first record using it, and referred to by id after.
+    A block flagged reset_dictionaries starts the ids over, which happens when a server starts
+    appending to the file and whenever the tables reach their limit. Values are in the byte
+    order of the machine that wrote them.
+
+    Author: Jarod Graygo
+
+*/
+
+#ifndef BINARY_LOG_H
+#define BINARY_LOG_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct BinaryLogRecord {
+    // Milliseconds since the block's base_ms
+    uint32_t time_ms_;
+    // From the request arriving to its response being handed over for writing
+    uint32_t latency_us_;
+    uint32_t address_id_;
+    uint32_t request_id_;
+    // Response bytes, saturating at 4 GiB - 1
+    uint32_t bytes_;
+    uint16_t status_;
+    uint16_t reserved_;
+};
+
+static_assert(sizeof(BinaryLogRecord) == 24, "binary log records are 24 bytes on disk");
+
+class BinaryLogWriter {
+public:
+    // A block is written once it holds block_bytes or spans more than a second; each interning table holds up to max_interned values
+    explicit BinaryLogWriter(size_t block_bytes = 64 * 1024, size_t max_interned = 65536);
+    ~BinaryLogWriter();
+
+    BinaryLogWriter(const BinaryLogWriter&) = delete;
+    BinaryLogWriter& operator=(const BinaryLogWriter&) = delete;
+
+    // Append to the file, creating it if needed
+    bool open(const std::string& file_name);
+    bool is_open() const { return file_.is_open(); }
+
+    // unix_ms is the wall clock time of the response; request_line is the first line of the request without its line break
+    void record(int64_t unix_ms, const uint8_t address[16], const std::string& request_line, uint16_t status, uint64_t bytes, uint32_t latency_us);
+    // Write out the records held so far
+    void flush();
+
+    static const char magic_[8];
+    enum BlockFlags : uint32_t { reset_dictionaries = 1 };
+    enum DefinitionKind : uint8_t { address_definition = 0, request_definition = 1 };
+
+private:
+    uint32_t intern(std::unordered_map<std::string, uint32_t>&, DefinitionKind, const std::string&);
+
+    std::ofstream file_;
+    size_t block_bytes_;
+    size_t max_interned_;
+    std::unordered_map<std::string, uint32_t> addresses_;
+    std::unordered_map<std::string, uint32_t> requests_;
+    std::string definitions_;
+    std::vector<BinaryLogRecord> records_;
+    int64_t base_ms_;
+    bool reset_pending_;
+};
+
+// Reads a binary log back one entry at a time
+class BinaryLogReader {
+public:
+    struct Entry {
+        int64_t unix_ms_;
+        std::string address_;
+        std::string request_line_;
+        uint16_t status_;
+        uint32_t bytes_;
+        uint32_t latency_us_;
+    };
+
+    // False if the file can't be read or isn't a binary log
+    bool open(const std::string& file_name);
+    // False at the end of the file, or at a block that is cut short or refers to an undefined id
+    bool next(Entry&);
+    bool corrupt() const { return corrupt_; }
+
+private:
+    bool read_block();
+
+    std::ifstream file_;
+    std::unordered_map<uint32_t, std::string> addresses_;
+    std::unordered_map<uint32_t, std::string> requests_;
+    std::vector<BinaryLogRecord> records_;
+    size_t next_record_ = 0;
+    int64_t base_ms_ = 0;
+    bool corrupt_ = false;
+};
+
+#endif // BINARY_LOG_H
@@ -13,18 +13,60 @@
 #ifndef CONNECTION_H
 #define CONNECTION_H
 
+#include <chrono>
+#include <functional>
+#include <memory>
 #include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
 #include <boost/bind.hpp>
+#include "http2_session.h"
+#include "memory_budget.h"
+#include "proxy.h"
+#include "request_buffer.h"
+#include "websocket_session.h"
 
 using std::string;
 
-// Connection structure that tracks the socket, streambuf, and request in string form
+// Connection structure that tracks the socket, read buffer, and request in string form
+// The read buffer draws its memory from the server's pool and never grows past the request size limit
+// io_pending_ counts the responses the file I/O pool is still working on for the connection, and reading_ and writing_
+// are set while a read or write is outstanding; during all of that the connection must stay in the list, so
+// erase_pending_ defers its removal until the last of them comes back
+// Connections accepted on the secure listener also carry a TLS stream layered over the socket. Once the kernel has
+// taken over encryption of outgoing records (ktls_send_) responses are written to the socket directly
+// A response that becomes ready while 103 Early Hints are still being written waits in deferred_response_
+// Once a connection switches to HTTP/2 the session in h2_ owns its framing, and once it upgrades to WebSocket ws_ does;
+// channel_ is the channel it joined and channel_index_ its place among the channel's members
+// A request forwarded to an upstream server is carried through by proxy_, which ends with the connection
+// memory_ is what the connection holds against the server's memory budget
+// request_started_ is when the current HTTP/1 request head arrived, for the latency in the log
 struct Connection {
-    Connection(boost::asio::io_service& io_service) : socket_(io_service), read_buffer_() { }
-    Connection(boost::asio::io_service& io_service, size_t max_buffer_size) : socket_(io_service), read_buffer_(max_buffer_size) { }
+    using tls_stream_t = boost::asio::ssl::stream<boost::asio::ip::tcp::socket&>;
+
+    Connection(boost::asio::io_service& io_service, BufferPool& pool, size_t max_buffer_size) : socket_(io_service), read_buffer_(pool, max_buffer_size), io_pending_(0), erase_pending_(false), reading_(false), writing_(false), acknowledged_(false), ktls_send_(false), channel_index_(0) { }
     boost::asio::ip::tcp::socket socket_;
-    boost::asio::streambuf read_buffer_;
+    RequestBuffer read_buffer_;
     string request_;
+    std::chrono::steady_clock::time_point request_started_;
+    size_t io_pending_;
+    bool erase_pending_;
+    bool reading_;
+    bool writing_;
+    bool acknowledged_;
+    MemoryBudget::Charge memory_;
+    std::function<void()> deferred_response_;
+
+    std::unique_ptr<tls_stream_t> tls_;
+    string ktls_secret_;
+    bool ktls_send_;
+
+    std::unique_ptr<Http2Session> h2_;
+
+    std::unique_ptr<WebSocketSession> ws_;
+    string channel_;
+    size_t channel_index_;
+
+    std::unique_ptr<ProxyExchange> proxy_;
 };
 
 #endif // CONNECTION_H
@@ -0,0 +1,152 @@
+/*
+
+    Function definitions for ContentStore class and the xxHash it uses
+
+    Author: Jarod Graygo
+
+*/
+
+#include "content_store.h"
+#include <cstdio>
+#include <cstring>
+
+std::shared_ptr<const ContentStore::Blob> ContentStore::intern(std::string contents) {
+    uint64_t hash = xxhash64(contents.data(), contents.size());
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = blobs_.find(hash);
+    if (found != blobs_.end()) {
+        std::shared_ptr<const Blob> existing = found->second.lock();
+        if (existing && existing->contents_ == contents) {
+            ++deduplicated_;
+            return existing;
+        }
+    }
+
+    auto blob = std::make_shared<Blob>();
+    blob->contents_ = std::move(contents);
+    blob->hash_ = hash;
+    blob->etag_ = content_etag(hash);
+
+    // A live body with the same hash but different contents keeps its place; the newcomer just goes unshared
+    if (found == blobs_.end())
+        blobs_.emplace(hash, blob);
+    else if (found->second.expired())
+        found->second = blob;
+
+    // Drop references to bodies no cache holds any more, now and then so the map doesn't grow without bound
+    if (blobs_.size() > 64 && (blobs_.size() & (blobs_.size() - 1)) == 0) {
+        for (auto it = blobs_.begin(); it != blobs_.end(); ) {
+            if (it->second.expired()) it = blobs_.erase(it);
+            else ++it;
+        }
+    }
+    return blob;
+}
+
+ContentStore::Stats ContentStore::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats stats;
+    for (const auto& entry : blobs_) {
+        std::shared_ptr<const Blob> blob = entry.second.lock();
+        if (!blob) continue;
+        ++stats.blobs_;
+        stats.bytes_ += blob->contents_.size();
+    }
+    stats.deduplicated_ = deduplicated_;
+    return stats;
+}
+
+//////////////////////// XXH64 ////////////////////////
+
+namespace {
+
+const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t prime3 = 0x165667B19E3779F9ULL;
+const uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+inline uint64_t read64(const unsigned char* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint32_t read32(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint64_t accumulate(uint64_t acc, uint64_t input) {
+    acc += input * prime2;
+    acc = rotl(acc, 31);
+    return acc * prime1;
+}
+
+inline uint64_t merge_round(uint64_t acc, uint64_t val) {
+    acc ^= accumulate(0, val);
+    return acc * prime1 + prime4;
+}
+
+}
+
+uint64_t xxhash64(const void* data, size_t len, uint64_t seed) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const unsigned char* end = p + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        uint64_t v1 = seed + prime1 + prime2;
+        uint64_t v2 = seed + prime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - prime1;
+        const unsigned char* limit = end - 32;
+        do {
+            v1 = accumulate(v1, read64(p));
+            v2 = accumulate(v2, read64(p + 8));
+            v3 = accumulate(v3, read64(p + 16));
+            v4 = accumulate(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge_round(h, v1);
+        h = merge_round(h, v2);
+        h = merge_round(h, v3);
+        h = merge_round(h, v4);
+    }
+    else {
+        h = seed + prime5;
+    }
+    h += (uint64_t)len;
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= accumulate(0, read64(p));
+        h = rotl(h, 27) * prime1 + prime4;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t)read32(p) * prime1;
+        h = rotl(h, 23) * prime2 + prime3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        h ^= (*p) * prime5;
+        h = rotl(h, 11) * prime1;
+    }
+
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+std::string content_etag(uint64_t hash) {
+    char etag[24];
+    snprintf(etag, sizeof(etag), "\"%016llx\"", (unsigned long long)hash);
+    return etag;
+}
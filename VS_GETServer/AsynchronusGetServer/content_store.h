@@ -0,0 +1,64 @@
+/*
+
+    Content addressed storage for the bodies of cached files, shared by every site.
+
+    The sites served by one process are largely copies of each other, so the same
+    images, stylesheets and scripts show up under many paths. Each body is stored once
+    under a 64-bit xxHash of its contents, and the per-site file caches only hold
+    references to it. The hash also serves as the body's ETag.
+
+    A body lives as long as some cache still refers to it; the store itself only
+    keeps weak references so it never holds memory on its own.
+
+    Author: Jarod Graygo
+
+*/
+
+#ifndef CONTENT_STORE_H
+#define CONTENT_STORE_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class ContentStore {
+public:
+    struct Blob {
+        std::string contents_;
+        uint64_t hash_ = 0;
+        // Quoted hash, ready for an ETag header
+        std::string etag_;
+    };
+
+    // Snapshot of the bodies currently alive
+    struct Stats {
+        size_t blobs_ = 0;
+        size_t bytes_ = 0;
+        // How many times a body that was read turned out to be stored already
+        uint64_t deduplicated_ = 0;
+    };
+
+    ContentStore() : deduplicated_(0) { }
+
+    ContentStore(const ContentStore&) = delete;
+    ContentStore& operator=(const ContentStore&) = delete;
+
+    // The stored body equal to contents, stored now if there isn't one yet
+    std::shared_ptr<const Blob> intern(std::string contents);
+
+    Stats stats() const;
+
+private:
+    mutable std::mutex mutex_;
+    std::unordered_map<uint64_t, std::weak_ptr<const Blob>> blobs_;
+    uint64_t deduplicated_;
+};
+
+// XXH64 of the bytes; expects a little endian machine
+uint64_t xxhash64(const void* data, size_t len, uint64_t seed = 0);
+// The hash quoted for an ETag header, as a Blob's etag_ holds it
+std::string content_etag(uint64_t hash);
+
+#endif // CONTENT_STORE_H
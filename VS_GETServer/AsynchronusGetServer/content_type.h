@@ -0,0 +1,31 @@
+/*
+
+    The Content-Type the server sends for each file extension it knows, shared with the
+    tools that prepare responses ahead of time.
+
+    Author: Jarod Graygo
+
+*/
+
+#ifndef CONTENT_TYPE_H
+#define CONTENT_TYPE_H
+
+#include <string>
+
+// Content-Type for an extension (without the dot), and whether the body is sent as binary
+// Unknown extensions get an empty type and are sent as text
+inline std::string content_type_for(const std::string& extension, bool& binary) {
+    binary = false;
+    if (extension == "html") return "text/html";
+    if (extension == "js") return "text/javascript; charset=utf-8";
+    if (extension == "css") return "text/css";
+    binary = true;
+    if (extension == "png") return "image/png";
+    if (extension == "ico") return "image/png";
+    if (extension == "jpg") return "image/jpeg";
+    if (extension == "gif") return "image/gif";
+    binary = false;
+    return std::string();
+}
+
+#endif // CONTENT_TYPE_H
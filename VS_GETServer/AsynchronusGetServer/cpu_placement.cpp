@@ -0,0 +1,313 @@
+/*
+
+    Function definitions for ThreadPlacement class
+
+    Author: Jarod Graygo
+
+*/
+
+#include "cpu_placement.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#if defined(__linux__)
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+namespace {
+
+#if defined(__linux__) || defined(_WIN32)
+    bool contains(const std::vector<int>& cpus, int cpu) {
+        return std::find(cpus.begin(), cpus.end(), cpu) != cpus.end();
+    }
+#endif
+
+#if defined(__linux__)
+
+    // set_mempolicy() mode from numaif.h, which belongs to libnuma
+    const int preferred_policy = 1;
+
+    std::string read_line(const std::string& path) {
+        std::ifstream in(path);
+        std::string line;
+        std::getline(in, line);
+        return line;
+    }
+
+    // CPUs the process may run on
+    std::vector<int> allowed_cpus() {
+        std::vector<int> cpus;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) != 0) return cpus;
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+        return cpus;
+    }
+
+    // NUMA node of a CPU, -1 on kernels built without NUMA
+    int node_of(int cpu) {
+        std::error_code ec;
+        std::filesystem::directory_iterator end;
+        for (std::filesystem::directory_iterator it("/sys/devices/system/cpu/cpu" + std::to_string(cpu), ec); !ec && it != end; it.increment(ec)) {
+            std::string name = it->path().filename().string();
+            if (name.size() > 4 && name.compare(0, 4, "node") == 0 && std::isdigit((unsigned char)name[4])) return std::atoi(name.c_str() + 4);
+        }
+        return -1;
+    }
+
+    std::vector<int> cpus_of_node(int node) {
+        return parse_cpu_list(read_line("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"));
+    }
+
+    // Uses the same list format as CPUs
+    size_t node_count() {
+        return parse_cpu_list(read_line("/sys/devices/system/node/online")).size();
+    }
+
+    // Interrupts an interface has raised on each CPU, and the CPUs its interrupts are currently routed to. A PCI device
+    // lists its vectors under msi_irqs, a virtio one under the PCI function it sits on; otherwise the lines of
+    // /proc/interrupts naming the interface are taken
+    void irq_load(const std::string& interface, std::map<int, uint64_t>& counts, std::set<int>& routed) {
+        std::set<int> irqs;
+        std::filesystem::directory_iterator end;
+        for (const char* vectors : { "/device/msi_irqs", "/device/../msi_irqs" }) {
+            std::error_code ec;
+            for (std::filesystem::directory_iterator it("/sys/class/net/" + interface + vectors, ec); !ec && it != end; it.increment(ec))
+                irqs.insert(std::atoi(it->path().filename().string().c_str()));
+            if (!irqs.empty()) break;
+        }
+
+        std::ifstream in("/proc/interrupts");
+        std::string line;
+        std::vector<int> columns;
+        if (std::getline(in, line)) {
+            std::istringstream header(line);
+            std::string name;
+            while (header >> name)
+                columns.push_back(name.compare(0, 3, "CPU") == 0 ? std::atoi(name.c_str() + 3) : -1);
+        }
+        while (std::getline(in, line)) {
+            std::istringstream fields(line);
+            std::string label;
+            fields >> label;
+            if (label.empty() || !std::isdigit((unsigned char)label[0])) continue;
+            int irq = std::atoi(label.c_str());
+            if (irqs.empty() ? line.find(interface) == std::string::npos : !irqs.count(irq)) continue;
+            uint64_t count;
+            for (size_t column = 0; column < columns.size() && fields >> count; ++column)
+                counts[columns[column]] += count;
+            std::string list = read_line("/proc/irq/" + std::to_string(irq) + "/effective_affinity_list");
+            if (list.empty()) list = read_line("/proc/irq/" + std::to_string(irq) + "/smp_affinity_list");
+            for (int cpu : parse_cpu_list(list))
+                routed.insert(cpu);
+        }
+    }
+
+    // Pick the io_service thread's CPU from the interface's interrupts, -1 with a note saying why if there is none
+    int irq_cpu(const std::string& interface, bool share, const std::vector<int>& allowed, std::vector<std::string>& notes) {
+        std::map<int, uint64_t> counts;
+        std::set<int> routed;
+        irq_load(interface, counts, routed);
+        if (routed.empty()) {
+            notes.push_back("Found no interrupts for " + interface + ", the io_service thread is left to the scheduler");
+            return -1;
+        }
+
+        if (share) {
+            int busiest = -1;
+            for (int cpu : routed)
+                if (contains(allowed, cpu) && (busiest < 0 || counts[cpu] > counts[busiest])) busiest = cpu;
+            if (busiest < 0) notes.push_back("None of the CPUs handling " + interface + "'s interrupts is available to the server");
+            return busiest;
+        }
+
+        // The interface's own node if the device says, otherwise that of a CPU its interrupts go to
+        std::string numa_node = read_line("/sys/class/net/" + interface + "/device/numa_node");
+        int node = numa_node.empty() ? -1 : std::atoi(numa_node.c_str());
+        if (node < 0) node = node_of(*routed.begin());
+        std::vector<int> candidates = node >= 0 ? cpus_of_node(node) : allowed;
+        // The highest numbered, since the low numbered CPUs tend to carry the rest of the system's interrupts
+        for (auto it = candidates.rbegin(); it != candidates.rend(); ++it)
+            if (contains(allowed, *it) && !routed.count(*it) && !counts[*it]) return *it;
+        notes.push_back("Every CPU near " + interface + " handles its interrupts, the io_service thread is left to the scheduler");
+        return -1;
+    }
+
+#elif defined(_WIN32)
+
+    std::vector<int> allowed_cpus() {
+        std::vector<int> cpus;
+        DWORD_PTR process_mask, system_mask;
+        if (!GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask)) return cpus;
+        for (int cpu = 0; cpu < (int)(8 * sizeof(DWORD_PTR)); ++cpu)
+            if (process_mask & ((DWORD_PTR)1 << cpu)) cpus.push_back(cpu);
+        return cpus;
+    }
+
+    int node_of(int cpu) {
+        UCHAR node;
+        return GetNumaProcessorNode((UCHAR)cpu, &node) ? (int)node : -1;
+    }
+
+    std::vector<int> cpus_of_node(int node) {
+        std::vector<int> cpus;
+        ULONGLONG mask;
+        if (!GetNumaNodeProcessorMask((UCHAR)node, &mask)) return cpus;
+        for (int cpu = 0; cpu < 64; ++cpu)
+            if (mask & (1ULL << cpu)) cpus.push_back(cpu);
+        return cpus;
+    }
+
+    size_t node_count() {
+        ULONG highest;
+        return GetNumaHighestNodeNumber(&highest) ? highest + 1 : 1;
+    }
+
+    int irq_cpu(const std::string& interface, bool, const std::vector<int>&, std::vector<std::string>& notes) {
+        notes.push_back("Choosing a CPU by " + interface + "'s interrupts is not supported on Windows");
+        return -1;
+    }
+
+#endif
+
+}
+
+// The file I/O threads follow a pinned io_service thread onto its node only where there is more than one node;
+// on a single node machine that would just pin them to every CPU
+ThreadPlacement::ThreadPlacement(const CpuPlacement& settings)
+    : io_cpu_(-1), io_node_(-1), file_io_each_(false), file_io_node_(-1), numa_local_(settings.numa_local_), pinned_(0), failed_(0) {
+#if defined(__linux__) || defined(_WIN32)
+    std::vector<int> allowed = allowed_cpus();
+    if (settings.io_cpu_ >= 0) {
+        if (contains(allowed, settings.io_cpu_)) io_cpu_ = settings.io_cpu_;
+        else notes_.push_back("CPU " + std::to_string(settings.io_cpu_) + " is not available, the io_service thread is left to the scheduler");
+    }
+    else if (!settings.irq_interface_.empty()) {
+        io_cpu_ = irq_cpu(settings.irq_interface_, settings.share_irq_cpu_, allowed, notes_);
+    }
+    if (io_cpu_ >= 0) io_node_ = node_of(io_cpu_);
+    bool numa = node_count() > 1;
+    if (!numa) numa_local_ = false;
+
+    if (!settings.file_io_cpus_.empty()) {
+        for (int cpu : settings.file_io_cpus_) {
+            if (contains(allowed, cpu) && !contains(file_io_cpus_, cpu)) file_io_cpus_.push_back(cpu);
+            else if (!contains(allowed, cpu)) notes_.push_back("CPU " + std::to_string(cpu) + " is not available to the file I/O threads");
+        }
+        file_io_each_ = true;
+    }
+    else if (numa && io_node_ >= 0) {
+        for (int cpu : cpus_of_node(io_node_))
+            if (contains(allowed, cpu)) file_io_cpus_.push_back(cpu);
+        file_io_node_ = io_node_;
+    }
+#else
+    if (settings.io_cpu_ >= 0 || !settings.irq_interface_.empty() || !settings.file_io_cpus_.empty())
+        notes_.push_back("Pinning threads to CPUs is not supported on this platform");
+    numa_local_ = false;
+#endif
+}
+
+void ThreadPlacement::place_io_thread() {
+    if (io_cpu_ < 0) return;
+    if (pin(std::vector<int>(1, io_cpu_), io_node_)) ++pinned_;
+    else ++failed_;
+}
+
+// With the CPUs given explicitly each thread gets one of them in turn; following the io_service thread they share its node's
+void ThreadPlacement::place_file_io_thread(size_t index) {
+    if (file_io_cpus_.empty()) return;
+    bool pinned;
+    if (file_io_each_) {
+        int cpu = file_io_cpus_[index % file_io_cpus_.size()];
+        pinned = pin(std::vector<int>(1, cpu), numa_local_ ? node_of(cpu) : -1);
+    }
+    else {
+        pinned = pin(file_io_cpus_, file_io_node_);
+    }
+    if (pinned) ++pinned_;
+    else ++failed_;
+}
+
+std::vector<std::string> ThreadPlacement::report() const {
+    std::vector<std::string> lines = notes_;
+    if (io_cpu_ >= 0)
+        lines.push_back("io_service thread on CPU " + std::to_string(io_cpu_) + (io_node_ >= 0 ? " (NUMA node " + std::to_string(io_node_) + ")" : std::string()));
+    if (!file_io_cpus_.empty())
+        lines.push_back("File I/O threads on CPU" + std::string(file_io_cpus_.size() > 1 ? "s " : " ") + format_cpu_list(file_io_cpus_) +
+            (file_io_each_ && file_io_cpus_.size() > 1 ? ", one each in turn" : ""));
+    if (numa_local_ && (io_cpu_ >= 0 || !file_io_cpus_.empty()))
+        lines.push_back("Pinned threads allocate from their own NUMA node first");
+    if (failed_)
+        lines.push_back("Could not pin " + std::to_string(failed_.load()) + " of " + std::to_string(pinned_.load() + failed_.load()) + " threads");
+    return lines;
+}
+
+// Memory the thread goes on to allocate comes from node where it can; a failure there leaves the thread pinned
+bool ThreadPlacement::pin(const std::vector<int>& cpus, int node) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+        CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) return false;
+    if (numa_local_ && node >= 0 && node < 1024) {
+        unsigned long mask[1024 / (8 * sizeof(unsigned long))] = {};
+        mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+        if (syscall(SYS_set_mempolicy, preferred_policy, mask, (unsigned long)(8 * sizeof(mask))) != 0) return false;
+    }
+    return true;
+#elif defined(_WIN32)
+    DWORD_PTR mask = 0;
+    for (int cpu : cpus)
+        if (cpu < (int)(8 * sizeof(DWORD_PTR))) mask |= (DWORD_PTR)1 << cpu;
+    return mask && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#else
+    return false;
+#endif
+}
+
+std::vector<int> parse_cpu_list(const std::string& list) {
+    std::vector<int> cpus;
+    size_t at = 0;
+    while (at < list.size() && std::isdigit((unsigned char)list[at])) {
+        char* next;
+        long first = std::strtol(list.c_str() + at, &next, 10);
+        long last = first;
+        if (*next == '-') last = std::strtol(next + 1, &next, 10);
+        if (last < first || last - first > 4096) break;
+        for (long cpu = first; cpu <= last; ++cpu)
+            cpus.push_back((int)cpu);
+        at = next - list.c_str();
+        if (at >= list.size() || list[at] != ',') break;
+        ++at;
+    }
+    return cpus;
+}
+
+std::string format_cpu_list(const std::vector<int>& cpus) {
+    std::vector<int> sorted(cpus);
+    std::sort(sorted.begin(), sorted.end());
+    std::string list;
+    for (size_t i = 0; i < sorted.size();) {
+        size_t j = i;
+        while (j + 1 < sorted.size() && sorted[j + 1] == sorted[j] + 1) ++j;
+        if (!list.empty()) list += ",";
+        list += std::to_string(sorted[i]);
+        if (j > i) list += "-" + std::to_string(sorted[j]);
+        i = j + 1;
+    }
+    return list;
+}
@@ -0,0 +1,64 @@
+/*
+
+    Pinning the server's threads to CPUs, following the CpuPlacement settings of ServerOptions.
+
+    The CPUs are worked out once, when the server is created: the io_service thread's
+    either given outright or picked from where a network interface's interrupts are handled,
+    and the file I/O pool threads' either given or taken from the io_service thread's NUMA
+    node, so the file contents they read are close to the thread that sends them. Each
+    thread then pins itself as it starts. A pinned thread can also be told to allocate from
+    its own node first, which keeps request buffers and cached files local to the thread
+    that fills them on machines with more than one node.
+
+    Linux reads the topology from /sys and /proc; Windows uses its NUMA functions and only
+    handles the first 64 CPUs. Elsewhere nothing is pinned. Whatever can't be done is
+    reported and otherwise ignored, the server runs fine without any of it.
+
+    Author: Jarod Graygo
+
+*/
+
+#ifndef CPU_PLACEMENT_H
+#define CPU_PLACEMENT_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include "server_options.h"
+
+class ThreadPlacement {
+public:
+    explicit ThreadPlacement(const CpuPlacement&);
+
+    ThreadPlacement(const ThreadPlacement&) = delete;
+    ThreadPlacement& operator=(const ThreadPlacement&) = delete;
+
+    // Pin the calling thread as the io_service thread, or as the index'th file I/O pool thread. Safe from any thread
+    void place_io_thread();
+    void place_file_io_thread(size_t index);
+
+    // Where the threads were put and what could not be done, one line each; empty when nothing was asked for
+    std::vector<std::string> report() const;
+
+private:
+    bool pin(const std::vector<int>& cpus, int node);
+
+    int io_cpu_;
+    int io_node_;
+    std::vector<int> file_io_cpus_;
+    // Whether each file I/O thread gets one of the CPUs, or all of them share the CPUs of file_io_node_
+    bool file_io_each_;
+    int file_io_node_;
+    bool numa_local_;
+    // Worked out in the constructor
+    std::vector<std::string> notes_;
+    std::atomic<size_t> pinned_;
+    std::atomic<size_t> failed_;
+};
+
+// Parse a Linux CPU list such as "0-3,8,10-11"; anything malformed ends the list
+std::vector<int> parse_cpu_list(const std::string&);
+// The reverse, collapsing runs into ranges
+std::string format_cpu_list(const std::vector<int>&);
+
+#endif // CPU_PLACEMENT_H
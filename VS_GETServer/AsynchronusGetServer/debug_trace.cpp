@@ -0,0 +1,90 @@
+/*
+
+    Function definitions for DebugTrace class
+
+    Author: Jarod Graygo
+
+*/
+
+#include "debug_trace.h"
+#include <algorithm>
+#include <cstdlib>
+
+namespace {
+
+    bool starts_with_any(const std::string& value, const std::vector<std::string>& prefixes) {
+        if (prefixes.empty()) return true;
+        return std::any_of(prefixes.begin(), prefixes.end(), [&value](const std::string& prefix) { return value.compare(0, prefix.size(), prefix) == 0; });
+    }
+
+    std::vector<std::string> split_list(const std::string& list) {
+        std::vector<std::string> items;
+        size_t start = 0;
+        while (start < list.size()) {
+            size_t end = std::min(list.find(',', start), list.size());
+            if (end > start) items.push_back(list.substr(start, end - start));
+            start = end + 1;
+        }
+        return items;
+    }
+
+    std::string join_list(const std::vector<std::string>& items) {
+        if (items.empty()) return "any";
+        std::string list;
+        for (const auto& item : items) list += (list.empty() ? "" : ",") + item;
+        return list;
+    }
+
+}
+
+DebugTrace::DebugTrace(const TraceSettings& settings, bool enabled) : settings_(settings), candidates_(0) {
+    settings_.enabled_ = enabled;
+    settings_.sample_every_ = std::max<uint32_t>(settings_.sample_every_, 1);
+}
+
+bool DebugTrace::wants_client(const std::string& address) const {
+    return starts_with_any(address, settings_.client_prefixes_);
+}
+
+bool DebugTrace::sample(const std::string& address, const std::string& target) {
+    if (!wants_client(address) || !starts_with_any(target, settings_.path_prefixes_)) return false;
+    return candidates_++ % settings_.sample_every_ == 0;
+}
+
+void DebugTrace::set(const TraceSettings& settings) {
+    settings_ = settings;
+    settings_.sample_every_ = std::max<uint32_t>(settings_.sample_every_, 1);
+    candidates_ = 0;
+}
+
+bool DebugTrace::apply_query(const std::string& query, TraceSettings& settings) {
+    TraceSettings changed = settings;
+    size_t start = 0;
+    while (start < query.size()) {
+        size_t end = std::min(query.find('&', start), query.size());
+        std::string parameter = query.substr(start, end - start);
+        start = end + 1;
+        if (parameter.empty()) continue;
+
+        size_t equals = parameter.find('=');
+        std::string name = parameter.substr(0, equals);
+        std::string value = equals == std::string::npos ? "" : parameter.substr(equals + 1);
+        if (name == "enable" && (value == "1" || value == "0"))
+            changed.enabled_ = value == "1";
+        else if (name == "sample" && !value.empty() && value.find_first_not_of("0123456789") == std::string::npos && value.size() < 10)
+            changed.sample_every_ = std::max<uint32_t>((uint32_t)std::strtoul(value.c_str(), nullptr, 10), 1);
+        else if (name == "path")
+            changed.path_prefixes_ = split_list(value);
+        else if (name == "client")
+            changed.client_prefixes_ = split_list(value);
+        else
+            return false;
+    }
+    settings = changed;
+    return true;
+}
+
+std::string DebugTrace::describe(const TraceSettings& settings) {
+    return std::string(settings.enabled_ ? "on" : "off") + ", sampling 1 in " + std::to_string(settings.sample_every_)
+        + ", paths " + join_list(settings.path_prefixes_) + ", clients " + join_list(settings.client_prefixes_);
+}
@@ -0,0 +1,44 @@
+/*
+
+    Decides which requests and connection events the server traces to the console, so tracing
+    can stay available on a busy server: it samples one in so many requests and filters them
+    by path and client, and it can be switched on and off while the server runs.
+
+    Only used from the io_service thread. While tracing is off the server's only cost is the
+    on() check.
+
+    Author: Jarod Graygo
+
+*/
+
+#ifndef DEBUG_TRACE_H
+#define DEBUG_TRACE_H
+
+#include <cstdint>
+#include <string>
+#include "server_options.h"
+
+class DebugTrace {
+public:
+    DebugTrace(const TraceSettings& settings, bool enabled);
+
+    bool on() const { return settings_.enabled_; }
+    // Whether events on a connection from this client are traced
+    bool wants_client(const std::string& address) const;
+    // Whether this request is traced: it passes both filters and is the one in sample_every_ due
+    bool sample(const std::string& address, const std::string& target);
+
+    const TraceSettings& settings() const { return settings_; }
+    void set(const TraceSettings&);
+
+    // Apply a query such as enable=1&sample=100&path=/src/,/api/&client=10.1. to the settings
+    // Returns false, leaving them alone, if a parameter is unknown or a value doesn't parse
+    static bool apply_query(const std::string& query, TraceSettings&);
+    static std::string describe(const TraceSettings&);
+
+private:
+    TraceSettings settings_;
+    uint64_t candidates_;
+};
+
+#endif // DEBUG_TRACE_H
@@ -0,0 +1,172 @@
+/*
+
+    Function definitions for DirectoryWatcher class
+
+    Author: Jarod Graygo
+
+*/
+
+#include "directory_watcher.h"
+#include <boost/bind.hpp>
+#if defined(__linux__)
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <sys/inotify.h>
+#endif
+
+#if defined(__linux__)
+
+namespace {
+
+    // Entries appearing or disappearing; changes to the files themselves are the file cache's business
+    const uint32_t watched_events = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+
+}
+
+DirectoryWatcher::DirectoryWatcher(boost::asio::io_service& io_service) : descriptor_(io_service) { }
+
+DirectoryWatcher::~DirectoryWatcher() { }
+
+bool DirectoryWatcher::watch(const std::string& root, std::function<void(bool)> on_change, std::string& error) {
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        error = std::strerror(errno);
+        return false;
+    }
+    descriptor_.assign(fd);
+    if (!add_tree(root, error)) {
+        boost::system::error_code ignored;
+        descriptor_.close(ignored);
+        directories_.clear();
+        return false;
+    }
+    on_change_ = on_change;
+    start_read();
+    return true;
+}
+
+// Watch the directory and every directory under it; symbolic links to directories inside the tree aren't followed
+bool DirectoryWatcher::add_tree(const std::string& directory, std::string& error) {
+    int wd = inotify_add_watch(descriptor_.native_handle(), directory.c_str(), watched_events);
+    if (wd < 0) {
+        error = directory + ": " + std::strerror(errno);
+        return false;
+    }
+    directories_[wd] = directory;
+
+    std::error_code ec;
+    for (auto it = std::filesystem::recursive_directory_iterator(directory, ec); !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+        if (it->is_symlink() || !it->is_directory()) continue;
+        wd = inotify_add_watch(descriptor_.native_handle(), it->path().c_str(), watched_events);
+        if (wd < 0) {
+            error = it->path().string() + ": " + std::strerror(errno);
+            return false;
+        }
+        directories_[wd] = it->path().string();
+    }
+    if (ec) error = directory + ": " + ec.message();
+    return !ec;
+}
+
+void DirectoryWatcher::start_read() {
+    descriptor_.async_read_some(boost::asio::buffer(buffer_),
+        boost::bind(&DirectoryWatcher::handle_read, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+}
+
+// A directory created under the tree is watched before the batch is reported, so nothing created inside it
+// afterwards goes unnoticed and whatever was created before the watch is covered by the report
+void DirectoryWatcher::handle_read(boost::system::error_code const& err, size_t bytes_transfered) {
+    if (err == boost::asio::error::operation_aborted) return;
+    bool intact = !err;
+    size_t at = 0;
+    while (intact && at + sizeof(inotify_event) <= bytes_transfered) {
+        const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer_ + at);
+        at += sizeof(inotify_event) + event->len;
+        if (event->mask & IN_Q_OVERFLOW) {
+            intact = false;
+        }
+        else if (event->mask & IN_IGNORED) {
+            directories_.erase(event->wd);
+        }
+        else if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO)) && event->len > 0) {
+            auto parent = directories_.find(event->wd);
+            std::string error;
+            if (parent != directories_.end())
+                intact = add_tree((std::filesystem::path(parent->second) / event->name).string(), error);
+        }
+    }
+
+    on_change_(intact);
+    if (!intact) {
+        boost::system::error_code ignored;
+        descriptor_.close(ignored);
+        directories_.clear();
+        return;
+    }
+    start_read();
+}
+
+#elif defined(_WIN32)
+
+DirectoryWatcher::DirectoryWatcher(boost::asio::io_service& io_service) : io_service_(io_service), handle_(io_service) { }
+
+DirectoryWatcher::~DirectoryWatcher() { }
+
+bool DirectoryWatcher::watch(const std::string& root, std::function<void(bool)> on_change, std::string& error) {
+    HANDLE directory = CreateFileA(root.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+        OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+    if (directory == INVALID_HANDLE_VALUE) {
+        error = "could not open " + root;
+        return false;
+    }
+    boost::system::error_code ec;
+    handle_.assign(directory, ec);
+    if (ec) {
+        CloseHandle(directory);
+        error = ec.message();
+        return false;
+    }
+    on_change_ = on_change;
+    start_read();
+    return true;
+}
+
+void DirectoryWatcher::start_read() {
+    boost::asio::windows::overlapped_ptr overlapped(io_service_,
+        boost::bind(&DirectoryWatcher::handle_read, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+    BOOL queued = ReadDirectoryChangesW(handle_.native_handle(), buffer_, sizeof(buffer_), TRUE,
+        FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME, nullptr, overlapped.get(), nullptr);
+    if (queued) overlapped.release();
+    else overlapped.complete(boost::system::error_code(GetLastError(), boost::asio::error::get_system_category()), 0);
+}
+
+// The whole tree is watched by the one handle; a read of 0 bytes means the buffer overflowed and the changes were lost,
+// which is still a change
+void DirectoryWatcher::handle_read(boost::system::error_code const& err, size_t bytes_transfered) {
+    if (err == boost::asio::error::operation_aborted) return;
+    on_change_(!err);
+    if (err) {
+        boost::system::error_code ignored;
+        handle_.close(ignored);
+        return;
+    }
+    start_read();
+}
+
+#else
+
+DirectoryWatcher::DirectoryWatcher(boost::asio::io_service&) { }
+
+DirectoryWatcher::~DirectoryWatcher() { }
+
+bool DirectoryWatcher::watch(const std::string&, std::function<void(bool)>, std::string& error) {
+    error = "not supported on this platform";
+    return false;
+}
+
+void DirectoryWatcher::start_read() { }
+
+void DirectoryWatcher::handle_read(boost::system::error_code const&, size_t) { }
+
+#endif
@@ -0,0 +1,57 @@
+/*
+
+    Reports entries being created, renamed or deleted anywhere under a directory, on the
+    io_service thread. Linux uses inotify, with a watch on every directory in the tree that
+    is added to as directories appear; Windows uses ReadDirectoryChangesW on the whole
+    tree. Other platforms aren't supported and watch() says so.
+
+    Changes are reported in batches, without saying what changed, and a batch may stand for
+    changes the watcher lost track of (a full change buffer). If the tree can no longer be
+    watched completely (a full inotify queue, or no watch left for a new directory) that is
+    reported instead, and nothing more is.
+
+    Author: Jarod Graygo
+
+*/
+
+#ifndef DIRECTORY_WATCHER_H
+#define DIRECTORY_WATCHER_H
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <boost/asio.hpp>
+
+class DirectoryWatcher {
+public:
+    explicit DirectoryWatcher(boost::asio::io_service&);
+    ~DirectoryWatcher();
+
+    DirectoryWatcher(const DirectoryWatcher&) = delete;
+    DirectoryWatcher& operator=(const DirectoryWatcher&) = delete;
+
+    // Start watching root and everything under it, calling on_change(true) after each batch of changes and
+    // on_change(false) once when it gives up. Returns false with error set if the tree can't be watched; a watcher is started once
+    bool watch(const std::string& root, std::function<void(bool)> on_change, std::string& error);
+
+private:
+    void start_read();
+    void handle_read(boost::system::error_code const&, size_t);
+
+    std::function<void(bool)> on_change_;
+#if defined(__linux__)
+    bool add_tree(const std::string& directory, std::string& error);
+
+    boost::asio::posix::stream_descriptor descriptor_;
+    // Watch descriptor to the directory it watches, so directories created under it can be added
+    std::unordered_map<int, std::string> directories_;
+    alignas(8) char buffer_[16 * 1024];
+#elif defined(_WIN32)
+    boost::asio::io_service& io_service_;
+    boost::asio::windows::stream_handle handle_;
+    // ReadDirectoryChangesW fills it with DWORD aligned records
+    alignas(8) char buffer_[16 * 1024];
+#endif
+};
+
+#endif // DIRECTORY_WATCHER_H
@@ -0,0 +1,63 @@
+/*
+
+    A site compiled into the server itself. Tools/embed_bundle_build turns a document root into a
+    C++ source holding every file's bytes, its ready made header lines and a sorted index of their
+    paths, all constexpr. Build the server with that source and EMBEDDED_BUNDLE defined, and set
+    ServerOptions::embedded_only_ to serve nothing but the bundle.
+
+    Author: Jarod Graygo
+
+*/
+
+#ifndef EMBEDDED_BUNDLE_H
+#define EMBEDDED_BUNDLE_H
+
+#include <cstddef>
+#include <string_view>
+
+struct EmbeddedAsset {
+    // Relative to the document root, with / separators
+    std::string_view path_;
+    // Header lines that never change for the file: Server, Content-Type, Connection, and Cache-Control, Link and Vary where they apply
+    std::string_view header_;
+    std::string_view etag_;
+    const unsigned char* body_;
+    size_t body_bytes_;
+    // Gzip encoded copy of the body, null when there is none
+    const unsigned char* gzip_;
+    size_t gzip_bytes_;
+    bool binary_;
+};
+
+struct EmbeddedBundle {
+    // Sorted by path
+    const EmbeddedAsset* assets_;
+    size_t size_;
+
+    constexpr const EmbeddedAsset* find(std::string_view path) const {
+        size_t low = 0, high = size_;
+        while (low < high) {
+            size_t mid = low + (high - low) / 2;
+            int order = assets_[mid].path_.compare(path);
+            if (order == 0) return &assets_[mid];
+            if (order < 0) low = mid + 1;
+            else high = mid;
+        }
+        return nullptr;
+    }
+};
+
+// Whether the paths are in strictly increasing order, which find() relies on; checked when the bundle is compiled
+constexpr bool embedded_paths_sorted(const EmbeddedAsset* assets, size_t size) {
+    for (size_t i = 1; i < size; ++i) {
+        if (!(assets[i - 1].path_ < assets[i].path_)) return false;
+    }
+    return true;
+}
+
+#ifdef EMBEDDED_BUNDLE
+// Defined by the source embed_bundle_build generates
+extern const EmbeddedBundle embedded_bundle;
+#endif
+
+#endif // EMBEDDED_BUNDLE_H
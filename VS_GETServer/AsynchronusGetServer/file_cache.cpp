@@ -0,0 +1,64 @@
+/*
+
+    Function definitions for FileCache class
+
+    Author: Jarod Graygo
+
+*/
+
+#include "file_cache.h"
+
+FileCache::blob_t FileCache::find(const std::string& path, std::filesystem::file_time_type modified, uintmax_t size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = index_.find(path);
+    if (found == index_.end()) return nullptr;
+
+    lru_t::iterator item = found->second;
+    if (item->second.modified_ != modified || item->second.blob_->contents_.size() != size) {
+        erase(item);
+        return nullptr;
+    }
+    lru_.splice(lru_.begin(), lru_, item);
+    return item->second.blob_;
+}
+
+void FileCache::insert(const std::string& path, std::filesystem::file_time_type modified, blob_t blob) {
+    size_t size = blob->contents_.size();
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = index_.find(path);
+    if (found != index_.end()) erase(found->second);
+    if (size > budget_) return;
+
+    while (bytes_ + size > budget_ && !lru_.empty())
+        erase(std::prev(lru_.end()));
+    lru_.emplace_front(path, Entry{ std::move(blob), modified });
+    index_[path] = lru_.begin();
+    bytes_ += size;
+}
+
+size_t FileCache::trim(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t dropped = 0;
+    while (dropped < bytes && !lru_.empty()) {
+        auto oldest = std::prev(lru_.end());
+        dropped += oldest->second.blob_->contents_.size();
+        erase(oldest);
+    }
+    return dropped;
+}
+
+FileCache::Stats FileCache::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats stats;
+    stats.entries_ = lru_.size();
+    stats.bytes_ = bytes_;
+    stats.budget_ = budget_;
+    return stats;
+}
+
+// Expects the mutex to be held
+void FileCache::erase(lru_t::iterator item) {
+    bytes_ -= item->second.blob_->contents_.size();
+    index_.erase(item->first);
+    lru_.erase(item);
+}
@@ -0,0 +1,74 @@
+/*
+
+    A byte bounded, least recently used cache mapping a site's file paths to their
+    contents. The contents are bodies shared through the content store, so identical
+    files under several paths or sites cost their size once in memory; the budget
+    counts every path in full. Entries carry the modification time and size the file
+    had when it was read, and a lookup only succeeds while both still match, so edits
+    on disk are picked up without any explicit invalidation. Safe to use from every
+    file I/O pool thread.
+
+    Author: Jarod Graygo
+
+*/
+
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include "content_store.h"
+
+class FileCache {
+public:
+    using blob_t = std::shared_ptr<const ContentStore::Blob>;
+
+    struct Entry {
+        blob_t blob_;
+        std::filesystem::file_time_type modified_;
+    };
+
+    // Snapshot of what the cache holds
+    struct Stats {
+        size_t entries_ = 0;
+        size_t bytes_ = 0;
+        size_t budget_ = 0;
+    };
+
+    explicit FileCache(size_t budget_bytes) : budget_(budget_bytes), bytes_(0) { }
+
+    FileCache(const FileCache&) = delete;
+    FileCache& operator=(const FileCache&) = delete;
+
+    // The cached contents of path, or nullptr if it is not cached or the file has changed since it was read
+    blob_t find(const std::string& path, std::filesystem::file_time_type modified, uintmax_t size);
+
+    // Add or replace the contents of path, evicting the least recently used files to stay within the budget
+    // Files larger than the whole budget are not cached
+    void insert(const std::string& path, std::filesystem::file_time_type modified, blob_t blob);
+
+    // Evict least recently used files until at least bytes have been dropped or the cache is empty; returns what was dropped
+    size_t trim(size_t bytes);
+
+    Stats stats() const;
+
+private:
+    using lru_t = std::list<std::pair<std::string, Entry>>;
+
+    void erase(lru_t::iterator);
+
+    mutable std::mutex mutex_;
+    size_t budget_;
+    size_t bytes_;
+    // Most recently used at the front
+    lru_t lru_;
+    std::unordered_map<std::string, lru_t::iterator> index_;
+};
+
+#endif // FILE_CACHE_H
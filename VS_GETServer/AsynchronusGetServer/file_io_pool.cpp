@@ -0,0 +1,89 @@
+/*
+
+    Function definitions for FileIOPool class
+
+    Author: Jarod Graygo
+
+*/
+
+#include "file_io_pool.h"
+
+FileIOPool::FileIOPool(size_t fast_threads, size_t bulk_threads, size_t max_queue_depth, std::function<void(size_t)> thread_started)
+    : max_queue_depth_(max_queue_depth), thread_started_(thread_started), stopped_(false), peak_queued_(0), completed_(0), rejected_(0), total_wait_us_(0), max_wait_us_(0) {
+    if (fast_threads == 0) fast_threads = 1;
+    if (bulk_threads == 0) bulk_threads = 1;
+    for (size_t i = 0; i < fast_threads; ++i)
+        threads_.emplace_back(&FileIOPool::worker_loop, this, std::ref(fast_), threads_.size());
+    for (size_t i = 0; i < bulk_threads; ++i)
+        threads_.emplace_back(&FileIOPool::worker_loop, this, std::ref(bulk_), threads_.size());
+}
+
+FileIOPool::~FileIOPool() {
+    stop();
+}
+
+// Queue a job on the lane provided
+// Jobs are refused once the combined depth of both lanes reaches the configured maximum
+bool FileIOPool::post(Lane lane, std::function<void()> work) {
+    Queue& queue = lane == Lane::fast ? fast_ : bulk_;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t depth = fast_.jobs_.size() + bulk_.jobs_.size();
+        if (stopped_ || depth >= max_queue_depth_) {
+            ++rejected_;
+            return false;
+        }
+        queue.jobs_.push_back(Job{ std::move(work), clock_t_::now() });
+        if (depth + 1 > peak_queued_) peak_queued_ = depth + 1;
+    }
+    queue.ready_.notify_one();
+    return true;
+}
+
+// Stop accepting jobs, let the workers finish what is already queued and join them
+void FileIOPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopped_ && threads_.empty()) return;
+        stopped_ = true;
+    }
+    fast_.ready_.notify_all();
+    bulk_.ready_.notify_all();
+    for (auto& t : threads_)
+        if (t.joinable()) t.join();
+    threads_.clear();
+}
+
+FileIOPool::Stats FileIOPool::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats s;
+    s.fast_queued_ = fast_.jobs_.size();
+    s.bulk_queued_ = bulk_.jobs_.size();
+    s.peak_queued_ = peak_queued_;
+    s.completed_ = completed_;
+    s.rejected_ = rejected_;
+    s.total_wait_us_ = total_wait_us_;
+    s.max_wait_us_ = max_wait_us_;
+    return s;
+}
+
+// Pull jobs off a single lane until the pool is stopped and the lane is drained
+void FileIOPool::worker_loop(Queue& queue, size_t index) {
+    if (thread_started_) thread_started_(index);
+    for (;;) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            queue.ready_.wait(lock, [&] { return stopped_ || !queue.jobs_.empty(); });
+            if (queue.jobs_.empty()) return;
+            job = std::move(queue.jobs_.front());
+            queue.jobs_.pop_front();
+            uint64_t waited = std::chrono::duration_cast<std::chrono::microseconds>(clock_t_::now() - job.queued_at_).count();
+            total_wait_us_ += waited;
+            if (waited > max_wait_us_) max_wait_us_ = waited;
+        }
+        job.work_();
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++completed_;
+    }
+}
@@ -0,0 +1,83 @@
+/*
+
+    A bounded pool of threads for blocking file system work (opens, stats and reads)
+    so that none of it runs on the thread driving the io_service. Jobs are split
+    into two lanes: the fast lane for opens, stats and small reads, and the bulk
+    lane for reads of large files. Each lane has its own threads so a burst of cold
+    reads of big images can never hold up small files queued behind them.
+
+    Author: Jarod Graygo
+
+*/
+
+#ifndef FILE_IO_POOL_H
+#define FILE_IO_POOL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class FileIOPool {
+public:
+    enum class Lane { fast, bulk };
+
+    // Snapshot of the pool's metrics
+    struct Stats {
+        size_t fast_queued_ = 0;
+        size_t bulk_queued_ = 0;
+        size_t peak_queued_ = 0;
+        uint64_t completed_ = 0;
+        uint64_t rejected_ = 0;
+        uint64_t total_wait_us_ = 0;
+        uint64_t max_wait_us_ = 0;
+    };
+
+    // Every thread calls thread_started with its index (fast lane threads first) before it takes any work
+    FileIOPool(size_t fast_threads, size_t bulk_threads, size_t max_queue_depth, std::function<void(size_t)> thread_started = nullptr);
+    ~FileIOPool();
+
+    FileIOPool(const FileIOPool&) = delete;
+    FileIOPool& operator=(const FileIOPool&) = delete;
+
+    // Queue a job on the given lane; returns false if the pool is full or stopped
+    bool post(Lane, std::function<void()>);
+    void stop();
+    Stats stats() const;
+
+private:
+    using clock_t_ = std::chrono::steady_clock;
+
+    struct Job {
+        std::function<void()> work_;
+        clock_t_::time_point queued_at_;
+    };
+
+    struct Queue {
+        std::deque<Job> jobs_;
+        std::condition_variable ready_;
+    };
+
+    void worker_loop(Queue&, size_t);
+
+    size_t max_queue_depth_;
+    std::function<void(size_t)> thread_started_;
+    bool stopped_;
+    mutable std::mutex mutex_;
+    Queue fast_;
+    Queue bulk_;
+    std::vector<std::thread> threads_;
+
+    size_t peak_queued_;
+    uint64_t completed_;
+    uint64_t rejected_;
+    uint64_t total_wait_us_;
+    uint64_t max_wait_us_;
+};
+
+#endif // FILE_IO_POOL_H
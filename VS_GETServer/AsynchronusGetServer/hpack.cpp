@@ -0,0 +1,353 @@
+/*
+
+    Function definitions for the HPACK encoder and decoder
+
+    Author: Jarod Graygo
+
+*/
+
+#include "hpack.h"
+
+namespace {
+
+const std::pair<const char*, const char*> static_table[] = {
+    { ":authority", "" }, { ":method", "GET" }, { ":method", "POST" }, { ":path", "/" },
+    { ":path", "/index.html" }, { ":scheme", "http" }, { ":scheme", "https" }, { ":status", "200" },
+    { ":status", "204" }, { ":status", "206" }, { ":status", "304" }, { ":status", "400" },
+    { ":status", "404" }, { ":status", "500" }, { "accept-charset", "" }, { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" }, { "accept-ranges", "" }, { "accept", "" }, { "access-control-allow-origin", "" },
+    { "age", "" }, { "allow", "" }, { "authorization", "" }, { "cache-control", "" },
+    { "content-disposition", "" }, { "content-encoding", "" }, { "content-language", "" }, { "content-length", "" },
+    { "content-location", "" }, { "content-range", "" }, { "content-type", "" }, { "cookie", "" },
+    { "date", "" }, { "etag", "" }, { "expect", "" }, { "expires", "" },
+    { "from", "" }, { "host", "" }, { "if-match", "" }, { "if-modified-since", "" },
+    { "if-none-match", "" }, { "if-range", "" }, { "if-unmodified-since", "" }, { "last-modified", "" },
+    { "link", "" }, { "location", "" }, { "max-forwards", "" }, { "proxy-authenticate", "" },
+    { "proxy-authorization", "" }, { "range", "" }, { "referer", "" }, { "refresh", "" },
+    { "retry-after", "" }, { "server", "" }, { "set-cookie", "" }, { "strict-transport-security", "" },
+    { "transfer-encoding", "" }, { "user-agent", "" }, { "vary", "" }, { "via", "" },
+    { "www-authenticate", "" }
+};
+const size_t static_table_size = sizeof(static_table) / sizeof(static_table[0]);
+
+// Huffman code and bit length for every octet, plus EOS (RFC 7541 appendix B)
+const struct { uint32_t code_; uint8_t bits_; } huffman_codes[257] = {
+    { 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 },
+    { 0xfffffe4, 28 }, { 0xfffffe5, 28 }, { 0xfffffe6, 28 }, { 0xfffffe7, 28 },
+    { 0xfffffe8, 28 }, { 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 },
+    { 0xfffffea, 28 }, { 0x3ffffffd, 30 }, { 0xfffffeb, 28 }, { 0xfffffec, 28 },
+    { 0xfffffed, 28 }, { 0xfffffee, 28 }, { 0xfffffef, 28 }, { 0xffffff0, 28 },
+    { 0xffffff1, 28 }, { 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+    { 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 },
+    { 0xffffff8, 28 }, { 0xffffff9, 28 }, { 0xffffffa, 28 }, { 0xffffffb, 28 },
+    { 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 },
+    { 0x1ff9, 13 }, { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 },
+    { 0x3fa, 10 }, { 0x3fb, 10 }, { 0xf9, 8 }, { 0x7fb, 11 },
+    { 0xfa, 8 }, { 0x16, 6 }, { 0x17, 6 }, { 0x18, 6 },
+    { 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 },
+    { 0x1a, 6 }, { 0x1b, 6 }, { 0x1c, 6 }, { 0x1d, 6 },
+    { 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 }, { 0xfb, 8 },
+    { 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 },
+    { 0x1ffa, 13 }, { 0x21, 6 }, { 0x5d, 7 }, { 0x5e, 7 },
+    { 0x5f, 7 }, { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 },
+    { 0x63, 7 }, { 0x64, 7 }, { 0x65, 7 }, { 0x66, 7 },
+    { 0x67, 7 }, { 0x68, 7 }, { 0x69, 7 }, { 0x6a, 7 },
+    { 0x6b, 7 }, { 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 },
+    { 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 }, { 0x72, 7 },
+    { 0xfc, 8 }, { 0x73, 7 }, { 0xfd, 8 }, { 0x1ffb, 13 },
+    { 0x7fff0, 19 }, { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 },
+    { 0x7ffd, 15 }, { 0x3, 5 }, { 0x23, 6 }, { 0x4, 5 },
+    { 0x24, 6 }, { 0x5, 5 }, { 0x25, 6 }, { 0x26, 6 },
+    { 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 },
+    { 0x28, 6 }, { 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 },
+    { 0x2b, 6 }, { 0x76, 7 }, { 0x2c, 6 }, { 0x8, 5 },
+    { 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 },
+    { 0x79, 7 }, { 0x7a, 7 }, { 0x7b, 7 }, { 0x7ffe, 15 },
+    { 0x7fc, 11 }, { 0x3ffd, 14 }, { 0x1ffd, 13 }, { 0xffffffc, 28 },
+    { 0xfffe6, 20 }, { 0x3fffd2, 22 }, { 0xfffe7, 20 }, { 0xfffe8, 20 },
+    { 0x3fffd3, 22 }, { 0x3fffd4, 22 }, { 0x3fffd5, 22 }, { 0x7fffd9, 23 },
+    { 0x3fffd6, 22 }, { 0x7fffda, 23 }, { 0x7fffdb, 23 }, { 0x7fffdc, 23 },
+    { 0x7fffdd, 23 }, { 0x7fffde, 23 }, { 0xffffeb, 24 }, { 0x7fffdf, 23 },
+    { 0xffffec, 24 }, { 0xffffed, 24 }, { 0x3fffd7, 22 }, { 0x7fffe0, 23 },
+    { 0xffffee, 24 }, { 0x7fffe1, 23 }, { 0x7fffe2, 23 }, { 0x7fffe3, 23 },
+    { 0x7fffe4, 23 }, { 0x1fffdc, 21 }, { 0x3fffd8, 22 }, { 0x7fffe5, 23 },
+    { 0x3fffd9, 22 }, { 0x7fffe6, 23 }, { 0x7fffe7, 23 }, { 0xffffef, 24 },
+    { 0x3fffda, 22 }, { 0x1fffdd, 21 }, { 0xfffe9, 20 }, { 0x3fffdb, 22 },
+    { 0x3fffdc, 22 }, { 0x7fffe8, 23 }, { 0x7fffe9, 23 }, { 0x1fffde, 21 },
+    { 0x7fffea, 23 }, { 0x3fffdd, 22 }, { 0x3fffde, 22 }, { 0xfffff0, 24 },
+    { 0x1fffdf, 21 }, { 0x3fffdf, 22 }, { 0x7fffeb, 23 }, { 0x7fffec, 23 },
+    { 0x1fffe0, 21 }, { 0x1fffe1, 21 }, { 0x3fffe0, 22 }, { 0x1fffe2, 21 },
+    { 0x7fffed, 23 }, { 0x3fffe1, 22 }, { 0x7fffee, 23 }, { 0x7fffef, 23 },
+    { 0xfffea, 20 }, { 0x3fffe2, 22 }, { 0x3fffe3, 22 }, { 0x3fffe4, 22 },
+    { 0x7ffff0, 23 }, { 0x3fffe5, 22 }, { 0x3fffe6, 22 }, { 0x7ffff1, 23 },
+    { 0x3ffffe0, 26 }, { 0x3ffffe1, 26 }, { 0xfffeb, 20 }, { 0x7fff1, 19 },
+    { 0x3fffe7, 22 }, { 0x7ffff2, 23 }, { 0x3fffe8, 22 }, { 0x1ffffec, 25 },
+    { 0x3ffffe2, 26 }, { 0x3ffffe3, 26 }, { 0x3ffffe4, 26 }, { 0x7ffffde, 27 },
+    { 0x7ffffdf, 27 }, { 0x3ffffe5, 26 }, { 0xfffff1, 24 }, { 0x1ffffed, 25 },
+    { 0x7fff2, 19 }, { 0x1fffe3, 21 }, { 0x3ffffe6, 26 }, { 0x7ffffe0, 27 },
+    { 0x7ffffe1, 27 }, { 0x3ffffe7, 26 }, { 0x7ffffe2, 27 }, { 0xfffff2, 24 },
+    { 0x1fffe4, 21 }, { 0x1fffe5, 21 }, { 0x3ffffe8, 26 }, { 0x3ffffe9, 26 },
+    { 0xffffffd, 28 }, { 0x7ffffe3, 27 }, { 0x7ffffe4, 27 }, { 0x7ffffe5, 27 },
+    { 0xfffec, 20 }, { 0xfffff3, 24 }, { 0xfffed, 20 }, { 0x1fffe6, 21 },
+    { 0x3fffe9, 22 }, { 0x1fffe7, 21 }, { 0x1fffe8, 21 }, { 0x7ffff3, 23 },
+    { 0x3fffea, 22 }, { 0x3fffeb, 22 }, { 0x1ffffee, 25 }, { 0x1ffffef, 25 },
+    { 0xfffff4, 24 }, { 0xfffff5, 24 }, { 0x3ffffea, 26 }, { 0x7ffff4, 23 },
+    { 0x3ffffeb, 26 }, { 0x7ffffe6, 27 }, { 0x3ffffec, 26 }, { 0x3ffffed, 26 },
+    { 0x7ffffe7, 27 }, { 0x7ffffe8, 27 }, { 0x7ffffe9, 27 }, { 0x7ffffea, 27 },
+    { 0x7ffffeb, 27 }, { 0xffffffe, 28 }, { 0x7ffffec, 27 }, { 0x7ffffed, 27 },
+    { 0x7ffffee, 27 }, { 0x7ffffef, 27 }, { 0x7fffff0, 27 }, { 0x3ffffee, 26 },
+    { 0x3fffffff, 30 },
+};
+
+// Binary decode tree built from the code table on first use
+// Each node holds two children; values >= 0 name the leaf symbol, the root is node 0
+struct HuffmanTree {
+    struct Node { int child_[2]; int symbol_; };
+    std::vector<Node> nodes_;
+
+    HuffmanTree() {
+        nodes_.push_back(Node{ { -1, -1 }, -1 });
+        for (int sym = 0; sym < 257; ++sym) {
+            int node = 0;
+            for (int bit = huffman_codes[sym].bits_ - 1; bit >= 0; --bit) {
+                int b = (huffman_codes[sym].code_ >> bit) & 1;
+                if (nodes_[node].child_[b] < 0) {
+                    nodes_[node].child_[b] = (int)nodes_.size();
+                    nodes_.push_back(Node{ { -1, -1 }, -1 });
+                }
+                node = nodes_[node].child_[b];
+            }
+            nodes_[node].symbol_ = sym;
+        }
+    }
+};
+
+const HuffmanTree& huffman_tree() {
+    static const HuffmanTree tree;
+    return tree;
+}
+
+bool decode_integer(const uint8_t*& pos, const uint8_t* end, uint8_t prefix_bits, uint64_t& value) {
+    if (pos >= end) return false;
+    uint8_t mask = static_cast<uint8_t>((1 << prefix_bits) - 1);
+    value = *pos++ & mask;
+    if (value < mask) return true;
+    unsigned shift = 0;
+    while (pos < end) {
+        uint8_t byte = *pos++;
+        if (shift > 56) return false;
+        value += static_cast<uint64_t>(byte & 0x7f) << shift;
+        shift += 7;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+bool decode_string(const uint8_t*& pos, const uint8_t* end, std::string& out) {
+    if (pos >= end) return false;
+    bool huffman = (*pos & 0x80) != 0;
+    uint64_t len;
+    if (!decode_integer(pos, end, 7, len) || len > static_cast<uint64_t>(end - pos)) return false;
+    out.clear();
+    bool ok = huffman ? hpack_huffman_decode(pos, (size_t)len, out) : (out.assign(reinterpret_cast<const char*>(pos), (size_t)len), true);
+    pos += len;
+    return ok;
+}
+
+void encode_string(const std::string& str, std::string& out) {
+    hpack_encode_integer(str.size(), 7, 0x00, out);
+    out.append(str);
+}
+
+}
+
+//////////////////////// HPACK TABLE ////////////////////////
+
+void HpackTable::add(const std::string& name, const std::string& value) {
+    size_t entry_size = name.size() + value.size() + 32;
+    if (entry_size > max_size_) {
+        // An entry larger than the table empties it
+        entries_.clear();
+        size_ = 0;
+        return;
+    }
+    entries_.emplace_front(name, value);
+    size_ += entry_size;
+    evict();
+}
+
+void HpackTable::set_max_size(size_t max_size) {
+    max_size_ = max_size;
+    evict();
+}
+
+void HpackTable::evict() {
+    while (size_ > max_size_ && !entries_.empty()) {
+        size_ -= entries_.back().first.size() + entries_.back().second.size() + 32;
+        entries_.pop_back();
+    }
+}
+
+bool HpackTable::get(size_t index, std::pair<std::string, std::string>& entry) const {
+    if (index == 0) return false;
+    if (index <= static_table_size) {
+        entry.first = static_table[index - 1].first;
+        entry.second = static_table[index - 1].second;
+        return true;
+    }
+    index -= static_table_size + 1;
+    if (index >= entries_.size()) return false;
+    entry = entries_[index];
+    return true;
+}
+
+size_t HpackTable::find(const std::string& name, const std::string& value, size_t& name_index) const {
+    name_index = 0;
+    for (size_t i = 0; i < static_table_size; ++i) {
+        if (name != static_table[i].first) continue;
+        if (value == static_table[i].second) return i + 1;
+        if (!name_index) name_index = i + 1;
+    }
+    for (size_t i = 0; i < entries_.size(); ++i) {
+        if (name != entries_[i].first) continue;
+        if (value == entries_[i].second) return static_table_size + i + 1;
+        if (!name_index) name_index = static_table_size + i + 1;
+    }
+    return 0;
+}
+
+//////////////////////// HPACK DECODER ////////////////////////
+
+bool HpackDecoder::decode(const uint8_t* data, size_t len, header_list_t& headers, size_t max_list_size, bool* oversized) {
+    const uint8_t* pos = data;
+    const uint8_t* end = data + len;
+    bool fields_seen = false;
+    size_t list_size = 0;
+    auto store = [&](const std::pair<std::string, std::string>& entry) {
+        list_size += entry.first.size() + entry.second.size() + 32;
+        if (list_size <= max_list_size) {
+            headers.push_back(entry);
+            return;
+        }
+        if (oversized) *oversized = true;
+        headers.clear();
+    };
+
+    while (pos < end) {
+        uint8_t byte = *pos;
+        std::pair<std::string, std::string> entry;
+        uint64_t index;
+
+        // Indexed header field
+        if (byte & 0x80) {
+            if (!decode_integer(pos, end, 7, index) || !table_.get((size_t)index, entry)) return false;
+            store(entry);
+            fields_seen = true;
+            continue;
+        }
+
+        // Dynamic table size update, only allowed before the first field of a block
+        if ((byte & 0xe0) == 0x20) {
+            if (fields_seen || !decode_integer(pos, end, 5, index) || index > max_allowed_size_) return false;
+            table_.set_max_size((size_t)index);
+            continue;
+        }
+
+        // Literal header field, with incremental indexing (6 bit prefix) or without/never indexed (4 bit prefix)
+        bool incremental = (byte & 0xc0) == 0x40;
+        if (!decode_integer(pos, end, incremental ? 6 : 4, index)) return false;
+        if (index) {
+            if (!table_.get((size_t)index, entry)) return false;
+        }
+        else if (!decode_string(pos, end, entry.first)) {
+            return false;
+        }
+        if (!decode_string(pos, end, entry.second)) return false;
+        if (incremental) table_.add(entry.first, entry.second);
+        store(entry);
+        fields_seen = true;
+    }
+    return true;
+}
+
+//////////////////////// HPACK ENCODER ////////////////////////
+
+void HpackEncoder::set_max_table_size(size_t max_size) {
+    if (max_size == table_.max_size()) return;
+    table_.set_max_size(max_size);
+    pending_size_update_ = true;
+}
+
+// Headers whose values recur across responses to the same client are worth a dynamic table slot
+bool HpackEncoder::should_index(const std::string& name) {
+    return name == "content-type" || name == "server" || name == "cache-control" || name == "accept-ranges"
+        || name == "vary" || name == "content-encoding" || name == "link";
+}
+
+void HpackEncoder::encode(const header_list_t& headers, std::string& out) {
+    if (pending_size_update_) {
+        hpack_encode_integer(table_.max_size(), 5, 0x20, out);
+        pending_size_update_ = false;
+    }
+
+    for (const auto& header : headers) {
+        size_t name_index;
+        size_t index = table_.find(header.first, header.second, name_index);
+        if (index) {
+            hpack_encode_integer(index, 7, 0x80, out);
+            continue;
+        }
+
+        bool indexed = should_index(header.first);
+        if (indexed)
+            hpack_encode_integer(name_index, 6, 0x40, out);
+        else
+            hpack_encode_integer(name_index, 4, 0x00, out);
+        if (!name_index) encode_string(header.first, out);
+        encode_string(header.second, out);
+        if (indexed) table_.add(header.first, header.second);
+    }
+}
+
+//////////////////////// FREE FUNCTIONS ////////////////////////
+
+void hpack_encode_integer(uint64_t value, uint8_t prefix_bits, uint8_t first_byte, std::string& out) {
+    uint64_t max_prefix = (1u << prefix_bits) - 1;
+    if (value < max_prefix) {
+        out.push_back(static_cast<char>(first_byte | value));
+        return;
+    }
+    out.push_back(static_cast<char>(first_byte | max_prefix));
+    value -= max_prefix;
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+// Walk the decode tree bit by bit. Padding must be at most seven 1 bits (a prefix of EOS)
+bool hpack_huffman_decode(const uint8_t* data, size_t len, std::string& out) {
+    const HuffmanTree& tree = huffman_tree();
+    int node = 0;
+    int depth = 0;
+    bool all_ones = true;
+    for (size_t i = 0; i < len; ++i) {
+        for (int bit = 7; bit >= 0; --bit) {
+            int b = (data[i] >> bit) & 1;
+            node = tree.nodes_[node].child_[b];
+            if (node < 0) return false;
+            ++depth;
+            all_ones = all_ones && b == 1;
+            int symbol = tree.nodes_[node].symbol_;
+            if (symbol >= 0) {
+                if (symbol == 256) return false;
+                out.push_back(static_cast<char>(symbol));
+                node = 0;
+                depth = 0;
+                all_ones = true;
+            }
+        }
+    }
+    return depth < 8 && all_ones;
+}
@@ -0,0 +1,83 @@
+/*
+
+    HPACK header compression (RFC 7541) for the HTTP/2 support.
+
+    The decoder understands every representation a client may send, including Huffman
+    coded strings and dynamic table size updates. The encoder never Huffman codes and
+    is tuned for static assets: headers that repeat from response to response
+    (content type, cache control, server) are added to the dynamic table so later
+    responses refer to them with a single byte, while headers that change on every
+    response (date, length, etag) are sent as literals that do not evict them.
+
+    Author: Jarod Graygo
+
+*/
+
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+using header_list_t = std::vector<std::pair<std::string, std::string>>;
+
+// Dynamic table shared by the encoder and decoder; entries are held newest first
+class HpackTable {
+public:
+    explicit HpackTable(size_t max_size = 4096) : max_size_(max_size), size_(0) { }
+
+    void add(const std::string& name, const std::string& value);
+    void set_max_size(size_t);
+    size_t max_size() const { return max_size_; }
+
+    // Look up a combined static/dynamic index, returns false if the index is out of range
+    bool get(size_t index, std::pair<std::string, std::string>& entry) const;
+
+    // Search both tables; returns the index of an exact match, or a name only match through name_index (0 if none)
+    size_t find(const std::string& name, const std::string& value, size_t& name_index) const;
+
+private:
+    void evict();
+
+    std::deque<std::pair<std::string, std::string>> entries_;
+    size_t max_size_;
+    size_t size_;
+};
+
+class HpackDecoder {
+public:
+    explicit HpackDecoder(size_t max_table_size = 4096) : table_(max_table_size), max_allowed_size_(max_table_size) { }
+
+    // Decode a complete header block, returns false on a compression error
+    // Once the fields add up to more than max_list_size (name, value and 32 bytes each, as SETTINGS_MAX_HEADER_LIST_SIZE
+    // counts them) the rest are still decoded to keep the table in sync but not stored, and oversized is set
+    bool decode(const uint8_t* data, size_t len, header_list_t& headers, size_t max_list_size = SIZE_MAX, bool* oversized = nullptr);
+
+private:
+    HpackTable table_;
+    size_t max_allowed_size_;
+};
+
+class HpackEncoder {
+public:
+    HpackEncoder() : table_(4096), pending_size_update_(false) { }
+
+    // Apply the peer's SETTINGS_HEADER_TABLE_SIZE; the change is signalled at the start of the next block
+    void set_max_table_size(size_t);
+    void encode(const header_list_t& headers, std::string& out);
+
+private:
+    static bool should_index(const std::string& name);
+
+    HpackTable table_;
+    bool pending_size_update_;
+};
+
+// Primitive encodings, exposed for the HTTP/2 benchmark client
+void hpack_encode_integer(uint64_t value, uint8_t prefix_bits, uint8_t first_byte, std::string& out);
+bool hpack_huffman_decode(const uint8_t* data, size_t len, std::string& out);
+
+#endif // HPACK_H
@@ -0,0 +1,543 @@
+/*
+
+    Function definitions for Http2Session class
+
+    Author: Jarod Graygo
+
+*/
+
+#include "http2_session.h"
+#include <algorithm>
+
+namespace {
+
+const size_t frame_header_size = 9;
+const size_t default_max_frame_size = 16384;
+const int64_t default_window = 65535;
+const int64_t max_window = 0x7fffffff;
+// Bytes of DATA gathered into a single write, so priorities are re-evaluated regularly
+const size_t data_budget_per_write = 64 * 1024;
+// Upper bound on idle priority nodes a client may create
+const size_t max_priority_nodes = 1000;
+
+uint32_t read_uint32(const uint8_t* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+void append_uint32(std::string& out, uint32_t value) {
+    out.push_back(static_cast<char>(value >> 24));
+    out.push_back(static_cast<char>(value >> 16));
+    out.push_back(static_cast<char>(value >> 8));
+    out.push_back(static_cast<char>(value));
+}
+
+void append_setting(std::string& out, uint16_t id, uint32_t value) {
+    out.push_back(static_cast<char>(id >> 8));
+    out.push_back(static_cast<char>(id));
+    append_uint32(out, value);
+}
+
+// Piece of an outgoing write, either a range of the frame header blob or a range of a response body
+struct Piece {
+    bool in_blob_;
+    size_t offset_;
+    const char* data_;
+    size_t len_;
+};
+
+}
+
+const std::string Http2Session::preface_ = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+Http2Session::Http2Session(uint32_t max_concurrent_streams, size_t max_header_list_size, size_t max_header_fields)
+    : preface_received_(false), settings_received_(false), goaway_sent_(false), going_away_(false), refusing_(false), refused_streams_(0), continuation_stream_(0), continuation_end_stream_(false),
+      max_header_list_size_(max_header_list_size), max_header_fields_(max_header_fields),
+      last_stream_id_(0), max_concurrent_streams_(max_concurrent_streams), virtual_time_(0),
+      connection_send_window_(default_window), peer_initial_window_(default_window), peer_max_frame_size_(default_max_frame_size) {
+
+    // The server connection preface is our SETTINGS frame
+    std::string settings;
+    append_setting(settings, 0x3, max_concurrent_streams_); // SETTINGS_MAX_CONCURRENT_STREAMS
+    append_setting(settings, 0x2, 0);                       // SETTINGS_ENABLE_PUSH
+    append_setting(settings, 0x6, (uint32_t)max_header_list_size_); // SETTINGS_MAX_HEADER_LIST_SIZE
+    write_frame_header(control_, settings.size(), SETTINGS, 0, 0);
+    control_.append(settings);
+}
+
+size_t Http2Session::held_bytes() const {
+    size_t bytes = in_.size() + control_.size() + headers_out_.size() + header_fragments_.size();
+    for (const auto& entry : streams_) {
+        if (entry.second.pin_) bytes += entry.second.body_len_;
+    }
+    return bytes;
+}
+
+std::chrono::steady_clock::time_point Http2Session::opened_at(uint32_t stream_id) const {
+    auto found = streams_.find(stream_id);
+    return found != streams_.end() ? found->second.opened_ : std::chrono::steady_clock::now();
+}
+
+bool Http2Session::receive(const char* data, size_t len, std::vector<Request>& requests) {
+    if (goaway_sent_) return false;
+    in_.append(data, len);
+    size_t pos = 0;
+
+    if (!preface_received_) {
+        size_t check = std::min(in_.size(), preface_.size());
+        if (in_.compare(0, check, preface_, 0, check) != 0) return connection_error(PROTOCOL_ERROR);
+        if (in_.size() < preface_.size()) return true;
+        pos = preface_.size();
+        preface_received_ = true;
+    }
+
+    while (in_.size() - pos >= frame_header_size) {
+        const uint8_t* header = reinterpret_cast<const uint8_t*>(in_.data() + pos);
+        size_t frame_len = (size_t(header[0]) << 16) | (size_t(header[1]) << 8) | size_t(header[2]);
+        uint8_t type = header[3];
+        uint8_t flags = header[4];
+        uint32_t stream_id = read_uint32(header + 5) & 0x7fffffff;
+
+        if (frame_len > default_max_frame_size) return connection_error(FRAME_SIZE_ERROR);
+        if (in_.size() - pos < frame_header_size + frame_len) break;
+
+        // The first frame from the client must be its SETTINGS
+        if (!settings_received_ && (type != SETTINGS || (flags & 0x1))) return connection_error(PROTOCOL_ERROR);
+        // Nothing may interrupt a header block
+        if (continuation_stream_ && (type != CONTINUATION || stream_id != continuation_stream_)) return connection_error(PROTOCOL_ERROR);
+
+        if (!process_frame(type, flags, stream_id, header + frame_header_size, frame_len, requests)) return false;
+        pos += frame_header_size + frame_len;
+    }
+    in_.erase(0, pos);
+    return true;
+}
+
+bool Http2Session::process_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const uint8_t* payload, size_t len, std::vector<Request>& requests) {
+    switch (type) {
+    case DATA: {
+        if (stream_id == 0) return connection_error(PROTOCOL_ERROR);
+        // Request bodies are not used, but the flow control credit is handed straight back
+        if (len > 0) queue_window_update(0, (uint32_t)len);
+        auto it = streams_.find(stream_id);
+        if (it == streams_.end() || it->second.remote_closed_) {
+            if (stream_id > last_stream_id_) return connection_error(PROTOCOL_ERROR);
+            queue_rst_stream(stream_id, STREAM_CLOSED);
+            return true;
+        }
+        if (flags & 0x1) it->second.remote_closed_ = true;
+        else if (len > 0) queue_window_update(stream_id, (uint32_t)len);
+        return true;
+    }
+    case HEADERS:
+        return process_headers(flags, stream_id, payload, len, requests);
+    case PRIORITY: {
+        if (stream_id == 0) return connection_error(PROTOCOL_ERROR);
+        if (len != 5) {
+            queue_rst_stream(stream_id, FRAME_SIZE_ERROR);
+            return true;
+        }
+        uint32_t dependency = read_uint32(payload);
+        set_priority(stream_id, dependency & 0x7fffffff, uint16_t(payload[4]) + 1, (dependency & 0x80000000) != 0);
+        return true;
+    }
+    case RST_STREAM:
+        if (stream_id == 0 || stream_id > last_stream_id_) return connection_error(PROTOCOL_ERROR);
+        if (len != 4) return connection_error(FRAME_SIZE_ERROR);
+        close_stream(stream_id);
+        return true;
+    case SETTINGS:
+        if (stream_id != 0) return connection_error(PROTOCOL_ERROR);
+        return process_settings(flags, payload, len);
+    case PUSH_PROMISE:
+        return connection_error(PROTOCOL_ERROR);
+    case PING:
+        if (stream_id != 0) return connection_error(PROTOCOL_ERROR);
+        if (len != 8) return connection_error(FRAME_SIZE_ERROR);
+        if (!(flags & 0x1)) {
+            write_frame_header(control_, 8, PING, 0x1, 0);
+            control_.append(reinterpret_cast<const char*>(payload), 8);
+        }
+        return true;
+    case GOAWAY:
+        if (stream_id != 0) return connection_error(PROTOCOL_ERROR);
+        return true;
+    case WINDOW_UPDATE:
+        return process_window_update(stream_id, payload, len);
+    case CONTINUATION: {
+        if (!continuation_stream_) return connection_error(PROTOCOL_ERROR);
+        if (header_fragments_.size() + len > max_header_list_size_) return connection_error(ENHANCE_YOUR_CALM);
+        header_fragments_.append(reinterpret_cast<const char*>(payload), len);
+        if (!(flags & 0x4)) return true;
+        return finish_header_block(requests);
+    }
+    default:
+        // Unknown frame types are ignored
+        return true;
+    }
+}
+
+bool Http2Session::process_headers(uint8_t flags, uint32_t stream_id, const uint8_t* payload, size_t len, std::vector<Request>& requests) {
+    if (stream_id == 0 || (stream_id & 1) == 0) return connection_error(PROTOCOL_ERROR);
+
+    size_t pad = 0;
+    if (flags & 0x8) {
+        if (len < 1) return connection_error(PROTOCOL_ERROR);
+        pad = payload[0];
+        ++payload;
+        --len;
+    }
+    if (flags & 0x20) {
+        if (len < 5) return connection_error(PROTOCOL_ERROR);
+        uint32_t dependency = read_uint32(payload);
+        set_priority(stream_id, dependency & 0x7fffffff, uint16_t(payload[4]) + 1, (dependency & 0x80000000) != 0);
+        payload += 5;
+        len -= 5;
+    }
+    if (pad > len) return connection_error(PROTOCOL_ERROR);
+    len -= pad;
+    if (len > max_header_list_size_) return connection_error(ENHANCE_YOUR_CALM);
+
+    continuation_stream_ = stream_id;
+    continuation_end_stream_ = (flags & 0x1) != 0;
+    header_fragments_.assign(reinterpret_cast<const char*>(payload), len);
+    if (!(flags & 0x4)) return true;
+    return finish_header_block(requests);
+}
+
+// A header block is complete. It is always decoded, even for streams that are refused, to keep the HPACK state in sync
+bool Http2Session::finish_header_block(std::vector<Request>& requests) {
+    uint32_t stream_id = continuation_stream_;
+    bool end_stream = continuation_end_stream_;
+    continuation_stream_ = 0;
+
+    header_list_t headers;
+    bool oversized = false;
+    if (!decoder_.decode(reinterpret_cast<const uint8_t*>(header_fragments_.data()), header_fragments_.size(), headers, max_header_list_size_, &oversized))
+        return connection_error(COMPRESSION_ERROR);
+    header_fragments_.clear();
+    if (headers.size() > max_header_fields_) {
+        oversized = true;
+        headers.clear();
+    }
+
+    // Trailers on a stream that is already open
+    auto existing = streams_.find(stream_id);
+    if (existing != streams_.end()) {
+        if (existing->second.remote_closed_ || !end_stream) {
+            queue_rst_stream(stream_id, existing->second.remote_closed_ ? STREAM_CLOSED : PROTOCOL_ERROR);
+            close_stream(stream_id);
+            return true;
+        }
+        existing->second.remote_closed_ = true;
+        return true;
+    }
+    if (stream_id <= last_stream_id_) return connection_error(PROTOCOL_ERROR);
+    last_stream_id_ = stream_id;
+
+    if (going_away_ || refusing_ || streams_.size() >= max_concurrent_streams_) {
+        if (refusing_) ++refused_streams_;
+        queue_rst_stream(stream_id, REFUSED_STREAM);
+        return true;
+    }
+
+    Request request;
+    request.stream_id_ = stream_id;
+    request.oversized_ = oversized;
+    for (const auto& header : headers) {
+        if (header.first == ":method") request.method_ = header.second;
+        else if (header.first == ":path") request.path_ = header.second;
+        else if (header.first == ":authority") request.authority_ = header.second;
+        else if (header.first[0] != ':') request.headers_.push_back(header);
+    }
+    if (!oversized && (request.method_.empty() || request.path_.empty())) {
+        queue_rst_stream(stream_id, PROTOCOL_ERROR);
+        return true;
+    }
+
+    Stream& stream = streams_[stream_id];
+    stream.send_window_ = peer_initial_window_;
+    stream.remote_closed_ = end_stream;
+    stream.opened_ = std::chrono::steady_clock::now();
+    if (!priority_.count(stream_id)) priority_[stream_id] = PriorityNode();
+    requests.push_back(std::move(request));
+    return true;
+}
+
+bool Http2Session::process_settings(uint8_t flags, const uint8_t* payload, size_t len) {
+    if (flags & 0x1) {
+        if (len != 0) return connection_error(FRAME_SIZE_ERROR);
+        return true;
+    }
+    if (len % 6 != 0) return connection_error(FRAME_SIZE_ERROR);
+
+    for (size_t i = 0; i < len; i += 6) {
+        uint16_t id = uint16_t((payload[i] << 8) | payload[i + 1]);
+        uint32_t value = read_uint32(payload + i + 2);
+        switch (id) {
+        case 0x1: // SETTINGS_HEADER_TABLE_SIZE, our encoder never uses more than the default
+            encoder_.set_max_table_size(std::min<uint32_t>(value, 4096));
+            break;
+        case 0x2: // SETTINGS_ENABLE_PUSH
+            if (value > 1) return connection_error(PROTOCOL_ERROR);
+            break;
+        case 0x4: { // SETTINGS_INITIAL_WINDOW_SIZE applies retroactively to every open stream
+            if (value > max_window) return connection_error(FLOW_CONTROL_ERROR);
+            int64_t delta = int64_t(value) - peer_initial_window_;
+            peer_initial_window_ = value;
+            for (auto& entry : streams_) {
+                entry.second.send_window_ += delta;
+                if (entry.second.send_window_ > max_window) return connection_error(FLOW_CONTROL_ERROR);
+            }
+            break;
+        }
+        case 0x5: // SETTINGS_MAX_FRAME_SIZE
+            if (value < default_max_frame_size || value > 0xffffff) return connection_error(PROTOCOL_ERROR);
+            peer_max_frame_size_ = value;
+            break;
+        default:
+            break;
+        }
+    }
+    settings_received_ = true;
+    write_frame_header(control_, 0, SETTINGS, 0x1, 0);
+    return true;
+}
+
+bool Http2Session::process_window_update(uint32_t stream_id, const uint8_t* payload, size_t len) {
+    if (len != 4) return connection_error(FRAME_SIZE_ERROR);
+    uint32_t increment = read_uint32(payload) & 0x7fffffff;
+
+    if (stream_id == 0) {
+        if (increment == 0) return connection_error(PROTOCOL_ERROR);
+        connection_send_window_ += increment;
+        if (connection_send_window_ > max_window) return connection_error(FLOW_CONTROL_ERROR);
+        return true;
+    }
+
+    auto it = streams_.find(stream_id);
+    if (it == streams_.end()) return true;
+    if (increment == 0) {
+        queue_rst_stream(stream_id, PROTOCOL_ERROR);
+        close_stream(stream_id);
+        return true;
+    }
+    it->second.send_window_ += increment;
+    if (it->second.send_window_ > max_window) {
+        queue_rst_stream(stream_id, FLOW_CONTROL_ERROR);
+        close_stream(stream_id);
+    }
+    return true;
+}
+
+// Reprioritise a stream as described in RFC 7540 section 5.3.3
+void Http2Session::set_priority(uint32_t stream_id, uint32_t parent, uint16_t weight, bool exclusive) {
+    if (parent == stream_id) {
+        queue_rst_stream(stream_id, PROTOCOL_ERROR);
+        close_stream(stream_id);
+        return;
+    }
+    if (!priority_.count(stream_id) && priority_.size() >= max_priority_nodes) return;
+    if (parent != 0 && !priority_.count(parent)) parent = 0;
+
+    PriorityNode& node = priority_[stream_id];
+
+    // A stream made dependent on one of its own descendants first moves that descendant up to take its place
+    if (parent != 0 && is_descendant(parent, stream_id))
+        priority_[parent].parent_ = node.parent_;
+
+    if (exclusive) {
+        for (auto& entry : priority_)
+            if (entry.second.parent_ == parent && entry.first != stream_id)
+                entry.second.parent_ = stream_id;
+    }
+    node.parent_ = parent;
+    node.weight_ = weight;
+}
+
+bool Http2Session::is_descendant(uint32_t stream_id, uint32_t ancestor) const {
+    size_t hops = 0;
+    auto it = priority_.find(stream_id);
+    while (it != priority_.end() && it->second.parent_ != 0 && hops++ < priority_.size()) {
+        if (it->second.parent_ == ancestor) return true;
+        it = priority_.find(it->second.parent_);
+    }
+    return false;
+}
+
+// A stream waits while any stream it depends on still has DATA it is able to send
+bool Http2Session::blocked_by_ancestor(uint32_t stream_id) const {
+    size_t hops = 0;
+    auto it = priority_.find(stream_id);
+    while (it != priority_.end() && it->second.parent_ != 0 && hops++ < priority_.size()) {
+        auto ancestor = streams_.find(it->second.parent_);
+        if (ancestor != streams_.end() && can_send_data(ancestor->second)) return true;
+        it = priority_.find(it->second.parent_);
+    }
+    return false;
+}
+
+bool Http2Session::can_send_data(const Stream& stream) const {
+    return stream.response_ready_ && stream.body_sent_ < stream.body_len_ && stream.send_window_ > 0;
+}
+
+// Forget a stream; its dependents move up to its parent
+void Http2Session::close_stream(uint32_t stream_id) {
+    streams_.erase(stream_id);
+    auto node = priority_.find(stream_id);
+    if (node == priority_.end()) return;
+    uint32_t parent = node->second.parent_;
+    for (auto& entry : priority_)
+        if (entry.second.parent_ == stream_id) entry.second.parent_ = parent;
+    priority_.erase(node);
+}
+
+void Http2Session::submit_response(uint32_t stream_id, int status, const header_list_t& headers, const char* body, size_t len, std::shared_ptr<const void> pin) {
+    auto it = streams_.find(stream_id);
+    if (it == streams_.end() || goaway_sent_) return; // Reset by the client while the file was being read
+
+    header_list_t block;
+    block.emplace_back(":status", std::to_string(status));
+    block.insert(block.end(), headers.begin(), headers.end());
+    // A 304 describes the body the client already has, so it carries no length of its own
+    if (status != 304)
+        block.emplace_back("content-length", std::to_string(len));
+    bool end_stream = len == 0;
+    queue_header_block(stream_id, block, end_stream);
+
+    if (end_stream) {
+        close_stream(stream_id);
+        return;
+    }
+    Stream& stream = it->second;
+    stream.response_ready_ = true;
+    stream.body_ = body;
+    stream.body_len_ = len;
+    stream.pin_ = std::move(pin);
+    stream.virtual_finish_ = virtual_time_;
+}
+
+void Http2Session::submit_informational(uint32_t stream_id, int status, const header_list_t& headers) {
+    auto it = streams_.find(stream_id);
+    if (it == streams_.end() || it->second.response_ready_ || goaway_sent_) return;
+
+    header_list_t block;
+    block.emplace_back(":status", std::to_string(status));
+    block.insert(block.end(), headers.begin(), headers.end());
+    queue_header_block(stream_id, block, false);
+}
+
+// Encode a header block and frame it, split into CONTINUATION frames if needed
+// The blocks must reach the client in the order they were encoded, so they all go through headers_out_
+void Http2Session::queue_header_block(uint32_t stream_id, const header_list_t& block, bool end_stream) {
+    std::string header_block;
+    encoder_.encode(block, header_block);
+    size_t offset = 0;
+    do {
+        size_t chunk = std::min(peer_max_frame_size_, header_block.size() - offset);
+        bool last = offset + chunk == header_block.size();
+        uint8_t flags = (last ? 0x4 : 0) | (offset == 0 && end_stream ? 0x1 : 0);
+        write_frame_header(headers_out_, chunk, offset == 0 ? HEADERS : CONTINUATION, flags, stream_id);
+        headers_out_.append(header_block, offset, chunk);
+        offset += chunk;
+    } while (offset < header_block.size());
+}
+
+bool Http2Session::collect_output(std::vector<boost::asio::const_buffer>& buffers, std::vector<std::shared_ptr<const void>>& pins) {
+    auto blob = std::make_shared<std::string>();
+    std::vector<Piece> pieces;
+    // Control frames first, then response HEADERS as soon as they are ready, ahead of any DATA on their streams
+    std::swap(*blob, control_);
+    blob->append(headers_out_);
+    headers_out_.clear();
+    if (!blob->empty()) pieces.push_back(Piece{ true, 0, nullptr, blob->size() });
+
+    auto add_blob = [&](size_t from) {
+        if (blob->size() > from) pieces.push_back(Piece{ true, from, nullptr, blob->size() - from });
+    };
+
+    // DATA, one frame at a time from the eligible stream with the smallest virtual finish time
+    size_t budget = data_budget_per_write;
+    while (budget > 0 && connection_send_window_ > 0) {
+        Stream* next = nullptr;
+        uint32_t next_id = 0;
+        for (auto& entry : streams_) {
+            if (!can_send_data(entry.second) || blocked_by_ancestor(entry.first)) continue;
+            if (!next || entry.second.virtual_finish_ < next->virtual_finish_) {
+                next = &entry.second;
+                next_id = entry.first;
+            }
+        }
+        if (!next) break;
+
+        size_t chunk = std::min<size_t>({ next->body_len_ - next->body_sent_, peer_max_frame_size_, budget,
+            (size_t)next->send_window_, (size_t)connection_send_window_ });
+        bool last = next->body_sent_ + chunk == next->body_len_;
+
+        size_t from = blob->size();
+        write_frame_header(*blob, chunk, DATA, last ? 0x1 : 0, next_id);
+        add_blob(from);
+        pieces.push_back(Piece{ false, 0, next->body_ + next->body_sent_, chunk });
+        pins.push_back(next->pin_);
+
+        next->body_sent_ += chunk;
+        next->send_window_ -= chunk;
+        connection_send_window_ -= chunk;
+        budget -= chunk;
+        uint16_t weight = priority_.count(next_id) ? priority_[next_id].weight_ : 16;
+        virtual_time_ = next->virtual_finish_;
+        next->virtual_finish_ += chunk * 256 / weight;
+        if (last) close_stream(next_id);
+    }
+
+    if (pieces.empty()) return false;
+    pins.push_back(blob);
+    for (const Piece& piece : pieces) {
+        if (piece.in_blob_) buffers.push_back(boost::asio::buffer(blob->data() + piece.offset_, piece.len_));
+        else buffers.push_back(boost::asio::buffer(piece.data_, piece.len_));
+    }
+    return true;
+}
+
+void Http2Session::write_frame_header(std::string& out, size_t len, uint8_t type, uint8_t flags, uint32_t stream_id) const {
+    out.push_back(static_cast<char>(len >> 16));
+    out.push_back(static_cast<char>(len >> 8));
+    out.push_back(static_cast<char>(len));
+    out.push_back(static_cast<char>(type));
+    out.push_back(static_cast<char>(flags));
+    append_uint32(out, stream_id & 0x7fffffff);
+}
+
+void Http2Session::queue_rst_stream(uint32_t stream_id, ErrorCode code) {
+    write_frame_header(control_, 4, RST_STREAM, 0, stream_id);
+    append_uint32(control_, code);
+}
+
+void Http2Session::require_http1(uint32_t stream_id) {
+    if (streams_.find(stream_id) == streams_.end() || goaway_sent_) return;
+    queue_rst_stream(stream_id, HTTP_1_1_REQUIRED);
+    close_stream(stream_id);
+}
+
+void Http2Session::queue_window_update(uint32_t stream_id, uint32_t increment) {
+    write_frame_header(control_, 4, WINDOW_UPDATE, 0, stream_id);
+    append_uint32(control_, increment);
+}
+
+void Http2Session::go_away() {
+    if (goaway_sent_ || going_away_) return;
+    write_frame_header(control_, 8, GOAWAY, 0, 0);
+    append_uint32(control_, last_stream_id_);
+    append_uint32(control_, NO_ERROR);
+    going_away_ = true;
+}
+
+// Queue a GOAWAY naming the last stream we processed; the connection is closed once it is written
+bool Http2Session::connection_error(ErrorCode code) {
+    if (!goaway_sent_) {
+        write_frame_header(control_, 8, GOAWAY, 0, 0);
+        append_uint32(control_, last_stream_id_);
+        append_uint32(control_, code);
+        goaway_sent_ = true;
+    }
+    return false;
+}
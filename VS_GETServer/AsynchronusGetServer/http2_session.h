@@ -0,0 +1,158 @@
+/*
+
+    Protocol engine for one HTTP/2 connection (RFC 7540). It knows nothing about sockets:
+    the server feeds it the bytes it reads, collects the requests it decodes, hands back
+    responses once the file lookup has finished and asks it for the next batch of frames
+    to write.
+
+    Responses are multiplexed under both connection and stream level flow control.
+    Which stream's DATA goes next is decided by the client's priority tree: a stream only
+    sends while none of its ancestors has data ready, and siblings share the connection
+    in proportion to their weights.
+
+    Author: Jarod Graygo
+
+*/
+
+#ifndef HTTP2_SESSION_H
+#define HTTP2_SESSION_H
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/asio/buffer.hpp>
+#include "hpack.h"
+
+class Http2Session {
+public:
+    // A complete request decoded from a HEADERS block
+    struct Request {
+        uint32_t stream_id_;
+        std::string method_;
+        std::string path_;
+        std::string authority_;
+        header_list_t headers_;
+        // The header block went over the size or field count limit; the fields are not kept and the request
+        // should be answered with a 431
+        bool oversized_ = false;
+    };
+
+    // Sent by a client using prior knowledge, and after it the first bytes of every HTTP/2 connection
+    static const std::string preface_;
+
+    // max_header_list_size is advertised to the client and, like max_header_fields, bounds each request's header block
+    explicit Http2Session(uint32_t max_concurrent_streams = 100, size_t max_header_list_size = 16384, size_t max_header_fields = 100);
+
+    // Process bytes read from the client, appending any requests that became complete
+    // Returns false once the connection has failed; a GOAWAY is queued and the connection should be closed after it is written
+    bool receive(const char* data, size_t len, std::vector<Request>& requests);
+
+    // Queue the response for a stream. The body is not copied; pin must keep it alive until the stream is finished
+    void submit_response(uint32_t stream_id, int status, const header_list_t& headers, const char* body, size_t len, std::shared_ptr<const void> pin);
+
+    // Queue an interim (1xx) response such as 103 Early Hints; ignored once the final response has been submitted
+    void submit_informational(uint32_t stream_id, int status, const header_list_t& headers);
+
+    // Gather the next batch of frames to write; returns false if there is nothing that can be sent right now
+    // The buffers stay valid as long as the objects added to pins are held
+    bool collect_output(std::vector<boost::asio::const_buffer>& buffers, std::vector<std::shared_ptr<const void>>& pins);
+
+    // Reset the stream with HTTP_1_1_REQUIRED, which tells the client to send the request again over HTTP/1.1
+    void require_http1(uint32_t stream_id);
+
+    // Begin a graceful shutdown: a GOAWAY tells the client no new streams will be accepted, while the open ones are still answered
+    void go_away();
+
+    // While set, new streams are reset with REFUSED_STREAM, which tells the client it may retry them; frames on open
+    // streams are processed as usual
+    void refuse_streams(bool refuse) { refusing_ = refuse; }
+    // Streams refused that way so far
+    size_t refused_streams() const { return refused_streams_; }
+    // When the stream's request arrived, or now for a stream the session doesn't know
+    std::chrono::steady_clock::time_point opened_at(uint32_t stream_id) const;
+
+    bool failed() const { return goaway_sent_; }
+    // True once a graceful shutdown has no streams left to answer
+    bool drained() const { return going_away_ && streams_.empty(); }
+    size_t open_streams() const { return streams_.size(); }
+    // Bytes the session keeps alive: response bodies of unfinished streams, frames waiting to be written and unparsed input
+    size_t held_bytes() const;
+
+private:
+    enum FrameType : uint8_t { DATA = 0x0, HEADERS = 0x1, PRIORITY = 0x2, RST_STREAM = 0x3, SETTINGS = 0x4, PUSH_PROMISE = 0x5, PING = 0x6, GOAWAY = 0x7, WINDOW_UPDATE = 0x8, CONTINUATION = 0x9 };
+    enum ErrorCode : uint32_t { NO_ERROR = 0x0, PROTOCOL_ERROR = 0x1, INTERNAL_ERROR = 0x2, FLOW_CONTROL_ERROR = 0x3, STREAM_CLOSED = 0x5, FRAME_SIZE_ERROR = 0x6, REFUSED_STREAM = 0x7, COMPRESSION_ERROR = 0x9, ENHANCE_YOUR_CALM = 0xb, HTTP_1_1_REQUIRED = 0xd };
+
+    // A node of the priority tree; idle streams named in PRIORITY frames are nodes too
+    struct PriorityNode {
+        uint32_t parent_ = 0;
+        uint16_t weight_ = 16;
+    };
+
+    struct Stream {
+        int64_t send_window_ = 0;
+        bool remote_closed_ = false;
+        bool response_ready_ = false;
+        const char* body_ = nullptr;
+        size_t body_len_ = 0;
+        size_t body_sent_ = 0;
+        std::shared_ptr<const void> pin_;
+        uint64_t virtual_finish_ = 0;
+        std::chrono::steady_clock::time_point opened_;
+    };
+
+    bool process_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const uint8_t* payload, size_t len, std::vector<Request>&);
+    bool process_headers(uint8_t flags, uint32_t stream_id, const uint8_t* payload, size_t len, std::vector<Request>&);
+    bool finish_header_block(std::vector<Request>&);
+    bool process_settings(uint8_t flags, const uint8_t* payload, size_t len);
+    bool process_window_update(uint32_t stream_id, const uint8_t* payload, size_t len);
+
+    void set_priority(uint32_t stream_id, uint32_t parent, uint16_t weight, bool exclusive);
+    bool is_descendant(uint32_t stream_id, uint32_t ancestor) const;
+    bool blocked_by_ancestor(uint32_t stream_id) const;
+    bool can_send_data(const Stream&) const;
+    void close_stream(uint32_t stream_id);
+
+    void queue_header_block(uint32_t stream_id, const header_list_t& block, bool end_stream);
+    void write_frame_header(std::string& out, size_t len, uint8_t type, uint8_t flags, uint32_t stream_id) const;
+    void queue_rst_stream(uint32_t stream_id, ErrorCode);
+    void queue_window_update(uint32_t stream_id, uint32_t increment);
+    bool connection_error(ErrorCode);
+
+    std::string in_;
+    bool preface_received_;
+    bool settings_received_;
+    std::string control_;
+    bool goaway_sent_;
+    bool going_away_;
+    bool refusing_;
+    size_t refused_streams_;
+
+    // Response HEADERS, framed in the order they were encoded since every block may change the HPACK table
+    std::string headers_out_;
+
+    HpackDecoder decoder_;
+    HpackEncoder encoder_;
+
+    // Header block being reassembled from HEADERS and CONTINUATION frames
+    // A block whose compressed form alone is over the header list limit ends the connection
+    uint32_t continuation_stream_;
+    bool continuation_end_stream_;
+    std::string header_fragments_;
+    size_t max_header_list_size_;
+    size_t max_header_fields_;
+
+    std::map<uint32_t, Stream> streams_;
+    std::map<uint32_t, PriorityNode> priority_;
+    uint32_t last_stream_id_;
+    uint32_t max_concurrent_streams_;
+    uint64_t virtual_time_;
+
+    int64_t connection_send_window_;
+    int64_t peer_initial_window_;
+    size_t peer_max_frame_size_;
+};
+
+#endif // HTTP2_SESSION_H
@@ -12,7 +12,9 @@
 #include "server.h"
 
 int main(int, char**) {
-    Server srv(80, true, false);
-    srv.run();
+    ServerOptions options;
+    // The messenger app under html/src/apps keeps its realtime traffic on this server
+    options.websocket_path_ = "/ws/";
+    run_server(80, true, false, options);
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,67 @@
+/*
+
+    Function definitions for MemoryBudget class
+
+    Author: Jarod Graygo
+
+*/
+
+#include "memory_budget.h"
+
+MemoryBudget::MemoryBudget(size_t budget_bytes) : budget_(budget_bytes), total_(0), peak_total_(0), refused_streams_(0), paused_accepts_(0), shed_(0) {
+    for (int category = 0; category < category_count; ++category) {
+        current_[category].store(0);
+        peak_[category].store(0);
+    }
+}
+
+void MemoryBudget::charge(Charge& charge, Category category, size_t bytes) {
+    adjust(category, charge.bytes_[category], bytes);
+    charge.bytes_[category] = bytes;
+}
+
+void MemoryBudget::set(Category category, size_t bytes) {
+    adjust(category, current_[category].load(std::memory_order_relaxed), bytes);
+}
+
+void MemoryBudget::adjust(Category category, size_t from, size_t to) {
+    if (from == to) return;
+    if (to > from) {
+        size_t grown = to - from;
+        raise_peak(peak_[category], current_[category].fetch_add(grown, std::memory_order_relaxed) + grown);
+        raise_peak(peak_total_, total_.fetch_add(grown, std::memory_order_relaxed) + grown);
+    }
+    else {
+        current_[category].fetch_sub(from - to, std::memory_order_relaxed);
+        total_.fetch_sub(from - to, std::memory_order_relaxed);
+    }
+}
+
+void MemoryBudget::raise_peak(std::atomic<size_t>& peak, size_t value) {
+    size_t seen = peak.load(std::memory_order_relaxed);
+    while (value > seen && !peak.compare_exchange_weak(seen, value, std::memory_order_relaxed)) { }
+}
+
+MemoryBudget::Stats MemoryBudget::stats() const {
+    Stats stats;
+    for (int category = 0; category < category_count; ++category) {
+        stats.current_[category] = current_[category].load(std::memory_order_relaxed);
+        stats.peak_[category] = peak_[category].load(std::memory_order_relaxed);
+    }
+    stats.total_ = total_.load(std::memory_order_relaxed);
+    stats.peak_total_ = peak_total_.load(std::memory_order_relaxed);
+    stats.budget_ = budget_;
+    stats.refused_streams_ = refused_streams_.load(std::memory_order_relaxed);
+    stats.paused_accepts_ = paused_accepts_.load(std::memory_order_relaxed);
+    stats.shed_ = shed_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+const char* MemoryBudget::category_name(Category category) {
+    switch (category) {
+    case read_buffers: return "read buffers";
+    case responses: return "responses";
+    case file_cache: return "file cache";
+    default: return "?";
+    }
+}
@@ -0,0 +1,86 @@
+/*
+
+    Accounting of the memory the server holds on behalf of its clients, against one
+    global budget.
+
+    Connections report what their read buffers and queued responses take, and the file
+    caches are counted as a whole. While the total is over the budget the server pushes
+    back: it trims the caches, stops accepting, refuses new streams on the HTTP/2
+    connections holding the most and refuses large file reads, resuming once usage falls
+    under nine tenths of the budget.
+    A budget of 0 only keeps the counts.
+
+    Counts are atomic so the file I/O pool threads can consult the budget.
+
+    Author: Jarod Graygo
+
+*/
+
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+class MemoryBudget {
+public:
+    enum Category { read_buffers = 0, responses, file_cache, category_count };
+
+    // What one connection holds, per category; file_cache is never charged to a connection
+    struct Charge {
+        size_t bytes_[category_count] = {};
+        size_t total() const { return bytes_[read_buffers] + bytes_[responses]; }
+    };
+
+    // Snapshot of the usage and of the pushback so far
+    struct Stats {
+        size_t current_[category_count] = {};
+        size_t peak_[category_count] = {};
+        size_t total_ = 0;
+        size_t peak_total_ = 0;
+        size_t budget_ = 0;
+        uint64_t refused_streams_ = 0;
+        uint64_t paused_accepts_ = 0;
+        uint64_t shed_ = 0;
+    };
+
+    explicit MemoryBudget(size_t budget_bytes);
+
+    MemoryBudget(const MemoryBudget&) = delete;
+    MemoryBudget& operator=(const MemoryBudget&) = delete;
+
+    // Move a connection's charge for a category to bytes
+    void charge(Charge&, Category, size_t bytes);
+    // Replace the usage of a category that isn't charged per connection
+    void set(Category, size_t bytes);
+
+    size_t total() const { return total_.load(std::memory_order_relaxed); }
+    // Over the budget, time to push back
+    bool over() const { return budget_ != 0 && total() > budget_; }
+    // Back under the low water mark, safe to resume what was held back
+    bool relieved() const { return budget_ == 0 || total() <= budget_ / 10 * 9; }
+
+    void note_refused_streams(size_t count) { refused_streams_.fetch_add(count, std::memory_order_relaxed); }
+    void note_paused_accept() { paused_accepts_.fetch_add(1, std::memory_order_relaxed); }
+    void note_shed() { shed_.fetch_add(1, std::memory_order_relaxed); }
+
+    Stats stats() const;
+
+    static const char* category_name(Category);
+
+private:
+    void adjust(Category, size_t from, size_t to);
+    static void raise_peak(std::atomic<size_t>& peak, size_t value);
+
+    size_t budget_;
+    std::atomic<size_t> current_[category_count];
+    std::atomic<size_t> peak_[category_count];
+    std::atomic<size_t> total_;
+    std::atomic<size_t> peak_total_;
+    std::atomic<uint64_t> refused_streams_;
+    std::atomic<uint64_t> paused_accepts_;
+    std::atomic<uint64_t> shed_;
+};
+
+#endif // MEMORY_BUDGET_H
@@ -0,0 +1,65 @@
+/*
+
+    Function definitions for MissingPaths class
+
+    Author: Jarod Graygo
+
+*/
+
+#include "missing_paths.h"
+
+void MissingPaths::enable(bool on) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    enabled_ = on;
+    ++generation_;
+    lru_.clear();
+    index_.clear();
+    bytes_ = 0;
+}
+
+bool MissingPaths::contains(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = index_.find(path);
+    if (found == index_.end()) return false;
+    lru_.splice(lru_.begin(), lru_, found->second);
+    ++hits_;
+    return true;
+}
+
+uint64_t MissingPaths::generation() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return generation_;
+}
+
+void MissingPaths::insert(const std::string& path, uint64_t generation) {
+    size_t size = cost(path);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!enabled_ || generation != generation_ || size > budget_ || index_.count(path)) return;
+
+    while (bytes_ + size > budget_ && !lru_.empty()) {
+        bytes_ -= cost(lru_.back());
+        index_.erase(lru_.back());
+        lru_.pop_back();
+    }
+    lru_.push_front(path);
+    index_.emplace(path, lru_.begin());
+    bytes_ += size;
+}
+
+void MissingPaths::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++generation_;
+    lru_.clear();
+    index_.clear();
+    bytes_ = 0;
+}
+
+MissingPaths::Stats MissingPaths::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats stats;
+    stats.entries_ = lru_.size();
+    stats.bytes_ = bytes_;
+    stats.budget_ = budget_;
+    stats.hits_ = hits_;
+    return stats;
+}
@@ -0,0 +1,73 @@
+/*
+
+    A byte bounded, least recently used set of a site's paths that were recently looked
+    up and not found, so requests that keep asking for them (mostly bots probing for
+    admin pages and leaked config files) are answered without touching the disk again.
+    Nothing is remembered until the site's root is being watched for changes; whenever
+    anything is created, renamed or deleted under it the whole set is dropped. Safe to
+    use from every file I/O pool thread.
+
+    Author: Jarod Graygo
+
+*/
+
+#ifndef MISSING_PATHS_H
+#define MISSING_PATHS_H
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class MissingPaths {
+public:
+    // Snapshot of what the set holds
+    struct Stats {
+        size_t entries_ = 0;
+        size_t bytes_ = 0;
+        size_t budget_ = 0;
+        uint64_t hits_ = 0;
+    };
+
+    explicit MissingPaths(size_t budget_bytes) : budget_(budget_bytes), bytes_(0), enabled_(false), generation_(0), hits_(0) { }
+
+    MissingPaths(const MissingPaths&) = delete;
+    MissingPaths& operator=(const MissingPaths&) = delete;
+
+    // Start remembering paths once changes under the root are reported to clear(), or stop and forget them when they no longer are
+    void enable(bool);
+
+    // Whether path was found missing and nothing under the root has changed since
+    bool contains(const std::string& path);
+
+    // Read before looking a path up on disk and handed to insert(), so a miss that raced with a change isn't remembered
+    uint64_t generation() const;
+
+    // Remember path as missing, evicting the least recently used paths to stay within the budget
+    // Ignored if the set was cleared since generation was read
+    void insert(const std::string& path, uint64_t generation);
+
+    // Forget every path, after something under the root changed
+    void clear();
+
+    Stats stats() const;
+
+private:
+    using lru_t = std::list<std::string>;
+
+    // Bytes a path is counted as: the path itself plus the list node and index entry holding it
+    static size_t cost(const std::string& path) { return path.size() + 64; }
+
+    mutable std::mutex mutex_;
+    size_t budget_;
+    size_t bytes_;
+    bool enabled_;
+    uint64_t generation_;
+    uint64_t hits_;
+    // Most recently used at the front
+    lru_t lru_;
+    std::unordered_map<std::string, lru_t::iterator> index_;
+};
+
+#endif // MISSING_PATHS_H
@@ -0,0 +1,202 @@
+/*
+
+    Function definitions for PreforkMaster class
+
+    Author: Jarod Graygo
+
+*/
+
+#include "prefork.h"
+
+#ifndef _WIN32
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <sys/wait.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/prctl.h>
+#endif
+#include "socket_tuning.h"
+
+using boost::asio::ip::tcp;
+
+PreforkMaster::PreforkMaster(uint16_t port, const ServerOptions& options, bool log)
+    : port_(port), options_(options), logging_(log), acceptor_(io_service_), tls_acceptor_(io_service_), running_(0), respawns_(0) {
+    sigemptyset(&previous_mask_);
+}
+
+void PreforkMaster::run(const worker_t& worker) {
+    if (logging_) {
+        log_writer_.open("log.txt", std::ios::app);
+        if (!log_writer_) std::cout << "ERROR:: Could not create log." << std::endl;
+        else log_writer_ << std::endl;
+    }
+    // Mapped before the first fork, so every worker, and every one restarted later, shares the one segment
+    std::string error;
+    cache_ = SharedFileCache::create(options_.shared_cache_bytes_, error);
+    if (!cache_) std::cout << "ERROR:: Could not map the shared file cache, each worker will cache on its own: " << error << std::endl;
+    else report("Mapped " + std::to_string(options_.shared_cache_bytes_) + " bytes of shared memory for the workers' file cache");
+
+    if (!options_.reuse_port_) {
+        bind(acceptor_, port_, options_.socket_tuning_, "listener");
+        if (options_.tls_port_ != 0) {
+            try {
+                bind(tls_acceptor_, options_.tls_port_, options_.tls_socket_tuning_, "secure listener");
+            }
+            catch (const boost::system::system_error& e) {
+                std::cout << "ERROR:: Could not start secure listener: " << e.what() << std::endl;
+                boost::system::error_code ignored;
+                tls_acceptor_.close(ignored);
+            }
+        }
+    }
+
+    // Blocked before forking so none of them is lost between forks; sigtimedwait() picks them up below
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGCHLD);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &signals, &previous_mask_);
+
+    pids_.assign(options_.workers_, 0);
+    started_.assign(options_.workers_, std::chrono::steady_clock::time_point());
+    respawn_at_.assign(options_.workers_, std::chrono::steady_clock::time_point());
+    report("Starting " + std::to_string(options_.workers_) + " workers on port: \"" + std::to_string(port_) + "\""
+        + (options_.reuse_port_ ? ", each with its own listener" : ""));
+    for (size_t index = 0; index < pids_.size(); ++index) spawn(index, worker);
+
+    bool stopping = false;
+    while (!stopping || running_ > 0) {
+        // Wake for the next restart that is due, and at least once a second to reap anything whose SIGCHLD merged with another's
+        auto now = std::chrono::steady_clock::now();
+        std::chrono::nanoseconds wait = std::chrono::seconds(1);
+        for (size_t index = 0; index < pids_.size() && !stopping; ++index)
+            if (pids_[index] == 0) wait = std::min(wait, std::max<std::chrono::nanoseconds>(respawn_at_[index] - now, std::chrono::nanoseconds(0)));
+        timespec timeout;
+        timeout.tv_sec = (time_t)(wait.count() / 1000000000);
+        timeout.tv_nsec = (long)(wait.count() % 1000000000);
+
+        int signal_number = sigtimedwait(&signals, nullptr, &timeout);
+        if (signal_number == SIGINT || signal_number == SIGTERM) {
+            if (stopping) report("Signal " + std::to_string(signal_number) + " received again, stopping the workers now");
+            else report("Signal " + std::to_string(signal_number) + " received, draining " + std::to_string(running_) + " workers");
+            stopping = true;
+            signal_workers(SIGTERM);
+        }
+        else if (signal_number == SIGUSR1) {
+            signal_workers(SIGUSR1);
+        }
+
+        reap(stopping);
+        if (stopping) continue;
+        now = std::chrono::steady_clock::now();
+        for (size_t index = 0; index < pids_.size(); ++index) {
+            if (pids_[index] != 0 || now < respawn_at_[index]) continue;
+            ++respawns_;
+            spawn(index, worker);
+        }
+    }
+    sigprocmask(SIG_SETMASK, &previous_mask_, nullptr);
+
+    if (cache_) {
+        SharedFileCache::Stats stats = cache_->stats();
+        report("Shared cache: " + std::to_string(stats.entries_) + " files, " + std::to_string(stats.bytes_) + " of " + std::to_string(stats.capacity_) + " bytes, "
+            + std::to_string(stats.hits_) + " of " + std::to_string(stats.hits_ + stats.misses_) + " lookups hit, " + std::to_string(stats.inserts_) + " files added");
+    }
+    report("All workers stopped after " + std::to_string(respawns_) + " restarts, master exiting");
+}
+
+void PreforkMaster::bind(tcp::acceptor& acceptor, uint16_t port, const SocketTuning& tuning, const std::string& name) {
+    auto endpoint = tcp::endpoint(tcp::v4(), port);
+    acceptor.open(endpoint.protocol());
+    acceptor.set_option(tcp::acceptor::reuse_address(true));
+    acceptor.bind(endpoint);
+    std::string failed = listen_tuned(acceptor, tuning);
+    if (!failed.empty())
+        std::cout << "ERROR:: Could not set " << failed << " on the " << name << std::endl;
+}
+
+// Fork worker index; the child runs worker and exits without returning here
+void PreforkMaster::spawn(size_t index, const worker_t& worker) {
+    // Anything still buffered would otherwise be written again by the child
+    std::cout.flush();
+    if (logging_) log_writer_.flush();
+    pid_t master = getpid();
+    pid_t pid = fork();
+    if (pid < 0) {
+        report("Could not start worker " + std::to_string(index) + ": " + std::strerror(errno));
+        respawn_at_[index] = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+        return;
+    }
+    if (pid == 0) {
+        setpgid(0, 0);
+#if defined(__linux__)
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        // The master may have gone before that was set
+        if (getppid() != master) _exit(1);
+#endif
+        sigprocmask(SIG_SETMASK, &previous_mask_, nullptr);
+
+        PreforkWorker descriptor;
+        descriptor.index_ = index;
+        descriptor.listen_fd_ = acceptor_.is_open() ? acceptor_.native_handle() : -1;
+        descriptor.tls_listen_fd_ = tls_acceptor_.is_open() ? tls_acceptor_.native_handle() : -1;
+        descriptor.cache_ = cache_.get();
+        int status = 0;
+        try {
+            worker(descriptor);
+        }
+        catch (const std::exception& e) {
+            std::cout << "ERROR:: Worker " << index << " failed: " << e.what() << std::endl;
+            status = 1;
+        }
+        std::cout.flush();
+        // The master's objects in this copy of its memory are left alone; the listeners stay open in the master
+        _exit(status);
+    }
+    setpgid(pid, pid);
+    pids_[index] = pid;
+    started_[index] = std::chrono::steady_clock::now();
+    ++running_;
+    report("Started worker " + std::to_string(index) + " (pid " + std::to_string(pid) + ")");
+}
+
+void PreforkMaster::signal_workers(int signal_number) {
+    for (pid_t pid : pids_)
+        if (pid != 0) kill(pid, signal_number);
+}
+
+// Collect every worker that has exited; unless the workers are stopping, each is due to be started again, after a
+// pause if it died straight after starting so one that can't start isn't forked over and over
+void PreforkMaster::reap(bool stopping) {
+    int status = 0;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        auto found = std::find(pids_.begin(), pids_.end(), pid);
+        if (found == pids_.end()) continue;
+        size_t index = found - pids_.begin();
+        *found = 0;
+        --running_;
+        auto now = std::chrono::steady_clock::now();
+        bool quick = now - started_[index] < std::chrono::seconds(1);
+        respawn_at_[index] = quick ? now + std::chrono::seconds(1) : now;
+        if (stopping && WIFEXITED(status) && WEXITSTATUS(status) == 0) continue;
+
+        std::string how = WIFSIGNALED(status) ? "was killed by signal " + std::to_string(WTERMSIG(status)) : "exited with status " + std::to_string(WEXITSTATUS(status));
+        report("Worker " + std::to_string(index) + " (pid " + std::to_string(pid) + ") " + how
+            + (stopping ? std::string() : quick ? ", restarting it in a second" : ", restarting it"));
+    }
+}
+
+void PreforkMaster::report(const std::string& str) {
+    std::cout << "MASTER:: " << str << std::endl;
+    if (logging_) log_writer_ << str << std::endl;
+}
+
+#endif // _WIN32
@@ -0,0 +1,91 @@
+/*
+
+    Running the server as a master process and a fixed number of forked workers, so a
+    crash takes down one worker rather than the whole server.
+
+    The master binds the listening sockets and maps the shared file cache before it forks,
+    and every worker accepts from the same sockets; with reuse_port_ set the workers bind
+    their own instead, with SO_REUSEPORT. The master itself serves nothing and starts no
+    threads, which is what makes forking it safe. It waits on signals: a worker that dies
+    is restarted in its place, after a second's pause if it died within a second of
+    starting; SIGUSR1 is passed on to every worker; and SIGINT or SIGTERM is passed on
+    once, so the workers drain, and the master returns when the last one has exited. A
+    second one stops them at once, as it does a single server. Workers are in process
+    groups of their own, so Ctrl+C reaches them through the master only, and on Linux are
+    sent SIGTERM if the master dies. Not available on Windows.
+
+    Author: Jarod Graygo
+
+*/
+
+#ifndef PREFORK_H
+#define PREFORK_H
+
+#ifndef _WIN32
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <signal.h>
+#include <sys/types.h>
+#include <boost/asio.hpp>
+#include "server_options.h"
+#include "shared_file_cache.h"
+
+// What a worker is handed in its process
+struct PreforkWorker {
+    size_t index_ = 0;
+    // Listeners bound by the master, -1 where the worker binds its own or there is none
+    int listen_fd_ = -1;
+    int tls_listen_fd_ = -1;
+    // Null if the segment could not be mapped, leaving each worker its own caches
+    SharedFileCache* cache_ = nullptr;
+};
+
+class PreforkMaster {
+public:
+    using worker_t = std::function<void(const PreforkWorker&)>;
+
+    PreforkMaster(uint16_t port, const ServerOptions&, bool log);
+
+    PreforkMaster(const PreforkMaster&) = delete;
+    PreforkMaster& operator=(const PreforkMaster&) = delete;
+
+    // Bind, fork the workers and look after them until they have all stopped. worker runs in each child process,
+    // which exits when it returns. Throws like Server::run() if a listener can't be bound
+    void run(const worker_t& worker);
+
+private:
+    void bind(boost::asio::ip::tcp::acceptor&, uint16_t port, const SocketTuning&, const std::string& name);
+    void spawn(size_t index, const worker_t&);
+    void signal_workers(int signal_number);
+    void reap(bool stopping);
+    void report(const std::string&);
+
+    uint16_t port_;
+    ServerOptions options_;
+    bool logging_;
+    std::ofstream log_writer_;
+    // Never run; it only holds the listeners
+    boost::asio::io_service io_service_;
+    boost::asio::ip::tcp::acceptor acceptor_;
+    boost::asio::ip::tcp::acceptor tls_acceptor_;
+    std::unique_ptr<SharedFileCache> cache_;
+    // The signal mask from before run() blocked the ones it waits on, restored in the workers
+    sigset_t previous_mask_;
+
+    // By worker index: the running process, 0 while there is none, when it started and when to start the next
+    std::vector<pid_t> pids_;
+    std::vector<std::chrono::steady_clock::time_point> started_;
+    std::vector<std::chrono::steady_clock::time_point> respawn_at_;
+    size_t running_;
+    uint64_t respawns_;
+};
+
+#endif // _WIN32
+
+#endif // PREFORK_H
@@ -0,0 +1,226 @@
+/*
+
+    Function definitions for BodyFraming, Upstream and ReverseProxy classes
+
+    Author: Jarod Graygo
+
+*/
+
+#include "proxy.h"
+#include <algorithm>
+#include <cctype>
+
+using boost::asio::ip::tcp;
+
+//////////////////////// BODY FRAMING ////////////////////////
+
+void BodyFraming::reset(Kind kind, uint64_t length) {
+    kind_ = kind;
+    remaining_ = length;
+    chunk_ = Chunk::size;
+    size_digits_ = 0;
+    failed_ = false;
+    done_ = kind == Kind::none || (kind == Kind::length && length == 0);
+}
+
+size_t BodyFraming::feed(const char* data, size_t len) {
+    if (done_ || failed_) return 0;
+    if (kind_ == Kind::until_close) return len;
+    if (kind_ == Kind::length) {
+        size_t taken = (size_t)std::min<uint64_t>(remaining_, len);
+        remaining_ -= taken;
+        done_ = remaining_ == 0;
+        return taken;
+    }
+
+    // Chunked: hex size, optional extensions, CRLF, the data and its CRLF, until a zero size chunk and the trailer
+    size_t i = 0;
+    while (i < len && !done_) {
+        char c = data[i];
+        switch (chunk_) {
+        case Chunk::size:
+            if (std::isxdigit((unsigned char)c)) {
+                // 15 hex digits is far beyond any real chunk and can't overflow
+                if (++size_digits_ > 15) { failed_ = true; return i; }
+                remaining_ = remaining_ * 16 + (uint64_t)(std::isdigit((unsigned char)c) ? c - '0' : std::tolower((unsigned char)c) - 'a' + 10);
+            }
+            else if (size_digits_ == 0) { failed_ = true; return i; }
+            else if (c == ';' || c == ' ' || c == '\t') chunk_ = Chunk::extension;
+            else if (c == '\r') chunk_ = Chunk::size_lf;
+            else { failed_ = true; return i; }
+            ++i;
+            break;
+        case Chunk::extension:
+            if (c == '\r') chunk_ = Chunk::size_lf;
+            ++i;
+            break;
+        case Chunk::size_lf:
+            if (c != '\n') { failed_ = true; return i; }
+            chunk_ = remaining_ == 0 ? Chunk::trailer_start : Chunk::data;
+            size_digits_ = 0;
+            ++i;
+            break;
+        case Chunk::data: {
+            size_t taken = (size_t)std::min<uint64_t>(remaining_, len - i);
+            remaining_ -= taken;
+            i += taken;
+            if (remaining_ == 0) chunk_ = Chunk::data_cr;
+            break;
+        }
+        case Chunk::data_cr:
+            if (c != '\r') { failed_ = true; return i; }
+            chunk_ = Chunk::data_lf;
+            ++i;
+            break;
+        case Chunk::data_lf:
+            if (c != '\n') { failed_ = true; return i; }
+            chunk_ = Chunk::size;
+            ++i;
+            break;
+        case Chunk::trailer_start:
+            chunk_ = c == '\r' ? Chunk::final_lf : Chunk::trailer_line;
+            ++i;
+            break;
+        case Chunk::trailer_line:
+            if (c == '\n') chunk_ = Chunk::trailer_start;
+            ++i;
+            break;
+        case Chunk::final_lf:
+            if (c != '\n') { failed_ = true; return i; }
+            done_ = true;
+            ++i;
+            break;
+        }
+    }
+    return i;
+}
+
+//////////////////////// UPSTREAM ////////////////////////
+
+Upstream::Upstream(boost::asio::io_service& io_service, const ProxyRoute& route)
+    : io_service_(io_service), route_(route), tcp_(false), open_(0), consecutive_failures_(0), requests_(0), reused_(0), failures_(0) {
+    static const std::string unix_scheme = "unix:";
+    if (route.upstream_.compare(0, unix_scheme.size(), unix_scheme) == 0) {
+#ifndef _WIN32
+        endpoint_ = boost::asio::local::stream_protocol::endpoint(route.upstream_.substr(unix_scheme.size()));
+#else
+        error_ = "Unix domain sockets are not supported on this platform";
+#endif
+        return;
+    }
+
+    size_t colon = route.upstream_.rfind(':');
+    if (colon == std::string::npos || colon == 0 || colon + 1 == route.upstream_.size()) {
+        error_ = "expected host:port or unix:/path";
+        return;
+    }
+    // Resolved once at startup; the first address is the one used
+    tcp::resolver resolver(io_service);
+    boost::system::error_code ec;
+    auto results = resolver.resolve(route.upstream_.substr(0, colon), route.upstream_.substr(colon + 1), ec);
+    if (ec || results.empty()) {
+        error_ = "could not resolve it" + (ec ? ": " + ec.message() : std::string());
+        return;
+    }
+    endpoint_ = boost::asio::generic::stream_protocol::endpoint(results.begin()->endpoint());
+    tcp_ = true;
+}
+
+bool Upstream::acquire(ready_t ready) {
+    if (down() || waiting_.size() >= route_.max_waiting_) return false;
+    ++requests_;
+    if (!idle_.empty()) {
+        connection_t connection = idle_.back();
+        idle_.pop_back();
+        ++reused_;
+        hand_over(ready, connection, true);
+    }
+    else if (open_ < route_.max_connections_) {
+        ++open_;
+        hand_over(ready, std::make_shared<socket_t>(io_service_), false);
+    }
+    else {
+        waiting_.push_back(ready);
+    }
+    return true;
+}
+
+void Upstream::release(connection_t connection, bool reusable) {
+    if (reusable && !waiting_.empty()) {
+        ready_t next = waiting_.front();
+        waiting_.pop_front();
+        ++reused_;
+        hand_over(next, connection, true);
+        return;
+    }
+    if (reusable && idle_.size() < route_.max_idle_) {
+        idle_.push_back(connection);
+        return;
+    }
+    boost::system::error_code ignored;
+    connection->close(ignored);
+    // Its place goes to the next in line, on a fresh connection
+    if (!waiting_.empty()) {
+        ready_t next = waiting_.front();
+        waiting_.pop_front();
+        hand_over(next, std::make_shared<socket_t>(io_service_), false);
+        return;
+    }
+    --open_;
+}
+
+void Upstream::hand_over(ready_t ready, connection_t connection, bool reused) {
+    boost::asio::post(io_service_, [ready, connection, reused]() { ready(connection, reused); });
+}
+
+void Upstream::succeeded() {
+    consecutive_failures_ = 0;
+}
+
+void Upstream::failed() {
+    ++failures_;
+    if (++consecutive_failures_ >= route_.max_fails_) {
+        down_until_ = std::chrono::steady_clock::now() + std::chrono::seconds(route_.fail_timeout_seconds_);
+        consecutive_failures_ = 0;
+        // Idle connections are as suspect as the ones that failed
+        for (auto& connection : idle_) {
+            boost::system::error_code ignored;
+            connection->close(ignored);
+        }
+        open_ -= idle_.size();
+        idle_.clear();
+    }
+}
+
+bool Upstream::down() const {
+    return std::chrono::steady_clock::now() < down_until_;
+}
+
+Upstream::Stats Upstream::stats() const {
+    Stats s;
+    s.open_ = open_;
+    s.idle_ = idle_.size();
+    s.waiting_ = waiting_.size();
+    s.requests_ = requests_;
+    s.reused_ = reused_;
+    s.failures_ = failures_;
+    s.down_ = down();
+    return s;
+}
+
+//////////////////////// REVERSE PROXY ////////////////////////
+
+ReverseProxy::ReverseProxy(boost::asio::io_service& io_service, const std::vector<ProxyRoute>& routes) {
+    for (const ProxyRoute& route : routes)
+        upstreams_.emplace_back(new Upstream(io_service, route));
+}
+
+Upstream* ReverseProxy::find(const std::string& target) {
+    Upstream* best = nullptr;
+    for (const auto& upstream : upstreams_) {
+        const std::string& prefix = upstream->route().prefix_;
+        if (prefix.empty() || target.compare(0, prefix.size(), prefix) != 0) continue;
+        if (!best || prefix.size() > best->route().prefix_.size()) best = upstream.get();
+    }
+    return best;
+}
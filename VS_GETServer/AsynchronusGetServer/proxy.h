@@ -0,0 +1,177 @@
+/*
+
+    Pieces of the reverse proxy that forwards requests under a path prefix to another HTTP
+    server: the routes, a pool of persistent connections for each upstream with its health,
+    and a parser that follows where an HTTP/1 body ends as its bytes stream past.
+
+    The server drives each exchange itself; nothing here reads or writes a socket. Upstream
+    connections are generic stream sockets, so TCP and Unix domain sockets are pooled alike.
+    An upstream holds at most max_connections_ connections, in use or idle. Requests beyond
+    that wait in line for one to be released, up to max_waiting_, and past that are refused.
+    After max_fails_ failures in a row the upstream counts as down and requests get a 502
+    at once until fail_timeout_seconds_ have passed, after which it is tried again.
+
+    Author: Jarod Graygo
+
+*/
+
+#ifndef PROXY_H
+#define PROXY_H
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/asio/generic/stream_protocol.hpp>
+#include "server_options.h"
+
+// Follows an HTTP/1 message body through the bytes that carry it, without keeping any of them
+class BodyFraming {
+public:
+    enum class Kind { none, length, chunked, until_close };
+
+    BodyFraming() { reset(Kind::none); }
+    void reset(Kind kind, uint64_t length = 0);
+
+    // How many of the len bytes belong to the body; anything after them is the next message
+    // Malformed chunking sets failed() and takes nothing more
+    size_t feed(const char* data, size_t len);
+
+    // A body delimited by the end of the connection is never done until the caller sees it close
+    bool done() const { return done_; }
+    bool failed() const { return failed_; }
+    Kind kind() const { return kind_; }
+
+private:
+    enum class Chunk { size, extension, size_lf, data, data_cr, data_lf, trailer_start, trailer_line, final_lf };
+
+    Kind kind_;
+    uint64_t remaining_;
+    Chunk chunk_;
+    // Hex digits of the chunk size read so far
+    size_t size_digits_;
+    bool done_;
+    bool failed_;
+};
+
+// One upstream server and its pool of connections
+class Upstream {
+public:
+    using socket_t = boost::asio::generic::stream_protocol::socket;
+    using connection_t = std::shared_ptr<socket_t>;
+    // Given a connection that is either reused, and so already connected, or fresh and still to be connected
+    using ready_t = std::function<void(connection_t, bool reused)>;
+
+    // Snapshot of the upstream's pool and traffic
+    struct Stats {
+        size_t open_ = 0;
+        size_t idle_ = 0;
+        size_t waiting_ = 0;
+        uint64_t requests_ = 0;
+        uint64_t reused_ = 0;
+        uint64_t failures_ = 0;
+        bool down_ = false;
+    };
+
+    // Resolves the upstream's address; error() says why if it can't be used
+    Upstream(boost::asio::io_service&, const ProxyRoute&);
+
+    Upstream(const Upstream&) = delete;
+    Upstream& operator=(const Upstream&) = delete;
+
+    const ProxyRoute& route() const { return route_; }
+    const std::string& error() const { return error_; }
+    const boost::asio::generic::stream_protocol::endpoint& endpoint() const { return endpoint_; }
+    // Whether the connection is a TCP one, which wants TCP_NODELAY
+    bool tcp() const { return tcp_; }
+
+    // Hand ready a connection: an idle one at once, a fresh one while under the connection limit, or otherwise the
+    // next one released. ready is always called from the io_service, never from within acquire()
+    // Returns false, without calling ready, if the upstream is down or too many requests are already waiting
+    bool acquire(ready_t ready);
+    // Give a connection back once its exchange is over; one that isn't reusable is closed and frees its place
+    void release(connection_t, bool reusable);
+
+    // Record how an exchange went, for the upstream's health
+    void succeeded();
+    void failed();
+    bool down() const;
+
+    Stats stats() const;
+
+private:
+    void hand_over(ready_t, connection_t, bool reused);
+
+    boost::asio::io_service& io_service_;
+    ProxyRoute route_;
+    std::string error_;
+    boost::asio::generic::stream_protocol::endpoint endpoint_;
+    bool tcp_;
+
+    std::vector<connection_t> idle_;
+    std::deque<ready_t> waiting_;
+    // Connections handed out or idle
+    size_t open_;
+    size_t consecutive_failures_;
+    std::chrono::steady_clock::time_point down_until_;
+    uint64_t requests_;
+    uint64_t reused_;
+    uint64_t failures_;
+};
+
+// One request on its way through the proxy, held by the client's connection until the response is written
+struct ProxyExchange {
+    explicit ProxyExchange(boost::asio::io_service& io_service) : timer_(io_service) { }
+
+    Upstream* upstream_ = nullptr;
+    Upstream::connection_t connection_;
+    bool reused_ = false;
+    // Whether a request that found its pooled connection closed under it was sent again on a fresh one
+    bool retried_ = false;
+    bool head_request_ = false;
+
+    // The request head as it goes upstream and the start of the body read along with it, kept until the response
+    // begins so it can be sent again; once more of the body has been streamed that is no longer possible
+    std::string request_;
+    bool body_streamed_ = false;
+    BodyFraming request_body_;
+    // The client sent Expect: 100-continue and is waiting for the go-ahead before sending the rest of its body
+    bool expect_continue_ = false;
+
+    // Upstream reads land in buffer_. The response head collects in head_ until it is complete, and is then replaced
+    // by the head as sent to the client, for the log; out_ holds that head along with the body bytes read with it
+    std::vector<char> buffer_;
+    std::string head_;
+    std::string out_;
+    bool response_started_ = false;
+    BodyFraming response_body_;
+    // Whether the upstream connection may take another request once this response is over
+    bool keep_alive_ = false;
+    uint64_t response_bytes_ = 0;
+
+    // Each step on the upstream connection must finish by deadline_, which is pushed back to the time point's maximum
+    // while the exchange waits on the client instead
+    boost::asio::steady_timer timer_;
+    std::chrono::steady_clock::time_point deadline_;
+    bool timer_armed_ = false;
+    bool timed_out_ = false;
+};
+
+// The routes, each with its upstream
+class ReverseProxy {
+public:
+    ReverseProxy(boost::asio::io_service&, const std::vector<ProxyRoute>&);
+
+    // The upstream of the longest prefix the target starts with, or null if none does
+    Upstream* find(const std::string& target);
+    const std::vector<std::unique_ptr<Upstream>>& upstreams() const { return upstreams_; }
+
+private:
+    std::vector<std::unique_ptr<Upstream>> upstreams_;
+};
+
+#endif // PROXY_H
@@ -0,0 +1,94 @@
+/*
+
+    Function definitions for BufferPool and RequestBuffer classes
+
+    Author: Jarod Graygo
+
+*/
+
+#include "request_buffer.h"
+#include <algorithm>
+#include <cstring>
+
+std::unique_ptr<char[]> BufferPool::acquire() {
+    std::unique_ptr<char[]> block;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (++in_use_ > peak_in_use_) peak_in_use_ = in_use_;
+        if (!free_.empty()) {
+            block = std::move(free_.back());
+            free_.pop_back();
+        }
+    }
+    if (!block) block.reset(new char[block_size_]);
+    return block;
+}
+
+void BufferPool::release(std::unique_ptr<char[]> block) {
+    if (!block) return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    --in_use_;
+    if (free_.size() < max_free_) free_.push_back(std::move(block));
+}
+
+void BufferPool::note_overflow() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++overflows_;
+}
+
+BufferPool::Stats BufferPool::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats stats;
+    stats.in_use_ = in_use_;
+    stats.peak_in_use_ = peak_in_use_;
+    stats.free_ = free_.size();
+    stats.overflows_ = overflows_;
+    return stats;
+}
+
+RequestBuffer::~RequestBuffer() {
+    pool_->release(std::move(block_));
+}
+
+boost::asio::mutable_buffer RequestBuffer::prepare() {
+    if (!block_ && overflow_.empty()) {
+        block_ = pool_->acquire();
+        capacity_ = pool_->block_size();
+    }
+
+    if (end_ == capacity_ && begin_ > 0) {
+        memmove(storage(), storage() + begin_, end_ - begin_);
+        end_ -= begin_;
+        begin_ = 0;
+    }
+
+    if (end_ == capacity_) {
+        if (capacity_ >= max_size_) return boost::asio::mutable_buffer();
+
+        size_t grown = std::min(capacity_ * 2, max_size_);
+        if (overflow_.empty()) {
+            // The block goes back to the pool as soon as its bytes are copied out
+            std::vector<char> larger(grown);
+            memcpy(larger.data(), block_.get(), end_);
+            overflow_.swap(larger);
+            pool_->release(std::move(block_));
+            pool_->note_overflow();
+        }
+        else {
+            overflow_.resize(grown);
+        }
+        capacity_ = grown;
+    }
+    return boost::asio::buffer(storage() + end_, capacity_ - end_);
+}
+
+void RequestBuffer::consume(size_t n) {
+    begin_ += std::min(n, size());
+    if (begin_ != end_) return;
+
+    begin_ = end_ = 0;
+    if (!overflow_.empty()) {
+        std::vector<char>().swap(overflow_);
+        capacity_ = 0;
+    }
+}
@@ -0,0 +1,95 @@
+/*
+
+    Buffers connections read their requests into.
+
+    Every connection reads into a fixed size block taken from a pool shared by all
+    connections, so the memory held by an idle connection is one block no matter how
+    much it has sent before. A request head that does not fit moves into an overflow
+    buffer that grows up to a hard cap; what the client sends beyond that is never
+    buffered, the request is refused instead. Blocks go back to the pool when the
+    connection closes.
+
+    Author: Jarod Graygo
+
+*/
+
+#ifndef REQUEST_BUFFER_H
+#define REQUEST_BUFFER_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <boost/asio/buffer.hpp>
+
+class BufferPool {
+public:
+    // Snapshot of the pool's metrics
+    struct Stats {
+        size_t in_use_ = 0;
+        size_t peak_in_use_ = 0;
+        size_t free_ = 0;
+        // Requests that outgrew their block
+        uint64_t overflows_ = 0;
+    };
+
+    // Up to max_free released blocks are kept for reuse, the rest are freed
+    BufferPool(size_t block_size, size_t max_free) : block_size_(block_size), max_free_(max_free), in_use_(0), peak_in_use_(0), overflows_(0) { }
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    std::unique_ptr<char[]> acquire();
+    void release(std::unique_ptr<char[]>);
+    void note_overflow();
+
+    size_t block_size() const { return block_size_; }
+    Stats stats() const;
+
+private:
+    size_t block_size_;
+    size_t max_free_;
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<char[]>> free_;
+    size_t in_use_;
+    size_t peak_in_use_;
+    uint64_t overflows_;
+};
+
+// The bytes read from one connection and not yet processed
+class RequestBuffer {
+public:
+    // max_size caps the overflow tier; a block larger than that still counts in full
+    RequestBuffer(BufferPool& pool, size_t max_size) : pool_(&pool), max_size_(max_size), capacity_(0), begin_(0), end_(0) { }
+    ~RequestBuffer();
+
+    RequestBuffer(const RequestBuffer&) = delete;
+    RequestBuffer& operator=(const RequestBuffer&) = delete;
+
+    // Space for the next read. Takes a block from the pool on first use and moves into the overflow tier once the
+    // block is full; returns an empty buffer once the cap is reached
+    boost::asio::mutable_buffer prepare();
+    void commit(size_t n) { end_ += n; }
+
+    const char* data() const { return storage() + begin_; }
+    size_t size() const { return end_ - begin_; }
+    // Bytes of memory held, the pool block or the overflow tier
+    size_t capacity() const { return capacity_; }
+    bool full() const { return begin_ == 0 && end_ == capacity_ && capacity_ >= max_size_; }
+
+    // Drop processed bytes from the front; an emptied overflow tier is freed straight away
+    void consume(size_t n);
+
+private:
+    char* storage() const { return overflow_.empty() ? block_.get() : const_cast<char*>(overflow_.data()); }
+
+    BufferPool* pool_;
+    size_t max_size_;
+    std::unique_ptr<char[]> block_;
+    std::vector<char> overflow_;
+    size_t capacity_;
+    size_t begin_;
+    size_t end_;
+};
+
+#endif // REQUEST_BUFFER_H
@@ -0,0 +1,348 @@
+/*
+
+    Function definitions for RootDirectory class
+
+    Author: Jarod Graygo
+
+*/
+
+#include "root_directory.h"
+#ifdef _WIN32
+#include <fstream>
+#include <iterator>
+#else
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#if defined(SYS_openat2) && __has_include(<linux/openat2.h>)
+#include <linux/openat2.h>
+#define HAVE_OPENAT2
+#endif
+#endif
+#endif
+
+#ifndef _WIN32
+
+namespace {
+
+    // Descriptors that are only looked through or stat'ed don't need to be readable
+#ifdef O_PATH
+    const int lookup_flags = O_PATH | O_CLOEXEC;
+#else
+    const int lookup_flags = O_RDONLY | O_CLOEXEC;
+#endif
+
+    std::error_code last_error() {
+        return std::error_code(errno, std::generic_category());
+    }
+
+    // Only ever compared with other times made here, so the epoch of file_time_type's clock doesn't matter
+    std::filesystem::file_time_type modified_time(const struct stat& st) {
+#ifdef __APPLE__
+        const timespec& t = st.st_mtimespec;
+#else
+        const timespec& t = st.st_mtim;
+#endif
+        return std::filesystem::file_time_type(std::chrono::duration_cast<std::filesystem::file_time_type::duration>(
+            std::chrono::seconds(t.tv_sec) + std::chrono::nanoseconds(t.tv_nsec)));
+    }
+
+    // Directories and the like are reported the way std::filesystem::file_size() reports them
+    bool regular_file(const struct stat& st, std::error_code& ec) {
+        if (S_ISREG(st.st_mode)) return true;
+        ec = std::make_error_code(S_ISDIR(st.st_mode) ? std::errc::is_a_directory : std::errc::not_supported);
+        return false;
+    }
+
+    void describe(RootDirectory::OpenFile& file, const struct stat& st) {
+        file.size_ = (uintmax_t)st.st_size;
+        file.modified_ = modified_time(st);
+        file.device_ = (uint64_t)st.st_dev;
+        file.inode_ = (uint64_t)st.st_ino;
+    }
+
+    // Whether the path still leads to the file that was opened, as it was when it was opened
+    bool unchanged(const RootDirectory::OpenFile& file, const struct stat& st) {
+        return file.device_ == (uint64_t)st.st_dev && file.inode_ == (uint64_t)st.st_ino &&
+            file.size_ == (uintmax_t)st.st_size && file.modified_ == modified_time(st);
+    }
+
+}
+
+RootDirectory::OpenFile::~OpenFile() {
+    if (fd_ >= 0) ::close(fd_);
+}
+
+RootDirectory::Descriptor::~Descriptor() {
+    ::close(fd_);
+}
+
+RootDirectory::RootDirectory(const std::string& root, size_t open_files, std::chrono::seconds inactive, std::chrono::seconds valid)
+    : caching_(false), generation_(0), max_files_(open_files), inactive_(inactive), valid_(valid), beneath_(true), root_(root) { }
+
+RootDirectory::~RootDirectory() { }
+
+// A cached file is used as it is within the revalidation interval; after it the path is stat'ed and the file kept if
+// nothing about it changed, otherwise it is opened again. Files are opened non-blocking so a FIFO can't hold up the
+// thread, which makes no difference to reading a regular file
+RootDirectory::file_t RootDirectory::open(const std::string& relative, std::error_code& ec) {
+    auto now = std::chrono::steady_clock::now();
+    file_t cached;
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        generation = generation_;
+        expire(now);
+        auto found = files_.find(relative);
+        if (found != files_.end()) {
+            CachedFile& entry = found->second;
+            lru_.splice(lru_.begin(), lru_, entry.lru_);
+            entry.used_ = now;
+            if (now - entry.validated_ < valid_) return entry.file_;
+            cached = entry.file_;
+        }
+    }
+
+    struct stat st;
+    if (cached) {
+        if (!stat_file(relative, st, ec)) {
+            drop(relative);
+            return nullptr;
+        }
+        if (unchanged(*cached, st)) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto found = files_.find(relative);
+            if (found != files_.end() && found->second.file_ == cached) found->second.validated_ = now;
+            return cached;
+        }
+    }
+
+    int fd = open_file(relative, O_RDONLY | O_NONBLOCK | O_CLOEXEC, ec);
+    if (fd < 0) {
+        drop(relative);
+        return nullptr;
+    }
+    auto file = std::make_shared<OpenFile>();
+    file->fd_ = fd;
+    if (fstat(fd, &st) != 0) {
+        ec = last_error();
+        return nullptr;
+    }
+    if (!regular_file(st, ec)) {
+        drop(relative);
+        return nullptr;
+    }
+    describe(*file, st);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (max_files_ == 0 || generation != generation_) return file;
+    auto found = files_.find(relative);
+    if (found == files_.end()) {
+        lru_.push_front(relative);
+        found = files_.emplace(relative, CachedFile()).first;
+        found->second.lru_ = lru_.begin();
+    }
+    else {
+        lru_.splice(lru_.begin(), lru_, found->second.lru_);
+    }
+    found->second.file_ = file;
+    found->second.validated_ = now;
+    found->second.used_ = now;
+    while (files_.size() > max_files_) {
+        files_.erase(lru_.back());
+        lru_.pop_back();
+    }
+    return file;
+}
+
+// Read with pread(), since the descriptor may be shared with other threads reading the same file
+bool RootDirectory::read(const OpenFile& file, const std::string&, std::string& contents, std::error_code& ec) {
+    contents.resize((size_t)file.size_);
+    size_t done = 0;
+    while (done < contents.size()) {
+        ssize_t got = ::pread(file.fd_, &contents[done], contents.size() - done, (off_t)done);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) {
+            ec = last_error();
+            break;
+        }
+        // The file was cut short since it was opened
+        if (got == 0) break;
+        done += (size_t)got;
+    }
+    contents.resize(done);
+    return !ec;
+}
+
+void RootDirectory::cache_directories(bool on) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    caching_ = on;
+    ++generation_;
+    directories_.clear();
+}
+
+void RootDirectory::forget() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++generation_;
+    directories_.clear();
+    files_.clear();
+    lru_.clear();
+}
+
+// Opened on first use, so a root created after the server started is still picked up
+RootDirectory::descriptor_t RootDirectory::root() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!root_fd_) {
+        int fd = ::open(root_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0) root_fd_ = std::make_shared<const Descriptor>(fd);
+    }
+    return root_fd_;
+}
+
+// The open directory a file is looked up in, or null (with errno set) if it can't be opened or directories aren't being cached
+RootDirectory::descriptor_t RootDirectory::directory(const std::string& relative) {
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!caching_) return nullptr;
+        auto found = directories_.find(relative);
+        if (found != directories_.end()) return found->second;
+        generation = generation_;
+    }
+
+    descriptor_t base = root();
+    if (!base) return nullptr;
+    int fd = open_beneath(base->fd_, relative, lookup_flags | O_DIRECTORY);
+    if (fd < 0) return nullptr;
+    descriptor_t dir = std::make_shared<const Descriptor>(fd);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (caching_ && generation == generation_ && directories_.size() < max_directories_) directories_.emplace(relative, dir);
+    return dir;
+}
+
+int RootDirectory::open_beneath(int dir, const std::string& relative, int flags) {
+#ifdef HAVE_OPENAT2
+    if (beneath_) {
+        struct open_how how;
+        std::memset(&how, 0, sizeof(how));
+        how.flags = (uint64_t)flags;
+        how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+        // EAGAIN means a rename elsewhere raced with the lookup
+        int fd;
+        int attempts = 0;
+        do fd = (int)syscall(SYS_openat2, dir, relative.c_str(), &how, sizeof(how));
+        while (fd < 0 && errno == EAGAIN && ++attempts < 3);
+        if (fd >= 0 || errno != ENOSYS) return fd;
+        // Kernels before 5.6
+        beneath_ = false;
+    }
+#endif
+    return openat(dir, relative.c_str(), flags);
+}
+
+int RootDirectory::open_file(const std::string& relative, int flags, std::error_code& ec) {
+    descriptor_t base = root();
+    if (!base) {
+        ec = last_error();
+        return -1;
+    }
+    size_t slash = relative.rfind('/');
+    descriptor_t dir = slash == std::string::npos ? nullptr : directory(relative.substr(0, slash));
+    if (dir) {
+        // A symbolic link fails with ELOOP here and is resolved from the root below instead, where it can be kept inside it
+        int fd = openat(dir->fd_, relative.c_str() + slash + 1, flags | O_NOFOLLOW);
+        if (fd >= 0) return fd;
+        if (errno != ELOOP) {
+            ec = last_error();
+            return -1;
+        }
+    }
+    int fd = open_beneath(base->fd_, relative, flags);
+    if (fd < 0) ec = last_error();
+    return fd;
+}
+
+// Stat'ed where it is; a symbolic link is resolved from the root instead, where it can be kept inside it
+bool RootDirectory::stat_file(const std::string& relative, struct stat& st, std::error_code& ec) {
+    descriptor_t base = root();
+    if (!base) {
+        ec = last_error();
+        return false;
+    }
+    size_t slash = relative.rfind('/');
+    descriptor_t dir = slash == std::string::npos ? base : directory(relative.substr(0, slash));
+    if (dir) {
+        if (fstatat(dir->fd_, relative.c_str() + (slash == std::string::npos ? 0 : slash + 1), &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            ec = last_error();
+            return false;
+        }
+        if (!S_ISLNK(st.st_mode)) return regular_file(st, ec);
+    }
+
+    int fd = open_beneath(base->fd_, relative, lookup_flags);
+    if (fd < 0) {
+        ec = last_error();
+        return false;
+    }
+    bool stated = fstat(fd, &st) == 0;
+    if (!stated) ec = last_error();
+    ::close(fd);
+    return stated && regular_file(st, ec);
+}
+
+// Close the files unused for longer than the inactivity timeout, looking at most once a second
+// The least recently used are at the back, so only the files being closed are visited
+void RootDirectory::expire(std::chrono::steady_clock::time_point now) {
+    if (now - expired_ < std::chrono::seconds(1)) return;
+    expired_ = now;
+    while (!lru_.empty() && now - files_.find(lru_.back())->second.used_ >= inactive_) {
+        files_.erase(lru_.back());
+        lru_.pop_back();
+    }
+}
+
+void RootDirectory::drop(const std::string& relative) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = files_.find(relative);
+    if (found == files_.end()) return;
+    lru_.erase(found->second.lru_);
+    files_.erase(found);
+}
+
+#else
+
+RootDirectory::OpenFile::~OpenFile() { }
+
+RootDirectory::RootDirectory(const std::string& root, size_t, std::chrono::seconds, std::chrono::seconds) : root_(root) { }
+
+RootDirectory::~RootDirectory() { }
+
+RootDirectory::file_t RootDirectory::open(const std::string& relative, std::error_code& ec) {
+    auto file = std::make_shared<OpenFile>();
+    file->modified_ = std::filesystem::last_write_time(root_ + relative, ec);
+    if (ec) return nullptr;
+    file->size_ = std::filesystem::file_size(root_ + relative, ec);
+    if (ec) return nullptr;
+    return file;
+}
+
+bool RootDirectory::read(const OpenFile&, const std::string& relative, std::string& contents, std::error_code& ec) {
+    std::ifstream in((root_ + relative).c_str(), std::ios::binary | std::ios::in);
+    if (!in) {
+        ec = std::make_error_code(std::errc::permission_denied);
+        return false;
+    }
+    contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+void RootDirectory::cache_directories(bool) { }
+
+void RootDirectory::forget() { }
+
+#endif
@@ -0,0 +1,137 @@
+/*
+
+    A site's document root, held open so request paths are resolved from it rather than
+    walked from the working directory each time. On Linux paths are opened with openat2()
+    and RESOLVE_BENEATH, so not even a symbolic link can lead a request outside the root;
+    kernels before 5.6 and other POSIX systems fall back to openat(), which relies on the
+    request path having been checked for ".." segments. Windows resolves paths against the
+    root's name as before.
+
+    While the root is watched for changes the directories files are served from are kept
+    open too, so a file in src/css/ is looked up with one path component instead of three.
+    They are closed as soon as anything under the root is created, renamed or deleted.
+
+    Files are held open as well, in a cache bounded by a number of entries, so a hot file is
+    neither looked up nor opened again while it is unchanged. An entry is trusted for a short
+    revalidation interval after it was last checked against the disk; after that its path is
+    stat'ed again and the file reopened if it now leads to a different file or one with a
+    different size or modification time. Entries unused for a while are closed. Handles are
+    reference counted, so a file dropped from the cache stays open until the last response
+    using it is sent. Windows doesn't keep files open and checks the disk every time.
+
+    The root is opened once, when it is first used; replacing the root directory itself
+    (rather than what is in it) takes a restart. Safe to use from every file I/O pool thread.
+
+    Author: Jarod Graygo
+
+*/
+
+#ifndef ROOT_DIRECTORY_H
+#define ROOT_DIRECTORY_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+class RootDirectory {
+public:
+    // A regular file opened for reading, with the size and modification time it had when it was opened
+    // Closed once the cache and every response using it are done with it
+    struct OpenFile {
+        OpenFile() : fd_(-1), size_(0), device_(0), inode_(0) { }
+        ~OpenFile();
+        OpenFile(const OpenFile&) = delete;
+        OpenFile& operator=(const OpenFile&) = delete;
+
+        // -1 on Windows, where files are read by name
+        int fd_;
+        uintmax_t size_;
+        std::filesystem::file_time_type modified_;
+        // The file the path led to, so one renamed over it with the same size and time is still noticed
+        uint64_t device_;
+        uint64_t inode_;
+    };
+    using file_t = std::shared_ptr<const OpenFile>;
+
+    // Up to open_files files are kept open, 0 disables the cache; one unused for inactive is closed and one checked
+    // against the disk less than valid ago is used without checking again
+    RootDirectory(const std::string& root, size_t open_files, std::chrono::seconds inactive, std::chrono::seconds valid);
+    ~RootDirectory();
+
+    RootDirectory(const RootDirectory&) = delete;
+    RootDirectory& operator=(const RootDirectory&) = delete;
+
+    // Open a regular file, given relative to the root with / separators and no . or .. segments
+    // Returns null with ec set the way std::filesystem would (no_such_file_or_directory, not_a_directory, ...)
+    file_t open(const std::string& relative, std::error_code& ec);
+
+    // Read up to the size an opened file had when it was opened
+    bool read(const OpenFile&, const std::string& relative, std::string& contents, std::error_code& ec);
+
+    // Keep the directories files are served from open; only while changes under the root are reported to forget()
+    void cache_directories(bool);
+    // Close the cached directories and files after something under the root changed
+    void forget();
+
+private:
+#ifndef _WIN32
+    // Closes the descriptor once the last lookup using it is done
+    struct Descriptor {
+        explicit Descriptor(int fd) : fd_(fd) { }
+        ~Descriptor();
+        int fd_;
+    };
+    using descriptor_t = std::shared_ptr<const Descriptor>;
+
+    struct CachedFile {
+        file_t file_;
+        std::chrono::steady_clock::time_point validated_;
+        std::chrono::steady_clock::time_point used_;
+        std::list<std::string>::iterator lru_;
+    };
+
+    static const size_t max_directories_ = 256;
+
+    descriptor_t root();
+    descriptor_t directory(const std::string& relative);
+    // Open relative to dir without leaving the root, where the kernel can enforce that
+    int open_beneath(int dir, const std::string& relative, int flags);
+    // Open the file itself, through a cached directory when there is one
+    int open_file(const std::string& relative, int flags, std::error_code& ec);
+    // What the path leads to now, without opening it
+    bool stat_file(const std::string& relative, struct stat& st, std::error_code& ec);
+    // Must hold mutex_
+    void expire(std::chrono::steady_clock::time_point now);
+    void drop(const std::string& relative);
+
+    std::mutex mutex_;
+    descriptor_t root_fd_;
+    bool caching_;
+    // Bumped whenever the cached directories and files are dropped, so one opened across a change isn't cached
+    uint64_t generation_;
+    // Directory relative to the root (without a trailing slash) to its descriptor
+    std::unordered_map<std::string, descriptor_t> directories_;
+    // Open files by path relative to the root, with their paths from most to least recently used
+    std::unordered_map<std::string, CachedFile> files_;
+    std::list<std::string> lru_;
+    size_t max_files_;
+    std::chrono::steady_clock::duration inactive_;
+    std::chrono::steady_clock::duration valid_;
+    std::chrono::steady_clock::time_point expired_;
+    // Cleared if the kernel turns out not to have openat2
+    std::atomic<bool> beneath_;
+#endif
+    std::string root_;
+};
+
+#endif // ROOT_DIRECTORY_H
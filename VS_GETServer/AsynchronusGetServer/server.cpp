@@ -10,83 +10,566 @@
 */
 
 #include "server.h"
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
 
-// Writes string to log file
+// Writes string to log file; a prefork worker's messages say which worker it is
 void Server::write_to_standard_outputs(string str) {
-    std::cout << "SERVER:: " << str;
+    if (worker_ >= 0) std::cout << "WORKER " << worker_ << ":: " << str;
+    else std::cout << "SERVER:: " << str;
     if (logging_)
         log_writer_ << str;
 }
 
+// The client's address as the log shows it, - if the socket no longer knows it
+string Server::client_address(con_handle_t con_handle) {
+    boost::system::error_code ec;
+    auto remote = con_handle->socket_.remote_endpoint(ec);
+    return ec ? string("-") : remote.address().to_string();
+}
+
 void Server::close_connection(con_handle_t con_handle) {
+    boost::system::error_code ignored;
     con_handle->read_buffer_.consume(con_handle->read_buffer_.size());
-    con_handle->socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both);
+    con_handle->socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+}
+
+// Reads whatever is available into the connection's read buffer, through the TLS stream on secure connections and
+// straight from the socket otherwise. Callers make sure the buffer has room, a full one would complete the read empty
+template <typename Handler>
+void Server::async_read_some(con_handle_t con_handle, Handler handler) {
+    boost::asio::mutable_buffer space = con_handle->read_buffer_.prepare();
+    charge(con_handle, MemoryBudget::read_buffers, con_handle->read_buffer_.capacity());
+    if (con_handle->tls_)
+        con_handle->tls_->async_read_some(space, handler);
+    else
+        con_handle->socket_.async_read_some(space, handler);
+}
+
+// Writes go through the TLS stream on secure connections, unless the kernel is encrypting for us
+template <typename ConstBufferSequence, typename Handler>
+void Server::async_write_to(con_handle_t con_handle, const ConstBufferSequence& buffers, Handler handler) {
+    if (con_handle->tls_ && !con_handle->ktls_send_)
+        boost::asio::async_write(*con_handle->tls_, buffers, handler);
+    else
+        boost::asio::async_write(con_handle->socket_, buffers, handler);
+}
+
+// Remove the connection from the list, unless a read or write is still outstanding on it or the file I/O pool is
+// still preparing a response for it, in which case the removal is left to whichever of those finishes last
+// A WebSocket connection leaves its channel straight away, so nothing more is queued for it, and a proxied request
+// gives up its upstream connection, aborting whatever is outstanding on it
+void Server::erase_connection(con_handle_t con_handle) {
+    leave_channel(con_handle);
+    end_proxy(con_handle, false);
+    if (con_handle->io_pending_ || con_handle->reading_ || con_handle->writing_) {
+        con_handle->erase_pending_ = true;
+        return;
+    }
+    charge(con_handle, MemoryBudget::read_buffers, 0);
+    charge(con_handle, MemoryBudget::responses, 0);
+    m_connections_.erase(con_handle);
+    // With every accept held back and no connection left, nothing else would ever resume them
+    if (m_connections_.empty() && (paused_accepts_[0] || paused_accepts_[1]) && !relief_posted_) {
+        relief_posted_ = true;
+        boost::asio::post(m_ioservice_, boost::bind(&Server::relieve_pressure, this));
+    }
+}
+
+//////////////////////// MEMORY BUDGET ////////////////////////
+
+// Move what the connection holds in a category to bytes. When usage drops while accepts are held back and is under
+// the low water mark again, they are resumed from a fresh handler so the caller's state is left alone
+void Server::charge(con_handle_t con_handle, MemoryBudget::Category category, size_t bytes) {
+    bool shrinking = bytes < con_handle->memory_.bytes_[category];
+    memory_.charge(con_handle->memory_, category, bytes);
+    if (!shrinking || relief_posted_ || (!paused_accepts_[0] && !paused_accepts_[1]) || !memory_.relieved())
+        return;
+    relief_posted_ = true;
+    boost::asio::post(m_ioservice_, boost::bind(&Server::relieve_pressure, this));
+}
+
+// Whether the connection holds at least an average connection's share of the budget while it is exceeded
+// Such an HTTP/2 connection takes no new streams until usage is back down. It keeps reading all the same: its responses
+// can't finish without the client's WINDOW_UPDATE frames, and only reading notices the client going away. HTTP/1
+// connections are left alone, they carry a single request each
+bool Server::is_heavy(con_handle_t con_handle) {
+    if (!memory_.over() || draining_) return false;
+    MemoryBudget::Stats stats = memory_.stats();
+    size_t average = (stats.current_[MemoryBudget::read_buffers] + stats.current_[MemoryBudget::responses]) / std::max<size_t>(m_connections_.size(), 1);
+    return con_handle->memory_.total() >= average;
+}
+
+// Resume the accepts that were held back, once usage is back under the low water mark, dropping cached files to get
+// there if need be. With no connection left they are resumed whatever usage is, as nothing else would free any
+void Server::relieve_pressure() {
+    relief_posted_ = false;
+    if (!shed_caches() && !m_connections_.empty()) return;
+    for (int secure = 0; secure < 2; ++secure) {
+        for (; paused_accepts_[secure] > 0; --paused_accepts_[secure]) {
+            if (!draining_) start_accept(secure != 0);
+        }
+    }
+}
+
+// Runs on the file I/O pool after a file was added to a cache. Cached files are the cheapest thing to give up, so while
+// the budget is exceeded the least recently used ones are dropped across the sites before any client is held back
+void Server::trim_caches() {
+    memory_.set(MemoryBudget::file_cache, content_store_.stats().bytes_);
+    if (memory_.over()) shed_caches();
+}
+
+// Bring the caches' figure up to date and drop the least recently used files across the sites until usage is under the
+// low water mark or the caches are empty; returns whether usage is under it. Safe to call from any thread
+bool Server::shed_caches() {
+    memory_.set(MemoryBudget::file_cache, content_store_.stats().bytes_);
+    if (memory_.relieved()) return true;
+    MemoryBudget::Stats stats = memory_.stats();
+    if (stats.current_[MemoryBudget::file_cache] == 0) return false;
+
+    size_t excess = stats.total_ - stats.budget_ / 10 * 9;
+    for (const auto& host : hosts_.hosts()) {
+        size_t dropped = host->cache_.trim(excess);
+        excess -= std::min(excess, dropped);
+        if (excess == 0) break;
+    }
+    memory_.set(MemoryBudget::file_cache, content_store_.stats().bytes_);
+    return memory_.relieved();
+}
+
+// A prefork worker looks files up in the cache all the workers share, any other server in the site's own
+FileCache::blob_t Server::find_cached(const string& filePath, VirtualHost& host, const RootDirectory::OpenFile& opened) {
+#ifndef _WIN32
+    if (shared_cache_) return shared_cache_->find(filePath, opened.modified_, opened.size_);
+#endif
+    return host.cache_.find(filePath, opened.modified_, opened.size_);
+}
+
+// The shared cache is a segment of fixed size outside the memory budget, so only the sites' caches need trimming
+void Server::cache_file(const string& filePath, VirtualHost& host, std::filesystem::file_time_type modified, const FileCache::blob_t& file) {
+#ifndef _WIN32
+    if (shared_cache_) {
+        shared_cache_->insert(filePath, modified, file);
+        return;
+    }
+#endif
+    host.cache_.insert(filePath, modified, file);
+    trim_caches();
 }
 
 // Handle what happens after asynchronous read
 // Reads the request and passes the connection handler with request attached into write_response()
 void Server::handle_read(con_handle_t con_handle, boost::system::error_code const& err, size_t bytes_transfered) {
-    if (bytes_transfered > 0) {
-        std::istream is(&con_handle->read_buffer_);
-        std::istreambuf_iterator<char> eos;
-        string tempreq(std::istreambuf_iterator<char>(is), eos);
-        con_handle->request_ = tempreq;
+    con_handle->reading_ = false;
+    if (con_handle->erase_pending_) {
+        erase_connection(con_handle);
+        return;
     }
 
     if (!err) {
+        RequestBuffer& buffer = con_handle->read_buffer_;
+        buffer.commit(bytes_transfered);
+        size_t head_len = 0;
+        RequestHead head = scan_request_head(buffer.data(), buffer.size(), head_len);
+        if (head == RequestHead::incomplete) {
+            do_async_read(con_handle);
+            return;
+        }
+        con_handle->request_started_ = std::chrono::steady_clock::now();
+        if (head != RequestHead::complete) {
+            reject_request(con_handle, head);
+            return;
+        }
+        con_handle->request_.assign(buffer.data(), head_len);
+
+        // A client with prior knowledge of HTTP/2 opens with the connection preface instead of a request
+        if (options_.http2_ && con_handle->request_.compare(0, 14, "PRI * HTTP/2.0") == 0) {
+            string initial(buffer.data(), buffer.size());
+            buffer.consume(buffer.size());
+            start_http2(con_handle, initial);
+            return;
+        }
+        buffer.consume(head_len);
+        // An upgrade to WebSocket takes the connection away from HTTP, along with anything read after the request
+        if (!options_.websocket_path_.empty() && is_websocket_upgrade(con_handle->request_)) {
+            start_websocket(con_handle);
+            return;
+        }
+        // A request under a proxied prefix goes to its upstream, which takes over reading the rest of it
+        Upstream* upstream = proxy_.find(request_target(con_handle->request_));
+        if (upstream) {
+            start_proxy(con_handle, upstream);
+            return;
+        }
         do_async_read(con_handle);
         write_response(con_handle);
     }
-    else if (err == boost::asio::error::eof) {}
+    // The client is done sending; if a response is on its way the connection is closed once it is written
+    else if (err == boost::asio::error::eof) {
+        if (!con_handle->io_pending_ && !con_handle->writing_) {
+            close_connection(con_handle);
+            erase_connection(con_handle);
+        }
+    }
     else {
         std::cerr << "ERROR:: " << err.message() << std::endl;;
         if (con_handle != m_connections_.end()) {
             close_connection(con_handle);
-            m_connections_.erase(con_handle);
+            erase_connection(con_handle);
         }
     }
 }
 
-// Perform an asynchronous read on the connecction until the end of the request marked by \r\n\r\n
+// Perform an asynchronous read on the connecction, handle_read() keeps reading until the end of the request marked by \r\n\r\n
 void Server::do_async_read(con_handle_t con_handle) {
+    con_handle->reading_ = true;
     auto handler = boost::bind(&Server::handle_read, this, con_handle, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred);
-    boost::asio::async_read_until(con_handle->socket_, con_handle->read_buffer_, "\r\n\r\n", handler);
+    async_read_some(con_handle, handler);
+}
+
+// Check the part of a request head read so far against the size limits; head_len is set once the blank line ending it arrives
+// Only complete lines count towards the header fields, and a head still unfinished when it fills the buffer is too large
+Server::RequestHead Server::scan_request_head(const char* data, size_t size, size_t& head_len) const {
+    static const char crlf[] = "\r\n";
+    const char* end = data + size;
+    const char* line_end = std::search(data, end, crlf, crlf + 2);
+    if ((size_t)(line_end - data) > options_.max_request_line_) return RequestHead::line_too_long;
+
+    size_t fields = 0;
+    const char* pos = line_end;
+    while (pos != end) {
+        pos += 2;
+        const char* next = std::search(pos, end, crlf, crlf + 2);
+        if (next == end) break;
+        if (next == pos) {
+            head_len = next + 2 - data;
+            return head_len > options_.max_request_header_bytes_ ? RequestHead::headers_too_large : RequestHead::complete;
+        }
+        if (++fields > options_.max_request_headers_) return RequestHead::headers_too_large;
+        pos = next;
+    }
+    return size >= options_.max_request_header_bytes_ ? RequestHead::headers_too_large : RequestHead::incomplete;
+}
+
+// Refuse a request that broke a size limit. Nothing more is read; the connection closes once the response is written
+void Server::reject_request(con_handle_t con_handle, RequestHead head) {
+    RequestBuffer& buffer = con_handle->read_buffer_;
+    const char* data = buffer.data();
+    size_t shown = std::find_if(data, data + std::min(buffer.size(), (size_t)64), [](char c) { return c == '\r' || c == '\n'; }) - data;
+    string req = string(data, shown) + "...\r\n";
+    buffer.consume(buffer.size());
+
+    response_t resinfo = formulate_error_response(head == RequestHead::line_too_long ? "414 URI Too Long" : "431 Request Header Fields Too Large");
+    send_response(con_handle, req, resinfo);
 }
 
 // Handle what happens after the response is sent
-// Checks if there is still binary data to be sent via isFinished parameter
-// If there isn't close the connection and clear the streambuf
-void Server::handle_response(con_handle_t con_handle, std::shared_ptr<string> msg_buffer, bool isFinished, boost::system::error_code const& err) {
-    if (!err && isFinished) {
-        if (con_handle->socket_.is_open()) {
-            close_connection(con_handle);
+// The header and any binary body go out in a single write, and a body sent from its file right after, so once that
+// completes close the connection and clear the read buffer
+// A corked connection is uncorked first so the tail of the response isn't held back
+// The connection is removed once the read still waiting on it sees the shutdown
+void Server::handle_response(con_handle_t con_handle, std::shared_ptr<response_t> resinfo, boost::system::error_code const& err) {
+    con_handle->writing_ = false;
+    if (err)
+        std::cerr << "ERROR:: " << err.message() << std::endl;
+    if ((con_handle->tls_ ? options_.tls_socket_tuning_ : options_.socket_tuning_).cork_)
+        set_cork(con_handle->socket_, false);
+    charge(con_handle, MemoryBudget::responses, 0);
+    close_connection(con_handle);
+    erase_connection(con_handle);
+}
+
+// Hand the request off to the file I/O pool so that no file system work happens on the io_service thread
+// The response is sent by send_response() once the pool posts its result back
+void Server::write_response(con_handle_t con_handle) {
+
+    string req(con_handle->request_);
+    if (!options_.trace_admin_path_.empty() && answer_trace_admin(con_handle, req, 0))
+        return;
+    VirtualHost* host = &hosts_.find(parse_header(req, "host"));
+    string reqfile = parse_get(req.c_str(), host->root_);
+    string validator = parse_header(req, "if-none-match");
+    if (respond_from_memory(con_handle, host, req, reqfile, validator, accepts_gzip(parse_header(req, "accept-encoding")), 0))
+        return;
+    if (options_.early_hints_)
+        send_early_hints(con_handle, *host, reqfile, 0);
+
+    ++con_handle->io_pending_;
+    bool file_body = takes_file_body(con_handle);
+    auto job = [this, con_handle, host, req, reqfile, validator, file_body]() { load_response(con_handle, host, req, reqfile, validator, file_body, FileIOPool::Lane::fast, 0); };
+    if (!file_io_pool_.post(FileIOPool::Lane::fast, job)) {
+        --con_handle->io_pending_;
+        response_t resinfo = formulate_unavailable_response();
+        send_response(con_handle, req, resinfo);
+    }
+}
+
+// Runs on the file I/O pool
+// Files above the bulk threshold are moved from the fast lane to the bulk lane before being read, then the
+// finished response is posted back to the io_service thread. A non-zero stream ID marks an HTTP/2 request
+// validator is the request's If-None-Match header, if any, and file_body says the connection can take a body sent
+// with sendfile(); a file that will be sent that way is never read, so it stays on the fast lane
+// Large files are the first work to go while the memory budget is exceeded, checked again once the bulk lane gets to
+// them; a built response counts against the budget from the moment it exists until its connection takes it over
+void Server::load_response(con_handle_t con_handle, VirtualHost* host, string req, string reqfile, string validator, bool file_body, FileIOPool::Lane lane, uint32_t stream_id) {
+    bool shed = lane == FileIOPool::Lane::bulk && memory_.over();
+    if (lane == FileIOPool::Lane::fast && reqfile.compare(0, host->root_.size(), host->root_) == 0) {
+        std::error_code ec;
+        RootDirectory::file_t file = host->directory_.open(reqfile.substr(host->root_.size()), ec);
+        if (file && file->size_ > options_.file_io_bulk_threshold_ && !(file_body && sends_file(file->size_))) {
+            shed = memory_.over();
+            auto job = [this, con_handle, host, req, reqfile, validator, file_body, stream_id]() { load_response(con_handle, host, req, reqfile, validator, file_body, FileIOPool::Lane::bulk, stream_id); };
+            if (!shed && file_io_pool_.post(FileIOPool::Lane::bulk, job)) return;
         }
     }
-    else if (err) {
-        std::cerr << "ERROR:: " << err.message() << std::endl;;
-        if (con_handle != m_connections_.end()) {
-            close_connection(con_handle);
-            m_connections_.erase(con_handle);
+
+    if (shed) {
+        memory_.note_shed();
+        post_response(con_handle, req, std::make_shared<response_t>(formulate_unavailable_response()), stream_id);
+        return;
+    }
+
+    // A large body is hashed and copied on the task pool, so this thread can get on with the next read; while the pool
+    // is full it is built here as before. What was read counts against the memory budget while it waits
+    auto loaded = std::make_shared<LoadedFile>(load_file(reqfile, *host, validator, file_body));
+    if (loaded->body_bytes() >= options_.task_min_bytes_) {
+        auto pending = std::make_shared<MemoryBudget::Charge>();
+        memory_.charge(*pending, MemoryBudget::responses, loaded->read_ ? loaded->contents_.size() : 0);
+        auto task = [this, con_handle, host, req, reqfile, validator, loaded, pending, stream_id]() {
+            memory_.charge(*pending, MemoryBudget::responses, 0);
+            post_response(con_handle, req, std::make_shared<response_t>(build_response(reqfile, *host, validator, *loaded)), stream_id);
+        };
+        if (task_pool_.post(task)) return;
+        memory_.charge(*pending, MemoryBudget::responses, 0);
+    }
+    post_response(con_handle, req, std::make_shared<response_t>(build_response(reqfile, *host, validator, *loaded)), stream_id);
+}
+
+// Runs on the file I/O pool: hand a built response back to the io_service thread to be sent
+void Server::post_response(con_handle_t con_handle, const string& req, std::shared_ptr<response_t> resinfo, uint32_t stream_id) {
+    auto pending = std::make_shared<MemoryBudget::Charge>();
+    memory_.charge(*pending, MemoryBudget::responses, std::get<0>(*resinfo).size() + std::get<2>(*resinfo).size());
+    boost::asio::post(m_ioservice_, [this, con_handle, req, resinfo, pending, stream_id]() {
+        memory_.charge(*pending, MemoryBudget::responses, 0);
+        --con_handle->io_pending_;
+        if (con_handle->erase_pending_) {
+            erase_connection(con_handle);
+            return;
         }
+        if (stream_id)
+            send_http2_response(con_handle, stream_id, req, resinfo);
+        else
+            send_response(con_handle, req, *resinfo);
+    });
+}
+
+// Answer a request for a file held in memory, in the embedded bundle or the site's asset pack, returning false if neither has it
+// There is no file system work to do, so small files are answered on the spot; large ones are copied out on the bulk
+// lane, where the pages of a pack that isn't in memory yet are read in without holding up the io_service thread
+// Files known to be missing are answered with a 404 on the spot as well: anything the embedded bundle doesn't have
+// while it is served on its own, and paths the site recently found missing
+bool Server::respond_from_memory(con_handle_t con_handle, VirtualHost* host, const string& req, const string& reqfile, const string& validator, bool gzip, uint32_t stream_id) {
+    AssetPack::Asset asset;
+    bool in_root = reqfile.compare(0, host->root_.size(), host->root_) == 0;
+    if (embedded_) {
+        const EmbeddedAsset* embedded = in_root ? embedded_->find(std::string_view(reqfile).substr(host->root_.size())) : nullptr;
+        if (!embedded) {
+            deliver_response(con_handle, req, std::make_shared<response_t>(formulate_response(reqfile, *host, validator, false)), stream_id);
+            return true;
+        }
+        asset.body_ = reinterpret_cast<const char*>(embedded->body_);
+        asset.body_bytes_ = embedded->body_bytes_;
+        asset.gzip_ = reinterpret_cast<const char*>(embedded->gzip_);
+        asset.gzip_bytes_ = embedded->gzip_bytes_;
+        asset.header_ = embedded->header_;
+        asset.etag_ = embedded->etag_;
+        asset.binary_ = embedded->binary_;
+    }
+    else if (!host->pack_ || !in_root || !host->pack_->find(reqfile.substr(host->root_.size()), asset)) {
+        if (!host->missing_.contains(reqfile)) return false;
+        deliver_response(con_handle, req, std::make_shared<response_t>(formulate_not_found_response(*host)), stream_id);
+        return true;
+    }
+
+    if (asset.body_bytes_ <= options_.file_io_bulk_threshold_) {
+        deliver_response(con_handle, req, std::make_shared<response_t>(formulate_packed_response(*host, asset, validator, gzip)), stream_id);
+        return true;
+    }
+
+    ++con_handle->io_pending_;
+    auto job = [this, con_handle, host, req, asset, validator, gzip, stream_id]() {
+        bool shed = memory_.over();
+        if (shed) memory_.note_shed();
+        post_response(con_handle, req, std::make_shared<response_t>(shed ? formulate_unavailable_response() : formulate_packed_response(*host, asset, validator, gzip)), stream_id);
+    };
+    if (!file_io_pool_.post(FileIOPool::Lane::bulk, job)) {
+        --con_handle->io_pending_;
+        deliver_response(con_handle, req, std::make_shared<response_t>(formulate_unavailable_response()), stream_id);
     }
+    return true;
 }
 
-// Create and send a proper HTTP response to the request
-void Server::write_response(con_handle_t con_handle) {
+// Send a response built on the io_service thread, on its HTTP/2 stream or as the HTTP/1 reply
+void Server::deliver_response(con_handle_t con_handle, const string& req, std::shared_ptr<response_t> resinfo, uint32_t stream_id) {
+    if (stream_id)
+        send_http2_response(con_handle, stream_id, req, resinfo);
+    else
+        send_response(con_handle, req, *resinfo);
+}
 
-    string req(con_handle->request_);
+// Create and send a proper HTTP response to the request
+// If early hints are still being written the response is sent once they are done
+void Server::send_response(con_handle_t con_handle, const string& req, response_t& resinfo) {
 
-    string reqfile = parse_get(req.c_str());
-    std::tuple<string, bool, vector<unsigned char>> resinfo = formulate_response(reqfile);
-    bool isBinary = std::get<1>(resinfo);
-    vector<unsigned char> fileBuff = std::get<2>(resinfo);
+    auto res = std::make_shared<response_t>(std::move(resinfo));
+    charge(con_handle, MemoryBudget::responses, std::get<0>(*res).size() + std::get<2>(*res).size());
+    if (con_handle->writing_) {
+        con_handle->deferred_response_ = [this, con_handle, req, res]() { send_response(con_handle, req, *res); };
+        return;
+    }
+    string* buff = &std::get<0>(*res);
+    bool isBinary = std::get<1>(*res);
+    vector<unsigned char>& fileBuff = std::get<2>(*res);
     size_t binarySize = fileBuff.size();
-    auto buff = std::make_shared<string>(std::get<0>(resinfo));
+    const RootDirectory::file_t& file = std::get<3>(*res);
+
+    log_response(con_handle, req, *buff, binarySize + (*buff).size() + (file ? (size_t)file->size_ : 0), con_handle->request_started_);
+
+    // Header and body are sent as one gathered write; two overlapping writes are not allowed on a TLS stream
+    // The acknowledgment that used to be written on accept goes out in front of the first response instead, since
+    // nothing may precede the server preface on a connection that turns out to be HTTP/2
+    static const string acknowledgment = "\r\n\r\n";
+    std::vector<boost::asio::const_buffer> buffers;
+    if (!con_handle->acknowledged_) {
+        buffers.push_back(boost::asio::buffer(acknowledgment));
+        con_handle->acknowledged_ = true;
+    }
+    buffers.push_back(boost::asio::buffer(*buff));
+    if (isBinary && binarySize > 0)
+        buffers.push_back(boost::asio::buffer(fileBuff));
+    if ((con_handle->tls_ ? options_.tls_socket_tuning_ : options_.socket_tuning_).cork_)
+        set_cork(con_handle->socket_, true);
+    con_handle->writing_ = true;
+    if (file) {
+        auto handler = boost::bind(&Server::send_file_body, this, con_handle, res, 0, boost::asio::placeholders::error);
+        async_write_to(con_handle, buffers, handler);
+        return;
+    }
+    auto handler = boost::bind(&Server::handle_response, this, con_handle, res, boost::asio::placeholders::error);
+    async_write_to(con_handle, buffers, handler);
+}
+
+// Whether a file this size is sent with sendfile() to connections that can take it
+bool Server::sends_file(uintmax_t size) const {
+#if defined(__linux__)
+    return options_.sendfile_threshold_ && size >= options_.sendfile_threshold_;
+#else
+    return false;
+#endif
+}
+
+// sendfile() writes to the socket itself, so the connection must be plain TCP or have the kernel encrypting for it
+// Only HTTP/1 responses come through here, HTTP/2 frames its bodies
+bool Server::takes_file_body(con_handle_t con_handle) const {
+    return !con_handle->tls_ || con_handle->ktls_send_;
+}
+
+// Send a response's body from its open file once the header is written, as much as the socket takes at a time
+// Whenever the socket is full the rest waits for it to drain, carrying on from offset. A file cut short since it was
+// opened can't fill the Content-Length already sent, so the connection is closed early and the client sees that
+void Server::send_file_body(con_handle_t con_handle, std::shared_ptr<response_t> resinfo, uint64_t offset, boost::system::error_code const& err) {
+    boost::system::error_code ec = err;
+#if defined(__linux__)
+    const RootDirectory::OpenFile& file = *std::get<3>(*resinfo);
+    if (!ec) con_handle->socket_.native_non_blocking(true, ec);
+    while (!ec && offset < file.size_) {
+        off_t at = (off_t)offset;
+        ssize_t sent = ::sendfile(con_handle->socket_.native_handle(), file.fd_, &at, (size_t)std::min<uint64_t>(file.size_ - offset, 1 << 30));
+        if (sent > 0) {
+            offset = (uint64_t)at;
+        }
+        else if (sent == 0) {
+            ec = boost::asio::error::eof;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            con_handle->socket_.async_wait(boost::asio::ip::tcp::socket::wait_write,
+                boost::bind(&Server::send_file_body, this, con_handle, resinfo, offset, boost::asio::placeholders::error));
+            return;
+        }
+        else if (errno == EPIPE || errno == ECONNRESET) {
+            // The client went away part way through the body, which is no error of the server's
+            break;
+        }
+        else if (errno != EINTR) {
+            ec = boost::system::error_code(errno, boost::system::system_category());
+        }
+    }
+#endif
+    handle_response(con_handle, resinfo, ec);
+}
+
+// Record the response in the request log and, for the requests debug tracing samples, print the server's state
+// With the binary format the request goes into a fixed width record, along with the latency since started, and
+// nothing is formatted or printed
+void Server::log_response(con_handle_t con_handle, const string& req, const string& header, size_t size, std::chrono::steady_clock::time_point started) {
+    if (logging_ && options_.log_format_ == LogFormat::binary) {
+        boost::system::error_code ec;
+        auto remote = con_handle->socket_.remote_endpoint(ec);
+        boost::asio::ip::address_v6::bytes_type address = {};
+        if (!ec)
+            address = (remote.address().is_v4() ? boost::asio::ip::make_address_v6(boost::asio::ip::v4_mapped, remote.address().to_v4()) : remote.address().to_v6()).to_bytes();
+        auto now = std::chrono::steady_clock::now();
+        int64_t unix_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        uint64_t latency_us = std::chrono::duration_cast<std::chrono::microseconds>(now - started).count();
+        uint16_t status = header.size() >= 12 ? (uint16_t)std::atoi(header.c_str() + 9) : 0;
+        binary_log_.record(unix_ms, address.data(), req.substr(0, req.find_first_of("\r\n")), status, size, (uint32_t)std::min<uint64_t>(latency_us, UINT32_MAX));
+    }
+    else
+        log_text(con_handle, req, header, size);
+    if (!trace_.on() || !trace_.sample(client_address(con_handle), request_target(req))) return;
+
+    FileIOPool::Stats io_stats = file_io_pool_.stats();
+    std::cout << "DEBUG:: Request received by connection: " << split_string(req, '\n')[0] << std::endl;
+    std::cout << "DEBUG:: File I/O queue depth: " << io_stats.fast_queued_ << " fast, " << io_stats.bulk_queued_ << " bulk (peak " << io_stats.peak_queued_ << "), "
+        << "max wait: " << io_stats.max_wait_us_ << "us, rejected: " << io_stats.rejected_ << std::endl;
+    TaskPool::Stats task_stats = task_pool_.stats();
+    std::cout << "DEBUG:: Task pool: " << task_stats.queued_ << " queued (peak " << task_stats.peak_queued_ << "), " << task_stats.completed_ << " done, "
+        << task_stats.stolen_ << " stolen, " << task_stats.rejected_ << " built in place" << std::endl;
+    BufferPool::Stats buffer_stats = request_buffers_.stats();
+    std::cout << "DEBUG:: Request buffers: " << buffer_stats.in_use_ << " in use (peak " << buffer_stats.peak_in_use_ << "), "
+        << buffer_stats.free_ << " pooled, " << buffer_stats.overflows_ << " overflowed" << std::endl;
+    MemoryBudget::Stats memory = memory_.stats();
+    std::cout << "DEBUG:: Memory: " << memory.total_ << " bytes (peak " << memory.peak_total_ << ")";
+    for (int category = 0; category < MemoryBudget::category_count; ++category)
+        std::cout << ", " << MemoryBudget::category_name((MemoryBudget::Category)category) << " " << memory.current_[category];
+    std::cout << std::endl;
+    std::cout << "DEBUG::\n==================================================\nRESPONSE:\n" << header << "\n==================================================" << std::endl << std::endl;
+}
+
+// Write out the binary log's records every second, so a quiet server doesn't keep the last ones to itself
+void Server::flush_log(boost::system::error_code const& err) {
+    if (err) return;
+    binary_log_.flush();
+    m_log_flush_timer_.expires_after(std::chrono::seconds(1));
+    m_log_flush_timer_.async_wait(boost::bind(&Server::flush_log, this, boost::asio::placeholders::error));
+}
 
-    // Output to console and log
+// Write the request line and outcome to the console and log in the common log format
+void Server::log_text(con_handle_t con_handle, const string& req, const string& header, size_t size) {
     time_t now = time(0);
-    char* dt = new char[26];
-    ctime_s(dt, 26, &now);
+    char dt[26];
+#ifdef _WIN32
+    ctime_s(dt, sizeof(dt), &now);
+#else
+    ctime_r(&now, dt);
+#endif
     string date = dt;
     std::replace(date.begin(), date.end(), ' ', '_');
     std::replace(date.begin(), date.end(), '\n', '\0');
@@ -94,99 +577,1581 @@ void Server::write_response(con_handle_t con_handle) {
     string temp = split_string(req, '\n')[0];
     string log_req = temp.substr(0, temp.length() - 1);
 
-    string log_entry = con_handle->socket_.remote_endpoint().address().to_string() +
+    string log_entry = client_address(con_handle) +
         " - - [" + date + "] \"" +
-        log_req + "\" " + split_string(*buff, ' ')[1] +
-        " " + std::to_string(binarySize + (*buff).size());
+        log_req + "\" " + split_string(header, ' ')[1] +
+        " " + std::to_string(size);
     write_to_standard_outputs(log_entry);
     std::cout << std::endl;
     
     if (logging_) log_writer_ << std::endl;
+}
+
+// Tell the client which chunks a web app's page needs while the page itself is still being read, so the browser
+// can start fetching them straight away. Over HTTP/1 the hints are only sent if nothing else is being written
+void Server::send_early_hints(con_handle_t con_handle, const VirtualHost& host, const string& reqfile, uint32_t stream_id) {
+    const AssetManifests::Asset* asset = host.assets_.find(reqfile);
+    if (!asset || asset->preload_.empty()) return;
+
+    if (stream_id) {
+        con_handle->h2_->submit_informational(stream_id, 103, header_list_t{ { "link", asset->preload_ } });
+        return;
+    }
+    if (con_handle->writing_) return;
+    auto hints = std::make_shared<string>();
+    if (!con_handle->acknowledged_) {
+        hints->append("\r\n\r\n");
+        con_handle->acknowledged_ = true;
+    }
+    hints->append("HTTP/1.1 103 Early Hints\r\nLink: ").append(asset->preload_).append("\r\n\r\n");
+    con_handle->writing_ = true;
+    auto handler = boost::bind(&Server::handle_early_hints, this, con_handle, hints, boost::asio::placeholders::error);
+    async_write_to(con_handle, boost::asio::buffer(*hints), handler);
+}
+
+// Handle what happens after early hints are written, sending the response if it became ready in the meantime
+void Server::handle_early_hints(con_handle_t con_handle, std::shared_ptr<string> hints, boost::system::error_code const& err) {
+    con_handle->writing_ = false;
+    if (con_handle->erase_pending_) {
+        erase_connection(con_handle);
+        return;
+    }
+    if (err) {
+        close_connection(con_handle);
+        erase_connection(con_handle);
+        return;
+    }
+    if (con_handle->deferred_response_) {
+        std::function<void()> respond;
+        respond.swap(con_handle->deferred_response_);
+        respond();
+    }
+}
+
+// Start reading the client's request, or speak HTTP/2 straight away if it was negotiated through ALPN
+void Server::begin_session(con_handle_t con_handle) {
+    if (con_handle->tls_ && options_.http2_) {
+        const unsigned char* protocol = nullptr;
+        unsigned int len = 0;
+        SSL_get0_alpn_selected(con_handle->tls_->native_handle(), &protocol, &len);
+        if (len == 2 && protocol[0] == 'h' && protocol[1] == '2') {
+            start_http2(con_handle, string());
+            return;
+        }
+    }
+    do_async_read(con_handle);
+}
+
+//////////////////////// HTTP/2 ////////////////////////
+
+// Switch the connection over to HTTP/2, feeding the session anything that was already read
+void Server::start_http2(con_handle_t con_handle, const string& initial) {
+    if (traced(con_handle))
+        std::cout << "DEBUG:: Connection switched to HTTP/2" << (con_handle->tls_ ? " (h2)" : " (h2c)") << std::endl;
+    con_handle->h2_.reset(new Http2Session(options_.http2_max_concurrent_streams_, options_.max_request_header_bytes_, options_.max_request_headers_));
+    // Responses go out as a series of small frame writes, which Nagle's algorithm would hold back behind delayed ACKs
+    boost::system::error_code ec;
+    con_handle->socket_.set_option(boost::asio::ip::tcp::no_delay(true), ec);
+    con_handle->acknowledged_ = true;
+    if (!initial.empty())
+        receive_http2(con_handle, initial.data(), initial.size());
+    flush_http2(con_handle);
+    if (!con_handle->h2_->failed())
+        do_http2_read(con_handle);
+}
+
+void Server::do_http2_read(con_handle_t con_handle) {
+    con_handle->reading_ = true;
+    auto handler = boost::bind(&Server::handle_http2_read, this, con_handle, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred);
+    async_read_some(con_handle, handler);
+}
+
+// Handle what happens after reading from an HTTP/2 connection
+// The connection is closed when the client goes away or breaks the protocol; in the latter case after our GOAWAY is written
+void Server::handle_http2_read(con_handle_t con_handle, boost::system::error_code const& err, size_t bytes_transfered) {
+    con_handle->reading_ = false;
+    if (con_handle->erase_pending_) {
+        erase_connection(con_handle);
+        return;
+    }
+    if (err) {
+        if (err != boost::asio::error::eof && traced(con_handle))
+            std::cout << "DEBUG:: HTTP/2 connection closed: " << err.message() << std::endl;
+        close_connection(con_handle);
+        erase_connection(con_handle);
+        return;
+    }
+
+    // The session copies what it is given, so the whole buffer is free again for the next read
+    RequestBuffer& buffer = con_handle->read_buffer_;
+    buffer.commit(bytes_transfered);
+    size_t refused = con_handle->h2_->refused_streams();
+    con_handle->h2_->refuse_streams(is_heavy(con_handle));
+    receive_http2(con_handle, buffer.data(), buffer.size());
+    memory_.note_refused_streams(con_handle->h2_->refused_streams() - refused);
+    buffer.consume(buffer.size());
+    flush_http2(con_handle);
+    if (!con_handle->h2_->failed())
+        do_http2_read(con_handle);
+}
+
+// Pass bytes to the session and send each completed request through the same file lookup as HTTP/1
+void Server::receive_http2(con_handle_t con_handle, const char* data, size_t len) {
+    std::vector<Http2Session::Request> requests;
+    con_handle->h2_->receive(data, len, requests);
+
+    for (const auto& request : requests) {
+        string req = request.method_ + " " + request.path_ + " HTTP/2.0\r\n";
+        // Clients send :authority in place of Host, though a Host header is allowed too
+        string authority = request.authority_;
+        string validator;
+        bool gzip = false;
+        for (const auto& header : request.headers_) {
+            if (header.first == "host" && authority.empty()) authority = header.second;
+            else if (header.first == "if-none-match") validator = header.second;
+            else if (header.first == "accept-encoding") gzip = accepts_gzip(header.second);
+        }
+        uint32_t stream_id = request.stream_id_;
+        if (request.oversized_) {
+            send_http2_response(con_handle, stream_id, req, std::make_shared<response_t>(formulate_error_response("431 Request Header Fields Too Large")));
+            continue;
+        }
+        // Request bodies aren't read on HTTP/2, so proxied paths send the client back to HTTP/1.1 for the request
+        if (proxy_.find(request.path_)) {
+            con_handle->h2_->require_http1(stream_id);
+            continue;
+        }
+        if (!options_.trace_admin_path_.empty() && answer_trace_admin(con_handle, req, stream_id))
+            continue;
+        VirtualHost* host = &hosts_.find(authority);
+        string reqfile = parse_get(req.c_str(), host->root_);
+        if (respond_from_memory(con_handle, host, req, reqfile, validator, gzip, stream_id))
+            continue;
+        if (options_.early_hints_)
+            send_early_hints(con_handle, *host, reqfile, stream_id);
+
+        ++con_handle->io_pending_;
+        auto job = [this, con_handle, host, req, reqfile, validator, stream_id]() { load_response(con_handle, host, req, reqfile, validator, false, FileIOPool::Lane::fast, stream_id); };
+        if (!file_io_pool_.post(FileIOPool::Lane::fast, job)) {
+            --con_handle->io_pending_;
+            send_http2_response(con_handle, stream_id, req, std::make_shared<response_t>(formulate_unavailable_response()));
+        }
+    }
+}
+
+// Convert the HTTP/1 response built by formulate_response() into an HTTP/2 response on the given stream
+// Header names are lower cased and headers that are connection specific or malformed are dropped; the body is not copied
+void Server::send_http2_response(con_handle_t con_handle, uint32_t stream_id, const string& req, std::shared_ptr<response_t> resinfo) {
+    if (!con_handle->h2_) return;
+    const string& response = std::get<0>(*resinfo);
+    const vector<unsigned char>& fileBuff = std::get<2>(*resinfo);
+
+    size_t header_end = response.find("\r\n\r\n");
+    if (response.size() < 12 || header_end == string::npos) {
+        con_handle->h2_->submit_response(stream_id, 500, header_list_t(), nullptr, 0, nullptr);
+        flush_http2(con_handle);
+        return;
+    }
+    int status = std::atoi(response.c_str() + 9);
+
+    header_list_t headers;
+    size_t line_start = response.find("\r\n") + 2;
+    while (line_start < header_end) {
+        size_t line_end = response.find("\r\n", line_start);
+        string line = response.substr(line_start, line_end - line_start);
+        line_start = line_end + 2;
+
+        size_t colon = line.find(':');
+        if (colon == string::npos) continue;
+        string name = line.substr(0, colon);
+        string value = line.substr(colon + 1);
+        name.erase(name.find_last_not_of(' ') + 1);
+        value.erase(0, value.find_first_not_of(' '));
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+
+        bool valid = !name.empty() && name.find_first_not_of("abcdefghijklmnopqrstuvwxyz0123456789-") == string::npos
+            && value.find_first_of("\r\n") == string::npos;
+        if (!valid || name == "connection" || name == "content-length" || name == "content-transfer-encoding"
+            || name == "keep-alive" || name == "transfer-encoding")
+            continue;
+        headers.emplace_back(name, value);
+    }
+
+    const char* body = response.data() + header_end + 4;
+    size_t body_len = response.size() - header_end - 4;
+    if (!fileBuff.empty()) {
+        body = reinterpret_cast<const char*>(fileBuff.data());
+        body_len = fileBuff.size();
+    }
+
+    log_response(con_handle, req, response.substr(0, header_end), body_len, con_handle->h2_->opened_at(stream_id));
+    con_handle->h2_->submit_response(stream_id, status, headers, body, body_len, resinfo);
+    flush_http2(con_handle);
+}
 
-    if (debugging_) {
-        std::cout << "DEBUG:: Request received by connection: " << split_string(req, '\n')[0] << std::endl;
-        std::cout << "DEBUG::\n==================================================\nRESPONSE:\n" << *buff << "\n==================================================" << std::endl << std::endl;
+// Write whatever frames the session has ready, one write at a time
+void Server::flush_http2(con_handle_t con_handle) {
+    if (con_handle->writing_ || !con_handle->h2_) return;
+    charge(con_handle, MemoryBudget::responses, con_handle->h2_->held_bytes());
+    std::vector<boost::asio::const_buffer> buffers;
+    auto pins = std::make_shared<std::vector<std::shared_ptr<const void>>>();
+    if (!con_handle->h2_->collect_output(buffers, *pins)) {
+        if (con_handle->h2_->failed() || con_handle->h2_->drained()) {
+            close_connection(con_handle);
+            erase_connection(con_handle);
+        }
+        return;
     }
+    con_handle->writing_ = true;
+    auto handler = boost::bind(&Server::handle_http2_write, this, con_handle, pins, boost::asio::placeholders::error);
+    async_write_to(con_handle, buffers, handler);
+}
 
+// Handle what happens after frames are written, the buffers they referenced are released with pins
+void Server::handle_http2_write(con_handle_t con_handle, std::shared_ptr<std::vector<std::shared_ptr<const void>>> pins, boost::system::error_code const& err) {
+    con_handle->writing_ = false;
+    if (con_handle->erase_pending_) {
+        erase_connection(con_handle);
+        return;
+    }
+    if (err) {
+        close_connection(con_handle);
+        erase_connection(con_handle);
+        return;
+    }
+    flush_http2(con_handle);
+}
 
-    auto handler = boost::bind(&Server::handle_response, this, con_handle, buff, !isBinary, boost::asio::placeholders::error);
-    boost::asio::async_write(con_handle->socket_, boost::asio::buffer(*buff), handler);
+//////////////////////// WEBSOCKET ////////////////////////
+
+// Whether the request asks to upgrade to WebSocket on a path under the WebSocket prefix
+bool Server::is_websocket_upgrade(const string& req) {
+    if (req.compare(0, 4, "GET ") != 0 || request_target(req).compare(0, options_.websocket_path_.size(), options_.websocket_path_) != 0)
+        return false;
+    string upgrade = parse_header(req, "upgrade");
+    string connection = parse_header(req, "connection");
+    std::transform(upgrade.begin(), upgrade.end(), upgrade.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    std::transform(connection.begin(), connection.end(), connection.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    return upgrade == "websocket" && connection.find("upgrade") != string::npos;
+}
 
-    if (isBinary) {
-        char* fileBuffArr = new char[binarySize];
-        size_t i = 0;
-        for_each(fileBuff.begin(), fileBuff.end(), [&](unsigned char c) {
-            fileBuffArr[i] = c;
-            ++i;
-            });
-        auto buff2 = std::make_shared<string>(fileBuffArr);
-        auto handler = boost::bind(&Server::handle_response, this, con_handle, buff2, isBinary, boost::asio::placeholders::error);
-        boost::asio::async_write(con_handle->socket_, boost::asio::buffer(fileBuffArr, binarySize), handler);
+// Answer the upgrade and join the channel named by the rest of the path; a handshake that is missing its key,
+// asks for another version or names no channel is refused with a 400 and the connection closes as usual
+void Server::start_websocket(con_handle_t con_handle) {
+    const string& req = con_handle->request_;
+    string target = request_target(req);
+    string channel = target.substr(0, target.find('?')).substr(options_.websocket_path_.size());
+    string key = parse_header(req, "sec-websocket-key");
+    if (draining_ || key.empty() || parse_header(req, "sec-websocket-version") != "13" || channel.empty()) {
+        response_t resinfo = formulate_error_response("400 Bad Request");
+        send_response(con_handle, req, resinfo);
+        return;
     }
+    if (traced(con_handle))
+        std::cout << "DEBUG:: Connection switched to WebSocket, channel " << channel << std::endl;
+
+    string header = "HTTP/1.1 101 Switching Protocols\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Accept: " + WebSocketSession::accept_key(key);
+    log_response(con_handle, req, header, 0, con_handle->request_started_);
+
+    // Messages go out as small writes that Nagle's algorithm would hold back, and nothing may precede the 101
+    boost::system::error_code ec;
+    con_handle->socket_.set_option(boost::asio::ip::tcp::no_delay(true), ec);
+    con_handle->acknowledged_ = true;
+    con_handle->ws_.reset(new WebSocketSession(options_.websocket_max_message_bytes_, options_.websocket_max_queued_bytes_));
+    con_handle->ws_->send_raw(std::make_shared<const string>(header + "\r\n\r\n"));
+
+    std::vector<con_handle_t>& members = channels_[channel];
+    con_handle->channel_ = channel;
+    con_handle->channel_index_ = members.size();
+    members.push_back(con_handle);
+    ++ws_subscribers_;
+
+    RequestBuffer& buffer = con_handle->read_buffer_;
+    bool open = receive_websocket(con_handle, buffer.data(), buffer.size());
+    buffer.consume(buffer.size());
+    flush_websocket(con_handle);
+    if (open)
+        do_websocket_read(con_handle);
 }
 
-// Handle what happens after the acknowledgement is sent
-// This function does nothing unless an error has occurred
-void Server::handle_acknowledge(con_handle_t con_handle, std::shared_ptr<string> msg_buffer, boost::system::error_code const& err) {
+void Server::do_websocket_read(con_handle_t con_handle) {
+    con_handle->reading_ = true;
+    auto handler = boost::bind(&Server::handle_websocket_read, this, con_handle, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred);
+    async_read_some(con_handle, handler);
+}
 
-    if (debugging_) {
-        if (!err)
-            std::cout << "DEBUG:: Acknowledgment sent." << std::endl;
+// Handle what happens after reading from a WebSocket connection; reading stops once a close has been received or
+// the client broke the protocol, and the connection closes when the client goes away
+void Server::handle_websocket_read(con_handle_t con_handle, boost::system::error_code const& err, size_t bytes_transfered) {
+    con_handle->reading_ = false;
+    if (con_handle->erase_pending_) {
+        erase_connection(con_handle);
+        return;
     }
     if (err) {
-        std::cerr << "ERROR:: " << err.message() << std::endl;;
-        if (con_handle != m_connections_.end()) {
+        if (err != boost::asio::error::eof && traced(con_handle))
+            std::cout << "DEBUG:: WebSocket connection closed: " << err.message() << std::endl;
+        close_connection(con_handle);
+        erase_connection(con_handle);
+        return;
+    }
+
+    // The session copies what it is given, so the whole buffer is free again for the next read
+    RequestBuffer& buffer = con_handle->read_buffer_;
+    buffer.commit(bytes_transfered);
+    bool open = receive_websocket(con_handle, buffer.data(), buffer.size());
+    buffer.consume(buffer.size());
+    flush_websocket(con_handle);
+    if (open)
+        do_websocket_read(con_handle);
+}
+
+// Pass bytes to the session and broadcast each message it completes to the rest of the connection's channel
+// A connection that is closing leaves its channel at once; returns whether to keep reading
+bool Server::receive_websocket(con_handle_t con_handle, const char* data, size_t len) {
+    std::vector<WebSocketSession::Message> messages;
+    bool open = con_handle->ws_->receive(data, len, messages);
+    for (const auto& message : messages) {
+        if (con_handle->channel_.empty()) break;
+        WebSocketSession::frame_t frame = WebSocketSession::frame(message.binary_ ? WebSocketSession::binary : WebSocketSession::text, message.payload_.data(), message.payload_.size());
+        broadcast(con_handle->channel_, frame, con_handle);
+    }
+    if (!open)
+        leave_channel(con_handle);
+    return open;
+}
+
+// Write whatever frames the session has waiting, one write at a time, closing the connection once the close
+// handshake is over. The frames are shared with the channel's other members, so queued frames aren't charged to the
+// connection's memory; the queue limit bounds them instead
+void Server::flush_websocket(con_handle_t con_handle) {
+    if (con_handle->writing_ || !con_handle->ws_ || con_handle->erase_pending_) return;
+    std::vector<boost::asio::const_buffer> buffers;
+    auto pins = std::make_shared<std::vector<std::shared_ptr<const void>>>();
+    if (!con_handle->ws_->collect_output(buffers, *pins)) {
+        if (con_handle->ws_->finished()) {
             close_connection(con_handle);
-            m_connections_.erase(con_handle);
+            erase_connection(con_handle);
         }
+        return;
     }
+    con_handle->writing_ = true;
+    auto handler = boost::bind(&Server::handle_websocket_write, this, con_handle, pins, boost::asio::placeholders::error);
+    async_write_to(con_handle, buffers, handler);
 }
 
-// Handle what happens after a function is accepted
-// This function simply sends an empty acknowledgment message to the client
-void Server::handle_accept(con_handle_t& con_handle, boost::system::error_code const& err) {
-    if (!err) {
+// Handle what happens after frames are written, the buffers they referenced are released with pins
+void Server::handle_websocket_write(con_handle_t con_handle, std::shared_ptr<std::vector<std::shared_ptr<const void>>> pins, boost::system::error_code const& err) {
+    con_handle->writing_ = false;
+    con_handle->ws_->written();
+    if (con_handle->erase_pending_) {
+        erase_connection(con_handle);
+        return;
+    }
+    if (err) {
+        close_connection(con_handle);
+        erase_connection(con_handle);
+        return;
+    }
+    flush_websocket(con_handle);
+}
 
-        auto buff = std::make_shared<string>("\r\n\r\n");
-        auto handler = boost::bind(&Server::handle_acknowledge, this, con_handle, buff, boost::asio::placeholders::error);
-        boost::asio::async_write(con_handle->socket_, boost::asio::buffer(*buff), handler);
-        do_async_read(con_handle);
+// Queue the same frame on every member of the channel but except, and start writing to those that were idle
+// A member whose queue is full is not keeping up and is dropped without a close, which would only wait behind the rest
+// Members already closing take nothing more and are left to finish their close
+void Server::broadcast(const string& channel, const WebSocketSession::frame_t& frame, con_handle_t except) {
+    ++ws_published_;
+    auto found = channels_.find(channel);
+    if (found == channels_.end()) return;
+    std::vector<con_handle_t> slow;
+    uint64_t delivered = 0;
+    for (con_handle_t member : found->second) {
+        if (member == except || member->ws_->close_queued()) continue;
+        if (!member->ws_->send(frame)) {
+            slow.push_back(member);
+            continue;
+        }
+        ++delivered;
+        flush_websocket(member);
+    }
+    ws_delivered_ += delivered;
+    for (con_handle_t member : slow) {
+        if (traced(member))
+            std::cout << "DEBUG:: Dropping slow WebSocket client with " << member->ws_->queued_bytes() << " bytes waiting" << std::endl;
+        ++ws_evicted_;
+        close_connection(member);
+        erase_connection(member);
+    }
+}
+
+// Take the connection out of its channel, moving the channel's last member into its place
+void Server::leave_channel(con_handle_t con_handle) {
+    if (con_handle->channel_.empty()) return;
+    auto found = channels_.find(con_handle->channel_);
+    std::vector<con_handle_t>& members = found->second;
+    size_t index = con_handle->channel_index_;
+    members[index] = members.back();
+    members[index]->channel_index_ = index;
+    members.pop_back();
+    if (members.empty()) channels_.erase(found);
+    con_handle->channel_.clear();
+    --ws_subscribers_;
+}
+
+void Server::publish(const string& channel, const string& message, bool binary) {
+    WebSocketSession::frame_t frame = WebSocketSession::frame(binary ? WebSocketSession::binary : WebSocketSession::text, message.data(), message.size());
+    boost::asio::post(m_ioservice_, [this, channel, frame]() { broadcast(channel, frame, m_connections_.end()); });
+}
+
+WebSocketStats Server::websocket_stats() const {
+    WebSocketStats stats;
+    stats.subscribers_ = ws_subscribers_.load();
+    stats.published_ = ws_published_.load();
+    stats.delivered_ = ws_delivered_.load();
+    stats.evicted_ = ws_evicted_.load();
+    return stats;
+}
+
+//////////////////////// REVERSE PROXY ////////////////////////
+
+// Forward the request to the route's upstream. The head is rewritten for the upstream and whatever of the body was
+// read along with it goes in the same write; the rest of the body is streamed from the client after that. Nothing
+// else is read from the client during the exchange, and the connection closes after the response as it does for files
+// A target that doesn't normalize is refused as it would be for a file, and so is a body framing the proxy can't follow
+void Server::start_proxy(con_handle_t con_handle, Upstream* upstream) {
+    const string& req = con_handle->request_;
+    string path;
+    if (!normalize_target(request_target(req), path)) {
+        response_t resinfo = formulate_error_response("400 Bad Request");
+        send_response(con_handle, req, resinfo);
+        return;
+    }
+    if (!upstream->error().empty()) {
+        response_t resinfo = formulate_error_response("502 Bad Gateway");
+        send_response(con_handle, req, resinfo);
+        return;
+    }
+
+    con_handle->proxy_.reset(new ProxyExchange(m_ioservice_));
+    ProxyExchange& exchange = *con_handle->proxy_;
+    exchange.upstream_ = upstream;
+    exchange.head_request_ = req.compare(0, 5, "HEAD ") == 0;
+    RequestBuffer& buffer = con_handle->read_buffer_;
+    size_t taken = 0;
+    bool valid = forward_request_head(con_handle, exchange);
+    if (valid) {
+        taken = exchange.request_body_.feed(buffer.data(), buffer.size());
+        valid = !exchange.request_body_.failed();
+    }
+    if (!valid) {
+        con_handle->proxy_.reset();
+        response_t resinfo = formulate_error_response("400 Bad Request");
+        send_response(con_handle, req, resinfo);
+        return;
+    }
+    // Anything after the body would be a pipelined request, which this connection closes without answering
+    exchange.request_.append(buffer.data(), taken);
+    buffer.consume(buffer.size());
+    exchange.buffer_.resize(16 * 1024);
+    charge(con_handle, MemoryBudget::responses, exchange.request_.size() + exchange.buffer_.size());
+    if (traced(con_handle))
+        std::cout << "DEBUG:: Proxying " << request_target(req) << " to " << upstream->route().upstream_ << std::endl;
+
+    ++con_handle->io_pending_;
+    auto ready = [this, con_handle](Upstream::connection_t connection, bool reused) { handle_proxy_connection(con_handle, connection, reused); };
+    if (!upstream->acquire(ready)) {
+        --con_handle->io_pending_;
+        con_handle->proxy_.reset();
+        response_t resinfo = upstream->down() ? formulate_error_response("502 Bad Gateway") : formulate_unavailable_response();
+        send_response(con_handle, req, resinfo);
+    }
+}
+
+// Build the head sent upstream into the exchange: HTTP/1.1 and keep-alive whatever the client spoke, the target with
+// the route's prefix stripped if asked, and the client's headers less the hop-by-hop ones and any its Connection header
+// names, with X-Forwarded-For and X-Forwarded-Proto added. Sets up how the request body is framed
+// Returns false for a body the proxy can't follow: Content-Length and Transfer-Encoding together, either of them given
+// twice or a header name followed by whitespace before its colon, any of which is either a broken client or an attempt
+// to smuggle a second request past it, a bad length or a coding other than chunked. The client's framing headers are
+// dropped and the body's framing written again as the proxy reads it, so the upstream can't read it any other way
+bool Server::forward_request_head(con_handle_t con_handle, ProxyExchange& exchange) {
+    const string& req = con_handle->request_;
+    const ProxyRoute& route = exchange.upstream_->route();
+    string target = request_target(req);
+    if (route.strip_prefix_) {
+        target.erase(0, route.prefix_.size());
+        if (target.empty() || target[0] != '/') target.insert(0, "/");
+    }
+
+    string length = parse_header(req, "content-length");
+    string coding = parse_header(req, "transfer-encoding");
+    std::transform(coding.begin(), coding.end(), coding.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    uint64_t body_length = 0;
+    if (!coding.empty()) {
+        if (!length.empty() || coding != "chunked") return false;
+        exchange.request_body_.reset(BodyFraming::Kind::chunked);
+    }
+    else if (!length.empty()) {
+        if (length.size() > 18 || length.find_first_not_of("0123456789") != string::npos) return false;
+        body_length = std::stoull(length);
+        exchange.request_body_.reset(BodyFraming::Kind::length, body_length);
+    }
+    string expect = parse_header(req, "expect");
+    exchange.expect_continue_ = lists_token(expect, "100-continue") && !exchange.request_body_.done();
+
+    string connection = parse_header(req, "connection");
+    string forwarded_for;
+    string& head = exchange.request_;
+    head = req.substr(0, req.find(' ')) + " " + target + " HTTP/1.1\r\n";
+    size_t lengths = 0;
+    size_t codings = 0;
+    size_t line_start = req.find("\r\n") + 2;
+    for (;;) {
+        size_t line_end = req.find("\r\n", line_start);
+        if (line_end == string::npos || line_end == line_start) break;
+        string line = req.substr(line_start, line_end - line_start);
+        line_start = line_end + 2;
+        size_t colon = line.find(':');
+        if (colon == string::npos) continue;
+        string name = line.substr(0, colon);
+        if (name.find_first_of(" \t") != string::npos) return false;
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+        if (name == "content-length" || name == "transfer-encoding") {
+            if (++(name == "content-length" ? lengths : codings) > 1) return false;
+            continue;
+        }
+        if (name == "x-forwarded-for") {
+            size_t value = line.find_first_not_of(" \t", colon + 1);
+            if (value != string::npos)
+                forwarded_for += (forwarded_for.empty() ? "" : ", ") + line.substr(value, line.find_last_not_of(" \t") + 1 - value);
+            continue;
+        }
+        if (name == "connection" || name == "keep-alive" || name == "proxy-connection" || name == "te" || name == "upgrade"
+            || name == "expect" || name == "x-forwarded-proto" || lists_token(connection, name))
+            continue;
+        head += line + "\r\n";
+    }
+    string client = client_address(con_handle);
+    head += "X-Forwarded-For: " + (forwarded_for.empty() ? client : forwarded_for + ", " + client) + "\r\n";
+    head += string("X-Forwarded-Proto: ") + (con_handle->tls_ ? "https" : "http") + "\r\n";
+    if (exchange.request_body_.kind() == BodyFraming::Kind::chunked)
+        head += "Transfer-Encoding: chunked\r\n";
+    else if (exchange.request_body_.kind() == BodyFraming::Kind::length)
+        head += "Content-Length: " + std::to_string(body_length) + "\r\n";
+    head += "Connection: keep-alive\r\n\r\n";
+    return true;
+}
+
+// Runs once the upstream hands over a connection: a pooled one already connected, or a fresh one to connect
+void Server::handle_proxy_connection(con_handle_t con_handle, Upstream::connection_t connection, bool reused) {
+    ProxyExchange& exchange = *con_handle->proxy_;
+    exchange.connection_ = connection;
+    exchange.reused_ = reused;
+    if (!resume_proxy(con_handle)) return;
+    if (reused)
+        send_upstream_request(con_handle);
+    else
+        connect_upstream(con_handle);
+}
+
+void Server::connect_upstream(con_handle_t con_handle) {
+    ProxyExchange& exchange = *con_handle->proxy_;
+    ++con_handle->io_pending_;
+    arm_proxy_timer(con_handle);
+    exchange.connection_->async_connect(exchange.upstream_->endpoint(), boost::bind(&Server::handle_upstream_connect, this, con_handle, boost::asio::placeholders::error));
+}
+
+// A refused or timed out connect counts against the upstream's health. Requests go out as a head and then pieces of
+// body that Nagle's algorithm would hold back, so TCP connections have it turned off
+void Server::handle_upstream_connect(con_handle_t con_handle, boost::system::error_code const& err) {
+    if (!resume_proxy(con_handle)) return;
+    ProxyExchange& exchange = *con_handle->proxy_;
+    if (err) {
+        if (traced(con_handle))
+            std::cout << "DEBUG:: Could not connect to " << exchange.upstream_->route().upstream_ << ": " << err.message() << std::endl;
+        exchange.upstream_->failed();
+        fail_proxy(con_handle, exchange.timed_out_ ? "504 Gateway Timeout" : "502 Bad Gateway");
+        return;
+    }
+    if (exchange.upstream_->tcp()) {
+        boost::system::error_code ignored;
+        exchange.connection_->set_option(boost::asio::ip::tcp::no_delay(true), ignored);
+    }
+    send_upstream_request(con_handle);
+}
+
+void Server::send_upstream_request(con_handle_t con_handle) {
+    ProxyExchange& exchange = *con_handle->proxy_;
+    ++con_handle->io_pending_;
+    arm_proxy_timer(con_handle);
+    boost::asio::async_write(*exchange.connection_, boost::asio::buffer(exchange.request_), boost::bind(&Server::handle_upstream_request, this, con_handle, boost::asio::placeholders::error));
+}
+
+// With the head and the first of the body written, stream the rest of the body from the client or wait for the response
+void Server::handle_upstream_request(con_handle_t con_handle, boost::system::error_code const& err) {
+    if (!resume_proxy(con_handle)) return;
+    ProxyExchange& exchange = *con_handle->proxy_;
+    if (err) {
+        if (retry_upstream(con_handle)) return;
+        exchange.upstream_->failed();
+        fail_proxy(con_handle, exchange.timed_out_ ? "504 Gateway Timeout" : "502 Bad Gateway");
+        return;
+    }
+    if (exchange.request_body_.done())
+        read_upstream(con_handle);
+    else
+        read_request_body(con_handle);
+}
+
+// A pooled connection the upstream closed while it sat idle only shows it when the request fails on it. If nothing has
+// come back and the request can still be sent whole, send it again once on a fresh connection, which keeps its place
+// in the pool; that isn't held against the upstream's health. Returns false if the request can't be retried
+bool Server::retry_upstream(con_handle_t con_handle) {
+    ProxyExchange& exchange = *con_handle->proxy_;
+    if (!exchange.reused_ || exchange.retried_ || exchange.body_streamed_ || exchange.timed_out_ || !exchange.head_.empty())
+        return false;
+    if (traced(con_handle))
+        std::cout << "DEBUG:: Pooled connection to " << exchange.upstream_->route().upstream_ << " was closed, retrying on a new one" << std::endl;
+    exchange.retried_ = true;
+    exchange.reused_ = false;
+    boost::system::error_code ignored;
+    exchange.connection_->close(ignored);
+    exchange.connection_ = std::make_shared<Upstream::socket_t>(m_ioservice_);
+    connect_upstream(con_handle);
+    return true;
+}
+
+// Read the next piece of the request body from the client; the upstream isn't timed while the client is the one awaited
+// A client that asked to be told to go ahead is sent a 100 Continue first
+void Server::read_request_body(con_handle_t con_handle) {
+    ProxyExchange& exchange = *con_handle->proxy_;
+    exchange.deadline_ = std::chrono::steady_clock::time_point::max();
+    if (exchange.expect_continue_) {
+        static const string acknowledged_continue = "\r\n\r\nHTTP/1.1 100 Continue\r\n\r\n";
+        size_t skip = con_handle->acknowledged_ ? 4 : 0;
+        exchange.expect_continue_ = false;
+        con_handle->acknowledged_ = true;
+        con_handle->writing_ = true;
+        auto handler = boost::bind(&Server::handle_continue_sent, this, con_handle, boost::asio::placeholders::error);
+        async_write_to(con_handle, boost::asio::buffer(acknowledged_continue.data() + skip, acknowledged_continue.size() - skip), handler);
+        return;
+    }
+    con_handle->reading_ = true;
+    auto handler = boost::bind(&Server::handle_request_body, this, con_handle, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred);
+    async_read_some(con_handle, handler);
+}
+
+void Server::handle_continue_sent(con_handle_t con_handle, boost::system::error_code const& err) {
+    con_handle->writing_ = false;
+    if (con_handle->erase_pending_) {
+        erase_connection(con_handle);
+        return;
+    }
+    if (err) {
+        end_proxy(con_handle, false);
+        close_connection(con_handle);
+        erase_connection(con_handle);
+        return;
+    }
+    read_request_body(con_handle);
+}
+
+// Pass what the client sent of its body straight from the read buffer to the upstream; the buffer is reused once
+// the write is done. A client that goes away or breaks its chunking ends the exchange
+void Server::handle_request_body(con_handle_t con_handle, boost::system::error_code const& err, size_t bytes_transfered) {
+    con_handle->reading_ = false;
+    if (con_handle->erase_pending_) {
+        erase_connection(con_handle);
+        return;
+    }
+    if (err) {
+        end_proxy(con_handle, false);
+        close_connection(con_handle);
+        erase_connection(con_handle);
+        return;
+    }
+    ProxyExchange& exchange = *con_handle->proxy_;
+    RequestBuffer& buffer = con_handle->read_buffer_;
+    buffer.commit(bytes_transfered);
+    size_t taken = exchange.request_body_.feed(buffer.data(), buffer.size());
+    if (exchange.request_body_.failed()) {
+        fail_proxy(con_handle, "400 Bad Request");
+        return;
+    }
+    exchange.body_streamed_ = true;
+    ++con_handle->io_pending_;
+    arm_proxy_timer(con_handle);
+    boost::asio::async_write(*exchange.connection_, boost::asio::buffer(buffer.data(), taken), boost::bind(&Server::handle_request_body_sent, this, con_handle, boost::asio::placeholders::error));
+}
+
+void Server::handle_request_body_sent(con_handle_t con_handle, boost::system::error_code const& err) {
+    con_handle->read_buffer_.consume(con_handle->read_buffer_.size());
+    if (!resume_proxy(con_handle)) return;
+    ProxyExchange& exchange = *con_handle->proxy_;
+    if (err) {
+        exchange.upstream_->failed();
+        fail_proxy(con_handle, exchange.timed_out_ ? "504 Gateway Timeout" : "502 Bad Gateway");
+        return;
+    }
+    if (exchange.request_body_.done())
+        read_upstream(con_handle);
+    else
+        read_request_body(con_handle);
+}
+
+void Server::read_upstream(con_handle_t con_handle) {
+    ProxyExchange& exchange = *con_handle->proxy_;
+    ++con_handle->io_pending_;
+    arm_proxy_timer(con_handle);
+    exchange.connection_->async_read_some(boost::asio::buffer(exchange.buffer_), boost::bind(&Server::handle_upstream_read, this, con_handle, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+}
+
+// Collect the response head, then pass the body on to the client a read at a time, writing straight from the
+// exchange's buffer; one read is written before the next is made, so a slow client slows the upstream down rather
+// than the proxy buffering for it. A body delimited by the end of the connection ends when the upstream closes,
+// anything else that breaks off cuts the client off too, since the response already begun can't be replaced
+void Server::handle_upstream_read(con_handle_t con_handle, boost::system::error_code const& err, size_t bytes_transfered) {
+    if (!resume_proxy(con_handle)) return;
+    ProxyExchange& exchange = *con_handle->proxy_;
+    if (!exchange.response_started_) {
+        if (err) {
+            if (retry_upstream(con_handle)) return;
+            exchange.upstream_->failed();
+            fail_proxy(con_handle, exchange.timed_out_ ? "504 Gateway Timeout" : "502 Bad Gateway");
+            return;
+        }
+        exchange.head_.append(exchange.buffer_.data(), bytes_transfered);
+        handle_upstream_head(con_handle);
+        return;
+    }
+
+    if (err) {
+        if (err == boost::asio::error::eof && exchange.response_body_.kind() == BodyFraming::Kind::until_close) {
+            finish_proxy(con_handle);
+            return;
+        }
+        exchange.upstream_->failed();
+        fail_proxy(con_handle, string());
+        return;
+    }
+    size_t taken = exchange.response_body_.feed(exchange.buffer_.data(), bytes_transfered);
+    if (exchange.response_body_.failed()) {
+        exchange.upstream_->failed();
+        fail_proxy(con_handle, string());
+        return;
+    }
+    // More than the body means the upstream can't be trusted with another request on this connection
+    if (taken < bytes_transfered) exchange.keep_alive_ = false;
+    exchange.response_bytes_ += taken;
+    con_handle->writing_ = true;
+    auto handler = boost::bind(&Server::handle_proxy_write, this, con_handle, boost::asio::placeholders::error);
+    async_write_to(con_handle, boost::asio::buffer(exchange.buffer_.data(), taken), handler);
+}
+
+// Once the head of the final response has arrived, send it on with the body bytes that came with it
+// Interim 1xx responses are dropped. The head loses the upstream's Connection and Keep-Alive, since it is the client's
+// connection that is closed afterwards, and the body is passed on in the framing the upstream gave it
+// The connection goes back to the pool afterwards only if the upstream speaks HTTP/1.1, didn't ask to close and framed
+// the body itself. An unreadable or overlong head is the upstream's fault and gets a 502, and so does one giving its
+// Content-Length or Transfer-Encoding twice or whitespace before a header's colon, which the client could read otherwise
+void Server::handle_upstream_head(con_handle_t con_handle) {
+    static const size_t max_response_head = 64 * 1024;
+    ProxyExchange& exchange = *con_handle->proxy_;
+    string& head = exchange.head_;
+    size_t end;
+    int status;
+    for (;;) {
+        end = head.find("\r\n\r\n");
+        if (end == string::npos) {
+            if (head.size() <= max_response_head) {
+                read_upstream(con_handle);
+                return;
+            }
+            status = 0;
+            break;
+        }
+        status = head.compare(0, 7, "HTTP/1.") == 0 && head.size() > 12 ? std::atoi(head.c_str() + 9) : 0;
+        if (status < 100 || status >= 200 || status == 101) break;
+        head.erase(0, end + 4);
+    }
+    if (status < 200 || status > 599) {
+        if (traced(con_handle))
+            std::cout << "DEBUG:: Unusable response head from " << exchange.upstream_->route().upstream_ << std::endl;
+        exchange.upstream_->failed();
+        fail_proxy(con_handle, "502 Bad Gateway");
+        return;
+    }
+
+    string response = head.substr(0, head.find("\r\n"));
+    string connection = parse_header(head.substr(0, end + 2), "connection");
+    size_t lengths = 0;
+    size_t codings = 0;
+    size_t line_start = response.size() + 2;
+    while (line_start < end) {
+        size_t line_end = head.find("\r\n", line_start);
+        string line = head.substr(line_start, line_end - line_start);
+        line_start = line_end + 2;
+        string name = line.substr(0, line.find(':'));
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+        if (name.find_first_of(" \t") != string::npos || (name == "content-length" && ++lengths > 1) || (name == "transfer-encoding" && ++codings > 1)) {
+            if (traced(con_handle))
+                std::cout << "DEBUG:: Ambiguous response framing from " << exchange.upstream_->route().upstream_ << std::endl;
+            exchange.upstream_->failed();
+            fail_proxy(con_handle, "502 Bad Gateway");
+            return;
+        }
+        if (name == "connection" || name == "keep-alive" || name == "proxy-connection" || lists_token(connection, name))
+            continue;
+        response += "\r\n" + line;
+    }
+    response += "\r\nConnection: close";
+
+    string length = parse_header(head.substr(0, end + 2), "content-length");
+    string coding = parse_header(head.substr(0, end + 2), "transfer-encoding");
+    std::transform(coding.begin(), coding.end(), coding.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    if (exchange.head_request_ || status == 204 || status == 304)
+        exchange.response_body_.reset(BodyFraming::Kind::none);
+    else if (!coding.empty())
+        exchange.response_body_.reset(coding.size() >= 7 && coding.compare(coding.size() - 7, 7, "chunked") == 0 ? BodyFraming::Kind::chunked : BodyFraming::Kind::until_close);
+    else if (!length.empty() && length.size() <= 18 && length.find_first_not_of("0123456789") == string::npos)
+        exchange.response_body_.reset(BodyFraming::Kind::length, std::stoull(length));
+    else
+        exchange.response_body_.reset(BodyFraming::Kind::until_close);
+    exchange.keep_alive_ = head.compare(0, 8, "HTTP/1.1") == 0 && !lists_token(connection, "close")
+        && exchange.response_body_.kind() != BodyFraming::Kind::until_close;
+
+    size_t rest = head.size() - end - 4;
+    size_t taken = exchange.response_body_.feed(head.data() + end + 4, rest);
+    if (taken < rest) exchange.keep_alive_ = false;
+    exchange.upstream_->succeeded();
+    exchange.response_started_ = true;
+    if (!con_handle->acknowledged_) {
+        exchange.out_ = "\r\n\r\n";
+        con_handle->acknowledged_ = true;
+    }
+    exchange.out_ += response + "\r\n\r\n";
+    exchange.out_.append(head, end + 4, taken);
+    exchange.response_bytes_ = exchange.out_.size();
+    head = response;
+    charge(con_handle, MemoryBudget::responses, exchange.out_.size() + exchange.buffer_.size());
+
+    con_handle->writing_ = true;
+    auto handler = boost::bind(&Server::handle_proxy_write, this, con_handle, boost::asio::placeholders::error);
+    async_write_to(con_handle, boost::asio::buffer(exchange.out_), handler);
+}
+
+// After each write to the client, finish once the body is complete or read the next piece of it
+void Server::handle_proxy_write(con_handle_t con_handle, boost::system::error_code const& err) {
+    con_handle->writing_ = false;
+    if (con_handle->erase_pending_) {
+        erase_connection(con_handle);
+        return;
+    }
+    if (err) {
+        end_proxy(con_handle, false);
+        close_connection(con_handle);
+        erase_connection(con_handle);
+        return;
+    }
+    if (con_handle->proxy_->response_body_.done())
+        finish_proxy(con_handle);
+    else
+        read_upstream(con_handle);
+}
+
+// Give the step on the upstream connection that is starting until the route's timeout. One timer wait covers the whole
+// exchange, waiting again whenever it wakes before the latest deadline, so steps don't each set and cancel a timer
+void Server::arm_proxy_timer(con_handle_t con_handle) {
+    ProxyExchange& exchange = *con_handle->proxy_;
+    exchange.deadline_ = std::chrono::steady_clock::now() + std::chrono::seconds(exchange.upstream_->route().timeout_seconds_);
+    if (exchange.timer_armed_) return;
+    exchange.timer_armed_ = true;
+    ++con_handle->io_pending_;
+    exchange.timer_.expires_at(exchange.deadline_);
+    exchange.timer_.async_wait(boost::bind(&Server::handle_proxy_timer, this, con_handle, boost::asio::placeholders::error));
+}
+
+// A step that overran its deadline has its upstream connection closed under it, and fails with timed_out_ set
+void Server::handle_proxy_timer(con_handle_t con_handle, boost::system::error_code const& err) {
+    ProxyExchange& exchange = *con_handle->proxy_;
+    exchange.timer_armed_ = false;
+    if (!resume_proxy(con_handle) || err || !exchange.connection_) return;
+    if (std::chrono::steady_clock::now() < exchange.deadline_) {
+        exchange.timer_armed_ = true;
+        ++con_handle->io_pending_;
+        exchange.timer_.expires_at(exchange.deadline_);
+        exchange.timer_.async_wait(boost::bind(&Server::handle_proxy_timer, this, con_handle, boost::asio::placeholders::error));
+        return;
+    }
+    if (traced(con_handle))
+        std::cout << "DEBUG:: " << exchange.upstream_->route().upstream_ << " timed out" << std::endl;
+    exchange.timed_out_ = true;
+    boost::system::error_code ignored;
+    exchange.connection_->close(ignored);
+}
+
+// Every upstream operation and timer wait holds the connection in the list like a file I/O job does; when one
+// completes, returns false if the connection is going away and has been dealt with
+bool Server::resume_proxy(con_handle_t con_handle) {
+    --con_handle->io_pending_;
+    if (con_handle->erase_pending_) {
+        erase_connection(con_handle);
+        return false;
+    }
+    return true;
+}
+
+// End the exchange with an error response of the proxy's own. Once the upstream's response has begun there is no
+// replacing it, so the client is cut off instead, as it is when status is empty
+void Server::fail_proxy(con_handle_t con_handle, const string& status) {
+    bool started = con_handle->proxy_->response_started_;
+    end_proxy(con_handle, false);
+    if (started || status.empty()) {
+        close_connection(con_handle);
+        erase_connection(con_handle);
+        return;
+    }
+    response_t resinfo = formulate_error_response(status);
+    send_response(con_handle, con_handle->request_, resinfo);
+}
+
+// The response has been passed on whole: log it, give the upstream connection back and close the client's
+void Server::finish_proxy(con_handle_t con_handle) {
+    ProxyExchange& exchange = *con_handle->proxy_;
+    log_response(con_handle, con_handle->request_, exchange.head_, (size_t)exchange.response_bytes_, con_handle->request_started_);
+    end_proxy(con_handle, exchange.keep_alive_);
+    charge(con_handle, MemoryBudget::responses, 0);
+    close_connection(con_handle);
+    erase_connection(con_handle);
+}
+
+// Release the exchange's upstream connection, to the pool if reusable and otherwise closed, which aborts anything
+// still outstanding on it. The exchange itself stays until the connection is erased, its handlers may still be queued
+void Server::end_proxy(con_handle_t con_handle, bool reusable) {
+    if (!con_handle->proxy_) return;
+    ProxyExchange& exchange = *con_handle->proxy_;
+    if (exchange.connection_) {
+        exchange.upstream_->release(exchange.connection_, reusable && !exchange.timed_out_);
+        exchange.connection_.reset();
+    }
+    boost::system::error_code ignored;
+    exchange.timer_.cancel(ignored);
+}
+
+//////////////////////// CONNECTION SETUP ////////////////////////
+
+// Handle what happens after the TLS handshake on a secure connection
+// With kTLS a session ticket is issued by hand before the kernel takes over so that the record sequence number is known
+void Server::handle_handshake(con_handle_t con_handle, boost::system::error_code const& err) {
+    if (err) {
+        if (traced(con_handle))
+            std::cout << "DEBUG:: TLS handshake failed: " << err.message() << std::endl;
+        close_connection(con_handle);
+        erase_connection(con_handle);
+        return;
+    }
+
+    SSL* ssl = con_handle->tls_->native_handle();
+    if (traced(con_handle))
+        std::cout << "DEBUG:: TLS handshake complete (" << SSL_get_version(ssl) << ", " << SSL_get_cipher_name(ssl) << (SSL_session_reused(ssl) ? ", resumed" : "") << ")" << std::endl;
+
+    if (tls_context_->ktls_enabled() && SSL_version(ssl) == TLS1_3_VERSION && SSL_new_session_ticket(ssl) == 1) {
+        auto handler = boost::bind(&Server::handle_ticket_sent, this, con_handle, boost::asio::placeholders::error);
+        con_handle->tls_->async_handshake(boost::asio::ssl::stream_base::server, handler);
+        return;
+    }
+    begin_session(con_handle);
+}
+
+// Handle what happens after the manually issued session ticket is flushed
+// The ticket was the only record sent under the application traffic key, so the kernel continues from sequence number 1
+void Server::handle_ticket_sent(con_handle_t con_handle, boost::system::error_code const& err) {
+    if (err) {
+        close_connection(con_handle);
+        erase_connection(con_handle);
+        return;
+    }
+    SSL* ssl = con_handle->tls_->native_handle();
+    con_handle->ktls_send_ = tls_context_->enable_ktls_send(ssl, con_handle->socket_.native_handle(), con_handle->ktls_secret_, 1);
+    con_handle->ktls_secret_.assign(con_handle->ktls_secret_.size(), '\0');
+    con_handle->ktls_secret_.clear();
+    if (traced(con_handle))
+        std::cout << "DEBUG:: kTLS transmit offload " << (con_handle->ktls_send_ ? "enabled" : "unavailable") << std::endl;
+    begin_session(con_handle);
+}
 
+// Set up a freshly accepted connection
+// Plain connections start reading their request straight away, secure ones perform the TLS handshake first
+void Server::open_connection(con_handle_t con_handle, bool secure) {
+    string failed = tune_connection(con_handle->socket_, secure ? options_.tls_socket_tuning_ : options_.socket_tuning_);
+    if (!failed.empty() && traced(con_handle))
+        std::cout << "DEBUG:: Could not set " << failed << " on an accepted connection" << std::endl;
+    if (secure) {
+        // Handshake flights are several small writes, don't let Nagle hold them back
+        boost::system::error_code ignored;
+        con_handle->socket_.set_option(boost::asio::ip::tcp::no_delay(true), ignored);
+        con_handle->tls_.reset(new Connection::tls_stream_t(con_handle->socket_, tls_context_->context()));
+        tls_context_->prepare_session(con_handle->tls_->native_handle(), &con_handle->ktls_secret_);
+        auto handler = boost::bind(&Server::handle_handshake, this, con_handle, boost::asio::placeholders::error);
+        con_handle->tls_->async_handshake(boost::asio::ssl::stream_base::server, handler);
     }
     else {
+        begin_session(con_handle);
+    }
+}
+
+// Handle what happens after a connection is accepted
+// The accept is re-armed before anything else so the listener never goes without one, then the connections already
+// waiting in the backlog are taken in the same wake-up
+void Server::handle_accept(con_handle_t& con_handle, bool secure, boost::system::error_code const& err) {
+    if (!err) {
+        if (!draining_)
+            start_accept(secure);
+        open_connection(con_handle, secure);
+        accept_waiting(secure);
+        return;
+    }
+
+    // Closing the listener for a drain cancels the pending accepts, which is expected
+    if (!(draining_ && err == boost::asio::error::operation_aborted))
         std::cerr << "ERROR:: " << err.message() << std::endl;;
-        if (con_handle != m_connections_.end()) {
-            close_connection(con_handle);
+    if (con_handle != m_connections_.end()) {
+        close_connection(con_handle);
+        erase_connection(con_handle);
+    }
+    if (!draining_)
+        start_accept(secure);
+}
+
+// Accept up to accept_batch_ connections that are already queued on the listener without waiting on it again
+// The listener is non-blocking, so this stops as soon as the backlog is empty
+void Server::accept_waiting(bool secure) {
+    boost::asio::ip::tcp::acceptor& acceptor = secure ? m_tls_acceptor_ : m_acceptor_;
+    for (size_t accepted = 0; accepted < options_.accept_batch_ && !draining_ && !memory_.over(); ++accepted) {
+        auto con_handle = m_connections_.emplace(m_connections_.begin(), m_ioservice_, request_buffers_, options_.max_request_header_bytes_);
+        boost::system::error_code ec;
+        acceptor.accept(con_handle->socket_, ec);
+        if (ec) {
             m_connections_.erase(con_handle);
+            if (ec != boost::asio::error::would_block && ec != boost::asio::error::try_again)
+                std::cerr << "ERROR:: " << ec.message() << std::endl;
+            return;
+        }
+        open_connection(con_handle, secure);
+    }
+}
+
+// Keep pending_accepts_ accepts outstanding on the listener; each one re-arms itself when it completes
+void Server::arm_listener(bool secure) {
+    boost::system::error_code ignored;
+    (secure ? m_tls_acceptor_ : m_acceptor_).non_blocking(true, ignored);
+    for (size_t i = 0; i < std::max<size_t>(options_.pending_accepts_, 1); ++i)
+        start_accept(secure);
+}
+
+// Add the connection to the list and asynchronously accept it on the plain or secure listener
+// Over the budget the caches are trimmed first, and only if that isn't enough is the accept held back until usage drops,
+// which needs some connection still open to drop it
+void Server::start_accept(bool secure) {
+    if (memory_.over()) shed_caches();
+    if (memory_.over() && !m_connections_.empty()) {
+        ++paused_accepts_[secure ? 1 : 0];
+        memory_.note_paused_accept();
+        return;
+    }
+    auto con_handle = m_connections_.emplace(m_connections_.begin(), m_ioservice_, request_buffers_, options_.max_request_header_bytes_);
+    auto handler = boost::bind(&Server::handle_accept, this, con_handle, secure, boost::asio::placeholders::error);
+    (secure ? m_tls_acceptor_ : m_acceptor_).async_accept(con_handle->socket_, handler);
+}
+
+//////////////////////// DEBUG TRACING ////////////////////////
+
+void Server::set_trace(const TraceSettings& settings) {
+    boost::asio::post(m_ioservice_, [this, settings]() { apply_trace(settings); });
+}
+
+void Server::apply_trace(const TraceSettings& settings) {
+    trace_.set(settings);
+    write_to_standard_outputs("Debug tracing " + DebugTrace::describe(trace_.settings()));
+    std::cout << std::endl;
+    if (logging_) log_writer_ << std::endl;
+}
+
+// Show the trace settings to a request for the admin path and change them through its query
+// Only loopback clients are answered, anyone else gets the 404 a missing file would. Returns false for any other path
+bool Server::answer_trace_admin(con_handle_t con_handle, const string& req, uint32_t stream_id) {
+    const string& path = options_.trace_admin_path_;
+    string target = request_target(req);
+    if (target.compare(0, path.size(), path) != 0 || (target.size() > path.size() && target[path.size()] != '?'))
+        return false;
+
+    boost::system::error_code ec;
+    auto remote = con_handle->socket_.remote_endpoint(ec);
+    response_t resinfo;
+    if (ec || !remote.address().is_loopback())
+        resinfo = formulate_error_response("404 Not Found");
+    else {
+        TraceSettings settings = trace_.settings();
+        size_t query = target.find('?');
+        bool valid = query == string::npos || DebugTrace::apply_query(target.substr(query + 1), settings);
+        if (valid && query != string::npos)
+            apply_trace(settings);
+        string body = valid ? "Debug tracing " + DebugTrace::describe(trace_.settings()) + "\n"
+            : "Unknown parameter, use enable=1|0, sample=N, path=/a/,/b/ or client=10.1.,::1\n";
+        string response = string("HTTP/1.1 ") + (valid ? "200 OK" : "400 Bad Request") + "\r\n"
+            "Server: Boost-Async-GET-Server\r\n"
+            "Content-Type: text/plain\r\n"
+            "Content-Length: " + std::to_string(body.size()) + "\r\n"
+            "Cache-Control: no-store\r\n"
+            "Connection: close\r\n\r\n" + body;
+        resinfo = std::make_tuple(response, false, vector<unsigned char>(), nullptr);
+    }
+    if (stream_id)
+        send_http2_response(con_handle, stream_id, req, std::make_shared<response_t>(std::move(resinfo)));
+    else
+        send_response(con_handle, req, resinfo);
+    return true;
+}
+
+//////////////////////// SHUTDOWN ////////////////////////
+
+// Ctrl+C or SIGTERM drains the server, a second one stops it straight away; SIGUSR1 switches debug tracing on and off
+void Server::handle_signal(boost::system::error_code const& err, int signal_number) {
+    if (err) return;
+#ifndef _WIN32
+    if (signal_number == SIGUSR1) {
+        TraceSettings settings = trace_.settings();
+        settings.enabled_ = !settings.enabled_;
+        apply_trace(settings);
+        m_signals_.async_wait(boost::bind(&Server::handle_signal, this, boost::asio::placeholders::error, boost::asio::placeholders::signal_number));
+        return;
+    }
+#endif
+    if (draining_) {
+        write_to_standard_outputs("Signal " + std::to_string(signal_number) + " received again, stopping now");
+        std::cout << std::endl;
+        if (logging_) log_writer_ << std::endl;
+        m_ioservice_.stop();
+        return;
+    }
+    begin_drain(std::chrono::seconds(options_.drain_timeout_seconds_));
+    m_signals_.async_wait(boost::bind(&Server::handle_signal, this, boost::asio::placeholders::error, boost::asio::placeholders::signal_number));
+}
+
+void Server::drain(std::chrono::seconds deadline) {
+    boost::asio::post(m_ioservice_, [this, deadline]() { begin_drain(deadline); });
+}
+
+// Stop listening and tell HTTP/2 clients to go elsewhere for new requests; responses already being prepared are
+// still sent, and each HTTP/1 connection closes once its response is written as it always does
+// HTTP/1 connections still waiting for a request, such as a browser's preconnects, are closed at once rather than
+// held open until the deadline. WebSocket clients are sent a close (going away) and their connections close once they answer it
+void Server::begin_drain(std::chrono::seconds deadline) {
+    if (draining_) return;
+    draining_ = true;
+    drain_deadline_ = std::chrono::steady_clock::now() + deadline;
+    write_to_standard_outputs("Draining, waiting up to " + std::to_string(deadline.count()) + "s for the connections in flight");
+    std::cout << std::endl;
+    if (logging_) log_writer_ << std::endl;
+
+    boost::system::error_code ignored;
+    m_acceptor_.close(ignored);
+    m_tls_acceptor_.close(ignored);
+#ifndef _WIN32
+    m_handoff_acceptor_.close(ignored);
+#endif
+
+    for (auto con = m_connections_.begin(); con != m_connections_.end(); ) {
+        auto next = std::next(con);
+        if (con->reading_ && !con->io_pending_ && !con->writing_ && !con->h2_ && !con->ws_ && !con->proxy_ && con->read_buffer_.size() == 0) {
+            close_connection(con);
+            erase_connection(con);
+            con = next;
+            continue;
+        }
+        if (con->h2_ && !con->erase_pending_) {
+            con->h2_->go_away();
+            flush_http2(con);
+        }
+        if (con->ws_ && !con->erase_pending_) {
+            leave_channel(con);
+            con->ws_->send_close(WebSocketSession::going_away);
+            flush_websocket(con);
+        }
+        con = next;
+    }
+    check_drained(boost::system::error_code());
+}
+
+// Poll until every connection is gone or the deadline has passed, then stop the io_service so run() returns
+void Server::check_drained(boost::system::error_code const& err) {
+    if (err) return;
+    if (!m_connections_.empty() && std::chrono::steady_clock::now() < drain_deadline_) {
+        m_drain_timer_.expires_after(std::chrono::milliseconds(50));
+        m_drain_timer_.async_wait(boost::bind(&Server::check_drained, this, boost::asio::placeholders::error));
+        return;
+    }
+    if (!m_connections_.empty()) {
+        write_to_standard_outputs("Drain deadline passed, closing " + std::to_string(m_connections_.size()) + " connections");
+        std::cout << std::endl;
+        if (logging_) log_writer_ << std::endl;
+        for (auto& con : m_connections_) {
+            boost::system::error_code ignored;
+            con.socket_.close(ignored);
+        }
+    }
+    size_t cached_bytes = 0;
+    for (const auto& host : hosts_.hosts()) {
+        HostStats::Snapshot stats = host->stats_.snapshot();
+        cached_bytes += host->cache_.stats().bytes_;
+        write_to_standard_outputs(host->name_ + ": " + std::to_string(stats.responses_) + " responses, " + std::to_string(stats.bytes_) + " bytes, "
+            + std::to_string(stats.not_found_) + " not found (" + std::to_string(host->missing_.stats().hits_) + " known to be missing), " + std::to_string(stats.cache_hits_) + " of "
+            + std::to_string(stats.cache_hits_ + stats.cache_misses_) + " files served from cache"
+            + (embedded_ || host->pack_ ? ", " + std::to_string(stats.pack_hits_) + (embedded_ ? " from the embedded bundle" : " from the asset pack") : string()));
+        std::cout << std::endl;
+        if (logging_) log_writer_ << std::endl;
+    }
+    // Identical files cached under several paths or sites are held once
+    ContentStore::Stats content = content_store_.stats();
+    string cache_usage = "Cache: " + std::to_string(cached_bytes) + " bytes of files held in " + std::to_string(content.bytes_) + " bytes ("
+        + std::to_string(content.blobs_) + " distinct bodies), " + std::to_string(cached_bytes - std::min(cached_bytes, content.bytes_))
+        + " bytes saved by deduplication";
+#ifndef _WIN32
+    // A worker's files are all in the shared segment
+    if (shared_cache_) {
+        SharedFileCache::Stats shared = shared_cache_->stats();
+        cache_usage = "Shared cache: " + std::to_string(shared.entries_) + " files, " + std::to_string(shared.bytes_) + " of " + std::to_string(shared.capacity_) + " bytes";
+    }
+#endif
+    write_to_standard_outputs(cache_usage);
+    std::cout << std::endl;
+    if (logging_) log_writer_ << std::endl;
+    WebSocketStats ws = websocket_stats();
+    if (ws.published_ || ws.evicted_) {
+        write_to_standard_outputs("WebSocket: " + std::to_string(ws.published_) + " messages published, " + std::to_string(ws.delivered_) + " delivered, "
+            + std::to_string(ws.evicted_) + " slow subscribers dropped");
+        std::cout << std::endl;
+        if (logging_) log_writer_ << std::endl;
+    }
+    for (const auto& upstream : proxy_.upstreams()) {
+        Upstream::Stats stats = upstream->stats();
+        write_to_standard_outputs("Proxy " + upstream->route().prefix_ + " -> " + upstream->route().upstream_ + ": " + std::to_string(stats.requests_) + " requests, "
+            + std::to_string(stats.reused_) + " on pooled connections, " + std::to_string(stats.failures_) + " failures");
+        std::cout << std::endl;
+        if (logging_) log_writer_ << std::endl;
+    }
+    MemoryBudget::Stats memory = memory_.stats();
+    string usage = "Memory peak: " + std::to_string(memory.peak_total_) + " bytes";
+    for (int category = 0; category < MemoryBudget::category_count; ++category)
+        usage += string(category ? ", " : " (") + MemoryBudget::category_name((MemoryBudget::Category)category) + " " + std::to_string(memory.peak_[category]);
+    usage += ")";
+    if (memory.budget_)
+        usage += "; budget " + std::to_string(memory.budget_) + ", " + std::to_string(memory.paused_accepts_) + " accepts held back, "
+            + std::to_string(memory.refused_streams_) + " HTTP/2 streams refused, " + std::to_string(memory.shed_) + " large files refused";
+    write_to_standard_outputs(usage);
+    std::cout << std::endl;
+    if (logging_) log_writer_ << std::endl;
+    binary_log_.flush();
+    write_to_standard_outputs("Drained, server stopped");
+    std::cout << std::endl;
+    if (logging_) log_writer_ << std::endl;
+    m_ioservice_.stop();
+}
+
+//////////////////////// HANDOFF ////////////////////////
+#ifndef _WIN32
+
+// Ask a server already running with the same handoff socket for its listening sockets
+// Returns false if there is no such server; a listener for a port this server does not use is closed
+bool Server::inherit_listeners() {
+    boost::asio::local::stream_protocol::socket handoff(m_ioservice_);
+    boost::system::error_code ec;
+    handoff.connect(boost::asio::local::stream_protocol::endpoint(options_.handoff_socket_path_), ec);
+    if (ec) return false;
+
+    uint8_t tag = 0;
+    std::vector<int> fds;
+    if (!receive_descriptors(handoff.native_handle(), tag, fds)) {
+        std::cout << "ERROR:: The running server did not hand over its listeners" << std::endl;
+        return false;
+    }
+
+    size_t next = 0;
+    auto adopt = [&](boost::asio::ip::tcp::acceptor& acceptor, unsigned short port) {
+        int fd = fds[next++];
+        boost::system::error_code adopt_ec;
+        acceptor.assign(boost::asio::ip::tcp::v4(), fd, adopt_ec);
+        if (adopt_ec) {
+            ::close(fd);
+            return;
+        }
+        if (port == 0 || acceptor.local_endpoint(adopt_ec).port() != port)
+            acceptor.close(adopt_ec);
+    };
+    if ((tag & handoff_plain) && next < fds.size()) adopt(m_acceptor_, port_);
+    if ((tag & handoff_secure) && next < fds.size()) adopt(m_tls_acceptor_, options_.tls_port_);
+    for (; next < fds.size(); ++next) ::close(fds[next]);
+
+    return m_acceptor_.is_open() || m_tls_acceptor_.is_open();
+}
+
+// Listen on the handoff socket so the next version of the server can take over from this one
+// Whoever binds the path last owns it, so the old server's socket is replaced rather than reused
+void Server::start_handoff_listener() {
+    ::unlink(options_.handoff_socket_path_.c_str());
+    boost::asio::local::stream_protocol::endpoint endpoint(options_.handoff_socket_path_);
+    boost::system::error_code ec;
+    m_handoff_acceptor_.open(endpoint.protocol(), ec);
+    if (!ec) m_handoff_acceptor_.bind(endpoint, ec);
+    if (!ec) m_handoff_acceptor_.listen(boost::asio::socket_base::max_listen_connections, ec);
+    if (ec) {
+        std::cout << "ERROR:: Could not open handoff socket: " << ec.message() << std::endl;
+        m_handoff_acceptor_.close(ec);
+        return;
+    }
+    start_handoff_accept();
+}
+
+void Server::start_handoff_accept() {
+    auto handoff = std::make_shared<boost::asio::local::stream_protocol::socket>(m_ioservice_);
+    auto handler = boost::bind(&Server::handle_handoff_accept, this, handoff, boost::asio::placeholders::error);
+    m_handoff_acceptor_.async_accept(*handoff, handler);
+}
+
+// A replacement server connected: pass it the listeners, then drain
+// The kernel keeps queueing connections on the shared sockets throughout, so none are refused during the switch
+void Server::handle_handoff_accept(std::shared_ptr<boost::asio::local::stream_protocol::socket> handoff, boost::system::error_code const& err) {
+    if (err) {
+        if (err != boost::asio::error::operation_aborted) {
+            std::cerr << "ERROR:: " << err.message() << std::endl;
+            start_handoff_accept();
         }
+        return;
+    }
+
+    uint8_t tag = 0;
+    std::vector<int> fds;
+    if (m_acceptor_.is_open()) {
+        tag |= handoff_plain;
+        fds.push_back(m_acceptor_.native_handle());
+    }
+    if (m_tls_acceptor_.is_open()) {
+        tag |= handoff_secure;
+        fds.push_back(m_tls_acceptor_.native_handle());
+    }
+    if (fds.empty() || !send_descriptors(handoff->native_handle(), tag, fds)) {
+        std::cout << "ERROR:: Could not hand the listeners over" << std::endl;
+        start_handoff_accept();
+        return;
+    }
+
+    write_to_standard_outputs("Listeners handed over to the new server");
+    std::cout << std::endl;
+    if (logging_) log_writer_ << std::endl;
+    begin_drain(std::chrono::seconds(options_.drain_timeout_seconds_));
+}
+
+#endif
+//////////////////////// PREFORK ////////////////////////
+#ifndef _WIN32
+
+// Take on the listeners and the shared cache the master hands this worker
+void Server::become_worker(const PreforkWorker& worker) {
+    worker_ = (int)worker.index_;
+    shared_cache_ = worker.cache_;
+    auto adopt = [](boost::asio::ip::tcp::acceptor& acceptor, int fd) {
+        if (fd < 0) return;
+        boost::system::error_code ec;
+        acceptor.assign(boost::asio::ip::tcp::v4(), fd, ec);
+        if (ec) std::cout << "ERROR:: Could not take over the master's listener: " << ec.message() << std::endl;
+    };
+    adopt(m_acceptor_, worker.listen_fd_);
+    adopt(m_tls_acceptor_, worker.tls_listen_fd_);
+}
+
+#endif
+
+// Each worker builds its server after it is forked, since a server's pools start threads that a fork would not carry
+// over; a pinned io_service thread goes to the CPU after the previous worker's
+void run_server(uint16_t port, bool log, bool debug, const ServerOptions& options) {
+#ifndef _WIN32
+    if (options.workers_ > 0) {
+        PreforkMaster master(port, options, log);
+        master.run([&](const PreforkWorker& worker) {
+            ServerOptions worker_options = options;
+            if (worker_options.cpu_placement_.io_cpu_ >= 0) worker_options.cpu_placement_.io_cpu_ += (int)worker.index_;
+            Server server(port, log, debug, worker_options);
+            server.become_worker(worker);
+            server.run();
+        });
+        return;
     }
-    start_accept();
+#else
+    if (options.workers_ > 0) std::cout << "ERROR:: Prefork workers are not supported on this platform, serving from one process" << std::endl;
+#endif
+    Server server(port, log, debug, options);
+    server.run();
 }
 
-// Add the connection to the list and asynchronously accept it
-void Server::start_accept() {
-    auto con_handle = m_connections_.emplace(m_connections_.begin(), m_ioservice_);
-    auto handler = boost::bind(&Server::handle_accept, this, con_handle, boost::asio::placeholders::error);
-    m_acceptor_.async_accept(con_handle->socket_, handler);
+//////////////////////// STARTUP ////////////////////////
+
+// Watch a site's root so the paths it finds missing can be remembered until something under it is created, renamed or deleted
+void Server::watch_root(VirtualHost& host) {
+    std::unique_ptr<DirectoryWatcher> watcher(new DirectoryWatcher(m_ioservice_));
+    VirtualHost* site = &host;
+    string error;
+    bool watching = watcher->watch(host.root_, [this, site](bool intact) {
+        if (intact) {
+            site->missing_.clear();
+            site->directory_.forget();
+            return;
+        }
+        site->missing_.enable(false);
+        site->directory_.cache_directories(false);
+        write_to_standard_outputs("Lost track of changes under " + site->root_ + ", no longer remembering missing files for " + site->name_);
+        std::cout << std::endl;
+        if (logging_) log_writer_ << std::endl;
+    }, error);
+    if (!watching) {
+        std::cout << "ERROR:: Not remembering missing files for " << host.name_ << ", could not watch " << host.root_ << ": " << error << std::endl;
+        return;
+    }
+    host.missing_.enable(true);
+    host.directory_.cache_directories(true);
+    watchers_.push_back(std::move(watcher));
 }
 
 // Begin running the Boost ioservice and listening for incoming requests on the port provided and call start_accept for each new connection
+// With a handoff socket configured the listeners are taken over from a server already running, if there is one
 void Server::run() {
+#ifndef _WIN32
+    // Asio's own writes never raise SIGPIPE, but sendfile() does when the client has closed its end; that must close the
+    // connection, not the process
+    signal(SIGPIPE, SIG_IGN);
+#endif
     if (logging_) {
         string log_file_name = "log.txt";
         log_writer_.open(log_file_name, std::ios::app);
         if (!log_writer_) std::cout << "ERROR:: Could not create log." << std::endl;
         else log_writer_ << std::endl;
+        if (options_.log_format_ == LogFormat::binary) {
+            // Workers each write their own, since records from several processes can't share one file
+            string binary_log_name = worker_ >= 0 ? "log-" + std::to_string(worker_) + ".bin" : "log.bin";
+            if (binary_log_.open(binary_log_name)) flush_log(boost::system::error_code());
+            else std::cout << "ERROR:: Could not create binary log." << std::endl;
+        }
+    }
+    // The io_service runs on this thread, pinned before anything is loaded for the sites so that comes from its node
+    placement_.place_io_thread();
+    for (const string& line : placement_.report()) {
+        write_to_standard_outputs(line);
+        std::cout << std::endl;
+        if (logging_) log_writer_ << std::endl;
+    }
+    if (options_.embedded_only_) {
+#ifdef EMBEDDED_BUNDLE
+        embedded_ = &embedded_bundle;
+        write_to_standard_outputs("Serving the " + std::to_string(embedded_->size_) + " files embedded in the server");
+        std::cout << std::endl;
+        if (logging_) log_writer_ << std::endl;
+#else
+        std::cout << "ERROR:: The server was built without an embedded bundle, serving from disk" << std::endl;
+#endif
+    }
+    // Nothing is read from the roots when the sites come from the embedded bundle, which has the manifests' headers built in
+    if (!embedded_) {
+        for (const auto& host : hosts_.hosts()) {
+            if (!host->pack_file_.empty()) {
+                string error;
+                host->pack_ = AssetPack::open(host->pack_file_, error);
+                if (!host->pack_) std::cout << "ERROR:: Could not load asset pack for " << host->name_ << ": " << error << std::endl;
+                else {
+                    write_to_standard_outputs("Mapped " + std::to_string(host->pack_->size()) + " files for " + host->name_ + " from " + host->pack_file_);
+                    std::cout << std::endl;
+                    if (logging_) log_writer_ << std::endl;
+                }
+            }
+            if (host->missing_.stats().budget_ > 0) watch_root(*host);
+            size_t manifests = host->assets_.load(host->root_);
+            if (manifests == 0) continue;
+            write_to_standard_outputs("Read " + std::to_string(manifests) + " asset manifests for " + host->name_ + ", "
+                + std::to_string(host->assets_.immutable_count()) + " content hashed files are served as immutable");
+            std::cout << std::endl;
+            if (logging_) log_writer_ << std::endl;
+        }
     }
+    for (const auto& upstream : proxy_.upstreams()) {
+        if (!upstream->error().empty())
+            std::cout << "ERROR:: Proxy upstream " << upstream->route().upstream_ << " for " << upstream->route().prefix_ << " is unusable, " << upstream->error() << std::endl;
+        else {
+            write_to_standard_outputs("Proxying " + upstream->route().prefix_ + " to " + upstream->route().upstream_);
+            std::cout << std::endl;
+            if (logging_) log_writer_ << std::endl;
+        }
+    }
+#ifndef _WIN32
+    if (!options_.handoff_socket_path_.empty() && worker_ < 0 && inherit_listeners()) {
+        write_to_standard_outputs("Took over the listeners of the running server");
+        std::cout << std::endl;
+        if (logging_) log_writer_ << std::endl;
+    }
+#endif
     write_to_standard_outputs("Starting sever on port: \"" + std::to_string(port_) + "\"");
     std::cout << std::endl;
     if (logging_) log_writer_ << std::endl;
-    auto endpoint = boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), port_);
-    m_acceptor_.open(endpoint.protocol());
-    m_acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
-    m_acceptor_.bind(endpoint);
-    m_acceptor_.listen();
-    start_accept();
+    if (!m_acceptor_.is_open()) {
+        auto endpoint = boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), port_);
+        m_acceptor_.open(endpoint.protocol());
+        m_acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+        if (options_.reuse_port_ && !set_reuse_port(m_acceptor_))
+            std::cout << "ERROR:: Could not set SO_REUSEPORT on the listener" << std::endl;
+        m_acceptor_.bind(endpoint);
+        string failed = listen_tuned(m_acceptor_, options_.socket_tuning_);
+        if (!failed.empty())
+            std::cout << "ERROR:: Could not set " << failed << " on the listener" << std::endl;
+    }
+    arm_listener(false);
+
+    if (options_.tls_port_ != 0) {
+        try {
+            tls_context_.reset(new TlsContext(options_));
+            if (!m_tls_acceptor_.is_open()) {
+                auto tls_endpoint = boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), options_.tls_port_);
+                m_tls_acceptor_.open(tls_endpoint.protocol());
+                m_tls_acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+                if (options_.reuse_port_ && !set_reuse_port(m_tls_acceptor_))
+                    std::cout << "ERROR:: Could not set SO_REUSEPORT on the secure listener" << std::endl;
+                m_tls_acceptor_.bind(tls_endpoint);
+                string failed = listen_tuned(m_tls_acceptor_, options_.tls_socket_tuning_);
+                if (!failed.empty())
+                    std::cout << "ERROR:: Could not set " << failed << " on the secure listener" << std::endl;
+            }
+            write_to_standard_outputs("Starting secure listener on port: \"" + std::to_string(options_.tls_port_) + "\"");
+            std::cout << std::endl;
+            if (logging_) log_writer_ << std::endl;
+            arm_listener(true);
+        }
+        catch (const boost::system::system_error& e) {
+            std::cout << "ERROR:: Could not start secure listener: " << e.what() << std::endl;
+            boost::system::error_code ignored;
+            m_tls_acceptor_.close(ignored);
+            tls_context_.reset();
+        }
+    }
+#ifndef _WIN32
+    if (!options_.handoff_socket_path_.empty() && worker_ < 0)
+        start_handoff_listener();
+#endif
+
+    m_signals_.add(SIGINT);
+    m_signals_.add(SIGTERM);
+#ifndef _WIN32
+    m_signals_.add(SIGUSR1);
+#endif
+    m_signals_.async_wait(boost::bind(&Server::handle_signal, this, boost::asio::placeholders::error, boost::asio::placeholders::signal_number));
     m_ioservice_.run();
 }
 
@@ -194,8 +2159,9 @@ bool Server::is_running() {
     return !(m_ioservice_.stopped());
 }
 
-// Extract the requested filename from the request and return it as a string
-string Server::parse_get(const char buff[]) {
+// Extract the requested filename from the request and return it, resolved against the site's document root, as a string
+// A target that doesn't normalize to a path inside the root is "invalid"
+string Server::parse_get(const char buff[], const string& root) {
 
     // Split the char array into parseable lines
     vector<string> reqLines = split_string(buff, '\n');
@@ -204,12 +2170,12 @@ string Server::parse_get(const char buff[]) {
 
     // Getting requested filename
     vector<string> reqFileLines = split_string(reqLines[0], ' ');
-    if (reqFileLines.size() > 1) {
-        string fileName = reqFileLines[1].substr(1);
+    string fileName;
+    if (reqFileLines.size() > 1 && normalize_target(reqFileLines[1], fileName)) {
         if (fileName == "") {
             fileName = "index.html";
         }
-        reqFile = "html/" + fileName;
+        reqFile = root + fileName;
     }
     else {
         reqFile = "invalid";
@@ -218,116 +2184,325 @@ string Server::parse_get(const char buff[]) {
     return reqFile;
 }
 
+// Value of the named header (given in lower case), or an empty string if the request has none
+string Server::parse_header(const string& req, const char* name) {
+    size_t name_len = strlen(name);
+    size_t line_end = req.find("\r\n");
+    while (line_end != string::npos) {
+        size_t line_start = line_end + 2;
+        line_end = req.find("\r\n", line_start);
+        size_t end = line_end == string::npos ? req.size() : line_end;
+        if (end - line_start < name_len + 1 || req[line_start + name_len] != ':') continue;
+
+        bool match = true;
+        for (size_t i = 0; i < name_len && match; ++i)
+            match = std::tolower((unsigned char)req[line_start + i]) == name[i];
+        if (!match) continue;
+
+        size_t value = req.find_first_not_of(" \t", line_start + name_len + 1);
+        if (value == string::npos || value >= end) return string();
+        size_t value_end = req.find_last_not_of(" \t", end - 1);
+        return req.substr(value, value_end + 1 - value);
+    }
+    return string();
+}
+
 // Grabs the requested file and returns a tuple containing the response as a string (response contains the
 // requested file if the file is in a text format), a boolean value indicating whether the file is in binary
 // format, and a vector of unsigned chars containing the binary data of the file (if binary, empty otherwise)
-std::tuple<string, bool, vector<unsigned char>> Server::formulate_response(string filePath) {
+// Called from the file I/O pool threads, so it must not touch any connection state
+// A file whose ETag is listed in validator (the request's If-None-Match) is answered with a bodiless 304
+// With file_body set a file large enough to be sent with sendfile() that isn't cached is returned open instead of read
+response_t Server::formulate_response(string filePath, VirtualHost& host, const string& validator, bool file_body) {
+    LoadedFile loaded = load_file(filePath, host, validator, file_body);
+    return build_response(filePath, host, validator, loaded);
+}
+
+// The disk half of formulate_response(): look the file up and read it if it isn't cached and has to be
+// Runs on the file I/O pool
+Server::LoadedFile Server::load_file(const string& filePath, VirtualHost& host, const string& validator, bool file_body) {
+    LoadedFile loaded;
+    if (filePath == "invalid") return loaded;
 
-    // Create input file stream
-    std::ifstream in(filePath.c_str());
+    // Read before the lookup, so a path found missing just as it was created isn't remembered as missing
+    loaded.generation_ = host.missing_.generation();
+    // While only the embedded bundle is served the disk isn't looked at, and anything that gets here is not found
+    if (embedded_) {
+        loaded.ec_ = std::make_error_code(std::errc::no_such_file_or_directory);
+        return loaded;
+    }
+    // Paths are looked up from the site's open root directory rather than the working directory, through its open file cache
+    string relative = filePath.substr(host.root_.size());
+    loaded.opened_ = host.directory_.open(relative, loaded.ec_);
+    if (!loaded.opened_) return loaded;
 
-    // Get current date and time and store in char array
-    auto start = std::chrono::system_clock::now();
-    std::time_t time = std::chrono::system_clock::to_time_t(start);
-    char charTime[256];
-    ctime_s(charTime, sizeof(charTime), &time);
+    // Use the site's cached copy while the file on disk is unchanged, otherwise read it
+    // Files sent with sendfile() are identified by their size and time, so neither sending one nor revalidating it needs a read
+    loaded.blob_ = find_cached(filePath, host, *loaded.opened_);
+    if (loaded.blob_) {
+        host.stats_.cache_hit();
+    }
+    else if (sends_file(loaded.opened_->size_) && (file_body || etag_matches(validator, file_etag(*loaded.opened_)))) {
+        loaded.from_file_ = true;
+        host.stats_.cache_miss();
+    }
+    else {
+        loaded.read_ = host.directory_.read(*loaded.opened_, relative, loaded.contents_, loaded.ec_);
+    }
+    return loaded;
+}
+
+// The CPU half of formulate_response(): cache what was read and make the response, copying the body into it
+// Runs on the task pool for large bodies and on the file I/O pool otherwise
+response_t Server::build_response(const string& filePath, VirtualHost& host, const string& validator, LoadedFile& loaded) {
 
     // Initialize necessary vars
     vector<unsigned char> fileBuff;
     bool binaryStatus = false;
     vector<string> vec = split_string(filePath, '.');
-    string fileName = vec[0];
     string fileExtension;
     string response;
 
+    // The extension follows the last dot, so hashed build output such as main.cf02be27.chunk.js is typed correctly
     if (vec.size() > 1) {
-        fileExtension = vec[1];
-    }
-
-    // If the file requested is invalid as decided by "parse_get()" return default values
-    if (filePath == "invalid") return std::make_tuple(response, binaryStatus, fileBuff);
-
-    // If file can't be found return a 404 response
-    if (!in) {
-        response = "HTTP/1.1 404 Not Found\r\n"
-            "Date: ";
-        response.append(charTime)
-            .append(" EST\r\n"
-                "Server : Boost-Async-GET-Server\r\n"
-                "Content - Length : 230\r\n"
-                "Connection : Closed\r\n"
-                "Content - Type : text / html; charset = iso - 8859 - 1\r\n\r\n"
-                "<!DOCTYPE HTML>\r\n"
-                "<html>\r\n"
-                "<head>\r\n"
-                "<title>404 Not Found</title>\r\n"
-                "</head>\r\n"
-                "<body>\r\n"
-                "<h1>Not Found</h1>\r\n"
-                "<p>The requested URL /")
-            .append(fileName)
-            .append(" was not found on this server.</p>\r\n"
-                "</body>\r\n"
-                "</html>");
-    }
-
-    // If the file is found then parse
+        fileExtension = vec.back();
+    }
+
+    // If the file requested is invalid as decided by "parse_get()" the request is refused
+    if (filePath == "invalid") return formulate_error_response("400 Bad Request");
+
+    // The contents read go through the content store, which hands back the copy it already holds of an identical file
+    FileCache::blob_t file = loaded.blob_;
+    if (loaded.read_) {
+        file = content_store_.intern(std::move(loaded.contents_));
+        host.stats_.cache_miss();
+        cache_file(filePath, host, loaded.opened_->modified_, file);
+    }
+    bool from_file = loaded.from_file_;
+    const RootDirectory::file_t& opened = loaded.opened_;
+
+    // If file can't be found return a 404 response, remembering the path if it doesn't exist at all (as opposed to being unreadable)
+    if (!file && !from_file) {
+        const std::error_code& ec = loaded.ec_;
+        if (!embedded_ && (ec == std::errc::no_such_file_or_directory || ec == std::errc::not_a_directory))
+            host.missing_.insert(filePath, loaded.generation_);
+        return formulate_not_found_response(host);
+    }
+
+    // The file was found, so determine content type for header
+    string content_type = content_type_for(fileExtension, binaryStatus);
+
+    // Text files travel inside the response string, binary files in the separate buffer, and files that weren't read
+    // follow the header from the open file
+    bool by_identity = sends_file(opened->size_);
+    string etag = by_identity ? file_etag(*opened) : file->etag_;
+    bool not_modified = etag_matches(validator, etag);
+    RootDirectory::file_t sent_file = from_file && !not_modified ? opened : nullptr;
+    static const string no_text;
+    const string& rS = binaryStatus || not_modified || from_file ? no_text : file->contents_;
+    if (binaryStatus && !not_modified && !from_file)
+        fileBuff.assign(file->contents_.begin(), file->contents_.end());
+    uintmax_t body_size = sent_file ? sent_file->size_ : rS.length() + fileBuff.size();
+
+    // Begin creating response
+    // Header names must be valid tokens for the response to be translated to HTTP/2, and Content-Length counts the body only
+    response = not_modified ? "HTTP/1.1 304 Not Modified\r\n" : "HTTP/1.1 200 OK\r\n";
+    response.append("Date: ")
+        .append(http_date())
+        .append("\r\n"
+            "Server: Boost-Async-GET-Server\r\n"
+            "Content-Type: ")
+        .append(content_type)
+        .append("\r\n"
+            "ETag: ")
+        .append(etag)
+        .append("\r\n"
+            "Connection: close\r\n");
+
+    // Content hashed build output never changes under its name; an app's page preloads its entrypoints
+    const AssetManifests::Asset* asset = host.assets_.find(filePath);
+    if (asset && asset->immutable_) response.append("Cache-Control: public, max-age=31536000, immutable\r\n");
+    if (asset && !asset->preload_.empty()) response.append("Link: ").append(asset->preload_).append("\r\n");
+
+    if (not_modified) {
+        response.append("\r\n");
+    }
     else {
-        string content_type;
-        string rS;
-
-        // Determine content type for header
-        if (fileExtension == "html") content_type = "text / html";
-        else if (fileExtension == "js") content_type = "text / javascript; charset=utf-8";
-        else if (fileExtension == "css") content_type = "text / css";
-        else if (fileExtension == "png") { content_type = "image / png"; binaryStatus = true; }
-        else if (fileExtension == "ico") { content_type = "image / png"; binaryStatus = true; }
-        else if (fileExtension == "jpg") { content_type = "image / jpeg"; binaryStatus = true; }
-        else if (fileExtension == "gif") { content_type = "image / gif"; binaryStatus = true; }
-
-        // If the file isn't a binary file then simply read into a string and convert to custom String class
-        if (!binaryStatus) {
-            string contents((std::istreambuf_iterator<char>(in)),
-                std::istreambuf_iterator<char>());
-            rS = contents;
-        }
-
-        // If the file is binary then read it in as such by opening a new file stream in binary mode
-        else {
-            std::ifstream bin_file(filePath.c_str(), std::ios::binary | std::ios::in);
-            vector<unsigned char> v_buf((std::istreambuf_iterator<char>(bin_file)), (std::istreambuf_iterator<char>()));
-            fileBuff = v_buf;
-        }
-
-        // Begin creating response
-        response = "HTTP/1.1 200 OK\r\n"
-            "Date: ";
-        response.append(charTime)
-            .append(" EST\r\n"
-                "Server : Boost-Async-GET-Server\r\n"
-                "Content - Type : ")
-            .append(content_type)
-            .append("\r\n"
-                "Connection: Closed\r\n");
-
-        // Convert size to char array
-        char num_char[10 + sizeof(char)];
-        sprintf_s(num_char, "%d", (int)rS.length() + (int)response.length() + (int)fileBuff.size());
-
-        if (binaryStatus) response.append("accept-ranges: bytes\r\nContent-Transfer-Encoding: binary\r\n");
-        response.append("Content - Length : ")
-            .append(num_char)
+        if (binaryStatus) response.append("Accept-Ranges: bytes\r\nContent-Transfer-Encoding: binary\r\n");
+        response.append("Content-Length: ")
+            .append(std::to_string(body_size))
             .append("\r\n\r\n")
             .append(rS);
-
     }
-    in.close();
+    host.stats_.response(response.size() + fileBuff.size() + (sent_file ? sent_file->size_ : 0), true);
 
     // Return a tuple containing all necessary information about the response
-    return std::make_tuple(response, binaryStatus, fileBuff);
+    return std::make_tuple(response, binaryStatus, fileBuff, sent_file);
+}
+
+// Build the response for a file in an asset pack. The header lines that never change come ready made from the pack;
+// a client accepting gzip gets the pack's gzip copy where there is one, under an ETag of its own
+response_t Server::formulate_packed_response(VirtualHost& host, const AssetPack::Asset& asset, const string& validator, bool gzip) {
+    bool encoded = gzip && asset.gzip_bytes_ > 0;
+    string etag(asset.etag_);
+    if (encoded && etag.size() >= 2) etag.insert(etag.size() - 1, "-gzip");
+    bool not_modified = etag_matches(validator, etag);
+
+    string response = not_modified ? "HTTP/1.1 304 Not Modified\r\n" : "HTTP/1.1 200 OK\r\n";
+    response.append("Date: ")
+        .append(http_date())
+        .append("\r\n")
+        .append(asset.header_)
+        .append("ETag: ")
+        .append(etag)
+        .append("\r\n");
+
+    // The body always travels in the separate buffer, whatever its type
+    vector<unsigned char> body;
+    if (not_modified) {
+        response.append("\r\n");
+    }
+    else {
+        const char* data = encoded ? asset.gzip_ : asset.body_;
+        size_t len = encoded ? asset.gzip_bytes_ : asset.body_bytes_;
+        if (encoded) response.append("Content-Encoding: gzip\r\n");
+        if (asset.binary_) response.append("Accept-Ranges: bytes\r\nContent-Transfer-Encoding: binary\r\n");
+        response.append("Content-Length: ")
+            .append(std::to_string(len))
+            .append("\r\n\r\n");
+        body.assign(data, data + len);
+    }
+    host.stats_.pack_hit();
+    host.stats_.response(response.size() + body.size(), true);
+    return std::make_tuple(response, true, body, nullptr);
+}
+
+// The 404 for a file that isn't there. Everything but the Date is rendered once, so a miss costs a single copy
+response_t Server::formulate_not_found_response(VirtualHost& host) {
+    static const string body = "<!DOCTYPE HTML>\r\n"
+        "<html>\r\n"
+        "<head>\r\n"
+        "<title>404 Not Found</title>\r\n"
+        "</head>\r\n"
+        "<body>\r\n"
+        "<h1>Not Found</h1>\r\n"
+        "<p>The requested URL was not found on this server.</p>\r\n"
+        "</body>\r\n"
+        "</html>";
+    static const string after_date = "\r\n"
+        "Server: Boost-Async-GET-Server\r\n"
+        "Content-Type: text/html; charset=iso-8859-1\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n"
+        "Connection: close\r\n\r\n" + body;
+
+    string response;
+    response.reserve(64 + after_date.size());
+    response.append("HTTP/1.1 404 Not Found\r\nDate: ")
+        .append(http_date())
+        .append(after_date);
+    host.stats_.response(response.size(), false);
+    return std::make_tuple(response, false, vector<unsigned char>(), nullptr);
+}
+
+// Response sent when the file I/O pool is saturated and cannot take on another request
+response_t Server::formulate_unavailable_response() {
+    string response = "HTTP/1.1 503 Service Unavailable\r\n"
+        "Server: Boost-Async-GET-Server\r\n"
+        "Retry-After: 1\r\n"
+        "Content-Length: 0\r\n"
+        "Connection: close\r\n\r\n";
+    return std::make_tuple(response, false, vector<unsigned char>(), nullptr);
+}
+
+// A bodiless response for requests refused before they reach the file lookup, status is the code and reason phrase
+response_t Server::formulate_error_response(const string& status) {
+    string response = "HTTP/1.1 " + status + "\r\n"
+        "Server: Boost-Async-GET-Server\r\n"
+        "Content-Length: 0\r\n"
+        "Connection: close\r\n\r\n";
+    return std::make_tuple(response, false, vector<unsigned char>(), nullptr);
 }
 
 //////////////////////// FREE FUNCTION ////////////////////////
+// Turn a request target such as "/src/css/../img/a%20b.png?v=2" into a path relative to the document root
+// The query is dropped, escapes are decoded and empty and "." segments removed; a ".." segment, a backslash,
+// a NUL, a bad escape or a target not starting with "/" makes the target invalid and false is returned
+bool normalize_target(const string& target, string& path) {
+    if (target.empty() || target[0] != '/') return false;
+    size_t end = std::min(target.find('?'), target.find('#'));
+    if (end == string::npos) end = target.size();
+
+    string decoded;
+    decoded.reserve(end);
+    for (size_t i = 0; i < end; ++i) {
+        char c = target[i];
+        if (c == '%') {
+            if (i + 2 >= end || !std::isxdigit((unsigned char)target[i + 1]) || !std::isxdigit((unsigned char)target[i + 2])) return false;
+            c = (char)std::stoi(target.substr(i + 1, 2), nullptr, 16);
+            i += 2;
+        }
+        if (c == '\0' || c == '\\') return false;
+        decoded += c;
+    }
+
+    path.clear();
+    size_t start = 0;
+    while (start < decoded.size()) {
+        size_t slash = std::min(decoded.find('/', start), decoded.size());
+        string segment = decoded.substr(start, slash - start);
+        start = slash + 1;
+        if (segment.empty() || segment == ".") continue;
+        if (segment == "..") return false;
+        if (!path.empty()) path += '/';
+        path += segment;
+    }
+    return true;
+}
+
+// Whether an Accept-Encoding value allows gzip; a q of 0 rules it out
+bool accepts_gzip(const string& accept_encoding) {
+    string value = accept_encoding;
+    std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    value.erase(std::remove(value.begin(), value.end(), ' '), value.end());
+    size_t start = 0;
+    while (start < value.size()) {
+        size_t end = std::min(value.find(',', start), value.size());
+        string coding = value.substr(start, end - start);
+        start = end + 1;
+        size_t params = coding.find(';');
+        string name = coding.substr(0, params);
+        if (name != "gzip" && name != "*") continue;
+        if (params == string::npos) return true;
+        size_t q = coding.find("q=", params);
+        return q == string::npos || std::strtod(coding.c_str() + q + 2, nullptr) > 0;
+    }
+    return false;
+}
+
+// Whether a comma separated header value, such as Connection's, lists token; tokens are compared ignoring case
+bool lists_token(const string& list, const string& token) {
+    size_t start = 0;
+    while (start < list.size()) {
+        size_t end = std::min(list.find(',', start), list.size());
+        string item = list.substr(start, end - start);
+        start = end + 1;
+        size_t first = item.find_first_not_of(" \t");
+        if (first == string::npos) continue;
+        item = item.substr(first, item.find_last_not_of(" \t") + 1 - first);
+        if (item.size() == token.size() && std::equal(item.begin(), item.end(), token.begin(), [](char a, char b) { return std::tolower((unsigned char)a) == std::tolower((unsigned char)b); }))
+            return true;
+    }
+    return false;
+}
+
+// The target of a request, the part of its request line between the method and the protocol
+string request_target(const string& req) {
+    size_t start = req.find(' ');
+    if (start == string::npos) return string();
+    size_t end = req.find_first_of(" \r\n", start + 1);
+    return req.substr(start + 1, end == string::npos ? string::npos : end - start - 1);
+}
+
 // Splits a string on the delimiter provided into a vector of strings
 vector<string> split_string(string str, char det) {
     string temp;
@@ -353,3 +2528,32 @@ vector<string> split_string(string str, char det) {
 
     return result;
 }
+
+// True if an If-None-Match value lists the ETag or is "*"; weak tags (W/"...") match as well
+bool etag_matches(const string& validator, const string& etag) {
+    size_t first = validator.find_first_not_of(" \t");
+    if (first == string::npos) return false;
+    if (validator[first] == '*') return true;
+    return validator.find(etag) != string::npos;
+}
+
+// ETag of a file identified by its modification time and size rather than its contents, in hex like nginx's
+string file_etag(const RootDirectory::OpenFile& file) {
+    char etag[48];
+    snprintf(etag, sizeof(etag), "\"%llx-%llx\"", (unsigned long long)file.modified_.time_since_epoch().count(), (unsigned long long)file.size_);
+    return etag;
+}
+
+// Current time in the IMF-fixdate format HTTP expects, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+string http_date() {
+    time_t now = time(0);
+    struct tm gmt;
+#ifdef _WIN32
+    gmtime_s(&gmt, &now);
+#else
+    gmtime_r(&now, &gmt);
+#endif
+    char buff[64];
+    strftime(buff, sizeof(buff), "%a, %d %b %Y %H:%M:%S GMT", &gmt);
+    return buff;
+}
@@ -14,6 +14,7 @@
 #ifndef SERVER_H
 #define SERVER_H
 
+#include <chrono>
 #include <cstdint>
 #include <iostream>
 #include <list>
@@ -21,44 +22,276 @@
 #include <vector>
 #include <fstream>
 #include <algorithm>
+#include <atomic>
+#include <tuple>
+#include <unordered_map>
+#include "binary_log.h"
 #include "connection.h"
+#include "content_type.h"
+#include "cpu_placement.h"
+#include "debug_trace.h"
+#include "directory_watcher.h"
+#include "embedded_bundle.h"
+#include "file_io_pool.h"
+#include "prefork.h"
+#include "proxy.h"
+#include "server_options.h"
+#include "shared_file_cache.h"
+#include "socket_handoff.h"
+#include "socket_tuning.h"
+#include "task_pool.h"
+#include "tls_context.h"
+#include "virtual_host.h"
 
 using std::vector;
 
+// The header (followed by a text body), whether the body is binary, a binary body, and a file whose contents follow
+// all of that straight from the disk, if the body is sent that way
+using response_t = std::tuple<string, bool, vector<unsigned char>, RootDirectory::file_t>;
+
+// Snapshot of the WebSocket channels' traffic
+struct WebSocketStats {
+    size_t subscribers_ = 0;
+    uint64_t published_ = 0;
+    uint64_t delivered_ = 0;
+    uint64_t evicted_ = 0;
+};
+
 class Server {
 private:
     bool logging_;
-    bool debugging_;
+    DebugTrace trace_;
     uint16_t port_;
+    ServerOptions options_;
+    ContentStore content_store_;
+    HostTable hosts_;
+    // The bundle compiled into the server while it is the only thing served, otherwise null
+    const EmbeddedBundle* embedded_;
+#ifndef _WIN32
+    // The file cache shared with the other workers while this server is a prefork worker, otherwise null
+    SharedFileCache* shared_cache_;
+#endif
+    // Which prefork worker this server is, -1 for a server on its own
+    int worker_;
 
     std::ofstream log_writer_;
+    BinaryLogWriter binary_log_;
     boost::asio::io_service m_ioservice_;
+    // Declared after the io_service, which its pooled upstream connections belong to
+    ReverseProxy proxy_;
     boost::asio::ip::tcp::acceptor m_acceptor_;
+    boost::asio::ip::tcp::acceptor m_tls_acceptor_;
+    boost::asio::signal_set m_signals_;
+    boost::asio::steady_timer m_drain_timer_;
+    boost::asio::steady_timer m_log_flush_timer_;
+    // Watching each site's root that remembers missing paths
+    std::vector<std::unique_ptr<DirectoryWatcher>> watchers_;
+#ifndef _WIN32
+    boost::asio::local::stream_protocol::acceptor m_handoff_acceptor_;
+#endif
+    bool draining_;
+    std::chrono::steady_clock::time_point drain_deadline_;
+    std::unique_ptr<TlsContext> tls_context_;
+    // Declared before the connections, which return their buffers to it
+    BufferPool request_buffers_;
+    MemoryBudget memory_;
     std::list<Connection> m_connections_;
     using con_handle_t = std::list<Connection>::iterator;
+    // Members of each WebSocket channel; each connection knows its place, so leaving takes constant time
+    std::unordered_map<string, std::vector<con_handle_t>> channels_;
+    std::atomic<size_t> ws_subscribers_;
+    std::atomic<uint64_t> ws_published_;
+    std::atomic<uint64_t> ws_delivered_;
+    std::atomic<uint64_t> ws_evicted_;
+    // Accepts per listener held back while the memory budget is exceeded
+    size_t paused_accepts_[2];
+    bool relief_posted_;
+
+    // Declared before the pools, whose threads place themselves as they start
+    ThreadPlacement placement_;
+    // Declared before the file I/O pool, whose threads hand it work until they are joined
+    TaskPool task_pool_;
+    // Declared after the io_service so its threads are joined before the io_service is destroyed
+    FileIOPool file_io_pool_;
+
+    // A file looked up and, unless it was cached or is sent from disk, read, waiting to be made into a response
+    struct LoadedFile {
+        RootDirectory::file_t opened_;
+        FileCache::blob_t blob_;
+        string contents_;
+        bool read_ = false;
+        bool from_file_ = false;
+        std::error_code ec_;
+        uint64_t generation_ = 0;
+        // Body bytes building the response hashes or copies
+        size_t body_bytes() const { return blob_ ? blob_->contents_.size() : read_ ? contents_.size() : 0; }
+    };
+
+    // How far a request head has arrived, or which limit it broke
+    enum class RequestHead { incomplete, complete, line_too_long, headers_too_large };
 
-    string parse_get(const char[]);
-    std::tuple<string, bool, vector<unsigned char>> formulate_response(string);
+    string parse_get(const char[], const string&);
+    string parse_header(const string&, const char*);
+    response_t formulate_response(string, VirtualHost&, const string&, bool);
+    LoadedFile load_file(const string&, VirtualHost&, const string&, bool);
+    response_t build_response(const string&, VirtualHost&, const string&, LoadedFile&);
+    FileCache::blob_t find_cached(const string&, VirtualHost&, const RootDirectory::OpenFile&);
+    void cache_file(const string&, VirtualHost&, std::filesystem::file_time_type, const FileCache::blob_t&);
+    response_t formulate_packed_response(VirtualHost&, const AssetPack::Asset&, const string&, bool);
+    response_t formulate_not_found_response(VirtualHost&);
+    response_t formulate_unavailable_response();
+    response_t formulate_error_response(const string&);
+    RequestHead scan_request_head(const char*, size_t, size_t&) const;
 
     void write_to_standard_outputs(string);
+    string client_address(con_handle_t);
+    // Whether events on the connection are traced; while tracing is off this is the only check made
+    bool traced(con_handle_t con_handle) { return trace_.on() && trace_.wants_client(client_address(con_handle)); }
+    void apply_trace(const TraceSettings&);
+    bool answer_trace_admin(con_handle_t, const string&, uint32_t);
+    void charge(con_handle_t, MemoryBudget::Category, size_t);
+    bool is_heavy(con_handle_t);
+    void relieve_pressure();
+    void trim_caches();
+    bool shed_caches();
+    void watch_root(VirtualHost&);
     void close_connection(con_handle_t);
+    void erase_connection(con_handle_t);
     void handle_read(con_handle_t, boost::system::error_code const&, size_t);
     void do_async_read(con_handle_t);
-    void handle_response(con_handle_t, std::shared_ptr<string>, bool, boost::system::error_code const&);
+    void reject_request(con_handle_t, RequestHead);
+    void handle_response(con_handle_t, std::shared_ptr<response_t>, boost::system::error_code const&);
     void write_response(con_handle_t);
-    void handle_acknowledge(con_handle_t, std::shared_ptr<string>, boost::system::error_code const&);
-    void handle_accept(con_handle_t&, boost::system::error_code const&);
-    void start_accept();
+    void load_response(con_handle_t, VirtualHost*, string, string, string, bool, FileIOPool::Lane, uint32_t);
+    bool respond_from_memory(con_handle_t, VirtualHost*, const string&, const string&, const string&, bool, uint32_t);
+    void deliver_response(con_handle_t, const string&, std::shared_ptr<response_t>, uint32_t);
+    void post_response(con_handle_t, const string&, std::shared_ptr<response_t>, uint32_t);
+    void send_response(con_handle_t, const string&, response_t&);
+    bool sends_file(uintmax_t) const;
+    bool takes_file_body(con_handle_t) const;
+    void send_file_body(con_handle_t, std::shared_ptr<response_t>, uint64_t, boost::system::error_code const&);
+    void log_response(con_handle_t, const string&, const string&, size_t, std::chrono::steady_clock::time_point);
+    void log_text(con_handle_t, const string&, const string&, size_t);
+    void flush_log(boost::system::error_code const&);
+    void send_early_hints(con_handle_t, const VirtualHost&, const string&, uint32_t);
+    void handle_early_hints(con_handle_t, std::shared_ptr<string>, boost::system::error_code const&);
+    void begin_session(con_handle_t);
+    void start_http2(con_handle_t, const string&);
+    void do_http2_read(con_handle_t);
+    void handle_http2_read(con_handle_t, boost::system::error_code const&, size_t);
+    void receive_http2(con_handle_t, const char*, size_t);
+    void send_http2_response(con_handle_t, uint32_t, const string&, std::shared_ptr<response_t>);
+    void flush_http2(con_handle_t);
+    void handle_http2_write(con_handle_t, std::shared_ptr<std::vector<std::shared_ptr<const void>>>, boost::system::error_code const&);
+    bool is_websocket_upgrade(const string&);
+    void start_websocket(con_handle_t);
+    void do_websocket_read(con_handle_t);
+    void handle_websocket_read(con_handle_t, boost::system::error_code const&, size_t);
+    bool receive_websocket(con_handle_t, const char*, size_t);
+    void flush_websocket(con_handle_t);
+    void handle_websocket_write(con_handle_t, std::shared_ptr<std::vector<std::shared_ptr<const void>>>, boost::system::error_code const&);
+    void broadcast(const string&, const WebSocketSession::frame_t&, con_handle_t);
+    void leave_channel(con_handle_t);
+    void start_proxy(con_handle_t, Upstream*);
+    bool forward_request_head(con_handle_t, ProxyExchange&);
+    void handle_proxy_connection(con_handle_t, Upstream::connection_t, bool);
+    void connect_upstream(con_handle_t);
+    void handle_upstream_connect(con_handle_t, boost::system::error_code const&);
+    void send_upstream_request(con_handle_t);
+    void handle_upstream_request(con_handle_t, boost::system::error_code const&);
+    bool retry_upstream(con_handle_t);
+    void read_request_body(con_handle_t);
+    void handle_continue_sent(con_handle_t, boost::system::error_code const&);
+    void handle_request_body(con_handle_t, boost::system::error_code const&, size_t);
+    void handle_request_body_sent(con_handle_t, boost::system::error_code const&);
+    void read_upstream(con_handle_t);
+    void handle_upstream_read(con_handle_t, boost::system::error_code const&, size_t);
+    void handle_upstream_head(con_handle_t);
+    void handle_proxy_write(con_handle_t, boost::system::error_code const&);
+    void arm_proxy_timer(con_handle_t);
+    void handle_proxy_timer(con_handle_t, boost::system::error_code const&);
+    bool resume_proxy(con_handle_t);
+    void fail_proxy(con_handle_t, const string&);
+    void finish_proxy(con_handle_t);
+    void end_proxy(con_handle_t, bool);
+    void handle_handshake(con_handle_t, boost::system::error_code const&);
+    void handle_ticket_sent(con_handle_t, boost::system::error_code const&);
+    void open_connection(con_handle_t, bool);
+    void handle_accept(con_handle_t&, bool, boost::system::error_code const&);
+    void accept_waiting(bool);
+    void start_accept(bool);
+    void arm_listener(bool);
+    void handle_signal(boost::system::error_code const&, int);
+    void begin_drain(std::chrono::seconds);
+    void check_drained(boost::system::error_code const&);
+#ifndef _WIN32
+    bool inherit_listeners();
+    void start_handoff_listener();
+    void start_handoff_accept();
+    void handle_handoff_accept(std::shared_ptr<boost::asio::local::stream_protocol::socket>, boost::system::error_code const&);
+#endif
+
+    template <typename Handler>
+    void async_read_some(con_handle_t, Handler);
+    template <typename ConstBufferSequence, typename Handler>
+    void async_write_to(con_handle_t, const ConstBufferSequence&, Handler);
 
 public:
 
-    Server(uint16_t prt = 8080, bool log = true, bool debug = false) : logging_(log), debugging_(debug), port_(prt), log_writer_(), m_ioservice_(), m_acceptor_(m_ioservice_), m_connections_() { }
+    Server(uint16_t prt = 8080, bool log = true, bool debug = false, ServerOptions opts = ServerOptions())
+        : logging_(log), trace_(opts.trace_, debug || opts.trace_.enabled_), port_(prt), options_(opts), hosts_(opts.virtual_hosts_), embedded_(nullptr),
+#ifndef _WIN32
+          shared_cache_(nullptr),
+#endif
+          worker_(-1), log_writer_(), binary_log_(), m_ioservice_(), proxy_(m_ioservice_, opts.proxy_routes_), m_acceptor_(m_ioservice_), m_tls_acceptor_(m_ioservice_),
+          m_signals_(m_ioservice_), m_drain_timer_(m_ioservice_), m_log_flush_timer_(m_ioservice_),
+#ifndef _WIN32
+          m_handoff_acceptor_(m_ioservice_),
+#endif
+          draining_(false), request_buffers_(opts.request_buffer_size_, opts.request_buffer_pool_max_), memory_(opts.memory_budget_bytes_), m_connections_(),
+          ws_subscribers_(0), ws_published_(0), ws_delivered_(0), ws_evicted_(0), paused_accepts_{ 0, 0 }, relief_posted_(false),
+          placement_(opts.cpu_placement_),
+          task_pool_(opts.task_threads_, opts.task_max_queue_, [this](size_t index) { placement_.place_file_io_thread(options_.file_io_fast_threads_ + options_.file_io_bulk_threads_ + index); }),
+          file_io_pool_(opts.file_io_fast_threads_, opts.file_io_bulk_threads_, opts.file_io_max_queue_, [this](size_t index) { placement_.place_file_io_thread(index); }) { }
 
     void run();
+#ifndef _WIN32
+    // Make this server a prefork worker, before run(): it accepts from the master's listeners, or binds its own with
+    // SO_REUSEPORT if it was given none, and caches files in the shared segment. See run_server()
+    void become_worker(const PreforkWorker&);
+#endif
+
+    // Stop accepting new connections and let the ones in flight finish, closing whatever is left after the deadline
+    // run() returns once the drain is over. Safe to call from any thread
+    void drain(std::chrono::seconds deadline);
+
+    // Change what debug tracing prints, switching it on or off. Safe to call from any thread
+    void set_trace(const TraceSettings& settings);
+
+    // Send a message to every member of a WebSocket channel, framed once on the calling thread. Safe to call from any thread
+    void publish(const string& channel, const string& message, bool binary = false);
 
     bool is_running();
+    FileIOPool::Stats file_io_stats() const { return file_io_pool_.stats(); }
+    TaskPool::Stats task_stats() const { return task_pool_.stats(); }
+    const HostTable& hosts() const { return hosts_; }
+    ContentStore::Stats content_stats() const { return content_store_.stats(); }
+    BufferPool::Stats request_buffer_stats() const { return request_buffers_.stats(); }
+    MemoryBudget::Stats memory_stats() const { return memory_.stats(); }
+    WebSocketStats websocket_stats() const;
 };
 
+// Serve on port from this process until the server is stopped or, with options.workers_ set, from that many prefork
+// workers under this process as their master, until they have all stopped
+void run_server(uint16_t port, bool log, bool debug, const ServerOptions& options);
+
 vector<string> split_string(string, char);
+string http_date();
+string request_target(const string&);
+bool etag_matches(const string&, const string&);
+string file_etag(const RootDirectory::OpenFile&);
+bool accepts_gzip(const string&);
+bool normalize_target(const string&, string&);
+bool lists_token(const string&, const string&);
 
 #endif // SERVER_H
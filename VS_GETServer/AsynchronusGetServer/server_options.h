@@ -0,0 +1,231 @@
+/*
+
+    Tunable settings for the Server class. Every field has a sensible default so
+    a default constructed ServerOptions reproduces the original behaviour.
+
+    Author: Jarod Graygo
+
+*/
+
+#ifndef SERVER_OPTIONS_H
+#define SERVER_OPTIONS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// One site served by name from a shared port
+struct VirtualHostOptions {
+    // Host header values the site answers to, without a port; matched ignoring case
+    std::vector<std::string> names_;
+    // Directory the requested paths are resolved against
+    std::string root_ = "html/";
+    // Bytes of file contents kept in memory for this site, 0 disables its cache
+    size_t cache_bytes_ = 32 * 1024 * 1024;
+    // Asset pack built from the root with Tools/asset_pack_build, mapped at startup; files found in it are served from
+    // memory and everything else from the root. Empty serves from the root only
+    std::string pack_file_;
+    // Bytes of recently requested paths that don't exist remembered so they are answered without a disk lookup, 0 disables it
+    // Only used while the root can be watched for new files (Linux and Windows)
+    size_t missing_cache_bytes_ = 256 * 1024;
+    // Files kept open with their size and modification time, so a hot file is neither looked up nor opened per request;
+    // 0 disables it. A file unused for the inactive time is closed, and one checked against the disk within the valid
+    // time is used without looking again, so a file edited in place can be served unchanged for that long (not on Windows)
+    size_t open_files_ = 256;
+    long open_file_inactive_seconds_ = 20;
+    long open_file_valid_seconds_ = 1;
+};
+
+// Socket settings for one listener and the connections accepted on it; 0 or false leaves the system default
+// Settings the platform doesn't have are skipped
+struct SocketTuning {
+    // Connections the kernel queues for accept, 0 for the system maximum
+    int listen_backlog_ = 0;
+    // Disable Nagle's algorithm on accepted connections (always on for TLS handshakes and HTTP/2)
+    bool no_delay_ = false;
+    // Cork HTTP/1 responses while they are written so only full segments go out (Linux TCP_CORK)
+    bool cork_ = false;
+    // Only hand over a connection once its first data has arrived, waiting this many seconds for it (Linux TCP_DEFER_ACCEPT)
+    int defer_accept_seconds_ = 0;
+    // Pending TCP Fast Open connections, whose request arrives with the SYN (net.ipv4.tcp_fastopen must allow it on Linux)
+    int fast_open_queue_ = 0;
+    // Kernel send and receive buffer sizes of accepted connections
+    int send_buffer_bytes_ = 0;
+    int receive_buffer_bytes_ = 0;
+    // Unsent bytes the kernel may queue per connection before it stops reporting the socket writable (TCP_NOTSENT_LOWAT)
+    int not_sent_low_water_bytes_ = 0;
+};
+
+// Where the server's threads run; -1 and empty leave a thread to the scheduler. The io_service runs on the thread that
+// calls Server::run(). Linux and Windows (first 64 CPUs only); elsewhere the settings are reported and ignored
+struct CpuPlacement {
+    // CPU the io_service thread is pinned to
+    int io_cpu_ = -1;
+    // With io_cpu_ at -1, pick the io_service thread's CPU from where this network interface's interrupts are handled,
+    // e.g. "eth0": a CPU on the interface's NUMA node that handles none of them, or with share_irq_cpu_ the one handling
+    // most of them, so the packets are still in its cache (Linux)
+    std::string irq_interface_;
+    bool share_irq_cpu_ = false;
+    // CPUs the file I/O pool threads are pinned to, each thread to the next one in turn. Empty keeps them on the NUMA
+    // node of a pinned io_service thread and leaves them to the scheduler otherwise
+    std::vector<int> file_io_cpus_;
+    // Have pinned threads allocate from their own NUMA node first, where there is more than one (Linux)
+    bool numa_local_ = true;
+};
+
+// What debug tracing prints. Tracing can be switched while the server runs: SIGUSR1 turns it on and off (not on
+// Windows), the admin path below changes any of it and so does Server::set_trace()
+struct TraceSettings {
+    bool enabled_ = false;
+    // Trace one in this many of the requests that pass the filters
+    uint32_t sample_every_ = 1;
+    // Only trace requests whose target starts with one of these; empty traces every path
+    std::vector<std::string> path_prefixes_;
+    // Only trace clients whose address starts with one of these, such as "10.1." or "::1"; empty traces every client
+    std::vector<std::string> client_prefixes_;
+};
+
+// How requests are recorded in the log; text lines go to log.txt, fixed width binary records to log.bin
+// Binary logs are read with Tools/binary_log_convert, and in that mode requests are no longer echoed on the console
+enum class LogFormat { text, binary };
+
+// A path prefix whose requests are forwarded to another HTTP server instead of served from the sites
+struct ProxyRoute {
+    // Target prefix, e.g. "/api/"; the longest one a target starts with wins
+    std::string prefix_;
+    // "host:port" for TCP or "unix:/path/to/socket" for a Unix domain socket
+    std::string upstream_;
+    // Forward "/api/users" as "/users" rather than as it came
+    bool strip_prefix_ = false;
+    // Connections to the upstream, in use or idle, and how many of them are kept open between requests
+    size_t max_connections_ = 32;
+    size_t max_idle_ = 8;
+    // Requests waiting for a connection while all are in use; more get a 503
+    size_t max_waiting_ = 256;
+    // Failures in a row (refused connections, broken or missing responses) after which the upstream is down, and
+    // how long it stays down, answering 502 at once, before it is tried again
+    size_t max_fails_ = 3;
+    long fail_timeout_seconds_ = 10;
+    // Longest the upstream may take over any step of an exchange: connecting, taking the request or sending a
+    // piece of the response. Past it the client gets a 504, or is cut off once the response has begun
+    long timeout_seconds_ = 30;
+};
+
+struct ServerOptions {
+    // Threads servicing the fast lane of the file I/O pool (opens, stats and small reads)
+    size_t file_io_fast_threads_ = 2;
+    // Threads servicing the bulk lane of the file I/O pool (reads of large files)
+    size_t file_io_bulk_threads_ = 2;
+    // Maximum number of file jobs waiting across both lanes before requests are refused with a 503
+    size_t file_io_max_queue_ = 1024;
+    // Files larger than this many bytes are read on the bulk lane so they never delay small files
+    size_t file_io_bulk_threshold_ = 64 * 1024;
+    // HTTP/1 responses for files at least this large are sent from the open file with sendfile() rather than read into
+    // memory, over plain TCP or kernel TLS; 0 disables it (Linux only). Such files get an ETag made from their size and
+    // modification time instead of their contents, whatever the protocol, since they are never read
+    size_t sendfile_threshold_ = 64 * 1024;
+    // Threads of the work-stealing pool that hashes, caches and copies the bodies of responses once a file I/O thread
+    // has read or found them, so a file I/O thread goes back to reading at once; 0 leaves that to the file I/O threads
+    size_t task_threads_ = 2;
+    // Responses waiting for the pool before the file I/O threads build any more themselves
+    size_t task_max_queue_ = 256;
+    // Bodies smaller than this many bytes are cheaper to build where they were read than to hand over
+    size_t task_min_bytes_ = 64 * 1024;
+
+    // CPUs the io_service, file I/O and task pool threads are pinned to, none by default
+    CpuPlacement cpu_placement_;
+
+    // Accepts kept outstanding on each listener, so a burst of connections doesn't wait for each one to be set up in turn
+    size_t pending_accepts_ = 4;
+    // Connections already queued on a listener that are taken in one go whenever an accept completes, 0 takes one at a time
+    size_t accept_batch_ = 16;
+
+    // Socket settings of the plain listener and of the HTTPS listener
+    SocketTuning socket_tuning_;
+    SocketTuning tls_socket_tuning_;
+
+    // Port for the HTTPS listener, 0 leaves it disabled
+    uint16_t tls_port_ = 0;
+    // PEM certificate chain and private key for the HTTPS listener
+    std::string tls_certificate_file_ = "server.crt";
+    std::string tls_private_key_file_ = "server.key";
+    // Number of sessions held in the shared resumption cache and how long they stay valid
+    size_t tls_session_cache_size_ = 20480;
+    long tls_session_timeout_seconds_ = 300;
+    // How often the session ticket key is replaced
+    long tls_ticket_rotation_seconds_ = 3600;
+    // Offload TLS record encryption for responses to the kernel where supported (Linux, TLS 1.3 AES-GCM)
+    bool tls_ktls_ = false;
+
+    // Bytes the server may hold for its clients across read buffers, queued responses and the file caches, 0 for no limit
+    // Over it the caches are trimmed first; then new connections wait in the backlog, HTTP/2 connections holding the most
+    // get no new streams and large files are refused with a 503, until usage is back under nine tenths of it
+    size_t memory_budget_bytes_ = 0;
+
+    // Bytes each connection reads its request into, drawn from a pool shared by all connections
+    size_t request_buffer_size_ = 4096;
+    // Released request buffers kept for reuse instead of being freed
+    size_t request_buffer_pool_max_ = 1024;
+    // Longest request line accepted; a longer one is refused with a 414
+    size_t max_request_line_ = 8192;
+    // Most header fields, and header bytes including the request line, a request may carry; more is refused with a 431
+    // A head larger than the request buffer grows into an overflow buffer up to this size. On HTTP/2 the byte limit
+    // is advertised as SETTINGS_MAX_HEADER_LIST_SIZE
+    size_t max_request_headers_ = 100;
+    size_t max_request_header_bytes_ = 16384;
+
+    // Accept HTTP/2, negotiated through ALPN on the HTTPS listener or with prior knowledge on the plain one
+    bool http2_ = true;
+    // Streams a client may have open at once on an HTTP/2 connection
+    uint32_t http2_max_concurrent_streams_ = 100;
+
+    // Path prefix under which HTTP/1 requests may upgrade to WebSocket, on either listener, such as "/ws/"; empty, the
+    // default, disables it. A connection to /ws/<channel> joins that channel, and every message it sends goes to the
+    // channel's other members
+    std::string websocket_path_;
+    // Largest message a client may send, fragments included; a larger one closes the connection with 1009
+    size_t websocket_max_message_bytes_ = 64 * 1024;
+    // Bytes of frames a WebSocket client may have waiting to be sent to it; one that falls further behind is dropped
+    size_t websocket_max_queued_bytes_ = 1024 * 1024;
+
+    // Path prefixes forwarded to upstream HTTP servers over HTTP/1.1 (see proxy.h); checked before the sites
+    std::vector<ProxyRoute> proxy_routes_;
+
+    // How long a graceful shutdown (Ctrl+C, SIGTERM or handing over to a new server) waits for the connections in flight
+    long drain_timeout_seconds_ = 30;
+    // Unix socket over which the listening sockets are handed to a replacement server, empty disables it (not on Windows)
+    // A server started with the path of one already running takes its listeners over, and the old one drains and exits
+    std::string handoff_socket_path_;
+
+    // Worker processes run_server() forks, each a server of its own, under a master that binds the listeners and
+    // restarts any worker that dies (see prefork.h, not on Windows); 0 serves from the calling process
+    // Workers take no part in handoffs, and each writes its binary log to log-<worker>.bin
+    size_t workers_ = 0;
+    // Bytes of file contents the workers cache between them in shared memory, in place of each site's own cache
+    size_t shared_cache_bytes_ = 64 * 1024 * 1024;
+    // Have each worker bind listeners of its own with SO_REUSEPORT, so the kernel spreads connections across them,
+    // instead of all accepting from the master's (Linux). Connections waiting on a worker that dies are reset
+    bool reuse_port_ = false;
+
+    // Sites served from this process. A request for a name no site lists goes to the first one, and with none
+    // configured everything is served from html/ with the default cache budget
+    std::vector<VirtualHostOptions> virtual_hosts_;
+    // Serve every site from the bundle compiled into the server (see embedded_bundle.h) without touching the disk;
+    // files not in it get a 404. Servers built without EMBEDDED_BUNDLE report it and serve from the roots as usual
+    bool embedded_only_ = false;
+
+    // Debug tracing at startup; the server's debug flag turns it on with these settings
+    TraceSettings trace_;
+    // Path answering to loopback clients only, e.g. "/_trace", that shows the trace settings and changes them through its
+    // query: enable=1|0, sample=N, path=/a/,/b/ and client=10.1.,::1 (an empty list clears a filter); empty disables it
+    std::string trace_admin_path_;
+
+    // Format of the request log written when logging is on; server messages always go to log.txt
+    LogFormat log_format_ = LogFormat::text;
+
+    // Send 103 Early Hints carrying the preload links of a web app's page while the page itself is being read
+    bool early_hints_ = false;
+};
+
+#endif // SERVER_OPTIONS_H
@@ -0,0 +1,198 @@
+/*
+
+    Function definitions for SharedFileCache class
+
+    Author: Jarod Graygo
+
+*/
+
+#include "shared_file_cache.h"
+
+#ifndef _WIN32
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <sys/mman.h>
+
+namespace {
+
+// Slots tried from a path's home slot, when looking it up and when finding it a place
+const size_t probe_limit = 8;
+// A slot for every 4 KB of arena, about the average size of a site's files
+const size_t bytes_per_slot = 4096;
+const size_t min_slots = 1024;
+
+size_t round_up(size_t n, size_t to) {
+    return (n + to - 1) / to * to;
+}
+
+}
+
+// Every field is written by one process and read by the others, so all of them are atomics
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the shared cache needs lock free 64-bit atomics");
+
+struct SharedFileCache::Header {
+    uint64_t slot_count_;
+    uint64_t arena_bytes_;
+    // Bytes ever reserved in the arena; the next entry goes at this modulo arena_bytes_
+    std::atomic<uint64_t> write_position_;
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+    std::atomic<uint64_t> inserts_;
+};
+
+struct SharedFileCache::Slot {
+    // Odd while a writer is filling the slot in
+    std::atomic<uint64_t> sequence_;
+    std::atomic<uint64_t> path_hash_;
+    // Where the entry was reserved in the ring; its path is stored first and then the body
+    std::atomic<uint64_t> position_;
+    // 0 while the slot has never been used
+    std::atomic<uint64_t> path_bytes_;
+    std::atomic<uint64_t> body_bytes_;
+    std::atomic<int64_t> modified_;
+    std::atomic<uint64_t> content_hash_;
+};
+
+std::unique_ptr<SharedFileCache> SharedFileCache::create(size_t arena_bytes, std::string& error) {
+    if (arena_bytes == 0) {
+        error = "the cache has no room";
+        return nullptr;
+    }
+    size_t slot_count = min_slots;
+    while (slot_count * bytes_per_slot < arena_bytes) slot_count *= 2;
+    size_t slots_offset = round_up(sizeof(Header), 64);
+    size_t arena_offset = round_up(slots_offset + slot_count * sizeof(Slot), 4096);
+    size_t segment_bytes = arena_offset + arena_bytes;
+
+    // Anonymous shared memory is zero filled and stays shared with every child forked after this
+    void* segment = mmap(nullptr, segment_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (segment == MAP_FAILED) {
+        error = std::strerror(errno);
+        return nullptr;
+    }
+    Header* header = new (segment) Header();
+    header->slot_count_ = slot_count;
+    header->arena_bytes_ = arena_bytes;
+    Slot* slots = reinterpret_cast<Slot*>(static_cast<char*>(segment) + slots_offset);
+    for (size_t i = 0; i < slot_count; ++i) new (&slots[i]) Slot();
+    return std::unique_ptr<SharedFileCache>(new SharedFileCache(segment, segment_bytes));
+}
+
+SharedFileCache::SharedFileCache(void* segment, size_t segment_bytes)
+    : segment_(segment), segment_bytes_(segment_bytes), header_(static_cast<Header*>(segment)) {
+    slots_ = reinterpret_cast<Slot*>(static_cast<char*>(segment) + round_up(sizeof(Header), 64));
+    arena_ = static_cast<char*>(segment) + round_up(round_up(sizeof(Header), 64) + header_->slot_count_ * sizeof(Slot), 4096);
+}
+
+SharedFileCache::~SharedFileCache() {
+    munmap(segment_, segment_bytes_);
+}
+
+bool SharedFileCache::intact(uint64_t position) const {
+    return header_->write_position_.load(std::memory_order_acquire) <= position + header_->arena_bytes_;
+}
+
+FileCache::blob_t SharedFileCache::find(const std::string& path, std::filesystem::file_time_type modified, uintmax_t size) {
+    uint64_t hash = xxhash64(path.data(), path.size());
+    int64_t modified_count = modified.time_since_epoch().count();
+    for (size_t probe = 0; probe < probe_limit; ++probe) {
+        Slot& slot = slots_[(hash + probe) & (header_->slot_count_ - 1)];
+        uint64_t sequence = slot.sequence_.load(std::memory_order_acquire);
+        if ((sequence & 1) || slot.path_hash_.load(std::memory_order_relaxed) != hash) continue;
+        uint64_t position = slot.position_.load(std::memory_order_relaxed);
+        uint64_t path_bytes = slot.path_bytes_.load(std::memory_order_relaxed);
+        uint64_t body_bytes = slot.body_bytes_.load(std::memory_order_relaxed);
+        uint64_t content_hash = slot.content_hash_.load(std::memory_order_relaxed);
+        if (path_bytes != path.size() || body_bytes != size || slot.modified_.load(std::memory_order_relaxed) != modified_count) continue;
+
+        // Copied before it is validated; if a writer got in meanwhile the copy is thrown away. The fields may then be
+        // a mix of two entries, so they are kept inside the arena before anything is read
+        uint64_t offset = position % header_->arena_bytes_;
+        if (offset + path_bytes + body_bytes > header_->arena_bytes_) continue;
+        const char* entry = arena_ + offset;
+        bool same_path = std::memcmp(entry, path.data(), path.size()) == 0;
+        auto blob = std::make_shared<ContentStore::Blob>();
+        if (same_path) blob->contents_.assign(entry + path_bytes, body_bytes);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (!same_path || slot.sequence_.load(std::memory_order_relaxed) != sequence || !intact(position)) continue;
+
+        blob->hash_ = content_hash;
+        blob->etag_ = content_etag(content_hash);
+        header_->hits_.fetch_add(1, std::memory_order_relaxed);
+        return blob;
+    }
+    header_->misses_.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+}
+
+void SharedFileCache::insert(const std::string& path, std::filesystem::file_time_type modified, const FileCache::blob_t& blob) {
+    const std::string& body = blob->contents_;
+    uint64_t arena_bytes = header_->arena_bytes_;
+    uint64_t length = path.size() + body.size();
+    if (path.empty() || length > arena_bytes / 8) return;
+    uint64_t hash = xxhash64(path.data(), path.size());
+
+    // The slot already holding the path, else a free one or one the ring has overwritten, else the oldest entry's
+    Slot* chosen = nullptr;
+    uint64_t oldest = UINT64_MAX;
+    for (size_t probe = 0; probe < probe_limit; ++probe) {
+        Slot& slot = slots_[(hash + probe) & (header_->slot_count_ - 1)];
+        if (slot.sequence_.load(std::memory_order_acquire) & 1) continue;
+        uint64_t position = slot.position_.load(std::memory_order_relaxed);
+        if (slot.path_bytes_.load(std::memory_order_relaxed) == 0 || slot.path_hash_.load(std::memory_order_relaxed) == hash || !intact(position)) {
+            chosen = &slot;
+            break;
+        }
+        if (position < oldest) {
+            oldest = position;
+            chosen = &slot;
+        }
+    }
+    if (!chosen) return;
+    uint64_t sequence = chosen->sequence_.load(std::memory_order_relaxed);
+    if ((sequence & 1) || !chosen->sequence_.compare_exchange_strong(sequence, sequence + 1, std::memory_order_acquire)) return;
+
+    // Entries never wrap round the end of the arena; one that would is moved on to the start of the next lap
+    uint64_t reserved = header_->write_position_.load(std::memory_order_relaxed);
+    uint64_t start;
+    do {
+        start = reserved;
+        uint64_t offset = start % arena_bytes;
+        if (offset + length > arena_bytes) start += arena_bytes - offset;
+    } while (!header_->write_position_.compare_exchange_weak(reserved, start + length, std::memory_order_acq_rel));
+    // Readers of the entries being overwritten must see the new write position before any of the new bytes
+    std::atomic_thread_fence(std::memory_order_release);
+
+    char* entry = arena_ + start % arena_bytes;
+    std::memcpy(entry, path.data(), path.size());
+    std::memcpy(entry + path.size(), body.data(), body.size());
+
+    chosen->path_hash_.store(hash, std::memory_order_relaxed);
+    chosen->position_.store(start, std::memory_order_relaxed);
+    chosen->path_bytes_.store(path.size(), std::memory_order_relaxed);
+    chosen->body_bytes_.store(body.size(), std::memory_order_relaxed);
+    chosen->modified_.store(modified.time_since_epoch().count(), std::memory_order_relaxed);
+    chosen->content_hash_.store(blob->hash_, std::memory_order_relaxed);
+    chosen->sequence_.store(sequence + 2, std::memory_order_release);
+    header_->inserts_.fetch_add(1, std::memory_order_relaxed);
+}
+
+SharedFileCache::Stats SharedFileCache::stats() const {
+    Stats stats;
+    for (size_t i = 0; i < header_->slot_count_; ++i) {
+        const Slot& slot = slots_[i];
+        if (slot.path_bytes_.load(std::memory_order_relaxed) == 0 || !intact(slot.position_.load(std::memory_order_relaxed))) continue;
+        ++stats.entries_;
+        stats.bytes_ += slot.body_bytes_.load(std::memory_order_relaxed);
+    }
+    stats.capacity_ = header_->arena_bytes_;
+    stats.hits_ = header_->hits_.load(std::memory_order_relaxed);
+    stats.misses_ = header_->misses_.load(std::memory_order_relaxed);
+    stats.inserts_ = header_->inserts_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+#endif // _WIN32
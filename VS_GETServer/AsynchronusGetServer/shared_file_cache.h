@@ -0,0 +1,82 @@
+/*
+
+    A file cache shared by the worker processes of a prefork server (see prefork.h). It
+    lives in one shared memory segment mapped by the master before it forks, so a file
+    read by any worker is a hit for all of them, and the cache costs the same memory
+    however many workers there are.
+
+    The segment holds a small header, an index of slots and an arena. Entries, the path
+    followed by the body, are appended to the arena as to a ring: a writer reserves its
+    bytes by moving the write position on with a compare and swap, and the oldest entries
+    are the ones overwritten, so eviction is first in first out rather than least recently
+    used. Each slot is guarded by a sequence number that is odd while a writer fills it in.
+    A reader copies the entry out, then checks the sequence is unchanged and the ring has
+    not come round over the bytes it copied, and otherwise treats it as a miss. Nothing
+    takes a lock, so a worker that dies in the middle of an insert holds up no one; the
+    slot it was filling is lost.
+
+    As in FileCache, entries carry the modification time and size the file had when it
+    was read and a lookup only succeeds while both still match. Not available on Windows.
+
+    Author: Jarod Graygo
+
+*/
+
+#ifndef SHARED_FILE_CACHE_H
+#define SHARED_FILE_CACHE_H
+
+#ifndef _WIN32
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include "file_cache.h"
+
+class SharedFileCache {
+public:
+    // Snapshot of the segment, across every process using it
+    struct Stats {
+        size_t entries_ = 0;
+        size_t bytes_ = 0;
+        size_t capacity_ = 0;
+        uint64_t hits_ = 0;
+        uint64_t misses_ = 0;
+        uint64_t inserts_ = 0;
+    };
+
+    // Map a segment with an arena of arena_bytes, to be shared with the processes forked after it
+    // Returns null, with error set, if it can't be mapped
+    static std::unique_ptr<SharedFileCache> create(size_t arena_bytes, std::string& error);
+    ~SharedFileCache();
+
+    SharedFileCache(const SharedFileCache&) = delete;
+    SharedFileCache& operator=(const SharedFileCache&) = delete;
+
+    // A copy of the cached contents of path, or nullptr if it is not cached or the file has changed since it was read
+    FileCache::blob_t find(const std::string& path, std::filesystem::file_time_type modified, uintmax_t size);
+
+    // Add or replace the contents of path. Entries over an eighth of the arena are not cached, and an insert that
+    // finds its slots busy with other writers is dropped rather than waited on
+    void insert(const std::string& path, std::filesystem::file_time_type modified, const FileCache::blob_t& blob);
+
+    Stats stats() const;
+
+private:
+    struct Header;
+    struct Slot;
+
+    SharedFileCache(void* segment, size_t segment_bytes);
+    // Whether the entry reserved at position has not been overwritten by the ring coming round
+    bool intact(uint64_t position) const;
+
+    void* segment_;
+    size_t segment_bytes_;
+    Header* header_;
+    Slot* slots_;
+    char* arena_;
+};
+
+#endif // _WIN32
+
+#endif // SHARED_FILE_CACHE_H
@@ -0,0 +1,107 @@
+/*
+
+    Function definitions for the listening socket handoff
+
+    Author: Jarod Graygo
+
+*/
+
+#include "socket_handoff.h"
+
+#ifndef _WIN32
+
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace {
+
+// Both servers listen on at most two ports
+const size_t max_descriptors = 2;
+
+#ifdef MSG_CMSG_CLOEXEC
+const int receive_flags = MSG_CMSG_CLOEXEC;
+#else
+const int receive_flags = 0;
+#endif
+
+}
+
+bool send_descriptors(int unix_socket, uint8_t tag, const std::vector<int>& fds) {
+    if (fds.empty() || fds.size() > max_descriptors) return false;
+
+    iovec iov;
+    iov.iov_base = &tag;
+    iov.iov_len = 1;
+
+    char control[CMSG_SPACE(sizeof(int) * max_descriptors)];
+    std::memset(control, 0, sizeof(control));
+    msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    std::memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(unix_socket, &msg, 0);
+    } while (sent < 0 && errno == EINTR);
+    return sent == 1;
+}
+
+bool receive_descriptors(int unix_socket, uint8_t& tag, std::vector<int>& fds) {
+    // The running server answers straight away; don't hang on startup if it has stopped responding
+    timeval timeout;
+    timeout.tv_sec = 5;
+    timeout.tv_usec = 0;
+    setsockopt(unix_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    iovec iov;
+    iov.iov_base = &tag;
+    iov.iov_len = 1;
+
+    char control[CMSG_SPACE(sizeof(int) * max_descriptors)];
+    msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t received;
+    do {
+        received = recvmsg(unix_socket, &msg, receive_flags);
+    } while (received < 0 && errno == EINTR);
+    if (received != 1) return false;
+
+    fds.clear();
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; ++i) {
+            int fd;
+            std::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            fds.push_back(fd);
+        }
+    }
+
+    // A truncated message may have lost descriptors, don't trust any of them
+    if ((msg.msg_flags & MSG_CTRUNC) || fds.empty()) {
+        for (int fd : fds) close(fd);
+        fds.clear();
+        return false;
+    }
+    return true;
+}
+
+#endif // _WIN32
@@ -0,0 +1,37 @@
+/*
+
+    Passing listening sockets from a running server to its replacement over a Unix
+    domain socket (SCM_RIGHTS), so an upgrade never closes the listening port.
+
+    The old process keeps serving until the new one has the descriptors; from then on
+    both hold the same listening socket, connections waiting in its backlog are
+    picked up by whichever accepts first, and the old process stops accepting and
+    drains. Not available on Windows.
+
+    Author: Jarod Graygo
+
+*/
+
+#ifndef SOCKET_HANDOFF_H
+#define SOCKET_HANDOFF_H
+
+#ifndef _WIN32
+
+#include <cstdint>
+#include <vector>
+
+// Which listeners a handoff message carries, the descriptors follow in this order
+enum HandoffListener : uint8_t {
+    handoff_plain = 0x1,
+    handoff_secure = 0x2
+};
+
+// Send the descriptors with a tag describing them; returns false if the message could not be sent
+bool send_descriptors(int unix_socket, uint8_t tag, const std::vector<int>& fds);
+
+// Receive descriptors sent by send_descriptors(); returns false if no well formed message arrived within a few seconds
+bool receive_descriptors(int unix_socket, uint8_t& tag, std::vector<int>& fds);
+
+#endif // _WIN32
+
+#endif // SOCKET_HANDOFF_H
@@ -0,0 +1,92 @@
+/*
+
+    Function definitions for applying socket tuning
+
+    Author: Jarod Graygo
+
+*/
+
+#include "socket_tuning.h"
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+
+namespace {
+
+template <typename Socket>
+bool set_int_option(Socket& socket, int level, int name, int value) {
+    return ::setsockopt(socket.native_handle(), level, name, reinterpret_cast<const char*>(&value), sizeof(value)) == 0;
+}
+
+void note_failure(std::string& failed, const char* name) {
+    if (!failed.empty()) failed += ", ";
+    failed += name;
+}
+
+}
+
+std::string listen_tuned(boost::asio::ip::tcp::acceptor& acceptor, const SocketTuning& tuning) {
+    std::string failed;
+    if (tuning.defer_accept_seconds_ > 0) {
+#ifdef TCP_DEFER_ACCEPT
+        if (!set_int_option(acceptor, IPPROTO_TCP, TCP_DEFER_ACCEPT, tuning.defer_accept_seconds_))
+#endif
+            note_failure(failed, "TCP_DEFER_ACCEPT");
+    }
+    if (tuning.fast_open_queue_ > 0) {
+#if defined(TCP_FASTOPEN) && defined(__APPLE__)
+        // macOS only takes an on/off switch
+        if (!set_int_option(acceptor, IPPROTO_TCP, TCP_FASTOPEN, 1))
+#elif defined(TCP_FASTOPEN)
+        if (!set_int_option(acceptor, IPPROTO_TCP, TCP_FASTOPEN, tuning.fast_open_queue_))
+#endif
+            note_failure(failed, "TCP_FASTOPEN");
+    }
+    int backlog = tuning.listen_backlog_ > 0 ? tuning.listen_backlog_ : (int)boost::asio::socket_base::max_listen_connections;
+    acceptor.listen(backlog);
+    return failed;
+}
+
+std::string tune_connection(boost::asio::ip::tcp::socket& socket, const SocketTuning& tuning) {
+    std::string failed;
+    boost::system::error_code ec;
+    if (tuning.no_delay_) {
+        socket.set_option(boost::asio::ip::tcp::no_delay(true), ec);
+        if (ec) note_failure(failed, "TCP_NODELAY");
+    }
+    if (tuning.send_buffer_bytes_ > 0) {
+        socket.set_option(boost::asio::socket_base::send_buffer_size(tuning.send_buffer_bytes_), ec);
+        if (ec) note_failure(failed, "SO_SNDBUF");
+    }
+    if (tuning.receive_buffer_bytes_ > 0) {
+        socket.set_option(boost::asio::socket_base::receive_buffer_size(tuning.receive_buffer_bytes_), ec);
+        if (ec) note_failure(failed, "SO_RCVBUF");
+    }
+    if (tuning.not_sent_low_water_bytes_ > 0) {
+#ifdef TCP_NOTSENT_LOWAT
+        if (!set_int_option(socket, IPPROTO_TCP, TCP_NOTSENT_LOWAT, tuning.not_sent_low_water_bytes_))
+#endif
+            note_failure(failed, "TCP_NOTSENT_LOWAT");
+    }
+    return failed;
+}
+
+void set_cork(boost::asio::ip::tcp::socket& socket, bool cork) {
+#ifdef TCP_CORK
+    set_int_option(socket, IPPROTO_TCP, TCP_CORK, cork ? 1 : 0);
+#else
+    (void)socket;
+    (void)cork;
+#endif
+}
+
+bool set_reuse_port(boost::asio::ip::tcp::acceptor& acceptor) {
+#ifdef SO_REUSEPORT
+    return set_int_option(acceptor, SOL_SOCKET, SO_REUSEPORT, 1);
+#else
+    (void)acceptor;
+    return false;
+#endif
+}
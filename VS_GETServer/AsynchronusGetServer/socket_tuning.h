@@ -0,0 +1,34 @@
+/*
+
+    Applying the SocketTuning settings of ServerOptions to listening and accepted sockets.
+
+    Listener settings have to be in place before the socket starts listening; connection
+    settings are applied right after accept. An option the platform or kernel refuses is
+    reported by name and otherwise ignored, the server runs fine without any of them.
+
+    Author: Jarod Graygo
+
+*/
+
+#ifndef SOCKET_TUNING_H
+#define SOCKET_TUNING_H
+
+#include <string>
+#include <boost/asio.hpp>
+#include "server_options.h"
+
+// Set the deferred accept and fast open options on an open, bound acceptor and start listening with the configured backlog
+// Returns the names of the options that could not be set, comma separated, or an empty string
+std::string listen_tuned(boost::asio::ip::tcp::acceptor&, const SocketTuning&);
+
+// Set Nagle, buffer size and low water options on an accepted connection; returns what could not be set like listen_tuned()
+std::string tune_connection(boost::asio::ip::tcp::socket&, const SocketTuning&);
+
+// Cork or uncork the connection; uncorking sends whatever partial segment was held back. No effect where TCP_CORK is missing
+void set_cork(boost::asio::ip::tcp::socket&, bool);
+
+// Let other sockets bind the same port, the kernel sharing its connections out among them, on an open acceptor before
+// it is bound; returns false where SO_REUSEPORT is missing or refused
+bool set_reuse_port(boost::asio::ip::tcp::acceptor&);
+
+#endif // SOCKET_TUNING_H
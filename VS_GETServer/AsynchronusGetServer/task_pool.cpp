@@ -0,0 +1,114 @@
+/*
+
+    Function definitions for TaskPool class
+
+    Author: Jarod Graygo
+
+*/
+
+#include "task_pool.h"
+
+namespace {
+
+    // The pool and worker the calling thread belongs to, so a task posted from a worker stays on its deque
+    thread_local const TaskPool* current_pool = nullptr;
+    thread_local size_t current_worker = 0;
+
+}
+
+TaskPool::TaskPool(size_t threads, size_t max_queued, std::function<void(size_t)> thread_started)
+    : max_queued_(max_queued), thread_started_(thread_started), queued_(0), next_(0), stopped_(false),
+      peak_queued_(0), completed_(0), stolen_(0), rejected_(0) {
+    for (size_t i = 0; i < threads; ++i)
+        workers_.emplace_back(new Worker());
+    for (size_t i = 0; i < threads; ++i)
+        threads_.emplace_back(&TaskPool::worker_loop, this, i);
+}
+
+TaskPool::~TaskPool() {
+    stop();
+}
+
+bool TaskPool::post(std::function<void()> task) {
+    if (workers_.empty()) return false;
+    size_t index = current_pool == this ? current_worker : next_.fetch_add(1, std::memory_order_relaxed) % workers_.size();
+    {
+        std::lock_guard<std::mutex> idle(idle_mutex_);
+        if (stopped_ || queued_.load() >= max_queued_) {
+            ++rejected_;
+            return false;
+        }
+        Worker& worker = *workers_[index];
+        std::lock_guard<std::mutex> lock(worker.mutex_);
+        worker.tasks_.push_back(std::move(task));
+        size_t depth = ++queued_;
+        if (depth > peak_queued_.load(std::memory_order_relaxed)) peak_queued_.store(depth, std::memory_order_relaxed);
+    }
+    idle_.notify_one();
+    return true;
+}
+
+void TaskPool::stop() {
+    {
+        std::lock_guard<std::mutex> idle(idle_mutex_);
+        if (stopped_ && threads_.empty()) return;
+        stopped_ = true;
+    }
+    idle_.notify_all();
+    for (auto& t : threads_)
+        if (t.joinable()) t.join();
+    threads_.clear();
+}
+
+TaskPool::Stats TaskPool::stats() const {
+    Stats s;
+    s.queued_ = queued_.load();
+    s.peak_queued_ = peak_queued_.load();
+    s.completed_ = completed_.load();
+    s.stolen_ = stolen_.load();
+    s.rejected_ = rejected_.load();
+    return s;
+}
+
+// Run tasks until the pool is stopped and every deque is empty, sleeping whenever there is nothing to take
+void TaskPool::worker_loop(size_t index) {
+    current_pool = this;
+    current_worker = index;
+    if (thread_started_) thread_started_(index);
+    for (;;) {
+        std::function<void()> task;
+        if (take(index, task)) {
+            task();
+            ++completed_;
+            continue;
+        }
+        std::unique_lock<std::mutex> idle(idle_mutex_);
+        idle_.wait(idle, [this] { return stopped_ || queued_.load() > 0; });
+        if (stopped_ && queued_.load() == 0) return;
+    }
+}
+
+// The worker's own oldest task, or failing that the newest task of the first other worker that has one
+bool TaskPool::take(size_t index, std::function<void()>& task) {
+    {
+        Worker& own = *workers_[index];
+        std::lock_guard<std::mutex> lock(own.mutex_);
+        if (!own.tasks_.empty()) {
+            task = std::move(own.tasks_.front());
+            own.tasks_.pop_front();
+            --queued_;
+            return true;
+        }
+    }
+    for (size_t i = 1; i < workers_.size(); ++i) {
+        Worker& victim = *workers_[(index + i) % workers_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex_);
+        if (victim.tasks_.empty()) continue;
+        task = std::move(victim.tasks_.back());
+        victim.tasks_.pop_back();
+        --queued_;
+        ++stolen_;
+        return true;
+    }
+    return false;
+}
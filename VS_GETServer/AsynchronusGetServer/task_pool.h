@@ -0,0 +1,83 @@
+/*
+
+    A work-stealing pool of threads for CPU-bound work, kept apart from the file I/O pool
+    so hashing and copying large bodies never holds up a thread that could be reading, and
+    never runs on the thread driving the io_service.
+
+    Every worker has its own deque. Tasks posted from outside the pool are spread over the
+    workers in turn, and a task posted from a worker goes onto that worker's deque. A
+    worker takes its own tasks oldest first; when it has none it steals the newest task of
+    another worker before going to sleep, so one worker stuck on a large task doesn't hold
+    up the tasks queued behind it. The number of tasks waiting is capped and post() refuses
+    more, leaving the caller to do the work itself.
+
+    Author: Jarod Graygo
+
+*/
+
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class TaskPool {
+public:
+    // Snapshot of the pool's metrics
+    struct Stats {
+        size_t queued_ = 0;
+        size_t peak_queued_ = 0;
+        uint64_t completed_ = 0;
+        uint64_t stolen_ = 0;
+        uint64_t rejected_ = 0;
+    };
+
+    // A pool of no threads refuses every task. Every thread calls thread_started with its index before it takes any work
+    TaskPool(size_t threads, size_t max_queued, std::function<void(size_t)> thread_started = nullptr);
+    ~TaskPool();
+
+    TaskPool(const TaskPool&) = delete;
+    TaskPool& operator=(const TaskPool&) = delete;
+
+    // Queue a task; returns false if the pool is full, stopped or has no threads
+    bool post(std::function<void()>);
+    // Stop accepting tasks, let the workers finish what is already queued and join them
+    void stop();
+    Stats stats() const;
+
+private:
+    struct Worker {
+        std::mutex mutex_;
+        std::deque<std::function<void()>> tasks_;
+    };
+
+    void worker_loop(size_t index);
+    bool take(size_t index, std::function<void()>& task);
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::thread> threads_;
+    size_t max_queued_;
+    std::function<void(size_t)> thread_started_;
+    // Tasks in all the deques, changed under the lock of the deque they went into or came out of
+    std::atomic<size_t> queued_;
+    // Worker the next task from outside the pool goes to
+    std::atomic<size_t> next_;
+    // Idle workers sleep on it until something is queued; posting and stopping hold the mutex so no task is left behind
+    std::mutex idle_mutex_;
+    std::condition_variable idle_;
+    bool stopped_;
+
+    std::atomic<size_t> peak_queued_;
+    std::atomic<uint64_t> completed_;
+    std::atomic<uint64_t> stolen_;
+    std::atomic<uint64_t> rejected_;
+};
+
+#endif // TASK_POOL_H
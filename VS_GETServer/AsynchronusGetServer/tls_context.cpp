@@ -0,0 +1,240 @@
+/*
+
+    Function definitions for TlsContext class
+
+    Author: Jarod Graygo
+
+*/
+
+#include "tls_context.h"
+#include <cstdlib>
+#include <cstring>
+#include <openssl/core_names.h>
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/rand.h>
+
+#if defined(__linux__)
+#include <linux/tls.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+#endif
+
+namespace {
+
+// Ex data slots used to find our objects from inside OpenSSL callbacks
+int context_index() {
+    static int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+    return index;
+}
+
+int secret_index() {
+    static int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+    return index;
+}
+
+// HKDF-Expand-Label from RFC 8446 section 7.1 with an empty context
+bool hkdf_expand_label(const EVP_MD* md, const std::string& secret, const std::string& label, unsigned char* out, size_t out_len) {
+    std::string full_label = "tls13 " + label;
+    std::vector<unsigned char> info;
+    info.push_back(static_cast<unsigned char>(out_len >> 8));
+    info.push_back(static_cast<unsigned char>(out_len & 0xff));
+    info.push_back(static_cast<unsigned char>(full_label.size()));
+    info.insert(info.end(), full_label.begin(), full_label.end());
+    info.push_back(0);
+
+    EVP_PKEY_CTX* pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, nullptr);
+    if (!pctx) return false;
+    bool ok = EVP_PKEY_derive_init(pctx) > 0
+        && EVP_PKEY_CTX_set_hkdf_mode(pctx, EVP_PKEY_HKDEF_MODE_EXPAND_ONLY) > 0
+        && EVP_PKEY_CTX_set_hkdf_md(pctx, md) > 0
+        && EVP_PKEY_CTX_set1_hkdf_key(pctx, reinterpret_cast<const unsigned char*>(secret.data()), (int)secret.size()) > 0
+        && EVP_PKEY_CTX_add1_hkdf_info(pctx, info.data(), (int)info.size()) > 0
+        && EVP_PKEY_derive(pctx, out, &out_len) > 0;
+    EVP_PKEY_CTX_free(pctx);
+    return ok;
+}
+
+}
+
+TlsContext::TlsContext(const ServerOptions& opts)
+    : context_(boost::asio::ssl::context::tls_server), ktls_(false), http2_(opts.http2_), ticket_rotation_(opts.tls_ticket_rotation_seconds_) {
+
+    context_.set_options(boost::asio::ssl::context::default_workarounds
+        | boost::asio::ssl::context::no_sslv2
+        | boost::asio::ssl::context::no_sslv3
+        | boost::asio::ssl::context::no_tlsv1
+        | boost::asio::ssl::context::no_tlsv1_1);
+    context_.use_certificate_chain_file(opts.tls_certificate_file_);
+    context_.use_private_key_file(opts.tls_private_key_file_, boost::asio::ssl::context::pem);
+
+    SSL_CTX* ctx = context_.native_handle();
+    SSL_CTX_set_ex_data(ctx, context_index(), this);
+
+    // Session ID resumption out of a cache shared by every connection on the listener
+    static const unsigned char session_id_context[] = "Boost-Async-GET-Server";
+    SSL_CTX_set_session_id_context(ctx, session_id_context, sizeof(session_id_context) - 1);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx, (long)opts.tls_session_cache_size_);
+    SSL_CTX_set_timeout(ctx, (long)opts.tls_session_timeout_seconds_);
+
+    // Ticket resumption with keys we rotate ourselves
+    rotate_ticket_keys_if_due();
+    SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, &TlsContext::ticket_key_callback);
+
+    SSL_CTX_set_alpn_select_cb(ctx, &TlsContext::alpn_callback, this);
+
+#if defined(__linux__)
+    if (opts.tls_ktls_) {
+        ktls_ = true;
+        SSL_CTX_set_keylog_callback(ctx, &TlsContext::keylog_callback);
+    }
+#endif
+}
+
+// With kTLS the server's traffic secret is captured during the handshake, and tickets are issued
+// manually afterwards so the number of records sent under the application key is known exactly
+void TlsContext::prepare_session(SSL* ssl, std::string* ktls_secret) {
+    if (!ktls_) return;
+    SSL_set_ex_data(ssl, secret_index(), ktls_secret);
+    SSL_set_num_tickets(ssl, 0);
+}
+
+// Generate a fresh ticket key once the rotation interval has passed, keeping the previous one for decryption
+void TlsContext::rotate_ticket_keys_if_due() {
+    std::lock_guard<std::mutex> lock(ticket_mutex_);
+    auto now = std::chrono::steady_clock::now();
+    if (!ticket_keys_.empty() && now - last_rotation_ < ticket_rotation_) return;
+
+    TicketKey key;
+    RAND_bytes(key.name_, sizeof(key.name_));
+    RAND_bytes(key.aes_key_, sizeof(key.aes_key_));
+    RAND_bytes(key.hmac_key_, sizeof(key.hmac_key_));
+    ticket_keys_.insert(ticket_keys_.begin(), key);
+    if (ticket_keys_.size() > 2) ticket_keys_.resize(2);
+    last_rotation_ = now;
+}
+
+// Called by OpenSSL to encrypt (enc == 1) or decrypt (enc == 0) a session ticket
+// Returns 2 when the ticket was made with the previous key so the client is issued a renewed one. TLS 1.3
+// clients use each ticket only once, and OpenSSL sends no replacement on a resumed connection unless asked to
+int TlsContext::ticket_key_callback(SSL* ssl, unsigned char* key_name, unsigned char* iv, EVP_CIPHER_CTX* cipher_ctx, EVP_MAC_CTX* mac_ctx, int enc) {
+    TlsContext* self = static_cast<TlsContext*>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), context_index()));
+    if (!self) return -1;
+    self->rotate_ticket_keys_if_due();
+
+    std::lock_guard<std::mutex> lock(self->ticket_mutex_);
+    const TicketKey* key = nullptr;
+    int result = 1;
+    if (enc) {
+        key = &self->ticket_keys_.front();
+        if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) <= 0) return -1;
+        std::memcpy(key_name, key->name_, sizeof(key->name_));
+    }
+    else {
+        for (size_t i = 0; i < self->ticket_keys_.size(); ++i) {
+            if (std::memcmp(key_name, self->ticket_keys_[i].name_, sizeof(key->name_)) == 0) {
+                key = &self->ticket_keys_[i];
+                result = i == 0 && SSL_version(ssl) != TLS1_3_VERSION ? 1 : 2;
+                break;
+            }
+        }
+        if (!key) return 0;
+    }
+
+    char digest[] = "SHA256";
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, const_cast<unsigned char*>(key->hmac_key_), sizeof(key->hmac_key_)),
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+        OSSL_PARAM_construct_end()
+    };
+    if (EVP_MAC_CTX_set_params(mac_ctx, params) <= 0) return -1;
+
+    int ok = enc ? EVP_EncryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), nullptr, key->aes_key_, iv)
+                 : EVP_DecryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), nullptr, key->aes_key_, iv);
+    return ok > 0 ? result : -1;
+}
+
+// Pick the application protocol, preferring HTTP/2 over HTTP/1.1 when it is enabled
+// Clients that offer neither carry on without ALPN and are treated as HTTP/1
+int TlsContext::alpn_callback(SSL*, const unsigned char** out, unsigned char* outlen, const unsigned char* in, unsigned int inlen, void* arg) {
+    static const unsigned char with_h2[] = "\x02h2\x08http/1.1";
+    static const unsigned char without_h2[] = "\x08http/1.1";
+    TlsContext* self = static_cast<TlsContext*>(arg);
+    const unsigned char* supported = self->http2_ ? with_h2 : without_h2;
+    unsigned int supported_len = self->http2_ ? sizeof(with_h2) - 1 : sizeof(without_h2) - 1;
+
+    unsigned char* selected = nullptr;
+    if (SSL_select_next_proto(&selected, outlen, supported, supported_len, in, inlen) != OPENSSL_NPN_NEGOTIATED)
+        return SSL_TLSEXT_ERR_NOACK;
+    *out = selected;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+// Key log lines look like "SERVER_TRAFFIC_SECRET_0 <client random> <secret>", both in hex
+void TlsContext::keylog_callback(const SSL* ssl, const char* line) {
+    static const char label[] = "SERVER_TRAFFIC_SECRET_0 ";
+    if (std::strncmp(line, label, sizeof(label) - 1) != 0) return;
+    std::string* secret = static_cast<std::string*>(SSL_get_ex_data(ssl, secret_index()));
+    if (!secret) return;
+
+    const char* hex = std::strrchr(line, ' ');
+    if (!hex) return;
+    ++hex;
+    secret->clear();
+    for (size_t i = 0; hex[i] && hex[i + 1]; i += 2) {
+        char byte[3] = { hex[i], hex[i + 1], '\0' };
+        secret->push_back(static_cast<char>(std::strtoul(byte, nullptr, 16)));
+    }
+}
+
+bool TlsContext::enable_ktls_send(SSL* ssl, boost::asio::ip::tcp::socket::native_handle_type fd, const std::string& ktls_secret, uint64_t record_seq) {
+#if defined(__linux__)
+    if (!ktls_ || ktls_secret.empty() || SSL_version(ssl) != TLS1_3_VERSION) return false;
+
+    const SSL_CIPHER* cipher = SSL_get_current_cipher(ssl);
+    if (!cipher) return false;
+    int nid = SSL_CIPHER_get_cipher_nid(cipher);
+
+    unsigned char key[32], iv[12];
+    unsigned char seq[8];
+    for (int i = 0; i < 8; ++i)
+        seq[i] = static_cast<unsigned char>(record_seq >> (56 - 8 * i));
+
+    if (nid == NID_aes_128_gcm) {
+        tls12_crypto_info_aes_gcm_128 info;
+        std::memset(&info, 0, sizeof(info));
+        if (!hkdf_expand_label(EVP_sha256(), ktls_secret, "key", key, 16) || !hkdf_expand_label(EVP_sha256(), ktls_secret, "iv", iv, 12)) return false;
+        info.info.version = TLS_1_3_VERSION;
+        info.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+        std::memcpy(info.key, key, TLS_CIPHER_AES_GCM_128_KEY_SIZE);
+        std::memcpy(info.salt, iv, TLS_CIPHER_AES_GCM_128_SALT_SIZE);
+        std::memcpy(info.iv, iv + TLS_CIPHER_AES_GCM_128_SALT_SIZE, TLS_CIPHER_AES_GCM_128_IV_SIZE);
+        std::memcpy(info.rec_seq, seq, TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+        if (setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) != 0) return false;
+        return setsockopt(fd, SOL_TLS, TLS_TX, &info, sizeof(info)) == 0;
+    }
+    if (nid == NID_aes_256_gcm) {
+        tls12_crypto_info_aes_gcm_256 info;
+        std::memset(&info, 0, sizeof(info));
+        if (!hkdf_expand_label(EVP_sha384(), ktls_secret, "key", key, 32) || !hkdf_expand_label(EVP_sha384(), ktls_secret, "iv", iv, 12)) return false;
+        info.info.version = TLS_1_3_VERSION;
+        info.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+        std::memcpy(info.key, key, TLS_CIPHER_AES_GCM_256_KEY_SIZE);
+        std::memcpy(info.salt, iv, TLS_CIPHER_AES_GCM_256_SALT_SIZE);
+        std::memcpy(info.iv, iv + TLS_CIPHER_AES_GCM_256_SALT_SIZE, TLS_CIPHER_AES_GCM_256_IV_SIZE);
+        std::memcpy(info.rec_seq, seq, TLS_CIPHER_AES_GCM_256_REC_SEQ_SIZE);
+        if (setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) != 0) return false;
+        return setsockopt(fd, SOL_TLS, TLS_TX, &info, sizeof(info)) == 0;
+    }
+    return false;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,67 @@
+/*
+
+    TLS support for the secure listener. Wraps the Boost ASIO SSL context and adds
+    the pieces ASIO does not cover itself:
+      - a shared server side session cache for session ID resumption
+      - session ticket keys that are rotated on a fixed interval, with the previous
+        key kept around so tickets issued just before a rotation still resume
+      - kernel TLS (kTLS) transmit offload on Linux, so responses on a secure
+        connection can be written as plaintext straight to the socket
+
+    Author: Jarod Graygo
+
+*/
+
+#ifndef TLS_CONTEXT_H
+#define TLS_CONTEXT_H
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include "server_options.h"
+
+class TlsContext {
+public:
+    explicit TlsContext(const ServerOptions&);
+
+    TlsContext(const TlsContext&) = delete;
+    TlsContext& operator=(const TlsContext&) = delete;
+
+    boost::asio::ssl::context& context() { return context_; }
+    bool ktls_enabled() const { return ktls_; }
+
+    // Prepare a new connection before its handshake; the secret buffer receives the server's
+    // traffic secret if kTLS is enabled and must outlive the handshake
+    void prepare_session(SSL*, std::string* ktls_secret);
+
+    // Hand the transmit side of an established TLS 1.3 connection to the kernel
+    // Returns false (and leaves the connection untouched) if the kernel, cipher or protocol version is unsupported
+    bool enable_ktls_send(SSL*, boost::asio::ip::tcp::socket::native_handle_type, const std::string& ktls_secret, uint64_t record_seq);
+
+private:
+    struct TicketKey {
+        unsigned char name_[16];
+        unsigned char aes_key_[32];
+        unsigned char hmac_key_[32];
+    };
+
+    void rotate_ticket_keys_if_due();
+    static int ticket_key_callback(SSL*, unsigned char*, unsigned char*, EVP_CIPHER_CTX*, EVP_MAC_CTX*, int);
+    static void keylog_callback(const SSL*, const char*);
+    static int alpn_callback(SSL*, const unsigned char**, unsigned char*, const unsigned char*, unsigned int, void*);
+
+    boost::asio::ssl::context context_;
+    bool ktls_;
+    bool http2_;
+
+    std::mutex ticket_mutex_;
+    std::vector<TicketKey> ticket_keys_; // Newest first
+    std::chrono::seconds ticket_rotation_;
+    std::chrono::steady_clock::time_point last_rotation_;
+};
+
+#endif // TLS_CONTEXT_H
@@ -0,0 +1,64 @@
+/*
+
+    Function definitions for the virtual host table
+
+    Author: Jarod Graygo
+
+*/
+
+#include "virtual_host.h"
+#include <algorithm>
+#include <cctype>
+
+HostStats::Snapshot HostStats::snapshot() const {
+    Snapshot snap;
+    snap.responses_ = responses_.load(std::memory_order_relaxed);
+    snap.bytes_ = bytes_.load(std::memory_order_relaxed);
+    snap.not_found_ = not_found_.load(std::memory_order_relaxed);
+    snap.cache_hits_ = cache_hits_.load(std::memory_order_relaxed);
+    snap.cache_misses_ = cache_misses_.load(std::memory_order_relaxed);
+    snap.pack_hits_ = pack_hits_.load(std::memory_order_relaxed);
+    return snap;
+}
+
+VirtualHost::VirtualHost(const VirtualHostOptions& opts)
+    : name_(opts.names_.empty() ? std::string("default") : normalize_host(opts.names_.front())),
+      root_(opts.root_.empty() || opts.root_.back() != '/' ? opts.root_ + '/' : opts.root_), directory_(root_, opts.open_files_,
+          std::chrono::seconds(opts.open_file_inactive_seconds_), std::chrono::seconds(opts.open_file_valid_seconds_)), cache_(opts.cache_bytes_),
+      missing_(opts.missing_cache_bytes_), pack_file_(opts.pack_file_) { }
+
+HostTable::HostTable(const std::vector<VirtualHostOptions>& sites) {
+    if (sites.empty()) {
+        hosts_.emplace_back(new VirtualHost(VirtualHostOptions()));
+        return;
+    }
+    for (const auto& site : sites) {
+        hosts_.emplace_back(new VirtualHost(site));
+        for (const auto& name : site.names_)
+            by_name_.emplace(normalize_host(name), hosts_.back().get());
+    }
+}
+
+VirtualHost& HostTable::find(const std::string& host) const {
+    if (!by_name_.empty() && !host.empty()) {
+        auto found = by_name_.find(normalize_host(host));
+        if (found != by_name_.end()) return *found->second;
+    }
+    return *hosts_.front();
+}
+
+std::string normalize_host(const std::string& host) {
+    size_t end = host.size();
+    // An IPv6 literal keeps its brackets and the colons inside them
+    if (!host.empty() && host[0] == '[') {
+        size_t close = host.find(']');
+        if (close != std::string::npos) end = close + 1;
+    }
+    else {
+        size_t colon = host.find(':');
+        if (colon != std::string::npos) end = colon;
+    }
+    std::string name = host.substr(0, end);
+    std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    return name;
+}
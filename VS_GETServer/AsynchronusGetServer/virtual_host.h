@@ -0,0 +1,102 @@
+/*
+
+    Name based virtual hosting. Every site has its own document root, file cache and
+    counters, and the host table maps each name a site answers to onto it so a request
+    is routed with one hash lookup on its Host header (or :authority for HTTP/2).
+
+    Author: Jarod Graygo
+
+*/
+
+#ifndef VIRTUAL_HOST_H
+#define VIRTUAL_HOST_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "asset_manifest.h"
+#include "asset_pack.h"
+#include "file_cache.h"
+#include "missing_paths.h"
+#include "root_directory.h"
+#include "server_options.h"
+
+// Per site counters, updated from the file I/O pool threads
+class HostStats {
+public:
+    struct Snapshot {
+        uint64_t responses_ = 0;
+        uint64_t bytes_ = 0;
+        uint64_t not_found_ = 0;
+        uint64_t cache_hits_ = 0;
+        uint64_t cache_misses_ = 0;
+        uint64_t pack_hits_ = 0;
+    };
+
+    HostStats() : responses_(0), bytes_(0), not_found_(0), cache_hits_(0), cache_misses_(0), pack_hits_(0) { }
+
+    void response(uint64_t bytes, bool found) {
+        responses_.fetch_add(1, std::memory_order_relaxed);
+        bytes_.fetch_add(bytes, std::memory_order_relaxed);
+        if (!found) not_found_.fetch_add(1, std::memory_order_relaxed);
+    }
+    void cache_hit() { cache_hits_.fetch_add(1, std::memory_order_relaxed); }
+    void cache_miss() { cache_misses_.fetch_add(1, std::memory_order_relaxed); }
+    void pack_hit() { pack_hits_.fetch_add(1, std::memory_order_relaxed); }
+
+    Snapshot snapshot() const;
+
+private:
+    std::atomic<uint64_t> responses_;
+    std::atomic<uint64_t> bytes_;
+    std::atomic<uint64_t> not_found_;
+    std::atomic<uint64_t> cache_hits_;
+    std::atomic<uint64_t> cache_misses_;
+    std::atomic<uint64_t> pack_hits_;
+};
+
+struct VirtualHost {
+    explicit VirtualHost(const VirtualHostOptions&);
+
+    // The first name the site is configured with, used when reporting
+    std::string name_;
+    // Document root with a trailing slash, request paths are appended to it
+    std::string root_;
+    // Held open, request paths are resolved from it
+    RootDirectory directory_;
+    FileCache cache_;
+    // Paths recently found missing, kept while the root is being watched
+    MissingPaths missing_;
+    // Filled in from the build manifests under the root when the server starts
+    AssetManifests assets_;
+    // Mapped from pack_file_ when the server starts, if the site has one
+    std::string pack_file_;
+    std::unique_ptr<AssetPack> pack_;
+    HostStats stats_;
+};
+
+class HostTable {
+public:
+    // With no hosts configured a single default site is served from html/
+    explicit HostTable(const std::vector<VirtualHostOptions>&);
+
+    HostTable(const HostTable&) = delete;
+    HostTable& operator=(const HostTable&) = delete;
+
+    // The site for a Host header value; a port and letter case are ignored, and unknown or missing names get the first site
+    VirtualHost& find(const std::string& host) const;
+
+    const std::vector<std::unique_ptr<VirtualHost>>& hosts() const { return hosts_; }
+
+private:
+    std::vector<std::unique_ptr<VirtualHost>> hosts_;
+    std::unordered_map<std::string, VirtualHost*> by_name_;
+};
+
+// Host name as the host table stores it: lower case, without a port
+std::string normalize_host(const std::string&);
+
+#endif // VIRTUAL_HOST_H
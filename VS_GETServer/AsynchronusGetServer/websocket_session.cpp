@@ -0,0 +1,193 @@
+/*
+
+    Function definitions for WebSocketSession class
+
+    Author: Jarod Graygo
+
+*/
+
+#include "websocket_session.h"
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+
+namespace {
+
+    // Whether the bytes are well formed UTF-8, as text messages and close reasons must be
+    bool valid_utf8(const unsigned char* s, size_t len) {
+        size_t i = 0;
+        while (i < len) {
+            unsigned char c = s[i];
+            size_t extra;
+            uint32_t code;
+            if (c < 0x80) { ++i; continue; }
+            else if ((c & 0xE0) == 0xC0) { extra = 1; code = c & 0x1F; }
+            else if ((c & 0xF0) == 0xE0) { extra = 2; code = c & 0x0F; }
+            else if ((c & 0xF8) == 0xF0) { extra = 3; code = c & 0x07; }
+            else return false;
+            if (i + extra >= len) return false;
+            for (size_t k = 1; k <= extra; ++k) {
+                if ((s[i + k] & 0xC0) != 0x80) return false;
+                code = (code << 6) | (s[i + k] & 0x3F);
+            }
+            // Overlong forms, UTF-16 surrogates and code points past U+10FFFF
+            static const uint32_t smallest[] = { 0, 0x80, 0x800, 0x10000 };
+            if (code < smallest[extra] || (code >= 0xD800 && code <= 0xDFFF) || code > 0x10FFFF) return false;
+            i += extra + 1;
+        }
+        return true;
+    }
+
+    // Close codes a client may send (RFC 6455 section 7.4)
+    bool valid_close_code(uint16_t code) {
+        return (code >= 1000 && code <= 1003) || (code >= 1007 && code <= 1014) || (code >= 3000 && code <= 4999);
+    }
+
+}
+
+WebSocketSession::WebSocketSession(size_t max_message_bytes, size_t max_queued_bytes)
+    : max_message_bytes_(max_message_bytes), max_queued_bytes_(max_queued_bytes), in_message_(false), message_binary_(false),
+      queued_bytes_(0), in_flight_(0), in_flight_bytes_(0), close_queued_(false), close_received_(false), failed_(false) { }
+
+bool WebSocketSession::receive(const char* data, size_t len, std::vector<Message>& messages) {
+    if (close_received_ || failed_) return false;
+    input_.append(data, len);
+    size_t pos = 0;
+
+    for (;;) {
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(input_.data()) + pos;
+        size_t available = input_.size() - pos;
+        if (available < 2) break;
+        bool fin = (p[0] & 0x80) != 0;
+        uint8_t opcode = p[0] & 0x0F;
+        bool control = (opcode & 0x8) != 0;
+        uint64_t payload_len = p[1] & 0x7F;
+        // Clients must mask every frame, and no extension giving the reserved bits a meaning was negotiated
+        if ((p[1] & 0x80) == 0 || (p[0] & 0x70) != 0) { fail(protocol_error); return false; }
+        if ((opcode > binary && !control) || opcode > pong) { fail(protocol_error); return false; }
+        if (control && (!fin || payload_len > 125)) { fail(protocol_error); return false; }
+        if (!control && (opcode == continuation) != in_message_) { fail(protocol_error); return false; }
+
+        size_t header_len = 2 + (payload_len == 126 ? 2 : payload_len == 127 ? 8 : 0) + 4;
+        if (available < header_len) break;
+        if (payload_len == 126) {
+            payload_len = ((uint64_t)p[2] << 8) | p[3];
+        }
+        else if (payload_len == 127) {
+            payload_len = 0;
+            for (int i = 0; i < 8; ++i) payload_len = (payload_len << 8) | p[2 + i];
+        }
+        // Refused before it is buffered, so a client can't make the session hold more than a message's worth
+        if (!control && payload_len > max_message_bytes_ - message_.size()) { fail(message_too_big); return false; }
+        if (available - header_len < payload_len) break;
+
+        const unsigned char* mask = p + header_len - 4;
+        std::string payload(reinterpret_cast<const char*>(p) + header_len, (size_t)payload_len);
+        for (size_t i = 0; i < payload.size(); ++i)
+            payload[i] = (char)(payload[i] ^ mask[i & 3]);
+        pos += header_len + (size_t)payload_len;
+
+        if (opcode == ping) {
+            send(frame(pong, payload.data(), payload.size()));
+            continue;
+        }
+        if (opcode == pong) continue;
+        if (opcode == close) {
+            const unsigned char* body = reinterpret_cast<const unsigned char*>(payload.data());
+            uint16_t code = payload.size() >= 2 ? (uint16_t)((body[0] << 8) | body[1]) : 1000;
+            if (payload.size() == 1 || (payload.size() >= 2 && !valid_close_code(code))) { fail(protocol_error); return false; }
+            if (payload.size() > 2 && !valid_utf8(body + 2, payload.size() - 2)) { fail(invalid_data); return false; }
+            close_received_ = true;
+            send_close(code);
+            input_.clear();
+            return false;
+        }
+
+        if (opcode != continuation) {
+            in_message_ = true;
+            message_binary_ = opcode == binary;
+        }
+        message_.append(payload);
+        if (!fin) continue;
+        in_message_ = false;
+        if (!message_binary_ && !valid_utf8(reinterpret_cast<const unsigned char*>(message_.data()), message_.size())) { fail(invalid_data); return false; }
+        messages.push_back(Message{ message_binary_, std::move(message_) });
+        message_.clear();
+    }
+    input_.erase(0, pos);
+    return true;
+}
+
+bool WebSocketSession::send(const frame_t& frame) {
+    if (close_queued_ || queued_bytes_ + frame->size() > max_queued_bytes_) return false;
+    queue_.push_back(frame);
+    queued_bytes_ += frame->size();
+    return true;
+}
+
+void WebSocketSession::send_raw(const frame_t& bytes) {
+    queue_.push_back(bytes);
+    queued_bytes_ += bytes->size();
+}
+
+void WebSocketSession::send_close(uint16_t code) {
+    if (close_queued_) return;
+    char payload[2] = { (char)(code >> 8), (char)(code & 0xFF) };
+    send_raw(frame(close, payload, sizeof(payload)));
+    close_queued_ = true;
+}
+
+void WebSocketSession::fail(uint16_t code) {
+    failed_ = true;
+    input_.clear();
+    message_.clear();
+    send_close(code);
+}
+
+bool WebSocketSession::collect_output(std::vector<boost::asio::const_buffer>& buffers, std::vector<std::shared_ptr<const void>>& pins, size_t max_frames) {
+    for (size_t i = 0; i < max_frames && !queue_.empty(); ++i) {
+        const frame_t& next = queue_.front();
+        buffers.push_back(boost::asio::buffer(*next));
+        in_flight_bytes_ += next->size();
+        ++in_flight_;
+        pins.push_back(next);
+        queue_.pop_front();
+    }
+    return in_flight_ > 0;
+}
+
+void WebSocketSession::written() {
+    queued_bytes_ -= in_flight_bytes_;
+    in_flight_bytes_ = 0;
+    in_flight_ = 0;
+}
+
+WebSocketSession::frame_t WebSocketSession::frame(Opcode opcode, const char* payload, size_t len) {
+    auto out = std::make_shared<std::string>();
+    out->reserve(len + 10);
+    out->push_back((char)(0x80 | opcode));
+    if (len < 126) {
+        out->push_back((char)len);
+    }
+    else if (len <= 0xFFFF) {
+        out->push_back((char)126);
+        out->push_back((char)(len >> 8));
+        out->push_back((char)(len & 0xFF));
+    }
+    else {
+        out->push_back((char)127);
+        for (int shift = 56; shift >= 0; shift -= 8)
+            out->push_back((char)(((uint64_t)len >> shift) & 0xFF));
+    }
+    out->append(payload, len);
+    return out;
+}
+
+std::string WebSocketSession::accept_key(const std::string& key) {
+    static const std::string guid = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    std::string input = key + guid;
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    SHA1(reinterpret_cast<const unsigned char*>(input.data()), input.size(), digest);
+    unsigned char encoded[4 * ((SHA_DIGEST_LENGTH + 2) / 3) + 1];
+    int n = EVP_EncodeBlock(encoded, digest, SHA_DIGEST_LENGTH);
+    return std::string(reinterpret_cast<const char*>(encoded), (size_t)n);
+}
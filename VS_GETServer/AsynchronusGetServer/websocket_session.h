@@ -0,0 +1,99 @@
+/*
+
+    Protocol engine for one WebSocket connection (RFC 6455). Like Http2Session it knows
+    nothing about sockets: the server feeds it the bytes it reads, collects the messages it
+    decodes and asks it for the next batch of frames to write.
+
+    Outgoing frames are shared, not copied. A message broadcast to a channel is framed once
+    by frame() and the same buffer is queued on every subscriber's session, so fanning a
+    message out costs a reference per subscriber whatever its size. Each session caps the
+    bytes waiting in its queue; a client that doesn't keep up is refused further frames and
+    the server drops it rather than buffering for it without limit.
+
+    Author: Jarod Graygo
+
+*/
+
+#ifndef WEBSOCKET_SESSION_H
+#define WEBSOCKET_SESSION_H
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/asio/buffer.hpp>
+
+class WebSocketSession {
+public:
+    using frame_t = std::shared_ptr<const std::string>;
+
+    enum Opcode : uint8_t { continuation = 0x0, text = 0x1, binary = 0x2, close = 0x8, ping = 0x9, pong = 0xA };
+
+    // A complete data message from the client, its fragments joined
+    struct Message {
+        bool binary_;
+        std::string payload_;
+    };
+
+    // Close codes sent by the server
+    static const uint16_t going_away = 1001;
+    static const uint16_t protocol_error = 1002;
+    static const uint16_t invalid_data = 1007;
+    static const uint16_t message_too_big = 1009;
+
+    WebSocketSession(size_t max_message_bytes, size_t max_queued_bytes);
+
+    // Process bytes read from the client, appending any messages that became complete. Pings are answered and a close
+    // is returned; a frame breaking the protocol queues a close with the matching code and nothing more is read
+    // Returns false once nothing more should be read
+    bool receive(const char* data, size_t len, std::vector<Message>& messages);
+
+    // Queue a frame. Returns false, queuing nothing, if the frame would take the bytes waiting over the limit or a
+    // close has already been queued
+    bool send(const frame_t& frame);
+    // Queue bytes that aren't a frame, such as the handshake response; never refused
+    void send_raw(const frame_t& bytes);
+    // Queue a close frame carrying code, after which nothing else is sent
+    void send_close(uint16_t code);
+
+    // Gather the frames waiting to be written, at most max_frames; returns false if there are none
+    // The buffers stay valid as long as the objects added to pins are held, and written() must be called once they are
+    bool collect_output(std::vector<boost::asio::const_buffer>& buffers, std::vector<std::shared_ptr<const void>>& pins, size_t max_frames = 64);
+    void written();
+
+    // A close has been both sent and received, or the client broke the protocol and our close is written: the
+    // connection can go once the last write completes
+    bool finished() const { return close_queued_ && (close_received_ || failed_) && queue_.empty() && in_flight_ == 0; }
+    bool close_queued() const { return close_queued_; }
+    // Bytes queued or being written, shared frames counted in full
+    size_t queued_bytes() const { return queued_bytes_; }
+
+    // Frame a message once for any number of sessions; server frames are never masked
+    static frame_t frame(Opcode opcode, const char* payload, size_t len);
+    // The Sec-WebSocket-Accept value answering a client's Sec-WebSocket-Key
+    static std::string accept_key(const std::string& key);
+
+private:
+    void fail(uint16_t code);
+
+    size_t max_message_bytes_;
+    size_t max_queued_bytes_;
+    // Bytes of an unfinished frame held over from the last read
+    std::string input_;
+    // Fragments of a data message so far, and whether it was opened as binary
+    std::string message_;
+    bool in_message_;
+    bool message_binary_;
+
+    std::deque<frame_t> queue_;
+    size_t queued_bytes_;
+    // Frames handed out by collect_output() and not yet written, and their bytes
+    size_t in_flight_;
+    size_t in_flight_bytes_;
+    bool close_queued_;
+    bool close_received_;
+    bool failed_;
+};
+
+#endif // WEBSOCKET_SESSION_H
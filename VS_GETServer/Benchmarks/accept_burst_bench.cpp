@@ -0,0 +1,170 @@
+/*
+
+    Runs the server in process with different accept settings and measures how quickly it
+    takes on bursts of new connections
+
+    Usage: accept_burst_bench [connections per burst] [bursts]
+
+    Run it from the server's directory so html/ is found. Build it with the server sources, e.g.
+        clang++ -std=c++17 -I../AsynchronusGetServer accept_burst_bench.cpp \
+            $(find ../AsynchronusGetServer -maxdepth 1 -name '*.cpp' ! -name main.cpp ! -name connection.cpp) -o accept_burst_bench -lssl -lcrypto -lpthread
+
+    Every burst opens all of its connections at once from four client threads and each of them fetches /1.html
+    (a few hundred bytes) as soon as it is connected. Connection latency is from starting the connect to the
+    last byte of the response; the rate is connections completed per second of burst wall time. Client and
+    server share the process, so raise the open file limit (ulimit -n) to well over twice the burst size.
+
+    Author: Jarod Graygo
+
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include "server.h"
+
+using boost::asio::ip::tcp;
+using bench_clock = std::chrono::steady_clock;
+
+struct Row {
+    const char* name_;
+    size_t pending_accepts_;
+    size_t accept_batch_;
+};
+
+struct RowResult {
+    std::vector<double> latency_ms_;
+    double connections_per_s_ = 0;
+    size_t failures_ = 0;
+};
+
+// One client connection of a burst
+class BurstClient : public std::enable_shared_from_this<BurstClient> {
+public:
+    BurstClient(boost::asio::io_service& io_service, RowResult& result) : socket_(io_service), result_(result) { }
+    ~BurstClient() {
+        if (latency_ms_ < 0) ++result_.failures_;
+        else result_.latency_ms_.push_back(latency_ms_);
+    }
+
+    void start(const tcp::endpoint& endpoint) {
+        start_ = bench_clock::now();
+        auto self = shared_from_this();
+        socket_.async_connect(endpoint, [self](const boost::system::error_code& ec) {
+            if (ec) return self->fail();
+            boost::asio::async_write(self->socket_, boost::asio::buffer(request_), [self](const boost::system::error_code& ec, size_t) {
+                if (ec) return self->fail();
+                self->read();
+            });
+        });
+    }
+
+private:
+    void read() {
+        auto self = shared_from_this();
+        socket_.async_read_some(boost::asio::buffer(buff_), [self](const boost::system::error_code& ec, size_t n) {
+            self->response_.append(self->buff_, n);
+            if (!ec) return self->read();
+            if (ec != boost::asio::error::eof || self->response_.find("HTTP/1.1 200") == std::string::npos) return self->fail();
+            self->latency_ms_ = std::chrono::duration<double, std::milli>(bench_clock::now() - self->start_).count();
+        });
+    }
+
+    void fail() { latency_ms_ = -1; }
+
+    static const std::string request_;
+    tcp::socket socket_;
+    // Results are recorded when the client is destroyed, which happens on the client thread's own io_service
+    RowResult& result_;
+    double latency_ms_ = -1;
+    bench_clock::time_point start_;
+    std::string response_;
+    char buff_[4096];
+};
+
+const std::string BurstClient::request_ = "GET /1.html HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+RowResult run_row(const Row& row, unsigned short port, size_t burst, size_t bursts) {
+    ServerOptions options;
+    options.pending_accepts_ = row.pending_accepts_;
+    options.accept_batch_ = row.accept_batch_;
+    Server server(port, false, false, options);
+    std::thread runner([&server]() { server.run(); });
+
+    tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), port);
+    for (int i = 0; i < 100; ++i) {
+        boost::asio::io_service probe_io;
+        tcp::socket probe(probe_io);
+        boost::system::error_code ec;
+        probe.connect(endpoint, ec);
+        if (!ec) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+
+    RowResult result;
+    double seconds = 0;
+    for (size_t b = 0; b < bursts; ++b) {
+        std::vector<RowResult> partial(4);
+        std::vector<std::thread> clients;
+        auto start = bench_clock::now();
+        for (size_t c = 0; c < partial.size(); ++c) {
+            clients.emplace_back([&, c]() {
+                boost::asio::io_service io_service;
+                for (size_t i = c; i < burst; i += partial.size())
+                    std::make_shared<BurstClient>(io_service, partial[c])->start(endpoint);
+                io_service.run();
+            });
+        }
+        for (auto& client : clients) client.join();
+        seconds += std::chrono::duration<double>(bench_clock::now() - start).count();
+        for (const auto& part : partial) {
+            result.latency_ms_.insert(result.latency_ms_.end(), part.latency_ms_.begin(), part.latency_ms_.end());
+            result.failures_ += part.failures_;
+        }
+    }
+    result.connections_per_s_ = result.latency_ms_.size() / seconds;
+
+    server.drain(std::chrono::seconds(0));
+    runner.join();
+    return result;
+}
+
+double percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, (size_t)(p * values.size()))];
+}
+
+int main(int argc, char** argv) {
+    size_t burst = argc > 1 ? std::stoul(argv[1]) : 400;
+    size_t bursts = argc > 2 ? std::stoul(argv[2]) : 20;
+
+    std::vector<Row> rows = {
+        { "1 accept, no batch", 1, 0 },
+        { "1 accept, batch 16", 1, 16 },
+        { "4 accepts, no batch", 4, 0 },
+        { "4 accepts, batch 16", 4, 16 },
+        { "16 accepts, batch 64", 16, 64 },
+    };
+
+    // A discarded first run warms the page cache, so the first row isn't penalised for going first
+    run_row(rows[0], 19079, burst, 2);
+    std::vector<RowResult> results;
+    for (size_t i = 0; i < rows.size(); ++i)
+        results.push_back(run_row(rows[i], (unsigned short)(19080 + i), burst, bursts));
+
+    std::cout << std::endl << std::left << std::setw(24) << "setting" << std::right << std::setw(14) << "conn/s" << std::setw(12) << "p50"
+        << std::setw(12) << "p99" << std::setw(10) << "failed" << std::endl << std::fixed;
+    for (size_t i = 0; i < rows.size(); ++i) {
+        std::cout << std::left << std::setw(24) << rows[i].name_ << std::right << std::setprecision(0) << std::setw(14) << results[i].connections_per_s_
+            << std::setprecision(3) << std::setw(10) << percentile(results[i].latency_ms_, 0.5) << "ms" << std::setw(10) << percentile(results[i].latency_ms_, 0.99) << "ms"
+            << std::setw(10) << results[i].failures_ << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,205 @@
+/*
+
+    Runs the server in process once per thread placement and measures what each one does to
+    small file latency and large file throughput over HTTP/1
+
+    Usage: cpu_placement_bench [interface] [small file requests] [large file requests per client]
+
+    Run it from the server's directory so html/ is found. Build it with the server sources, e.g.
+        clang++ -std=c++17 -I../AsynchronusGetServer cpu_placement_bench.cpp \
+            $(find ../AsynchronusGetServer -maxdepth 1 -name '*.cpp' ! -name main.cpp ! -name connection.cpp) -o cpu_placement_bench -lssl -lcrypto -lpthread
+
+    The rows are made from the machine's NUMA nodes (Linux; elsewhere every CPU counts as one node):
+      - scheduler: nothing pinned
+      - io pinned: the io_service thread on the last CPU of the first node
+      - node local: that, with the file I/O threads on the rest of the same node
+      - cross node: the file I/O threads on the second node instead, so every file they read into the cache is
+        sent from memory on the other node (only with two nodes or more)
+      - irq avoid / irq share: the io_service thread placed by the interface's interrupts (only with an interface,
+        and only meaningful when the clients come in through it rather than over loopback)
+    Each row then runs the same loads as socket_tuning_bench:
+      - small: /index.html (about 6 KB) fetched one request at a time on a fresh connection; latency is from
+        connect to the last byte
+      - large: four clients fetch /src/img/banner_bg.jpg (about 2.4 MB) side by side; throughput is the bytes
+        received over the wall time of the run
+    The clients run unpinned, so on a small machine they compete with the pinned server threads; compare rows on a
+    box with CPUs to spare.
+
+    Author: Jarod Graygo
+
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include "server.h"
+
+using boost::asio::ip::tcp;
+using bench_clock = std::chrono::steady_clock;
+
+struct Row {
+    std::string name_;
+    CpuPlacement placement_;
+};
+
+struct RowResult {
+    std::vector<double> small_ms_;
+    double large_mb_per_s_ = 0;
+    size_t failures_ = 0;
+};
+
+// CPUs of each NUMA node, in node order
+std::vector<std::vector<int>> numa_nodes() {
+    std::vector<std::vector<int>> nodes;
+    for (int node = 0;; ++node) {
+        std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        std::string list;
+        if (!in || !std::getline(in, list)) break;
+        std::vector<int> cpus = parse_cpu_list(list);
+        if (!cpus.empty()) nodes.push_back(cpus);
+    }
+    if (nodes.empty()) {
+        nodes.emplace_back();
+        for (int cpu = 0; cpu < (int)std::max(1u, std::thread::hardware_concurrency()); ++cpu)
+            nodes.back().push_back(cpu);
+    }
+    return nodes;
+}
+
+// Fetch one path on a fresh connection and return the bytes received, or 0 if it failed
+size_t fetch(boost::asio::io_service& io_service, const tcp::endpoint& endpoint, const std::string& path) {
+    tcp::socket socket(io_service);
+    boost::system::error_code ec;
+    socket.connect(endpoint, ec);
+    if (ec) return 0;
+    socket.set_option(tcp::no_delay(true), ec);
+
+    std::string request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    boost::asio::write(socket, boost::asio::buffer(request), ec);
+    if (ec) return 0;
+
+    static thread_local std::vector<char> buff(256 * 1024);
+    size_t received = 0;
+    bool ok = false;
+    for (;;) {
+        size_t n = socket.read_some(boost::asio::buffer(buff), ec);
+        // The status line follows the acknowledgment the server writes ahead of the first response
+        if (!ok && received < 64) ok = std::string(buff.data(), std::min(n, (size_t)64)).find("HTTP/1.1 200") != std::string::npos;
+        received += n;
+        if (ec) break;
+    }
+    return ec == boost::asio::error::eof && ok ? received : 0;
+}
+
+RowResult run_row(const Row& row, unsigned short port, size_t small_requests, size_t large_requests) {
+    ServerOptions options;
+    options.cpu_placement_ = row.placement_;
+    Server server(port, false, false, options);
+    // The io_service thread is the one calling run(), so it is this one that gets pinned
+    std::thread runner([&server]() { server.run(); });
+
+    boost::asio::io_service io_service;
+    tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), port);
+    RowResult result;
+
+    // Wait for the listener, which also warms the file cache
+    for (int i = 0; i < 100 && !fetch(io_service, endpoint, "/index.html"); ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    fetch(io_service, endpoint, "/src/img/banner_bg.jpg");
+
+    for (size_t i = 0; i < small_requests; ++i) {
+        auto start = bench_clock::now();
+        if (fetch(io_service, endpoint, "/index.html"))
+            result.small_ms_.push_back(std::chrono::duration<double, std::milli>(bench_clock::now() - start).count());
+        else
+            ++result.failures_;
+    }
+
+    std::vector<size_t> bytes(4, 0);
+    std::vector<size_t> failures(4, 0);
+    std::vector<std::thread> clients;
+    auto start = bench_clock::now();
+    for (size_t c = 0; c < bytes.size(); ++c) {
+        clients.emplace_back([&, c]() {
+            boost::asio::io_service client_io;
+            for (size_t i = 0; i < large_requests; ++i) {
+                size_t n = fetch(client_io, endpoint, "/src/img/banner_bg.jpg");
+                if (n) bytes[c] += n;
+                else ++failures[c];
+            }
+        });
+    }
+    for (auto& client : clients) client.join();
+    double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+    size_t total = 0;
+    for (size_t c = 0; c < bytes.size(); ++c) {
+        total += bytes[c];
+        result.failures_ += failures[c];
+    }
+    result.large_mb_per_s_ = total / seconds / (1024 * 1024);
+
+    server.drain(std::chrono::seconds(0));
+    runner.join();
+    return result;
+}
+
+double percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, (size_t)(p * values.size()))];
+}
+
+int main(int argc, char** argv) {
+    std::string interface = argc > 1 ? argv[1] : "";
+    size_t small_requests = argc > 2 ? std::stoul(argv[2]) : 2000;
+    size_t large_requests = argc > 3 ? std::stoul(argv[3]) : 50;
+
+    std::vector<std::vector<int>> nodes = numa_nodes();
+    int io_cpu = nodes[0].back();
+    std::vector<int> rest(nodes[0].begin(), nodes[0].end() - (nodes[0].size() > 1 ? 1 : 0));
+
+    std::vector<Row> rows(3);
+    rows[0].name_ = "scheduler";
+    rows[1].name_ = "io pinned";
+    rows[1].placement_.io_cpu_ = io_cpu;
+    rows[2].name_ = "node local";
+    rows[2].placement_.io_cpu_ = io_cpu;
+    rows[2].placement_.file_io_cpus_ = rest;
+    if (nodes.size() > 1) {
+        rows.emplace_back();
+        rows.back().name_ = "cross node";
+        rows.back().placement_.io_cpu_ = io_cpu;
+        rows.back().placement_.file_io_cpus_ = nodes[1];
+    }
+    if (!interface.empty()) {
+        rows.emplace_back();
+        rows.back().name_ = "irq avoid";
+        rows.back().placement_.irq_interface_ = interface;
+        rows.emplace_back();
+        rows.back().name_ = "irq share";
+        rows.back().placement_.irq_interface_ = interface;
+        rows.back().placement_.share_irq_cpu_ = true;
+    }
+    std::cout << nodes.size() << " NUMA node" << (nodes.size() > 1 ? "s" : "") << ", io_service thread pinned to CPU " << io_cpu << std::endl;
+
+    // A discarded first run warms the page cache, so the scheduler row isn't penalised for going first
+    run_row(rows[0], 18179, small_requests / 10, large_requests / 10);
+    std::vector<RowResult> results;
+    for (size_t i = 0; i < rows.size(); ++i)
+        results.push_back(run_row(rows[i], (unsigned short)(18180 + i), small_requests, large_requests));
+
+    std::cout << std::endl << std::left << std::setw(20) << "placement" << std::right << std::setw(12) << "small p50" << std::setw(12) << "small p99"
+        << std::setw(14) << "large MB/s" << std::setw(10) << "failed" << std::endl << std::fixed << std::setprecision(3);
+    for (size_t i = 0; i < rows.size(); ++i) {
+        std::cout << std::left << std::setw(20) << rows[i].name_ << std::right
+            << std::setw(10) << percentile(results[i].small_ms_, 0.5) << "ms" << std::setw(10) << percentile(results[i].small_ms_, 0.99) << "ms"
+            << std::setw(14) << std::setprecision(1) << results[i].large_mb_per_s_ << std::setprecision(3) << std::setw(10) << results[i].failures_ << std::endl;
+    }
+    return 0;
+}
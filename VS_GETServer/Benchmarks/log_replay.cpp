@@ -0,0 +1,292 @@
+/*
+
+    Replays the requests recorded in the server's log.txt against a running server and reports
+    throughput, latency and the responses that came back different. Given a second server it
+    replays the same requests against that one too and lists where the two disagree, so two
+    builds can be compared on real traffic
+
+    Usage: log_replay <log file> <host> <port> [options]
+      --speed <x>             replay at x times the recorded pace (default 1, the original timing)
+      --max                   ignore the recorded timing and send as fast as the clients allow
+      --clients <n>           requests in flight at most (default 32)
+      --limit <n>             replay only the first n requests
+      --host-header <name>    Host header to send (default localhost); the log doesn't record it
+      --compare <host> <port> replay against this server as well and diff the two
+
+    Build it standalone, e.g.
+        clang++ -std=c++17 log_replay.cpp -o log_replay -lpthread
+
+    Only GET and HEAD lines are replayed, each over HTTP/1 on a fresh connection since the server closes after
+    every response, whatever protocol it was logged with. The log keeps whole seconds only, so the requests of one
+    second are spread evenly over it. A request is late when it starts more than 50ms after its slot, which means
+    the clients couldn't keep up with the pace asked for; raise --clients if many are.
+
+    Author: Jarod Graygo
+
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+
+using boost::asio::ip::tcp;
+using bench_clock = std::chrono::steady_clock;
+
+struct LoggedRequest {
+    std::string method_;
+    std::string path_;
+    int status_ = 0;
+    size_t size_ = 0;
+    double offset_s_ = 0;
+};
+
+struct Outcome {
+    int status_ = 0;
+    size_t bytes_ = 0;
+    double latency_ms_ = 0;
+    bool late_ = false;
+};
+
+struct Target {
+    std::string host_;
+    std::string port_;
+};
+
+struct Settings {
+    double speed_ = 1;
+    bool max_rate_ = false;
+    size_t clients_ = 32;
+    size_t limit_ = 0;
+    std::string host_header_ = "localhost";
+};
+
+// Seconds since the epoch of a log date such as Mon_Oct_19_05:58:57_2026, or -1 if it doesn't parse
+// The server writes ctime() with the spaces turned into underscores, so single digit days leave an empty field
+long long parse_log_date(const std::string& date) {
+    static const char* months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+    std::vector<std::string> fields;
+    size_t start = 0;
+    while (start <= date.size()) {
+        size_t end = date.find('_', start);
+        if (end == std::string::npos) end = date.size();
+        if (end > start) fields.push_back(date.substr(start, end - start));
+        start = end + 1;
+    }
+    if (fields.size() != 5) return -1;
+
+    int month = -1;
+    for (int i = 0; i < 12; ++i)
+        if (fields[1] == months[i]) month = i + 1;
+    int hour, minute, second;
+    if (month < 0 || sscanf(fields[3].c_str(), "%d:%d:%d", &hour, &minute, &second) != 3) return -1;
+    int day = std::atoi(fields[2].c_str());
+    long long year = std::atoll(fields[4].c_str());
+
+    // Days from 1970-01-01 to the civil date
+    year -= month <= 2;
+    long long era = (year >= 0 ? year : year - 399) / 400;
+    long long year_of_era = year - era * 400;
+    long long day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    long long day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    long long days = era * 146097 + day_of_era - 719468;
+    return days * 86400 + hour * 3600 + minute * 60 + second;
+}
+
+// The replayable requests of a log, with their offsets from the first one
+std::vector<LoggedRequest> read_log(const std::string& file_name, size_t& skipped) {
+    static const std::regex entry("^\\S+ - - \\[([^\\]]+)\\] \"(\\S+) (\\S+)[^\"]*\" (\\d{3}) (\\d+)");
+    std::ifstream log(file_name);
+    std::vector<LoggedRequest> requests;
+    std::vector<long long> seconds;
+    std::string line;
+    skipped = 0;
+    while (std::getline(log, line)) {
+        std::smatch match;
+        if (!std::regex_search(line, match, entry)) continue;
+        long long when = parse_log_date(match[1]);
+        if (when < 0 || (match[2] != "GET" && match[2] != "HEAD")) {
+            ++skipped;
+            continue;
+        }
+        LoggedRequest request;
+        request.method_ = match[2];
+        request.path_ = match[3];
+        request.status_ = std::stoi(match[4]);
+        request.size_ = std::stoul(match[5]);
+        requests.push_back(request);
+        seconds.push_back(when);
+    }
+
+    // Spread the requests of each second evenly over it
+    for (size_t first = 0; first < requests.size();) {
+        size_t last = first;
+        while (last < requests.size() && seconds[last] == seconds[first]) ++last;
+        for (size_t i = first; i < last; ++i)
+            requests[i].offset_s_ = (seconds[i] - seconds[0]) + double(i - first) / (last - first);
+        first = last;
+    }
+    return requests;
+}
+
+// Send one request on a fresh connection and read until the server closes it. The status is 0 if the exchange failed
+Outcome replay_one(boost::asio::io_service& io_service, const tcp::resolver::results_type& endpoints, const LoggedRequest& request, const std::string& host_header) {
+    Outcome outcome;
+    auto start = bench_clock::now();
+    tcp::socket socket(io_service);
+    boost::system::error_code ec;
+    boost::asio::connect(socket, endpoints, ec);
+    if (ec) return outcome;
+    socket.set_option(tcp::no_delay(true), ec);
+
+    std::string req = request.method_ + " " + request.path_ + " HTTP/1.1\r\nHost: " + host_header + "\r\n\r\n";
+    boost::asio::write(socket, boost::asio::buffer(req), ec);
+    if (ec) return outcome;
+
+    static thread_local std::vector<char> buff(256 * 1024);
+    std::string head;
+    for (;;) {
+        size_t n = socket.read_some(boost::asio::buffer(buff), ec);
+        // The status line follows the acknowledgment the server writes ahead of the first response
+        if (head.size() < 64) head.append(buff.data(), std::min(n, 64 - head.size()));
+        outcome.bytes_ += n;
+        if (ec) break;
+    }
+    size_t status_line = head.find("HTTP/1.");
+    if (ec != boost::asio::error::eof || status_line == std::string::npos || head.size() < status_line + 12) return outcome;
+    outcome.status_ = std::atoi(head.c_str() + status_line + 9);
+    outcome.latency_ms_ = std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+    return outcome;
+}
+
+// Replay every request against the target on the schedule the settings ask for
+std::vector<Outcome> replay(const std::vector<LoggedRequest>& requests, const Target& target, const Settings& settings, double& seconds) {
+    std::vector<Outcome> outcomes(requests.size());
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> clients;
+    auto start = bench_clock::now();
+    for (size_t c = 0; c < settings.clients_; ++c) {
+        clients.emplace_back([&]() {
+            boost::asio::io_service io_service;
+            tcp::resolver resolver(io_service);
+            tcp::resolver::results_type endpoints = resolver.resolve(target.host_, target.port_);
+            for (size_t i = next++; i < requests.size(); i = next++) {
+                bool late = false;
+                if (!settings.max_rate_) {
+                    auto due = start + std::chrono::duration_cast<bench_clock::duration>(std::chrono::duration<double>(requests[i].offset_s_ / settings.speed_));
+                    std::this_thread::sleep_until(due);
+                    late = bench_clock::now() - due > std::chrono::milliseconds(50);
+                }
+                outcomes[i] = replay_one(io_service, endpoints, requests[i], settings.host_header_);
+                outcomes[i].late_ = late;
+            }
+        });
+    }
+    for (auto& client : clients) client.join();
+    seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+    return outcomes;
+}
+
+double percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, (size_t)(p * values.size()))];
+}
+
+void report(const std::string& name, const std::vector<LoggedRequest>& requests, const std::vector<Outcome>& outcomes, double seconds) {
+    std::vector<double> latency_ms;
+    size_t failed = 0, late = 0, bytes = 0;
+    std::map<std::string, size_t> changed;
+    for (size_t i = 0; i < outcomes.size(); ++i) {
+        if (!outcomes[i].status_) {
+            ++failed;
+            continue;
+        }
+        latency_ms.push_back(outcomes[i].latency_ms_);
+        bytes += outcomes[i].bytes_;
+        late += outcomes[i].late_;
+        if (outcomes[i].status_ != requests[i].status_)
+            ++changed[requests[i].path_ + " " + std::to_string(requests[i].status_) + " -> " + std::to_string(outcomes[i].status_)];
+    }
+
+    std::cout << std::endl << name << std::endl << std::fixed << std::setprecision(1)
+        << "  " << latency_ms.size() << " of " << outcomes.size() << " requests completed in " << seconds << "s, " << failed << " failed, " << late << " started late" << std::endl
+        << "  " << latency_ms.size() / seconds << " requests/s, " << bytes / seconds / (1024 * 1024) << " MB/s" << std::endl << std::setprecision(3)
+        << "  latency p50 " << percentile(latency_ms, 0.5) << "ms, p90 " << percentile(latency_ms, 0.9) << "ms, p99 " << percentile(latency_ms, 0.99)
+        << "ms, max " << percentile(latency_ms, 1) << "ms" << std::endl;
+    if (!changed.empty()) {
+        std::cout << "  status differs from the log:" << std::endl;
+        for (const auto& change : changed)
+            std::cout << "    " << change.first << " (" << change.second << "x)" << std::endl;
+    }
+}
+
+// Requests the two servers answered differently, a failed exchange counting as status 0
+void report_differences(const std::vector<LoggedRequest>& requests, const std::vector<Outcome>& a, const std::vector<Outcome>& b) {
+    std::map<std::string, size_t> differences;
+    for (size_t i = 0; i < requests.size(); ++i)
+        if (a[i].status_ != b[i].status_)
+            ++differences[requests[i].path_ + " " + std::to_string(a[i].status_) + " vs " + std::to_string(b[i].status_)];
+    std::cout << std::endl << (differences.empty() ? "Both servers answered every request the same" : "Answered differently (first vs second):") << std::endl;
+    for (const auto& difference : differences)
+        std::cout << "    " << difference.first << " (" << difference.second << "x)" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 4) {
+        std::cerr << "Usage: log_replay <log file> <host> <port> [--speed x | --max] [--clients n] [--limit n] [--host-header name] [--compare host port]" << std::endl;
+        return 1;
+    }
+    Settings settings;
+    std::vector<Target> targets = { { argv[2], argv[3] } };
+    for (int i = 4; i < argc; ++i) {
+        std::string option = argv[i];
+        bool has_value = i + 1 < argc;
+        if (option == "--max") settings.max_rate_ = true;
+        else if (option == "--speed" && has_value) settings.speed_ = std::stod(argv[++i]);
+        else if (option == "--clients" && has_value) settings.clients_ = std::max<size_t>(1, std::stoul(argv[++i]));
+        else if (option == "--limit" && has_value) settings.limit_ = std::stoul(argv[++i]);
+        else if (option == "--host-header" && has_value) settings.host_header_ = argv[++i];
+        else if (option == "--compare" && i + 2 < argc) {
+            targets.push_back({ argv[i + 1], argv[i + 2] });
+            i += 2;
+        }
+        else {
+            std::cerr << "Unknown or incomplete option " << option << std::endl;
+            return 1;
+        }
+    }
+    if (settings.speed_ <= 0) {
+        std::cerr << "--speed must be above 0" << std::endl;
+        return 1;
+    }
+
+    size_t skipped;
+    std::vector<LoggedRequest> requests = read_log(argv[1], skipped);
+    if (settings.limit_ && requests.size() > settings.limit_) requests.resize(settings.limit_);
+    if (requests.empty()) {
+        std::cerr << "No requests to replay in " << argv[1] << std::endl;
+        return 1;
+    }
+    std::cout << "Replaying " << requests.size() << " requests spanning " << std::fixed << std::setprecision(0) << requests.back().offset_s_ << "s";
+    if (skipped) std::cout << " (" << skipped << " other lines skipped)";
+    std::cout << (settings.max_rate_ ? " as fast as possible" : "") << std::endl;
+
+    std::vector<std::vector<Outcome>> outcomes;
+    for (const Target& target : targets) {
+        double seconds;
+        outcomes.push_back(replay(requests, target, settings, seconds));
+        report(target.host_ + ":" + target.port_, requests, outcomes.back(), seconds);
+    }
+    if (outcomes.size() == 2) report_differences(requests, outcomes[0], outcomes[1]);
+    return 0;
+}
@@ -0,0 +1,304 @@
+/*
+
+    Measures how long it takes to load the portfolio page and the assets it references over
+    HTTP/1 and over HTTP/2 with prior knowledge (h2c)
+
+    Usage: page_load_bench <host> <port> [page loads]
+
+    Build it next to the server's HPACK code, e.g.
+        clang++ -std=c++17 -I../AsynchronusGetServer page_load_bench.cpp ../AsynchronusGetServer/hpack.cpp -o page_load_bench -lpthread
+
+    A page load fetches /portfolio.html, picks the local stylesheets, scripts and images out of it and
+    then fetches those the way a browser would:
+      - HTTP/1: six parallel connections, one request per connection since the server closes after each response
+      - HTTP/2: every asset as its own stream on the connection that fetched the page, all requested at once
+    Request latency is measured from sending the request (or opening its connection) to the last byte of the response.
+
+    Author: Jarod Graygo
+
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include "hpack.h"
+
+using boost::asio::ip::tcp;
+using bench_clock = std::chrono::steady_clock;
+
+struct Results {
+    std::vector<double> page_ms_;
+    std::vector<double> request_ms_;
+    size_t failures_ = 0;
+};
+
+double ms_since(bench_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+}
+
+// Local stylesheets, scripts and images referenced by the page
+std::vector<std::string> find_assets(const std::string& html) {
+    static const std::regex reference("(?:href|src)=\"([^\"]+)\"");
+    static const std::regex asset("\\.(css|js|png|jpg|gif|ico)$");
+    std::vector<std::string> assets;
+    for (auto it = std::sregex_iterator(html.begin(), html.end(), reference); it != std::sregex_iterator(); ++it) {
+        std::string path = (*it)[1];
+        if (path.find("://") != std::string::npos || !std::regex_search(path, asset)) continue;
+        if (path.compare(0, 2, "./") == 0) path = path.substr(2);
+        path = "/" + path;
+        if (std::find(assets.begin(), assets.end(), path) == assets.end()) assets.push_back(path);
+    }
+    return assets;
+}
+
+//////////////////////// HTTP/1 ////////////////////////
+
+// Fetch one path on a fresh connection, reading until the server closes it
+bool http1_get(boost::asio::io_service& io_service, const tcp::resolver::results_type& endpoints, const std::string& path, std::string& body) {
+    tcp::socket socket(io_service);
+    boost::system::error_code ec;
+    boost::asio::connect(socket, endpoints, ec);
+    if (ec) return false;
+    socket.set_option(tcp::no_delay(true));
+
+    std::string request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    boost::asio::write(socket, boost::asio::buffer(request), ec);
+    if (ec) return false;
+
+    std::string response;
+    char buff[16384];
+    for (;;) {
+        size_t n = socket.read_some(boost::asio::buffer(buff), ec);
+        response.append(buff, n);
+        if (ec) break;
+    }
+    if (ec != boost::asio::error::eof) return false;
+
+    size_t status = response.find("HTTP/1.1 ");
+    size_t header_end = response.find("\r\n\r\n", status);
+    if (status == std::string::npos || header_end == std::string::npos || response.compare(status + 9, 3, "200") != 0) return false;
+    body = response.substr(header_end + 4);
+    return true;
+}
+
+void run_http1(const tcp::resolver::results_type& endpoints, size_t loads, Results& results) {
+    boost::asio::io_service io_service;
+    for (size_t i = 0; i < loads; ++i) {
+        auto page_start = bench_clock::now();
+        std::string html;
+        if (!http1_get(io_service, endpoints, "/portfolio.html", html)) { ++results.failures_; continue; }
+        results.request_ms_.push_back(ms_since(page_start));
+
+        std::vector<std::string> assets = find_assets(html);
+        std::vector<double> latencies(assets.size(), -1);
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> connections;
+        for (int c = 0; c < 6; ++c) {
+            connections.emplace_back([&]() {
+                boost::asio::io_service worker_io;
+                for (size_t a = next++; a < assets.size(); a = next++) {
+                    auto start = bench_clock::now();
+                    std::string body;
+                    if (http1_get(worker_io, endpoints, assets[a], body)) latencies[a] = ms_since(start);
+                }
+            });
+        }
+        for (auto& connection : connections) connection.join();
+
+        for (double latency : latencies) {
+            if (latency < 0) ++results.failures_;
+            else results.request_ms_.push_back(latency);
+        }
+        results.page_ms_.push_back(ms_since(page_start));
+    }
+}
+
+//////////////////////// HTTP/2 ////////////////////////
+
+class H2Client {
+public:
+    explicit H2Client(tcp::socket& socket) : socket_(socket) { }
+
+    // Send the preface with a large window so flow control never throttles the measurement
+    void start() {
+        std::string out = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+        std::string settings;
+        settings += std::string("\x00\x04", 2) + "\x7f\xff\xff\xff";
+        frame(out, settings, 0x4, 0, 0);
+        std::string increment("\x7f\xff\x00\x00", 4);
+        frame(out, increment, 0x8, 0, 0);
+        boost::asio::write(socket_, boost::asio::buffer(out));
+    }
+
+    uint32_t request(const std::string& path, std::string& out) {
+        std::string block;
+        block += '\x82'; // :method GET
+        block += '\x86'; // :scheme http
+        hpack_encode_integer(4, 4, 0x00, block); // :path
+        hpack_encode_integer(path.size(), 7, 0x00, block);
+        block += path;
+        hpack_encode_integer(1, 4, 0x00, block); // :authority
+        hpack_encode_integer(9, 7, 0x00, block);
+        block += "localhost";
+
+        uint32_t stream_id = next_stream_;
+        next_stream_ += 2;
+        frame(out, block, 0x1, 0x5, stream_id); // END_STREAM | END_HEADERS
+        pending_[stream_id] = Response();
+        return stream_id;
+    }
+
+    void send(const std::string& out) { boost::asio::write(socket_, boost::asio::buffer(out)); }
+
+    // Read frames until the stream has ended, returns false on a connection problem or non-200 status
+    bool wait_for(uint32_t stream_id, std::string& body, bench_clock::time_point& finished) {
+        while (!pending_[stream_id].done_) {
+            if (!read_frame()) return false;
+        }
+        Response& response = pending_[stream_id];
+        body.swap(response.body_);
+        finished = response.finished_;
+        return response.status_ == "200";
+    }
+
+private:
+    struct Response {
+        std::string status_;
+        std::string body_;
+        bool done_ = false;
+        bench_clock::time_point finished_;
+    };
+
+    static void frame(std::string& out, const std::string& payload, uint8_t type, uint8_t flags, uint32_t stream_id) {
+        size_t len = payload.size();
+        out += (char)(len >> 16); out += (char)(len >> 8); out += (char)len;
+        out += (char)type; out += (char)flags;
+        out += (char)(stream_id >> 24); out += (char)(stream_id >> 16); out += (char)(stream_id >> 8); out += (char)stream_id;
+        out += payload;
+    }
+
+    bool read_frame() {
+        unsigned char header[9];
+        boost::system::error_code ec;
+        boost::asio::read(socket_, boost::asio::buffer(header), ec);
+        if (ec) return false;
+        size_t len = (header[0] << 16) | (header[1] << 8) | header[2];
+        uint8_t type = header[3], flags = header[4];
+        uint32_t stream_id = ((header[5] & 0x7f) << 24) | (header[6] << 16) | (header[7] << 8) | header[8];
+        std::string payload(len, '\0');
+        boost::asio::read(socket_, boost::asio::buffer(&payload[0], len), ec);
+        if (ec) return false;
+
+        if (type == 0x4 && !(flags & 0x1)) {
+            std::string ack;
+            frame(ack, "", 0x4, 0x1, 0);
+            send(ack);
+        }
+        else if (type == 0x7) {
+            return false;
+        }
+        else if ((type == 0x1 || type == 0x9 || type == 0x0) && pending_.count(stream_id)) {
+            Response& response = pending_[stream_id];
+            if (type == 0x0) {
+                response.body_ += payload;
+            }
+            else {
+                header_list_t headers;
+                if (!decoder_.decode(reinterpret_cast<const uint8_t*>(payload.data()), payload.size(), headers)) return false;
+                for (const auto& field : headers)
+                    if (field.first == ":status") response.status_ = field.second;
+            }
+            if (flags & 0x1) {
+                response.done_ = true;
+                response.finished_ = bench_clock::now();
+            }
+        }
+        return true;
+    }
+
+    tcp::socket& socket_;
+    HpackDecoder decoder_;
+    uint32_t next_stream_ = 1;
+    std::map<uint32_t, Response> pending_;
+};
+
+void run_http2(const tcp::resolver::results_type& endpoints, size_t loads, Results& results) {
+    boost::asio::io_service io_service;
+    for (size_t i = 0; i < loads; ++i) {
+        auto page_start = bench_clock::now();
+        tcp::socket socket(io_service);
+        boost::system::error_code ec;
+        boost::asio::connect(socket, endpoints, ec);
+        if (ec) { ++results.failures_; continue; }
+        socket.set_option(tcp::no_delay(true));
+
+        try {
+            H2Client client(socket);
+            client.start();
+            std::string out, html;
+            bench_clock::time_point finished;
+            uint32_t page = client.request("/portfolio.html", out);
+            client.send(out);
+            if (!client.wait_for(page, html, finished)) { ++results.failures_; continue; }
+            results.request_ms_.push_back(std::chrono::duration<double, std::milli>(finished - page_start).count());
+
+            std::vector<std::string> assets = find_assets(html);
+            std::vector<uint32_t> streams;
+            out.clear();
+            for (const auto& asset : assets) streams.push_back(client.request(asset, out));
+            auto sent = bench_clock::now();
+            client.send(out);
+            for (uint32_t stream_id : streams) {
+                std::string body;
+                if (client.wait_for(stream_id, body, finished))
+                    results.request_ms_.push_back(std::chrono::duration<double, std::milli>(finished - sent).count());
+                else
+                    ++results.failures_;
+            }
+            results.page_ms_.push_back(ms_since(page_start));
+        }
+        catch (const boost::system::system_error&) {
+            ++results.failures_;
+        }
+    }
+}
+
+//////////////////////// REPORT ////////////////////////
+
+double percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, (size_t)(p * values.size()))];
+}
+
+void report(const char* name, const Results& results) {
+    std::cout << name << ": page load p50 " << percentile(results.page_ms_, 0.5) << "ms, p95 " << percentile(results.page_ms_, 0.95)
+        << "ms; request p50 " << percentile(results.request_ms_, 0.5) << "ms, p95 " << percentile(results.request_ms_, 0.95)
+        << "ms; " << results.page_ms_.size() << " loads, " << results.failures_ << " failed requests" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <host> <port> [page loads]" << std::endl;
+        return 1;
+    }
+    size_t loads = argc > 3 ? std::stoul(argv[3]) : 200;
+
+    boost::asio::io_service io_service;
+    tcp::resolver resolver(io_service);
+    auto endpoints = resolver.resolve(argv[1], argv[2]);
+
+    Results http1, http2;
+    run_http1(endpoints, loads, http1);
+    run_http2(endpoints, loads, http2);
+    report("HTTP/1", http1);
+    report("HTTP/2 (h2c)", http2);
+    return 0;
+}
@@ -0,0 +1,205 @@
+/*
+
+    Runs the server as a prefork master with a growing number of workers and measures how
+    much memory the workers and their file caches take, with the shared cache and with
+    each worker caching on its own
+
+    Usage: prefork_cache_bench [most workers] [rounds]
+
+    Run it from the server's directory so html/ is found, on Linux (it reads /proc). Build it with the server sources, e.g.
+        clang++ -std=c++17 -I../AsynchronusGetServer prefork_cache_bench.cpp \
+            $(find ../AsynchronusGetServer -maxdepth 1 -name '*.cpp' ! -name main.cpp ! -name connection.cpp) -o prefork_cache_bench -lssl -lcrypto -lpthread
+
+    For 1, 2, 4 ... workers up to the most given, a master is forked off with run_server() twice: once with the
+    shared cache and once with it sized 0, which leaves each worker the site's own cache. sendfile is raised out of
+    the way so every file under html/ is cached. Four clients then fetch every file rounds times over, each on a fresh
+    connection, so requests land on whichever worker accepts them. Memory is the proportional set size (Pss) of the
+    master and its workers from /proc/<pid>/smaps_rollup, where pages shared between processes count a share each:
+      - total: every process, all their memory
+      - heap: the workers' private memory (Pss_Anon), which holds their caches when they are private, along with
+        whatever the allocator keeps of the buffers responses were built in
+      - shared: the shared segment (Pss_Shmem), counted once however many workers map it
+    With the shared cache the shared column should stay flat as workers are added, while private caches make the heap
+    column grow by a cache's worth with each one.
+    glibc keeps the large buffers responses are built in once they are freed, and that swamps the caches in the heap
+    column; running with MALLOC_MMAP_THRESHOLD_=131072 returns them to the system, showing the caches on their own at
+    some cost in throughput.
+
+    Author: Jarod Graygo
+
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "server.h"
+
+using boost::asio::ip::tcp;
+using bench_clock = std::chrono::steady_clock;
+
+struct RowResult {
+    size_t workers_ = 0;
+    bool shared_ = false;
+    size_t requests_ = 0;
+    size_t failures_ = 0;
+    double seconds_ = 0;
+    size_t total_kb_ = 0;
+    size_t heap_kb_ = 0;
+    size_t shared_kb_ = 0;
+};
+
+// Fetch one path on a fresh connection and return the bytes received, or 0 if it failed
+size_t fetch(boost::asio::io_service& io_service, const tcp::endpoint& endpoint, const std::string& path) {
+    tcp::socket socket(io_service);
+    boost::system::error_code ec;
+    socket.connect(endpoint, ec);
+    if (ec) return 0;
+    socket.set_option(tcp::no_delay(true), ec);
+
+    std::string request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    boost::asio::write(socket, boost::asio::buffer(request), ec);
+    if (ec) return 0;
+
+    static thread_local std::vector<char> buff(256 * 1024);
+    size_t received = 0;
+    bool ok = false;
+    for (;;) {
+        size_t n = socket.read_some(boost::asio::buffer(buff), ec);
+        // The status line follows the acknowledgment the server writes ahead of the first response
+        if (!ok && received < 64) ok = std::string(buff.data(), std::min(n, (size_t)64)).find("HTTP/1.1 200") != std::string::npos;
+        received += n;
+        if (ec) break;
+    }
+    return ec == boost::asio::error::eof && ok ? received : 0;
+}
+
+// Every file under html/, as a request path
+std::vector<std::string> site_paths() {
+    std::vector<std::string> paths;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator("html")) {
+        if (!entry.is_regular_file()) continue;
+        std::string path = entry.path().generic_string().substr(4);
+        if (path.find_first_of(" %?#") == std::string::npos) paths.push_back(path);
+    }
+    return paths;
+}
+
+// The master's workers, from the kernel's list of its children
+std::vector<pid_t> children_of(pid_t pid) {
+    std::ifstream in("/proc/" + std::to_string(pid) + "/task/" + std::to_string(pid) + "/children");
+    std::vector<pid_t> children;
+    pid_t child;
+    while (in >> child) children.push_back(child);
+    return children;
+}
+
+// A field of the process's smaps_rollup, in KB
+size_t rollup_kb(pid_t pid, const std::string& field) {
+    std::ifstream in("/proc/" + std::to_string(pid) + "/smaps_rollup");
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.compare(0, field.size() + 1, field + ":") != 0) continue;
+        std::istringstream value(line.substr(field.size() + 1));
+        size_t kb = 0;
+        value >> kb;
+        return kb;
+    }
+    return 0;
+}
+
+RowResult run_row(size_t workers, bool shared, unsigned short port, const std::vector<std::string>& paths, size_t rounds) {
+    ServerOptions options;
+    options.workers_ = workers;
+    options.shared_cache_bytes_ = shared ? 64 * 1024 * 1024 : 0;
+    options.sendfile_threshold_ = 64 * 1024 * 1024;
+    options.tls_port_ = 0;
+
+    // Forked before this process has any threads of its own, as run_server() needs
+    pid_t master = fork();
+    if (master == 0) {
+        std::cout.setstate(std::ios::failbit);
+        run_server(port, false, false, options);
+        _exit(0);
+    }
+
+    boost::asio::io_service io_service;
+    tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), port);
+    for (int i = 0; i < 100 && !fetch(io_service, endpoint, "/index.html"); ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    RowResult result;
+    result.workers_ = workers;
+    result.shared_ = shared;
+    std::vector<size_t> requests(4, 0);
+    std::vector<size_t> failures(4, 0);
+    std::vector<std::thread> clients;
+    auto start = bench_clock::now();
+    for (size_t c = 0; c < requests.size(); ++c) {
+        clients.emplace_back([&, c]() {
+            boost::asio::io_service client_io;
+            for (size_t round = 0; round < rounds; ++round) {
+                for (size_t i = c; i < paths.size(); i += requests.size()) {
+                    ++requests[c];
+                    if (!fetch(client_io, endpoint, paths[(i + round) % paths.size()])) ++failures[c];
+                }
+            }
+        });
+    }
+    for (auto& client : clients) client.join();
+    result.seconds_ = std::chrono::duration<double>(bench_clock::now() - start).count();
+    for (size_t c = 0; c < requests.size(); ++c) {
+        result.requests_ += requests[c];
+        result.failures_ += failures[c];
+    }
+
+    std::vector<pid_t> processes = children_of(master);
+    processes.push_back(master);
+    for (pid_t pid : processes) {
+        result.total_kb_ += rollup_kb(pid, "Pss");
+        if (pid == master) continue;
+        result.heap_kb_ += rollup_kb(pid, "Pss_Anon");
+        result.shared_kb_ += rollup_kb(pid, "Pss_Shmem");
+    }
+
+    kill(master, SIGTERM);
+    int status = 0;
+    waitpid(master, &status, 0);
+    return result;
+}
+
+int main(int argc, char** argv) {
+    size_t most_workers = argc > 1 ? std::stoul(argv[1]) : 8;
+    size_t rounds = argc > 2 ? std::stoul(argv[2]) : 20;
+
+    std::vector<std::string> paths = site_paths();
+    uintmax_t site_bytes = 0;
+    for (const std::string& path : paths) site_bytes += std::filesystem::file_size("html" + path);
+    std::cout << paths.size() << " files, " << site_bytes / 1024 << " KB under html/" << std::endl;
+
+    std::vector<RowResult> results;
+    unsigned short port = 18280;
+    for (size_t workers = 1; workers <= most_workers; workers *= 2) {
+        results.push_back(run_row(workers, true, port++, paths, rounds));
+        results.push_back(run_row(workers, false, port++, paths, rounds));
+    }
+
+    std::cout << std::endl << std::setw(8) << "workers" << std::setw(10) << "cache" << std::setw(12) << "requests" << std::setw(10) << "failed"
+        << std::setw(12) << "req/s" << std::setw(14) << "total Pss" << std::setw(14) << "heap Pss" << std::setw(14) << "shared Pss" << std::endl;
+    for (const RowResult& result : results) {
+        std::cout << std::setw(8) << result.workers_ << std::setw(10) << (result.shared_ ? "shared" : "private") << std::setw(12) << result.requests_
+            << std::setw(10) << result.failures_ << std::setw(12) << (size_t)(result.requests_ / result.seconds_)
+            << std::setw(11) << result.total_kb_ / 1024 << " MB" << std::setw(11) << result.heap_kb_ / 1024 << " MB" << std::setw(11) << result.shared_kb_ / 1024 << " MB" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,281 @@
+/*
+
+    Measures the latency the reverse proxy adds. A stub upstream runs inside the benchmark,
+    answering every request over keep-alive connections, and the same requests are timed
+    going to it directly and going to it through a running server that proxies a prefix to it
+
+    Usage: proxy_latency_bench <host> <port> [options]
+      --upstream-port <n>   port the stub upstream listens on (default 9090)
+      --unix <path>         have the stub listen on this Unix domain socket as well
+      --path <target>       target requested through the server (default /api/bench)
+      --requests <n>        requests timed each way, per client (default 2000)
+      --clients <n>         clients sending requests at the same time (default 1)
+      --size <bytes>        body of each response from the stub (default 1024)
+      --stub-only           only run the stub upstream, until interrupted
+
+    Build it standalone, e.g.
+        clang++ -std=c++17 -O2 proxy_latency_bench.cpp -o proxy_latency_bench -lpthread
+
+    Configure the server with a route sending the prefix of --path to 127.0.0.1:<upstream port>, e.g. ProxyRoute
+    { "/api/", "127.0.0.1:9090" }, or to unix:<path>. The server closes each client connection after its response,
+    so every request is timed from opening a connection to reading the response to its end, both directly and
+    through the proxy; the difference is the proxy's own cost, its pooled connection to the stub included. Direct
+    requests always go to the stub's TCP port.
+    The stub answers with the request's body when it has one and with --size bytes otherwise, and reports the target
+    and X-Forwarded-For it saw in X-Upstream-Target and X-Upstream-Forwarded-For.
+
+    Author: Jarod Graygo
+
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <boost/asio.hpp>
+
+using boost::asio::ip::tcp;
+using bench_clock = std::chrono::steady_clock;
+
+struct Settings {
+    unsigned short upstream_port_ = 9090;
+    std::string unix_path_;
+    std::string path_ = "/api/bench";
+    size_t requests_ = 2000;
+    size_t clients_ = 1;
+    size_t size_ = 1024;
+    bool stub_only_ = false;
+};
+
+// Value of a header in a head, matched ignoring case, or empty
+std::string header_value(const std::string& head, const std::string& name) {
+    size_t pos = head.find("\r\n");
+    while (pos != std::string::npos && pos + 2 < head.size()) {
+        size_t start = pos + 2;
+        size_t end = head.find("\r\n", start);
+        if (end == std::string::npos) end = head.size();
+        if (end - start > name.size() && head[start + name.size()] == ':') {
+            bool match = true;
+            for (size_t i = 0; i < name.size() && match; ++i)
+                match = std::tolower((unsigned char)head[start + i]) == std::tolower((unsigned char)name[i]);
+            if (match) {
+                size_t value = head.find_first_not_of(" \t", start + name.size() + 1);
+                return value < end ? head.substr(value, end - value) : std::string();
+            }
+        }
+        pos = end;
+    }
+    return std::string();
+}
+
+// One keep-alive connection to the stub, served on its own thread with blocking reads
+template <typename Socket>
+void serve_stub_connection(std::shared_ptr<Socket> socket, const std::string& payload) {
+    boost::system::error_code ec;
+    std::string pending;
+    char buffer[16 * 1024];
+    // Read until at least count bytes are pending
+    auto fill = [&](size_t count) {
+        while (pending.size() < count) {
+            size_t n = socket->read_some(boost::asio::buffer(buffer), ec);
+            if (ec) return false;
+            pending.append(buffer, n);
+        }
+        return true;
+    };
+    auto fill_line = [&](size_t from, size_t& line_end) {
+        while ((line_end = pending.find("\r\n", from)) == std::string::npos) {
+            size_t n = socket->read_some(boost::asio::buffer(buffer), ec);
+            if (ec) return false;
+            pending.append(buffer, n);
+        }
+        return true;
+    };
+
+    for (;;) {
+        size_t head_end;
+        while ((head_end = pending.find("\r\n\r\n")) == std::string::npos) {
+            size_t n = socket->read_some(boost::asio::buffer(buffer), ec);
+            if (ec) return;
+            pending.append(buffer, n);
+        }
+        std::string head = pending.substr(0, head_end + 2);
+        pending.erase(0, head_end + 4);
+
+        std::string body;
+        std::string length = header_value(head, "content-length");
+        if (header_value(head, "transfer-encoding") == "chunked") {
+            for (;;) {
+                size_t line_end;
+                if (!fill_line(0, line_end)) return;
+                size_t chunk = std::strtoul(pending.c_str(), nullptr, 16);
+                pending.erase(0, line_end + 2);
+                if (chunk == 0) {
+                    // Trailer fields up to the blank line
+                    for (;;) {
+                        if (!fill_line(0, line_end)) return;
+                        pending.erase(0, line_end + 2);
+                        if (line_end == 0) break;
+                    }
+                    break;
+                }
+                if (!fill(chunk + 2)) return;
+                body.append(pending, 0, chunk);
+                pending.erase(0, chunk + 2);
+            }
+        }
+        else if (!length.empty()) {
+            size_t len = std::strtoul(length.c_str(), nullptr, 10);
+            if (!fill(len)) return;
+            body = pending.substr(0, len);
+            pending.erase(0, len);
+        }
+
+        size_t target_start = head.find(' ') + 1;
+        std::string target = head.substr(target_start, head.find(' ', target_start) - target_start);
+        bool close = header_value(head, "connection") == "close";
+        const std::string& out = body.empty() ? payload : body;
+        std::string response = "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: " + std::to_string(out.size())
+            + "\r\nX-Upstream-Target: " + target + "\r\nX-Upstream-Forwarded-For: " + header_value(head, "x-forwarded-for")
+            + (close ? "\r\nConnection: close" : "") + "\r\n\r\n";
+        if (head.compare(0, 5, "HEAD ") != 0) response += out;
+        boost::asio::write(*socket, boost::asio::buffer(response), ec);
+        if (ec || close) return;
+    }
+}
+
+template <typename Acceptor>
+void run_stub(Acceptor& acceptor, const std::string& payload) {
+    using socket_t = typename Acceptor::protocol_type::socket;
+    for (;;) {
+        auto socket = std::make_shared<socket_t>(acceptor.get_executor());
+        boost::system::error_code ec;
+        acceptor.accept(*socket, ec);
+        if (ec) return;
+        std::thread(serve_stub_connection<socket_t>, socket, std::cref(payload)).detach();
+    }
+}
+
+// Time requests sent one after another on fresh connections, until the response is read to its close
+std::vector<double> time_requests(const tcp::endpoint& endpoint, const std::string& request, size_t count, std::atomic<size_t>& failed) {
+    std::vector<double> latencies;
+    latencies.reserve(count);
+    boost::asio::io_service io_service;
+    char buffer[64 * 1024];
+    for (size_t i = 0; i < count; ++i) {
+        auto start = bench_clock::now();
+        tcp::socket socket(io_service);
+        boost::system::error_code ec;
+        socket.connect(endpoint, ec);
+        if (!ec) {
+            socket.set_option(tcp::no_delay(true), ec);
+            boost::asio::write(socket, boost::asio::buffer(request), ec);
+        }
+        size_t received = 0;
+        while (!ec) received += socket.read_some(boost::asio::buffer(buffer), ec);
+        if (ec != boost::asio::error::eof || received == 0) {
+            ++failed;
+            continue;
+        }
+        latencies.push_back(std::chrono::duration<double, std::micro>(bench_clock::now() - start).count());
+    }
+    return latencies;
+}
+
+// Run the clients at once and gather their latencies; seconds is set to how long they took together
+std::vector<double> run_clients(const tcp::endpoint& endpoint, const std::string& request, const Settings& settings, double& seconds, std::atomic<size_t>& failed) {
+    std::vector<std::vector<double>> results(settings.clients_);
+    std::vector<std::thread> clients;
+    auto start = bench_clock::now();
+    for (size_t i = 0; i < settings.clients_; ++i)
+        clients.emplace_back([&, i]() { results[i] = time_requests(endpoint, request, settings.requests_, failed); });
+    for (auto& client : clients) client.join();
+    seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+    std::vector<double> all;
+    for (const auto& result : results) all.insert(all.end(), result.begin(), result.end());
+    std::sort(all.begin(), all.end());
+    return all;
+}
+
+double percentile(const std::vector<double>& sorted, double p) {
+    return sorted.empty() ? 0 : sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+}
+
+void report(const char* label, const std::vector<double>& sorted, double seconds) {
+    double mean = 0;
+    for (double latency : sorted) mean += latency;
+    mean /= std::max<size_t>(sorted.size(), 1);
+    std::cout << "  " << label << std::fixed << std::setprecision(0) << "p50 " << percentile(sorted, 0.5) << "us, p99 " << percentile(sorted, 0.99)
+        << "us, mean " << mean << "us, " << sorted.size() / seconds << " requests/s" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: proxy_latency_bench <host> <port> [--upstream-port n] [--unix path] [--path target] [--requests n] [--clients n] [--size bytes] [--stub-only]" << std::endl;
+        return 1;
+    }
+    Settings settings;
+    for (int i = 3; i < argc; ++i) {
+        std::string option = argv[i];
+        bool has_value = i + 1 < argc;
+        if (option == "--upstream-port" && has_value) settings.upstream_port_ = (unsigned short)std::stoul(argv[++i]);
+        else if (option == "--unix" && has_value) settings.unix_path_ = argv[++i];
+        else if (option == "--path" && has_value) settings.path_ = argv[++i];
+        else if (option == "--requests" && has_value) settings.requests_ = std::stoul(argv[++i]);
+        else if (option == "--clients" && has_value) settings.clients_ = std::max<size_t>(1, std::stoul(argv[++i]));
+        else if (option == "--size" && has_value) settings.size_ = std::stoul(argv[++i]);
+        else if (option == "--stub-only") settings.stub_only_ = true;
+        else {
+            std::cerr << "Unknown or incomplete option " << option << std::endl;
+            return 1;
+        }
+    }
+
+    boost::asio::io_service io_service;
+    std::string payload(settings.size_, 'x');
+    tcp::acceptor acceptor(io_service, tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), settings.upstream_port_));
+    std::thread(run_stub<tcp::acceptor>, std::ref(acceptor), std::cref(payload)).detach();
+    std::unique_ptr<boost::asio::local::stream_protocol::acceptor> unix_acceptor;
+    if (!settings.unix_path_.empty()) {
+        ::unlink(settings.unix_path_.c_str());
+        unix_acceptor.reset(new boost::asio::local::stream_protocol::acceptor(io_service, boost::asio::local::stream_protocol::endpoint(settings.unix_path_)));
+        std::thread(run_stub<boost::asio::local::stream_protocol::acceptor>, std::ref(*unix_acceptor), std::cref(payload)).detach();
+    }
+    std::cout << "Stub upstream on 127.0.0.1:" << settings.upstream_port_ << (settings.unix_path_.empty() ? "" : " and " + settings.unix_path_)
+        << ", " << settings.size_ << " byte responses" << std::endl;
+    if (settings.stub_only_) {
+        for (;;) std::this_thread::sleep_for(std::chrono::hours(1));
+    }
+
+    tcp::resolver resolver(io_service);
+    tcp::endpoint server = *resolver.resolve(tcp::resolver::query(argv[1], argv[2]));
+    tcp::endpoint upstream(boost::asio::ip::make_address("127.0.0.1"), settings.upstream_port_);
+    std::string request = "GET " + settings.path_ + " HTTP/1.1\r\nHost: " + std::string(argv[1]) + "\r\nConnection: close\r\n\r\n";
+
+    // A first pass warms up both sides and fills the proxy's pool
+    std::atomic<size_t> failed(0);
+    double seconds = 0;
+    Settings warmup = settings;
+    warmup.requests_ = std::min<size_t>(settings.requests_, 100);
+    run_clients(upstream, request, warmup, seconds, failed);
+    run_clients(server, request, warmup, seconds, failed);
+    failed = 0;
+
+    std::cout << settings.requests_ * settings.clients_ << " requests for " << settings.path_ << " from " << settings.clients_ << " clients" << std::endl;
+    double direct_seconds = 0, proxied_seconds = 0;
+    std::vector<double> direct = run_clients(upstream, request, settings, direct_seconds, failed);
+    report("direct:  ", direct, direct_seconds);
+    std::vector<double> proxied = run_clients(server, request, settings, proxied_seconds, failed);
+    report("proxied: ", proxied, proxied_seconds);
+    std::cout << "  added:   p50 " << percentile(proxied, 0.5) - percentile(direct, 0.5) << "us, p99 " << percentile(proxied, 0.99) - percentile(direct, 0.99) << "us" << std::endl;
+    if (failed)
+        std::cout << "  failed:  " << failed.load() << " requests" << std::endl;
+    return 0;
+}
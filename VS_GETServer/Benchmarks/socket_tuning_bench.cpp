@@ -0,0 +1,180 @@
+/*
+
+    Runs the server in process once per socket setting and measures what each one does to
+    small file latency and large file throughput over HTTP/1
+
+    Usage: socket_tuning_bench [small file requests] [large file requests per client]
+
+    Run it from the server's directory so html/ is found. Build it with the server sources, e.g.
+        clang++ -std=c++17 -I../AsynchronusGetServer socket_tuning_bench.cpp \
+            $(find ../AsynchronusGetServer -maxdepth 1 -name '*.cpp' ! -name main.cpp ! -name connection.cpp) -o socket_tuning_bench -lssl -lcrypto -lpthread
+
+    For every row of the matrix a server is started on its own port with only that setting changed from
+    the defaults, then:
+      - small: /index.html (about 6 KB) is fetched one request at a time, each on a fresh connection since the
+        server closes after every response; latency is from connect to the last byte
+      - large: four clients fetch /src/img/banner_bg.jpg (about 2.4 MB) side by side; throughput is the bytes
+        received over the wall time of the run
+    The fast open row only makes a difference where the kernel allows it for both sides (net.ipv4.tcp_fastopen = 3 on
+    Linux); the client asks for it with TCP_FASTOPEN_CONNECT.
+
+    Author: Jarod Graygo
+
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include "server.h"
+#ifndef _WIN32
+#include <netinet/tcp.h>
+#endif
+
+using boost::asio::ip::tcp;
+using bench_clock = std::chrono::steady_clock;
+
+struct Row {
+    const char* name_;
+    SocketTuning tuning_;
+};
+
+struct RowResult {
+    std::vector<double> small_ms_;
+    double large_mb_per_s_ = 0;
+    size_t failures_ = 0;
+};
+
+// Fetch one path on a fresh connection and return the bytes received, or 0 if it failed
+size_t fetch(boost::asio::io_service& io_service, const tcp::endpoint& endpoint, const std::string& path, bool fast_open) {
+    tcp::socket socket(io_service);
+    boost::system::error_code ec;
+    socket.open(tcp::v4(), ec);
+#ifdef TCP_FASTOPEN_CONNECT
+    if (fast_open) {
+        int on = 1;
+        ::setsockopt(socket.native_handle(), IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &on, sizeof(on));
+    }
+#endif
+    socket.connect(endpoint, ec);
+    if (ec) return 0;
+    socket.set_option(tcp::no_delay(true), ec);
+
+    std::string request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    boost::asio::write(socket, boost::asio::buffer(request), ec);
+    if (ec) return 0;
+
+    static thread_local std::vector<char> buff(256 * 1024);
+    size_t received = 0;
+    bool ok = false;
+    for (;;) {
+        size_t n = socket.read_some(boost::asio::buffer(buff), ec);
+        // The status line follows the acknowledgment the server writes ahead of the first response
+        if (!ok && received < 64) ok = std::string(buff.data(), std::min(n, (size_t)64)).find("HTTP/1.1 200") != std::string::npos;
+        received += n;
+        if (ec) break;
+    }
+    return ec == boost::asio::error::eof && ok ? received : 0;
+}
+
+RowResult run_row(const Row& row, unsigned short port, size_t small_requests, size_t large_requests) {
+    ServerOptions options;
+    options.socket_tuning_ = row.tuning_;
+    Server server(port, false, false, options);
+    std::thread runner([&server]() { server.run(); });
+
+    boost::asio::io_service io_service;
+    tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), port);
+    bool fast_open = row.tuning_.fast_open_queue_ > 0;
+    RowResult result;
+
+    // Wait for the listener, which also warms the file cache
+    for (int i = 0; i < 100 && !fetch(io_service, endpoint, "/index.html", fast_open); ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    fetch(io_service, endpoint, "/src/img/banner_bg.jpg", fast_open);
+
+    for (size_t i = 0; i < small_requests; ++i) {
+        auto start = bench_clock::now();
+        if (fetch(io_service, endpoint, "/index.html", fast_open))
+            result.small_ms_.push_back(std::chrono::duration<double, std::milli>(bench_clock::now() - start).count());
+        else
+            ++result.failures_;
+    }
+
+    std::vector<size_t> bytes(4, 0);
+    std::vector<size_t> failures(4, 0);
+    std::vector<std::thread> clients;
+    auto start = bench_clock::now();
+    for (size_t c = 0; c < bytes.size(); ++c) {
+        clients.emplace_back([&, c]() {
+            boost::asio::io_service client_io;
+            for (size_t i = 0; i < large_requests; ++i) {
+                size_t n = fetch(client_io, endpoint, "/src/img/banner_bg.jpg", fast_open);
+                if (n) bytes[c] += n;
+                else ++failures[c];
+            }
+        });
+    }
+    for (auto& client : clients) client.join();
+    double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+    size_t total = 0;
+    for (size_t c = 0; c < bytes.size(); ++c) {
+        total += bytes[c];
+        result.failures_ += failures[c];
+    }
+    result.large_mb_per_s_ = total / seconds / (1024 * 1024);
+
+    server.drain(std::chrono::seconds(0));
+    runner.join();
+    return result;
+}
+
+double percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, (size_t)(p * values.size()))];
+}
+
+int main(int argc, char** argv) {
+    size_t small_requests = argc > 1 ? std::stoul(argv[1]) : 2000;
+    size_t large_requests = argc > 2 ? std::stoul(argv[2]) : 50;
+
+    std::vector<Row> rows(9);
+    rows[0].name_ = "defaults";
+    rows[1].name_ = "no_delay";
+    rows[1].tuning_.no_delay_ = true;
+    rows[2].name_ = "cork";
+    rows[2].tuning_.cork_ = true;
+    rows[3].name_ = "defer_accept 5s";
+    rows[3].tuning_.defer_accept_seconds_ = 5;
+    rows[4].name_ = "fast_open 256";
+    rows[4].tuning_.fast_open_queue_ = 256;
+    rows[5].name_ = "backlog 16";
+    rows[5].tuning_.listen_backlog_ = 16;
+    rows[6].name_ = "sndbuf/rcvbuf 64K";
+    rows[6].tuning_.send_buffer_bytes_ = 64 * 1024;
+    rows[6].tuning_.receive_buffer_bytes_ = 64 * 1024;
+    rows[7].name_ = "sndbuf 4M";
+    rows[7].tuning_.send_buffer_bytes_ = 4 * 1024 * 1024;
+    rows[8].name_ = "notsent_lowat 16K";
+    rows[8].tuning_.not_sent_low_water_bytes_ = 16 * 1024;
+
+    // A discarded first run warms the page cache, so the defaults row isn't penalised for going first
+    run_row(rows[0], 18079, small_requests / 10, large_requests / 10);
+    std::vector<RowResult> results;
+    for (size_t i = 0; i < rows.size(); ++i)
+        results.push_back(run_row(rows[i], (unsigned short)(18080 + i), small_requests, large_requests));
+
+    std::cout << std::endl << std::left << std::setw(20) << "setting" << std::right << std::setw(12) << "small p50" << std::setw(12) << "small p99"
+        << std::setw(14) << "large MB/s" << std::setw(10) << "failed" << std::endl << std::fixed << std::setprecision(3);
+    for (size_t i = 0; i < rows.size(); ++i) {
+        std::cout << std::left << std::setw(20) << rows[i].name_ << std::right
+            << std::setw(10) << percentile(results[i].small_ms_, 0.5) << "ms" << std::setw(10) << percentile(results[i].small_ms_, 0.99) << "ms"
+            << std::setw(14) << std::setprecision(1) << results[i].large_mb_per_s_ << std::setprecision(3) << std::setw(10) << results[i].failures_ << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,156 @@
+/*
+
+    Runs the server in process with different sizes of task pool and measures small file
+    latency while the pool is kept busy building large responses
+
+    Usage: task_pool_bench [small file requests] [large file clients]
+
+    Run it from the server's directory so html/ is found. Build it with the server sources, e.g.
+        clang++ -std=c++17 -O2 -I../AsynchronusGetServer task_pool_bench.cpp \
+            $(find ../AsynchronusGetServer -maxdepth 1 -name '*.cpp' ! -name main.cpp ! -name connection.cpp) -o task_pool_bench -lssl -lcrypto -lpthread
+
+    sendfile() is off in every row, so each large response is copied out of the file cache into memory, which is
+    the work the pool takes over. Each row runs:
+      - load: the large file clients fetch /src/img/banner_bg.jpg (about 2.4 MB) and /src/img/me.jpg (about 560 KB)
+        in turn over HTTP/1 for as long as the row lasts
+      - small: meanwhile /index.html (about 6 KB) is fetched one request at a time on a fresh connection; latency
+        is from connect to the last byte
+    The rows are no pool (file I/O threads build everything, as before the pool), then pools of 1, 2 and 4 threads.
+    The pool's counters are printed for each row: responses built on it, stolen from another worker's queue, and
+    built by a file I/O thread because the pool was full.
+
+    Author: Jarod Graygo
+
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include "server.h"
+
+using boost::asio::ip::tcp;
+using bench_clock = std::chrono::steady_clock;
+
+struct RowResult {
+    std::vector<double> small_ms_;
+    double large_mb_per_s_ = 0;
+    size_t failures_ = 0;
+    TaskPool::Stats pool_;
+};
+
+// Fetch one path on a fresh connection and return the bytes received, or 0 if it failed
+size_t fetch(boost::asio::io_service& io_service, const tcp::endpoint& endpoint, const std::string& path) {
+    tcp::socket socket(io_service);
+    boost::system::error_code ec;
+    socket.connect(endpoint, ec);
+    if (ec) return 0;
+    socket.set_option(tcp::no_delay(true), ec);
+
+    std::string request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    boost::asio::write(socket, boost::asio::buffer(request), ec);
+    if (ec) return 0;
+
+    static thread_local std::vector<char> buff(256 * 1024);
+    size_t received = 0;
+    bool ok = false;
+    for (;;) {
+        size_t n = socket.read_some(boost::asio::buffer(buff), ec);
+        // The status line follows the acknowledgment the server writes ahead of the first response
+        if (!ok && received < 64) ok = std::string(buff.data(), std::min(n, (size_t)64)).find("HTTP/1.1 200") != std::string::npos;
+        received += n;
+        if (ec) break;
+    }
+    return ec == boost::asio::error::eof && ok ? received : 0;
+}
+
+RowResult run_row(size_t task_threads, unsigned short port, size_t small_requests, size_t large_clients) {
+    ServerOptions options;
+    options.sendfile_threshold_ = 0;
+    options.task_threads_ = task_threads;
+    Server server(port, false, false, options);
+    std::thread runner([&server]() { server.run(); });
+
+    boost::asio::io_service io_service;
+    tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), port);
+    RowResult result;
+
+    // Wait for the listener, which also warms the file cache
+    for (int i = 0; i < 100 && !fetch(io_service, endpoint, "/index.html"); ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    fetch(io_service, endpoint, "/src/img/banner_bg.jpg");
+    fetch(io_service, endpoint, "/src/img/me.jpg");
+
+    std::atomic<bool> done(false);
+    std::vector<size_t> bytes(large_clients, 0);
+    std::vector<size_t> failures(large_clients, 0);
+    std::vector<std::thread> clients;
+    auto start = bench_clock::now();
+    for (size_t c = 0; c < large_clients; ++c) {
+        clients.emplace_back([&, c]() {
+            boost::asio::io_service client_io;
+            for (size_t i = 0; !done; ++i) {
+                size_t n = fetch(client_io, endpoint, i % 2 ? "/src/img/me.jpg" : "/src/img/banner_bg.jpg");
+                if (n) bytes[c] += n;
+                else ++failures[c];
+            }
+        });
+    }
+
+    for (size_t i = 0; i < small_requests; ++i) {
+        auto small_start = bench_clock::now();
+        if (fetch(io_service, endpoint, "/index.html"))
+            result.small_ms_.push_back(std::chrono::duration<double, std::milli>(bench_clock::now() - small_start).count());
+        else
+            ++result.failures_;
+    }
+    done = true;
+    for (auto& client : clients) client.join();
+    double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+    size_t total = 0;
+    for (size_t c = 0; c < large_clients; ++c) {
+        total += bytes[c];
+        result.failures_ += failures[c];
+    }
+    result.large_mb_per_s_ = total / seconds / (1024 * 1024);
+    result.pool_ = server.task_stats();
+
+    server.drain(std::chrono::seconds(0));
+    runner.join();
+    return result;
+}
+
+double percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, (size_t)(p * values.size()))];
+}
+
+int main(int argc, char** argv) {
+    size_t small_requests = argc > 1 ? std::stoul(argv[1]) : 2000;
+    size_t large_clients = argc > 2 ? std::stoul(argv[2]) : 8;
+
+    std::vector<size_t> rows = { 0, 1, 2, 4 };
+    // A discarded first run warms the page cache, so the first row isn't penalised for going first
+    run_row(0, 18279, small_requests / 10, large_clients);
+    std::vector<RowResult> results;
+    for (size_t i = 0; i < rows.size(); ++i)
+        results.push_back(run_row(rows[i], (unsigned short)(18280 + i), small_requests, large_clients));
+
+    std::cout << std::left << std::setw(12) << "pool" << std::right << std::setw(12) << "small p50" << std::setw(12) << "small p99"
+        << std::setw(14) << "large MB/s" << std::setw(10) << "built" << std::setw(10) << "stolen" << std::setw(10) << "in place"
+        << std::setw(10) << "failed" << std::endl << std::fixed << std::setprecision(3);
+    for (size_t i = 0; i < rows.size(); ++i) {
+        std::cout << std::left << std::setw(12) << (rows[i] ? std::to_string(rows[i]) + " thread" + (rows[i] > 1 ? "s" : "") : std::string("none")) << std::right
+            << std::setw(10) << percentile(results[i].small_ms_, 0.5) << "ms" << std::setw(10) << percentile(results[i].small_ms_, 0.99) << "ms"
+            << std::setw(14) << std::setprecision(1) << results[i].large_mb_per_s_ << std::setprecision(3)
+            << std::setw(10) << results[i].pool_.completed_ << std::setw(10) << results[i].pool_.stolen_ << std::setw(10) << results[i].pool_.rejected_
+            << std::setw(10) << results[i].failures_ << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,103 @@
+/*
+
+    Measures full and resumed TLS handshakes per second against the server's secure listener
+
+    Usage: tls_handshake_bench <host> <port> [handshakes]
+
+    Generate a local certificate for the server with:
+        openssl req -x509 -newkey rsa:2048 -nodes -days 30 -subj "/CN=localhost" -keyout server.key -out server.crt
+    and start the server with ServerOptions::tls_port_ set, next to the two files.
+
+    Each connection completes the handshake and fetches the index page over HTTP/1, which also delivers
+    any TLS 1.3 session tickets, reading until the server closes the connection. The resumed run offers the newest session
+    received so far on every connection and counts how many the server actually resumed.
+
+    Author: Jarod Graygo
+
+*/
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+
+using boost::asio::ip::tcp;
+
+struct RunResult {
+    size_t completed_ = 0;
+    size_t resumed_ = 0;
+    double seconds_ = 0;
+};
+
+// Perform the handshakes, optionally offering the last session for resumption
+RunResult run(boost::asio::io_service& io_service, boost::asio::ssl::context& ctx, const tcp::resolver::results_type& endpoints, size_t count, bool resume) {
+    RunResult result;
+    SSL_SESSION* session = nullptr;
+    auto start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < count; ++i) {
+        boost::asio::ssl::stream<tcp::socket> stream(io_service, ctx);
+        boost::system::error_code ec;
+        boost::asio::connect(stream.next_layer(), endpoints, ec);
+        if (ec) continue;
+        stream.next_layer().set_option(tcp::no_delay(true));
+        if (resume && session) SSL_set_session(stream.native_handle(), session);
+
+        stream.handshake(boost::asio::ssl::stream_base::client, ec);
+        if (ec) continue;
+        static const std::string request = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        boost::asio::write(stream, boost::asio::buffer(request), ec);
+        if (ec) continue;
+        char buff[16384];
+        while (!ec) stream.read_some(boost::asio::buffer(buff), ec);
+        if (ec != boost::asio::error::eof && ec != boost::asio::ssl::error::stream_truncated) continue;
+
+        ++result.completed_;
+        if (SSL_session_reused(stream.native_handle())) ++result.resumed_;
+        // TLS 1.3 tickets are single use, so move on to the newest one the server issued
+        if (resume) {
+            SSL_SESSION* fresh = SSL_get1_session(stream.native_handle());
+            if (fresh && fresh != session && SSL_SESSION_is_resumable(fresh)) {
+                if (session) SSL_SESSION_free(session);
+                session = fresh;
+            }
+            else if (fresh) {
+                SSL_SESSION_free(fresh);
+            }
+        }
+        // Mark the session as cleanly shut down, otherwise OpenSSL refuses to resume it
+        SSL_set_shutdown(stream.native_handle(), SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+        stream.next_layer().close(ec);
+    }
+
+    result.seconds_ = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (session) SSL_SESSION_free(session);
+    return result;
+}
+
+void report(const char* name, const RunResult& result) {
+    std::cout << name << ": " << result.completed_ << " handshakes in " << result.seconds_ << "s = "
+        << (result.seconds_ > 0 ? result.completed_ / result.seconds_ : 0) << "/s, "
+        << result.resumed_ << " resumed" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <host> <port> [handshakes]" << std::endl;
+        return 1;
+    }
+    size_t count = argc > 3 ? std::stoul(argv[3]) : 1000;
+
+    boost::asio::io_service io_service;
+    boost::asio::ssl::context ctx(boost::asio::ssl::context::tls_client);
+    ctx.set_verify_mode(boost::asio::ssl::verify_none);
+    SSL_CTX_set_session_cache_mode(ctx.native_handle(), SSL_SESS_CACHE_CLIENT);
+
+    tcp::resolver resolver(io_service);
+    auto endpoints = resolver.resolve(argv[1], argv[2]);
+
+    report("Full handshakes", run(io_service, ctx, endpoints, count, false));
+    report("Resumed handshakes", run(io_service, ctx, endpoints, count, true));
+    return 0;
+}
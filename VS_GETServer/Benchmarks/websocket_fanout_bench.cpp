@@ -0,0 +1,264 @@
+/*
+
+    Subscribes many WebSocket clients to one channel of a running server, publishes messages
+    into the channel from another client and reports how many messages per second reach the
+    subscribers
+
+    Usage: websocket_fanout_bench <host> <port> [options]
+      --subscribers <n>   clients joining the channel (default 10000)
+      --messages <n>      messages published (default 200)
+      --size <bytes>      payload of each message (default 128)
+      --burst <n>         messages published before waiting for every subscriber to have them (default 10)
+      --channel <name>    channel joined under /ws/ (default bench)
+
+    Build it standalone, e.g.
+        clang++ -std=c++17 -O2 websocket_fanout_bench.cpp -o websocket_fanout_bench -lpthread
+
+    Every client is a socket of this process and of the server's, so raise the open file limit on both sides
+    (ulimit -n) above the subscriber count. The subscribers are read on one thread. Timing covers the messages
+    only: from the first publish to the last subscriber receiving the last message. A subscriber the server
+    drops for falling behind is counted and no longer waited for.
+
+    Author: Jarod Graygo
+
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+
+using boost::asio::ip::tcp;
+using bench_clock = std::chrono::steady_clock;
+
+struct Settings {
+    size_t subscribers_ = 10000;
+    size_t messages_ = 200;
+    size_t size_ = 128;
+    size_t burst_ = 10;
+    std::string channel_ = "bench";
+};
+
+// The opening handshake; the key is fixed since the answer isn't checked
+std::string handshake(const std::string& host, const std::string& channel) {
+    return "GET /ws/" + channel + " HTTP/1.1\r\nHost: " + host + "\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+}
+
+// A client frame: clients must mask what they send
+std::string client_frame(const std::string& payload, std::mt19937& random) {
+    std::string frame(1, (char)0x82);
+    size_t len = payload.size();
+    if (len < 126) {
+        frame.push_back((char)(0x80 | len));
+    }
+    else if (len <= 0xFFFF) {
+        frame.push_back((char)(0x80 | 126));
+        frame.push_back((char)(len >> 8));
+        frame.push_back((char)(len & 0xFF));
+    }
+    else {
+        frame.push_back((char)(0x80 | 127));
+        for (int shift = 56; shift >= 0; shift -= 8)
+            frame.push_back((char)(((uint64_t)len >> shift) & 0xFF));
+    }
+    char mask[4];
+    for (char& c : mask) c = (char)random();
+    frame.append(mask, 4);
+    for (size_t i = 0; i < len; ++i)
+        frame.push_back((char)(payload[i] ^ mask[i & 3]));
+    return frame;
+}
+
+// One subscriber: connects, upgrades, then counts the frames it receives
+class Subscriber {
+public:
+    Subscriber(boost::asio::io_service& io_service, const tcp::endpoint& endpoint, const std::string& request,
+               std::atomic<size_t>& ready, std::atomic<size_t>& failed, std::atomic<uint64_t>& received)
+        : socket_(io_service), endpoint_(endpoint), request_(request), ready_(ready), failed_(failed), received_(received),
+          buffer_(64 * 1024), upgraded_(false), done_(false) { }
+
+    void start(std::function<void()> connected) {
+        connected_ = connected;
+        socket_.async_connect(endpoint_, boost::bind(&Subscriber::handle_connect, this, boost::asio::placeholders::error));
+    }
+    bool done() const { return done_; }
+    uint64_t messages() const { return messages_; }
+
+private:
+    void handle_connect(const boost::system::error_code& err) {
+        connected_();
+        if (err) return fail();
+        boost::asio::async_write(socket_, boost::asio::buffer(request_), boost::bind(&Subscriber::handle_write, this, boost::asio::placeholders::error));
+    }
+    void handle_write(const boost::system::error_code& err) {
+        if (err) return fail();
+        read();
+    }
+    void read() {
+        socket_.async_read_some(boost::asio::buffer(buffer_), boost::bind(&Subscriber::handle_read, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+    }
+    void handle_read(const boost::system::error_code& err, size_t n) {
+        if (err) return fail();
+        pending_.append(buffer_.data(), n);
+        if (!upgraded_) {
+            size_t end = pending_.find("\r\n\r\n");
+            if (end == std::string::npos) return read();
+            if (pending_.compare(0, 12, "HTTP/1.1 101") != 0) return fail();
+            pending_.erase(0, end + 4);
+            upgraded_ = true;
+            ++ready_;
+        }
+        // Server frames are unmasked; only whole frames are counted
+        size_t pos = 0;
+        uint64_t counted = 0;
+        for (;;) {
+            size_t available = pending_.size() - pos;
+            if (available < 2) break;
+            const unsigned char* p = reinterpret_cast<const unsigned char*>(pending_.data()) + pos;
+            uint64_t len = p[1] & 0x7F;
+            size_t header = 2 + (len == 126 ? 2 : len == 127 ? 8 : 0);
+            if (available < header) break;
+            if (len == 126) len = ((uint64_t)p[2] << 8) | p[3];
+            else if (len == 127) { len = 0; for (int i = 0; i < 8; ++i) len = (len << 8) | p[2 + i]; }
+            if (available - header < len) break;
+            if ((p[0] & 0x0F) == 0x8) return fail();
+            pos += header + (size_t)len;
+            ++counted;
+        }
+        pending_.erase(0, pos);
+        messages_ += counted;
+        received_ += counted;
+        read();
+    }
+    void fail() {
+        if (!done_) ++failed_;
+        done_ = true;
+        boost::system::error_code ignored;
+        socket_.close(ignored);
+    }
+
+    tcp::socket socket_;
+    tcp::endpoint endpoint_;
+    const std::string& request_;
+    std::atomic<size_t>& ready_;
+    std::atomic<size_t>& failed_;
+    std::atomic<uint64_t>& received_;
+    std::function<void()> connected_;
+    std::vector<char> buffer_;
+    std::string pending_;
+    bool upgraded_;
+    // Read by the publishing thread
+    std::atomic<bool> done_;
+    std::atomic<uint64_t> messages_{ 0 };
+};
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: websocket_fanout_bench <host> <port> [--subscribers n] [--messages n] [--size bytes] [--burst n] [--channel name]" << std::endl;
+        return 1;
+    }
+    Settings settings;
+    for (int i = 3; i < argc; ++i) {
+        std::string option = argv[i];
+        bool has_value = i + 1 < argc;
+        if (option == "--subscribers" && has_value) settings.subscribers_ = std::stoul(argv[++i]);
+        else if (option == "--messages" && has_value) settings.messages_ = std::stoul(argv[++i]);
+        else if (option == "--size" && has_value) settings.size_ = std::stoul(argv[++i]);
+        else if (option == "--burst" && has_value) settings.burst_ = std::max<size_t>(1, std::stoul(argv[++i]));
+        else if (option == "--channel" && has_value) settings.channel_ = argv[++i];
+        else {
+            std::cerr << "Unknown or incomplete option " << option << std::endl;
+            return 1;
+        }
+    }
+
+    boost::asio::io_service io_service;
+    tcp::resolver resolver(io_service);
+    tcp::endpoint endpoint = *resolver.resolve(tcp::resolver::query(argv[1], argv[2]));
+    std::string request = handshake(argv[1], settings.channel_);
+
+    // Connect a few hundred at a time, so the listen backlog doesn't overflow into SYN retries
+    std::atomic<size_t> ready(0), failed(0);
+    std::atomic<uint64_t> received(0);
+    std::vector<std::unique_ptr<Subscriber>> subscribers;
+    for (size_t i = 0; i < settings.subscribers_; ++i)
+        subscribers.emplace_back(new Subscriber(io_service, endpoint, request, ready, failed, received));
+    size_t next = 0;
+    std::function<void()> connect_next = [&]() {
+        if (next < subscribers.size()) subscribers[next++]->start(connect_next);
+    };
+    for (size_t i = 0; i < std::min<size_t>(256, subscribers.size()); ++i) connect_next();
+
+    auto work = std::make_shared<boost::asio::io_service::work>(io_service);
+    std::thread reader([&io_service]() { io_service.run(); });
+    auto setup_start = bench_clock::now();
+    while (ready + failed < settings.subscribers_)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    double setup_s = std::chrono::duration<double>(bench_clock::now() - setup_start).count();
+    std::cout << ready.load() << " subscribers joined /ws/" << settings.channel_ << " in " << std::fixed << std::setprecision(2) << setup_s << "s";
+    if (failed) std::cout << ", " << failed.load() << " failed";
+    std::cout << std::endl;
+
+    // The publisher is one more member of the channel; it doesn't receive its own messages
+    tcp::socket publisher(io_service);
+    publisher.connect(endpoint);
+    publisher.set_option(tcp::no_delay(true));
+    boost::asio::write(publisher, boost::asio::buffer(request));
+    std::string head;
+    char c;
+    while (head.size() < 4 || head.compare(head.size() - 4, 4, "\r\n\r\n") != 0) {
+        boost::asio::read(publisher, boost::asio::buffer(&c, 1));
+        head.push_back(c);
+    }
+
+    std::mt19937 random(12345);
+    std::string payload(settings.size_, 'x');
+    auto start = bench_clock::now();
+    std::vector<double> burst_ms;
+    for (size_t sent = 0; sent < settings.messages_; ) {
+        size_t burst = std::min(settings.burst_, settings.messages_ - sent);
+        std::string frames;
+        for (size_t i = 0; i < burst; ++i) frames += client_frame(payload, random);
+        auto burst_start = bench_clock::now();
+        boost::asio::write(publisher, boost::asio::buffer(frames));
+        sent += burst;
+        // Wait until every subscriber still connected has every message so far
+        for (;;) {
+            bool everyone = true;
+            for (const auto& s : subscribers) {
+                if (!s->done() && s->messages() < sent) {
+                    everyone = false;
+                    break;
+                }
+            }
+            if (everyone) break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        burst_ms.push_back(std::chrono::duration<double, std::milli>(bench_clock::now() - burst_start).count());
+    }
+    double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+    size_t alive = 0;
+    for (const auto& s : subscribers) if (!s->done()) ++alive;
+    std::sort(burst_ms.begin(), burst_ms.end());
+    std::cout << settings.messages_ << " messages of " << settings.size_ << " bytes to " << alive << " subscribers in " << std::setprecision(3) << seconds << "s" << std::endl;
+    std::cout << "  delivered:      " << received.load() << " (" << std::setprecision(0) << received.load() / seconds << " messages/s, "
+        << std::setprecision(1) << received.load() * (double)settings.size_ / seconds / (1024 * 1024) << " MB/s of payload)" << std::endl;
+    std::cout << "  bursts of " << settings.burst_ << ":   p50 " << std::setprecision(2) << burst_ms[burst_ms.size() / 2] << "ms, max " << burst_ms.back() << "ms to reach everyone" << std::endl;
+    if (alive < ready)
+        std::cout << "  dropped:        " << ready - alive << " subscribers closed by the server" << std::endl;
+
+    work.reset();
+    io_service.stop();
+    reader.join();
+    return 0;
+}
@@ -0,0 +1,138 @@
+/*
+
+    Packs a document root into an asset pack the server maps into memory (see asset_pack.h
+    and VirtualHostOptions::pack_file_)
+
+    Usage: asset_pack_build <document root> <pack file> [--gzip]
+
+    Every regular file under the root is packed under its path relative to the root, with the header lines
+    the server would send for it worked out ahead of time (see site_files.h): its Content-Type, its ETag, and
+    the Cache-Control and Link headers the build manifests under the root call for. With --gzip, text files
+    also get a gzip copy.
+    Rebuild the pack whenever the root changes; the server doesn't look at the root for files it finds in the pack.
+
+    Build it with the server's pack, manifest and hashing code, e.g.
+        clang++ -std=c++17 -I../AsynchronusGetServer asset_pack_build.cpp ../AsynchronusGetServer/asset_pack.cpp \
+            ../AsynchronusGetServer/asset_manifest.cpp ../AsynchronusGetServer/content_store.cpp -o asset_pack_build -lz
+
+    Author: Jarod Graygo
+
+*/
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include "asset_pack.h"
+#include "site_files.h"
+
+uint64_t align_to_page(uint64_t offset) {
+    return (offset + AssetPack::page_bytes_ - 1) / AssetPack::page_bytes_ * AssetPack::page_bytes_;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: asset_pack_build <document root> <pack file> [--gzip]" << std::endl;
+        return 1;
+    }
+    std::string root = argv[1];
+    if (root.empty() || root.back() != '/') root += '/';
+    std::string pack_file = argv[2];
+    bool compress = argc > 3 && std::string(argv[3]) == "--gzip";
+
+    std::vector<SiteFile> files;
+    std::error_code ec;
+    if (!read_site_files(root, pack_file, compress, files, ec)) {
+        std::cerr << "ERROR:: Could not read " << root << ": " << ec.message() << std::endl;
+        return 1;
+    }
+
+    // Lay the pack out: header, buckets, entries and strings, then the bodies on page boundaries
+    PackHeader header = {};
+    std::memcpy(header.magic_, AssetPack::magic_, sizeof(header.magic_));
+    header.entry_count_ = (uint32_t)files.size();
+    header.bucket_count_ = 16;
+    while (header.bucket_count_ < files.size() * 2) header.bucket_count_ *= 2;
+    header.buckets_offset_ = sizeof(PackHeader);
+    header.entries_offset_ = header.buckets_offset_ + (uint64_t)header.bucket_count_ * sizeof(uint32_t);
+    header.entries_offset_ = (header.entries_offset_ + alignof(PackEntry) - 1) / alignof(PackEntry) * alignof(PackEntry);
+    header.strings_offset_ = header.entries_offset_ + files.size() * sizeof(PackEntry);
+
+    std::vector<uint32_t> buckets(header.bucket_count_, 0);
+    std::vector<PackEntry> entries(files.size());
+    std::string strings;
+    for (size_t i = 0; i < files.size(); ++i) {
+        const SiteFile& file = files[i];
+        PackEntry& entry = entries[i];
+        entry.path_hash_ = xxhash64(file.path_.data(), file.path_.size());
+        entry.path_offset_ = (uint32_t)strings.size();
+        entry.path_bytes_ = (uint16_t)file.path_.size();
+        strings += file.path_;
+        entry.header_offset_ = (uint32_t)strings.size();
+        entry.header_bytes_ = (uint16_t)file.header_.size();
+        strings += file.header_;
+        entry.etag_offset_ = (uint32_t)strings.size();
+        entry.etag_bytes_ = (uint8_t)file.etag_.size();
+        strings += file.etag_;
+        entry.binary_ = file.binary_ ? 1 : 0;
+
+        uint32_t mask = header.bucket_count_ - 1;
+        uint32_t bucket = (uint32_t)entry.path_hash_ & mask;
+        while (buckets[bucket]) bucket = (bucket + 1) & mask;
+        buckets[bucket] = (uint32_t)i + 1;
+    }
+    header.strings_bytes_ = strings.size();
+
+    // Bodies identical across paths are stored once
+    std::vector<const std::string*> bodies;
+    std::map<std::pair<uint64_t, size_t>, uint64_t> stored;
+    uint64_t offset = align_to_page(header.strings_offset_ + strings.size());
+    auto place = [&](const std::string& body, uint64_t& body_offset) {
+        auto key = std::make_pair(xxhash64(body.data(), body.size()), body.size());
+        auto found = stored.find(key);
+        if (found != stored.end()) {
+            body_offset = found->second;
+            return;
+        }
+        body_offset = offset;
+        stored.emplace(key, offset);
+        bodies.push_back(&body);
+        offset = align_to_page(offset + body.size());
+    };
+    size_t gzipped = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+        place(files[i].contents_, entries[i].body_offset_);
+        entries[i].body_bytes_ = files[i].contents_.size();
+        if (files[i].gzip_.empty()) continue;
+        place(files[i].gzip_, entries[i].gzip_offset_);
+        entries[i].gzip_bytes_ = files[i].gzip_.size();
+        ++gzipped;
+    }
+    header.file_bytes_ = offset;
+
+    std::ofstream out(pack_file, std::ios::binary | std::ios::trunc);
+    auto pad_to = [&out](uint64_t position) {
+        static const char zeros[AssetPack::page_bytes_] = {};
+        uint64_t at = (uint64_t)out.tellp();
+        if (position > at) out.write(zeros, (std::streamsize)(position - at));
+    };
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(buckets.data()), buckets.size() * sizeof(uint32_t));
+    pad_to(header.entries_offset_);
+    out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(PackEntry));
+    out.write(strings.data(), strings.size());
+    for (const std::string* body : bodies) {
+        pad_to(align_to_page((uint64_t)out.tellp()));
+        out.write(body->data(), body->size());
+    }
+    pad_to(header.file_bytes_);
+    if (!out.flush()) {
+        std::cerr << "ERROR:: Could not write " << pack_file << std::endl;
+        return 1;
+    }
+    std::cout << "Packed " << files.size() << " files (" << bodies.size() << " distinct bodies, " << gzipped << " with a gzip copy) into "
+        << pack_file << ", " << header.file_bytes_ << " bytes" << std::endl;
+    return 0;
+}
@@ -0,0 +1,93 @@
+/*
+
+    Converts a binary request log (log.bin, written with LogFormat::binary) into the text
+    log format or CSV
+
+    Usage: binary_log_convert <log.bin> [--csv] > log.txt
+
+    The text output matches the lines the server writes to log.txt, so log_replay and anything else
+    reading text logs can take it. The CSV also carries what the text format has no room for:
+        time_ms,address,method,target,protocol,status,bytes,latency_us
+    with time_ms in milliseconds since the Unix epoch. Times in the text output are local, like the server's.
+
+    Build it with the log code, e.g.
+        clang++ -std=c++17 -I../AsynchronusGetServer binary_log_convert.cpp ../AsynchronusGetServer/binary_log.cpp -o binary_log_convert
+
+    Author: Jarod Graygo
+
+*/
+
+#include <algorithm>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include "binary_log.h"
+
+// The date as the server writes it, ctime() with the spaces turned into underscores
+std::string log_date(int64_t unix_ms) {
+    time_t seconds = (time_t)(unix_ms / 1000);
+    struct tm local;
+#ifdef _WIN32
+    localtime_s(&local, &seconds);
+#else
+    localtime_r(&seconds, &local);
+#endif
+    char date[32];
+    strftime(date, sizeof(date), "%a %b %e %H:%M:%S %Y", &local);
+    std::string text = date;
+    std::replace(text.begin(), text.end(), ' ', '_');
+    return text;
+}
+
+// Quote a CSV field if it holds a separator, quote or line break
+std::string csv_field(const std::string& value) {
+    if (value.find_first_of(",\"\r\n") == std::string::npos) return value;
+    std::string quoted = "\"";
+    for (char c : value) {
+        if (c == '"') quoted += '"';
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: binary_log_convert <log.bin> [--csv]" << std::endl;
+        return 1;
+    }
+    bool csv = argc > 2 && std::string(argv[2]) == "--csv";
+
+    BinaryLogReader reader;
+    if (!reader.open(argv[1])) {
+        std::cerr << "ERROR:: " << argv[1] << " is not a binary log" << std::endl;
+        return 1;
+    }
+    std::ios::sync_with_stdio(false);
+    if (csv) std::cout << "time_ms,address,method,target,protocol,status,bytes,latency_us\n";
+
+    BinaryLogReader::Entry entry;
+    size_t entries = 0;
+    while (reader.next(entry)) {
+        ++entries;
+        if (!csv) {
+            std::cout << entry.address_ << " - - [" << log_date(entry.unix_ms_) << "] \"" << entry.request_line_ << "\" "
+                << entry.status_ << " " << entry.bytes_ << "\n";
+            continue;
+        }
+        // The request line is method, target and protocol separated by single spaces
+        const std::string& line = entry.request_line_;
+        size_t first = line.find(' ');
+        size_t last = line.rfind(' ');
+        std::string method = line.substr(0, first);
+        std::string target = first == std::string::npos ? "" : line.substr(first + 1, (last > first ? last : line.size()) - first - 1);
+        std::string protocol = last > first && last != std::string::npos ? line.substr(last + 1) : "";
+        std::cout << entry.unix_ms_ << "," << entry.address_ << "," << csv_field(method) << "," << csv_field(target) << ","
+            << csv_field(protocol) << "," << entry.status_ << "," << entry.bytes_ << "," << entry.latency_us_ << "\n";
+    }
+    std::cout.flush();
+    if (reader.corrupt()) {
+        std::cerr << "ERROR:: " << argv[1] << " is damaged after entry " << entries << std::endl;
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,137 @@
+/*
+
+    Turns a document root into a C++ source that compiles the site into the server (see embedded_bundle.h
+    and ServerOptions::embedded_only_)
+
+    Usage: embed_bundle_build <document root> <output .cpp> [--gzip]
+
+    Every regular file under the root becomes a constexpr byte array, next to the header lines and ETag the
+    server would send for it (see site_files.h) in an index sorted by path. Identical files are stored once.
+    With --gzip, text files also get a gzip copy. Build the server with the output and EMBEDDED_BUNDLE
+    defined, e.g.
+        embed_bundle_build html embedded_bundle.cpp --gzip
+        clang++ -std=c++17 -DEMBEDDED_BUNDLE main.cpp server.cpp ... embedded_bundle.cpp -o server -lssl -lcrypto
+    The output is regenerated from scratch each time, so rerun it whenever the site changes.
+
+    Build it with the server's manifest and hashing code, e.g.
+        clang++ -std=c++17 -I../AsynchronusGetServer embed_bundle_build.cpp ../AsynchronusGetServer/asset_manifest.cpp \
+            ../AsynchronusGetServer/content_store.cpp -o embed_bundle_build -lz
+
+    Author: Jarod Graygo
+
+*/
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include "site_files.h"
+
+// A C++ string literal holding the bytes, with everything but printable ASCII written as three digit octal escapes
+std::string quoted(const std::string& bytes) {
+    std::string out = "\"";
+    for (unsigned char c : bytes) {
+        if (c >= 0x20 && c < 0x7f && c != '"' && c != '\\') {
+            out += (char)c;
+            continue;
+        }
+        char escape[5];
+        snprintf(escape, sizeof(escape), "\\%03o", c);
+        out += escape;
+    }
+    return out + "\"";
+}
+
+// A string_view constructed with its length, so the bytes may hold anything
+std::string string_view_of(const std::string& bytes) {
+    return "std::string_view(" + quoted(bytes) + ", " + std::to_string(bytes.size()) + ")";
+}
+
+// Writes each distinct body as a constexpr array once, handing back the name to refer to it by
+class BodyWriter {
+public:
+    explicit BodyWriter(std::ostream& out) : out_(out) { }
+
+    std::string write(const std::string& body) {
+        if (body.empty()) return "nullptr";
+        auto found = names_.find(body);
+        if (found != names_.end()) return found->second;
+
+        std::string name = "body_" + std::to_string(names_.size());
+        names_.emplace(body, name);
+        bytes_ += body.size();
+        out_ << "    constexpr unsigned char " << name << "[] = {";
+        for (size_t i = 0; i < body.size(); ++i) {
+            if (i % 32 == 0) out_ << "\n        ";
+            out_ << (unsigned)(unsigned char)body[i] << ',';
+        }
+        out_ << "\n    };\n";
+        return name;
+    }
+
+    size_t count() const { return names_.size(); }
+    size_t bytes() const { return bytes_; }
+
+private:
+    std::ostream& out_;
+    std::map<std::string, std::string> names_;
+    size_t bytes_ = 0;
+};
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: embed_bundle_build <document root> <output .cpp> [--gzip]" << std::endl;
+        return 1;
+    }
+    std::string root = argv[1];
+    if (root.empty() || root.back() != '/') root += '/';
+    std::string output = argv[2];
+    bool compress = argc > 3 && std::string(argv[3]) == "--gzip";
+
+    std::vector<SiteFile> files;
+    std::error_code ec;
+    if (!read_site_files(root, output, compress, files, ec)) {
+        std::cerr << "ERROR:: Could not read " << root << ": " << ec.message() << std::endl;
+        return 1;
+    }
+    if (files.empty()) {
+        std::cerr << "ERROR:: There are no files under " << root << std::endl;
+        return 1;
+    }
+    // The index is searched by halving, so it has to be in the order string_view compares paths in
+    std::sort(files.begin(), files.end(), [](const SiteFile& a, const SiteFile& b) { return a.path_ < b.path_; });
+
+    std::ofstream out(output, std::ios::binary | std::ios::trunc);
+    out << "// Generated by embed_bundle_build from " << root << "; rerun it rather than editing this file\n\n"
+        << "#include \"embedded_bundle.h\"\n\n"
+        << "namespace {\n\n";
+
+    BodyWriter bodies(out);
+    std::vector<std::string> entries;
+    size_t gzipped = 0;
+    for (const SiteFile& file : files) {
+        std::string body = bodies.write(file.contents_);
+        std::string gzip = bodies.write(file.gzip_);
+        if (!file.gzip_.empty()) ++gzipped;
+        entries.push_back("        { " + string_view_of(file.path_) + ",\n          " + string_view_of(file.header_) + ",\n          "
+            + string_view_of(file.etag_) + ", " + body + ", " + std::to_string(file.contents_.size()) + ", " + gzip + ", "
+            + std::to_string(file.gzip_.size()) + ", " + (file.binary_ ? "true" : "false") + " },\n");
+    }
+
+    out << "\n    constexpr EmbeddedAsset assets[] = {\n";
+    for (const std::string& entry : entries) out << entry;
+    out << "    };\n\n"
+        << "    constexpr size_t asset_count = sizeof(assets) / sizeof(assets[0]);\n"
+        << "    static_assert(embedded_paths_sorted(assets, asset_count), \"the embedded paths must be sorted\");\n\n"
+        << "}\n\n"
+        << "extern const EmbeddedBundle embedded_bundle = { assets, asset_count };\n";
+    if (!out.flush()) {
+        std::cerr << "ERROR:: Could not write " << output << std::endl;
+        return 1;
+    }
+    std::cout << "Embedded " << files.size() << " files (" << bodies.count() << " distinct bodies, " << gzipped << " with a gzip copy, "
+        << bodies.bytes() << " bytes) into " << output << std::endl;
+    return 0;
+}
@@ -0,0 +1,97 @@
+/*
+
+    Reads a document root into the responses the server would send for each of its files, with the header
+    lines worked out ahead of time. Shared by the tools that bake a site into an asset pack or into the server itself.
+
+    Needs the server's manifest and hashing code, and zlib for the gzip copies.
+
+    Author: Jarod Graygo
+
+*/
+
+#ifndef SITE_FILES_H
+#define SITE_FILES_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#include "asset_manifest.h"
+#include "content_store.h"
+#include "content_type.h"
+
+struct SiteFile {
+    // Relative to the document root, with / separators
+    std::string path_;
+    std::string contents_;
+    // Gzip encoded copy of the contents, empty when there is none
+    std::string gzip_;
+    // Server, Content-Type, Connection, and Cache-Control, Link and Vary where they apply
+    std::string header_;
+    std::string etag_;
+    bool binary_ = false;
+};
+
+// Gzip encode the contents, or return an empty string if zlib fails
+inline std::string gzip(const std::string& contents) {
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+    // 15 window bits plus 16 asks for a gzip wrapper rather than a zlib one
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) return std::string();
+    std::string out(deflateBound(&stream, (uLong)contents.size()), '\0');
+    stream.next_in = (Bytef*)contents.data();
+    stream.avail_in = (uInt)contents.size();
+    stream.next_out = (Bytef*)&out[0];
+    stream.avail_out = (uInt)out.size();
+    int result = deflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+    return result == Z_STREAM_END ? out : std::string();
+}
+
+// Read every regular file under root (which ends in a /), skipping the file named by skip if it lies under it
+// With compress, stylesheets, scripts, pages and other text files of 256 bytes or more also get a gzip copy, kept when it saves at least a tenth
+// Paths or header lines too long for a pack entry are left out. Returns false with ec set if the root can't be read
+inline bool read_site_files(const std::string& root, const std::string& skip, bool compress, std::vector<SiteFile>& files, std::error_code& ec) {
+    // The server looks manifests up by the document root followed by the request path, so the same form is used here
+    AssetManifests manifests;
+    manifests.load(root);
+
+    std::filesystem::path skip_path = std::filesystem::absolute(skip, ec);
+    for (auto it = std::filesystem::recursive_directory_iterator(root, ec); !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+        // The output may be written under the root it is built from, and may not exist yet
+        std::error_code missing;
+        if (!it->is_regular_file() || std::filesystem::equivalent(it->path(), skip_path, missing)) continue;
+        SiteFile file;
+        file.path_ = std::filesystem::relative(it->path(), root).generic_string();
+        if (file.path_.size() > UINT16_MAX) continue;
+        std::ifstream in(it->path(), std::ios::binary);
+        file.contents_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+
+        size_t dot = file.path_.rfind('.');
+        std::string content_type = content_type_for(dot == std::string::npos ? std::string() : file.path_.substr(dot + 1), file.binary_);
+        char etag[24];
+        snprintf(etag, sizeof(etag), "\"%016llx\"", (unsigned long long)xxhash64(file.contents_.data(), file.contents_.size()));
+        file.etag_ = etag;
+        if (compress && !file.binary_ && file.contents_.size() >= 256) {
+            file.gzip_ = gzip(file.contents_);
+            if (file.gzip_.size() > file.contents_.size() / 10 * 9) file.gzip_.clear();
+        }
+
+        file.header_ = "Server: Boost-Async-GET-Server\r\nContent-Type: " + content_type + "\r\nConnection: close\r\n";
+        const AssetManifests::Asset* asset = manifests.find(root + file.path_);
+        if (asset && asset->immutable_) file.header_ += "Cache-Control: public, max-age=31536000, immutable\r\n";
+        if (asset && !asset->preload_.empty()) file.header_ += "Link: " + asset->preload_ + "\r\n";
+        if (!file.gzip_.empty()) file.header_ += "Vary: Accept-Encoding\r\n";
+        if (file.header_.size() > UINT16_MAX) continue;
+        files.push_back(std::move(file));
+    }
+    return !ec;
+}
+
+#endif // SITE_FILES_H
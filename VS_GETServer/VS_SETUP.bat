@@ -1,2 +1,3 @@
 setx BOOST178_DIR C:\ProgrammingLibs\boost_1_78_0
-setx OPENSSL_DIR C:\ProgrammingLibs\openssl-master\include
\ No newline at end of file
+setx OPENSSL_DIR C:\ProgrammingLibs\openssl-master\include
+setx OPENSSL_LIB_DIR C:\ProgrammingLibs\openssl-master
\ No newline at end of file